@@ -22,6 +22,21 @@
 #define OPTION_CACHETTL 500
 #define OPTION_CHUNKSIZE 501
 #define OPTION_MAXCHUNKS 502
+#define OPTION_WRITEBEHIND 503
+#define OPTION_CACHEDIR 504
+#define OPTION_SYNCPOLICY 505
+#define OPTION_SYNCWINDOW 506
+#define OPTION_ATIME 507
+#define OPTION_FULLINDEX 508
+#define OPTION_MAXCACHEDFILES 509
+#define OPTION_MAXCACHEMEMORY 510
+#define OPTION_MEMORYPRESSURE 511
+#define OPTION_STALEGRACE 512
+#define OPTION_RETRYBUDGET 513
+#define OPTION_DEADLINE 514
+#define OPTION_STALLTIME 515
+#define OPTION_HEDGE 516
+#define OPTION_MEMSTATS 517
 #define OPTION_STRING "+a:c:i:p:d:"
 
 #define DEFAULT_GDRIVE_ACCESS GDRIVE_ACCESS_WRITE
@@ -33,6 +48,24 @@
 #define DEFAULT_MAXCHUNKS 15
 #define DEFAULT_FILEPERMS 0644
 #define DEFAULT_DIRPERMS 07777
+#define DEFAULT_WRITEBEHIND false
+#define DEFAULT_CACHEDIR NULL
+#define DEFAULT_SYNCPOLICY GDRIVE_SYNC_STRICT
+#define DEFAULT_SYNCWINDOW 5
+#define DEFAULT_ATIME GDRIVE_ATIME_NOATIME
+#define DEFAULT_FULLINDEX false
+#define DEFAULT_MAXCACHEDFILES 0
+#define DEFAULT_MAXCACHEMEMORY 0
+#define DEFAULT_MEMORYPRESSURE false
+#define DEFAULT_STALEGRACE 0
+// DEFAULT_RETRYBUDGET: Negative to leave Gdrive's default in place
+#define DEFAULT_RETRYBUDGET -1
+// DEFAULT_DEADLINE and DEFAULT_STALLTIME: Negative to leave Gdrive's default
+// in place
+#define DEFAULT_DEADLINE -1
+#define DEFAULT_STALLTIME -1
+#define DEFAULT_HEDGE false
+#define DEFAULT_MEMSTATS false
 
 
 /**
@@ -60,6 +93,37 @@ static bool fudr_options_set_chunksize(Fudr_Options* pOptions, const char* arg);
 
 static bool fudr_options_set_maxchunks(Fudr_Options* pOptions, const char* arg);
 
+static bool fudr_options_set_cachedir(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_set_syncpolicy(Fudr_Options* pOptions, 
+                                        const char* arg);
+
+static bool fudr_options_set_syncwindow(Fudr_Options* pOptions, 
+                                        const char* arg);
+
+static bool fudr_options_set_atime(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_set_maxcachedfiles(Fudr_Options* pOptions, 
+                                            const char* arg);
+
+static bool fudr_options_set_maxcachememory(Fudr_Options* pOptions, 
+                                            const char* arg);
+
+static bool fudr_options_set_stalegrace(Fudr_Options* pOptions, 
+                                        const char* arg);
+
+static bool fudr_options_set_retrybudget(Fudr_Options* pOptions, 
+                                         const char* arg);
+
+static bool fudr_options_set_deadline(Fudr_Options* pOptions, const char* arg);
+
+static bool fudr_options_set_stalltime(Fudr_Options* pOptions, 
+                                       const char* arg);
+
+static bool fudr_options_set_classvalues(Fudr_Options* pOptions, 
+                                         const char* arg, const char* fmtStr, 
+                                         time_t values[GDRIVE_CLASS_COUNT]);
+
 static bool fudr_options_set_failed(Fudr_Options* pOptions, int arg, 
                                     const struct option* longopts, 
                                     int longIndex);
@@ -145,6 +209,96 @@ Fudr_Options* fudr_options_create(int argc, char** argv)
                 .flag = NULL,
                 .val = OPTION_DIRPERM
             },
+            {
+                .name = "write-behind",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_WRITEBEHIND
+            },
+            {
+                .name = "cache-dir",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_CACHEDIR
+            },
+            {
+                .name = "sync-policy",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_SYNCPOLICY
+            },
+            {
+                .name = "sync-window",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_SYNCWINDOW
+            },
+            {
+                .name = "atime",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_ATIME
+            },
+            {
+                .name = "full-index",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_FULLINDEX
+            },
+            {
+                .name = "max-cached-files",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_MAXCACHEDFILES
+            },
+            {
+                .name = "max-cache-memory",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_MAXCACHEMEMORY
+            },
+            {
+                .name = "memory-pressure",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_MEMORYPRESSURE
+            },
+            {
+                .name = "stale-grace",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_STALEGRACE
+            },
+            {
+                .name = "retry-budget",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_RETRYBUDGET
+            },
+            {
+                .name = "deadline",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_DEADLINE
+            },
+            {
+                .name = "stall-time",
+                .has_arg = required_argument,
+                .flag = NULL,
+                .val = OPTION_STALLTIME
+            },
+            {
+                .name = "hedge",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_HEDGE
+            },
+            {
+                .name = "memstats",
+                .has_arg = no_argument,
+                .flag = NULL,
+                .val = OPTION_MEMSTATS
+            },
             {
                 // End the array with an 
                 // all-zero element
@@ -193,6 +347,69 @@ Fudr_Options* fudr_options_create(int argc, char** argv)
                     // Set max chunks
                     hasError = fudr_options_set_maxchunks(pOptions, optarg);
                     break;
+                case OPTION_WRITEBEHIND:
+                    // Queue namespace changes instead of sending them right
+                    // away
+                    pOptions->gdrive_writebehind = true;
+                    break;
+                case OPTION_CACHEDIR:
+                    // Set the directory for unuploaded changes
+                    hasError = fudr_options_set_cachedir(pOptions, optarg);
+                    break;
+                case OPTION_SYNCPOLICY:
+                    // Set when file contents get uploaded
+                    hasError = fudr_options_set_syncpolicy(pOptions, optarg);
+                    break;
+                case OPTION_SYNCWINDOW:
+                    // Set how long the coalesce sync policy waits
+                    hasError = fudr_options_set_syncwindow(pOptions, optarg);
+                    break;
+                case OPTION_ATIME:
+                    // Set when reading updates the access time
+                    hasError = fudr_options_set_atime(pOptions, optarg);
+                    break;
+                case OPTION_FULLINDEX:
+                    // Index every file at startup
+                    pOptions->gdrive_fullindex = true;
+                    break;
+                case OPTION_MAXCACHEDFILES:
+                    // Limit the number of cached entries
+                    hasError = fudr_options_set_maxcachedfiles(pOptions, 
+                                                               optarg);
+                    break;
+                case OPTION_MAXCACHEMEMORY:
+                    // Limit the memory used by the caches
+                    hasError = fudr_options_set_maxcachememory(pOptions, 
+                                                               optarg);
+                    break;
+                case OPTION_MEMORYPRESSURE:
+                    // Shrink the caches when memory is short
+                    pOptions->gdrive_memory_pressure = true;
+                    break;
+                case OPTION_STALEGRACE:
+                    // Set how long expired cache entries can still be used
+                    hasError = fudr_options_set_stalegrace(pOptions, optarg);
+                    break;
+                case OPTION_RETRYBUDGET:
+                    // Set how long each kind of request can wait to retry
+                    hasError = fudr_options_set_retrybudget(pOptions, optarg);
+                    break;
+                case OPTION_DEADLINE:
+                    // Set how long each kind of request can take
+                    hasError = fudr_options_set_deadline(pOptions, optarg);
+                    break;
+                case OPTION_STALLTIME:
+                    // Set how long a request can go on stalled
+                    hasError = fudr_options_set_stalltime(pOptions, optarg);
+                    break;
+                case OPTION_HEDGE:
+                    // Send slow read-only requests twice
+                    pOptions->gdrive_hedge = true;
+                    break;
+                case OPTION_MEMSTATS:
+                    // Print memory use at unmount
+                    pOptions->print_memstats = true;
+                    break;
                 case '?': 
                     // Fall through to default
                     default:
@@ -282,6 +499,23 @@ void fudr_options_free(Fudr_Options* pOptions)
     pOptions->gdrive_max_chunks = 0;
     pOptions->file_perms = 0;
     pOptions->dir_perms = 0;
+    pOptions->gdrive_writebehind = false;
+    free(pOptions->gdrive_cache_dir);
+    pOptions->gdrive_cache_dir = NULL;
+    pOptions->gdrive_sync_policy = 0;
+    pOptions->gdrive_sync_window = 0;
+    pOptions->gdrive_atime_policy = 0;
+    pOptions->gdrive_fullindex = false;
+    pOptions->gdrive_max_cached_files = 0;
+    pOptions->gdrive_max_cache_memory = 0;
+    pOptions->gdrive_memory_pressure = false;
+    pOptions->gdrive_stale_grace = 0;
+    memset(pOptions->gdrive_retry_budget, 0, 
+           sizeof(pOptions->gdrive_retry_budget));
+    memset(pOptions->gdrive_deadline, 0, sizeof(pOptions->gdrive_deadline));
+    pOptions->gdrive_stall_time = 0;
+    pOptions->gdrive_hedge = false;
+    pOptions->print_memstats = false;
     free(pOptions->fuse_argv);
     pOptions->fuse_argv = NULL;
     pOptions->fuse_argc = 0;
@@ -317,6 +551,24 @@ static Fudr_Options* fudr_options_default()
     pOptions->gdrive_max_chunks = DEFAULT_MAXCHUNKS;
     pOptions->file_perms = DEFAULT_FILEPERMS;
     pOptions->dir_perms = DEFAULT_DIRPERMS;
+    pOptions->gdrive_writebehind = DEFAULT_WRITEBEHIND;
+    pOptions->gdrive_cache_dir = DEFAULT_CACHEDIR;
+    pOptions->gdrive_sync_policy = DEFAULT_SYNCPOLICY;
+    pOptions->gdrive_sync_window = DEFAULT_SYNCWINDOW;
+    pOptions->gdrive_atime_policy = DEFAULT_ATIME;
+    pOptions->gdrive_fullindex = DEFAULT_FULLINDEX;
+    pOptions->gdrive_max_cached_files = DEFAULT_MAXCACHEDFILES;
+    pOptions->gdrive_max_cache_memory = DEFAULT_MAXCACHEMEMORY;
+    pOptions->gdrive_memory_pressure = DEFAULT_MEMORYPRESSURE;
+    pOptions->gdrive_stale_grace = DEFAULT_STALEGRACE;
+    for (int i = 0; i < GDRIVE_CLASS_COUNT; i++)
+    {
+        pOptions->gdrive_retry_budget[i] = DEFAULT_RETRYBUDGET;
+        pOptions->gdrive_deadline[i] = DEFAULT_DEADLINE;
+    }
+    pOptions->gdrive_stall_time = DEFAULT_STALLTIME;
+    pOptions->gdrive_hedge = DEFAULT_HEDGE;
+    pOptions->print_memstats = DEFAULT_MEMSTATS;
     pOptions->fuse_argv = NULL;
     pOptions->fuse_argc = 0;
     pOptions->error = false;
@@ -608,6 +860,325 @@ static bool fudr_options_set_maxchunks(Fudr_Options* pOptions, const char* arg)
     return false;
 }
 
+/**
+ * Set the cache directory for unuploaded changes
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_cachedir(Fudr_Options* pOptions, const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+
+    free(pOptions->gdrive_cache_dir);
+    pOptions->gdrive_cache_dir = malloc(strlen(arg) + 1);
+    if (!pOptions->gdrive_cache_dir)
+    {
+        // Memory error
+        pOptions->error = true;
+
+        // This will probably fail, but still need to try.
+        pOptions->errorMsg =
+                malloc(strlen("Could not allocate memory for options\n") + 1);
+        if (pOptions->errorMsg)
+        {
+            strcpy(pOptions->errorMsg,
+                   "Could not allocate memory for options\n");
+        }
+        return true;
+    }
+
+    strcpy(pOptions->gdrive_cache_dir, arg);
+    return false;
+}
+
+/**
+ * Set the sync policy
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_syncpolicy(Fudr_Options* pOptions, 
+                                        const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    if (!strcmp(arg, "strict"))
+    {
+        pOptions->gdrive_sync_policy = GDRIVE_SYNC_STRICT;
+    }
+    else if (!strcmp(arg, "coalesce"))
+    {
+        pOptions->gdrive_sync_policy = GDRIVE_SYNC_COALESCE;
+    }
+    else if (!strcmp(arg, "close"))
+    {
+        pOptions->gdrive_sync_policy = GDRIVE_SYNC_CLOSE;
+    }
+    else
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Unrecognized sync policy '%s'. Valid values "
+                             "are strict, coalesce, and close\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Set the sync window
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_syncwindow(Fudr_Options* pOptions, 
+                                        const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long syncWindow = strtol(arg, &end, 10);
+    if (end == arg || syncWindow < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid sync-window '%s', not a non-negative "
+                             "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_sync_window = syncWindow;
+    return false;
+}
+
+/**
+ * Set the maximum number of cached entries
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_maxcachedfiles(Fudr_Options* pOptions, 
+                                            const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long maxFiles = strtol(arg, &end, 10);
+    if (end == arg || maxFiles < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid max-cached-files '%s', not a "
+                             "non-negative integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_max_cached_files = maxFiles;
+    return false;
+}
+
+/**
+ * Set the approximate memory limit (given in MiB) for the caches
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_maxcachememory(Fudr_Options* pOptions, 
+                                            const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long maxMiB = strtol(arg, &end, 10);
+    if (end == arg || maxMiB < 0 || 
+            (unsigned long) maxMiB > (size_t) -1 / (1024 * 1024))
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid max-cache-memory '%s', not a "
+                             "non-negative integer number of MiB\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_max_cache_memory = (size_t) maxMiB * 1024 * 1024;
+    return false;
+}
+
+/**
+ * Set the grace period for expired cache entries
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_stalegrace(Fudr_Options* pOptions, 
+                                        const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long staleGrace = strtol(arg, &end, 10);
+    if (end == arg || staleGrace < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid stale-grace '%s', not a non-negative "
+                             "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_stale_grace = staleGrace;
+    return false;
+}
+
+/**
+ * Set the retry budgets, given as a comma-separated list of class=seconds
+ * pairs, such as "metadata=5,upload=120"
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_retrybudget(Fudr_Options* pOptions, 
+                                         const char* arg)
+{
+    const char* fmtStr = "Invalid retry-budget '%s'. Expected class=seconds "
+                         "pairs separated by commas, where class is metadata, "
+                         "content or upload\n";
+    return fudr_options_set_classvalues(pOptions, arg, fmtStr, 
+                                        pOptions->gdrive_retry_budget);
+}
+
+/**
+ * Set the deadlines, given the same way as the retry budgets
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_deadline(Fudr_Options* pOptions, const char* arg)
+{
+    const char* fmtStr = "Invalid deadline '%s'. Expected class=seconds pairs "
+                         "separated by commas, where class is metadata, "
+                         "content or upload\n";
+    return fudr_options_set_classvalues(pOptions, arg, fmtStr, 
+                                        pOptions->gdrive_deadline);
+}
+
+/**
+ * Set how long a request can go on transferring too slowly
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_stalltime(Fudr_Options* pOptions, 
+                                       const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    char* end = NULL;
+    long stallTime = strtol(arg, &end, 10);
+    if (end == arg || stallTime < 0)
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Invalid stall-time '%s', not a non-negative "
+                             "integer\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    pOptions->gdrive_stall_time = stallTime;
+    return false;
+}
+
+/**
+ * Fill in per-class values, given as a comma-separated list of class=seconds
+ * pairs. Classes that aren't mentioned are left alone.
+ * @param pOptions
+ * @param arg
+ * @param fmtStr The error message, with a %s for arg
+ * @param values Indexed by enum Gdrive_Request_Class
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_classvalues(Fudr_Options* pOptions, 
+                                         const char* arg, const char* fmtStr, 
+                                         time_t values[GDRIVE_CLASS_COUNT])
+{
+    // Nothing should be NULL
+    assert(pOptions && arg && fmtStr && values);
+    
+    static const char* const classNames[GDRIVE_CLASS_COUNT] = 
+    {
+        [GDRIVE_CLASS_METADATA] = "metadata",
+        [GDRIVE_CLASS_CONTENT] = "content",
+        [GDRIVE_CLASS_UPLOAD] = "upload"
+    };
+    
+    const char* pair = arg;
+    while (true)
+    {
+        const char* equals = strchr(pair, '=');
+        int requestClass = GDRIVE_CLASS_COUNT;
+        for (int i = 0; equals != NULL && i < GDRIVE_CLASS_COUNT; i++)
+        {
+            if (strlen(classNames[i]) == (size_t) (equals - pair) && 
+                    strncmp(pair, classNames[i], equals - pair) == 0)
+            {
+                requestClass = i;
+            }
+        }
+        char* end = NULL;
+        long value = (requestClass < GDRIVE_CLASS_COUNT) ? 
+            strtol(equals + 1, &end, 10) : -1;
+        if (value < 0 || end == equals + 1 || (*end != ',' && *end != '\0'))
+        {
+            pOptions->error = true;
+            fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+            return true;
+        }
+        values[requestClass] = value;
+        if (*end == '\0')
+        {
+            return false;
+        }
+        pair = end + 1;
+    }
+}
+
+/**
+ * Set the atime policy
+ * @param pOptions
+ * @param arg
+ * @return false on success, true on error
+ */
+static bool fudr_options_set_atime(Fudr_Options* pOptions, const char* arg)
+{
+    // Nothing should be NULL
+    assert(pOptions && arg);
+    
+    if (!strcmp(arg, "noatime"))
+    {
+        pOptions->gdrive_atime_policy = GDRIVE_ATIME_NOATIME;
+    }
+    else if (!strcmp(arg, "relatime"))
+    {
+        pOptions->gdrive_atime_policy = GDRIVE_ATIME_RELATIME;
+    }
+    else if (!strcmp(arg, "strict"))
+    {
+        pOptions->gdrive_atime_policy = GDRIVE_ATIME_STRICT;
+    }
+    else
+    {
+        pOptions->error = true;
+        const char* fmtStr = "Unrecognized atime policy '%s'. Valid values "
+                             "are noatime, relatime, and strict\n";
+        fudr_options_make_errormsg(&pOptions->errorMsg, fmtStr, arg);
+        return true;
+    }
+    return false;
+}
+
 /**
  * Set unrecognized option or option with required value but no value provided
  * @param pOptions
@@ -46,6 +46,61 @@ typedef struct Fudr_Options
     // Permissions for files. Interpreted as a 3-digit octal number
     unsigned long dir_perms;
     
+    // Whether to queue namespace changes (create, delete, rename, link) and
+    // send them to Google Drive later
+    bool gdrive_writebehind;
+    
+    // Directory for keeping unuploaded file changes on disk, or NULL to keep
+    // them only in temporary files
+    char* gdrive_cache_dir;
+    
+    // When to upload file contents in response to fsync() and close()
+    enum Gdrive_Sync_Policy gdrive_sync_policy;
+    
+    // Minimum time (in seconds) between uploads of the same file with the
+    // coalesce sync policy
+    time_t gdrive_sync_window;
+    
+    // Whether opening a file for reading updates its access time
+    enum Gdrive_Atime_Policy gdrive_atime_policy;
+    
+    // Whether to build an index of every file at startup
+    bool gdrive_fullindex;
+    
+    // Most entries in each of the metadata caches, or 0 for no limit
+    size_t gdrive_max_cached_files;
+    
+    // Approximate most memory (in bytes) for the metadata caches, or 0 for no
+    // limit
+    size_t gdrive_max_cache_memory;
+    
+    // Whether to shrink the metadata caches under memory pressure
+    bool gdrive_memory_pressure;
+    
+    // How long (in seconds) expired cache entries can still be used while 
+    // fresh information is fetched in the background
+    time_t gdrive_stale_grace;
+    
+    // Longest time (in seconds) that each class of request can spend waiting
+    // to retry, indexed by enum Gdrive_Request_Class
+    time_t gdrive_retry_budget[GDRIVE_CLASS_COUNT];
+    
+    // Longest time (in seconds) that one attempt at each class of request can
+    // take, indexed by enum Gdrive_Request_Class, or negative to keep the
+    // default
+    time_t gdrive_deadline[GDRIVE_CLASS_COUNT];
+    
+    // How long (in seconds) a request can go on stalled before it is 
+    // abandoned, or negative to keep the default
+    time_t gdrive_stall_time;
+    
+    // Whether to send slow read-only requests a second time
+    bool gdrive_hedge;
+    
+    // Whether to print how much memory the caches use when the filesystem is
+    // unmounted
+    bool print_memstats;
+    
     // Arguments to be passed on to FUSE
     char** fuse_argv;
     
@@ -31,6 +31,19 @@
 #include "fuse-drive-options.h"
 
 
+// Setting this extended attribute on a file copies the file to the path given
+// as the attribute's value, without downloading and re-uploading it.
+#define FUDR_XATTR_COPY_TO "user.fusedrive.copy_to"
+
+// Reading this extended attribute on the root directory describes the health
+// of the connection to Google Drive.
+#define FUDR_XATTR_STATUS "user.fusedrive.status"
+
+// Set from --memstats. Whether fudr_destroy() prints how much memory the 
+// caches used.
+static bool fudr_print_memstats = false;
+
+
 
 static int fudr_stat_from_fileinfo(const Gdrive_Fileinfo* pFileinfo, 
                                    bool isRoot, struct stat* stbuf);
@@ -77,9 +90,8 @@ static int fudr_ftruncate(const char* path, off_t size,
 
 static int fudr_getattr(const char *path, struct stat *stbuf);
 
-/* static int fudr_getxattr(const char* path, const char* name, char* value, 
- *                          size_t size);
- */
+static int fudr_getxattr(const char* path, const char* name, char* value, 
+                         size_t size);
 
 static void* fudr_init(struct fuse_conn_info *conn);
 
@@ -130,9 +142,8 @@ static int fudr_rename(const char* from, const char* to);
 
 static int fudr_rmdir(const char* path);
 
-/* static int fudr_setxattr(const char* path, const char* name, 
- *                          const char* value, size_t size, int flags);
- */
+static int fudr_setxattr(const char* path, const char* name, 
+                         const char* value, size_t size, int flags);
 
 static int fudr_statfs(const char* path, struct statvfs* stbuf);
 
@@ -163,6 +174,14 @@ static int fudr_stat_from_fileinfo(const Gdrive_Fileinfo* pFileinfo,
     {
         case GDRIVE_FILETYPE_FOLDER:
             stbuf->st_mode = S_IFDIR;
+            if (pFileinfo->nChildren == GDRIVE_FINFO_CHILDREN_UNKNOWN)
+            {
+                // Children haven't been counted. A link count of 1 tells 
+                // programs like find not to guess the number of 
+                // subdirectories from it.
+                stbuf->st_nlink = 1;
+                break;
+            }
             stbuf->st_nlink = pFileinfo->nParents + pFileinfo->nChildren;
             // Account for ".".  Also, if the root of the filesystem, account 
             // for  "..", which is outside of the Google Drive filesystem and 
@@ -406,6 +425,21 @@ static void fudr_destroy(void* private_data)
     // Silence compiler warning about unused parameter
     (void) private_data;
     
+    if (gdrive_get_syncpolicy() != GDRIVE_SYNC_STRICT)
+    {
+        Gdrive_Sync_Stats stats;
+        gdrive_file_get_syncstats(&stats);
+        fprintf(stderr, "Sync requests: %lu, uploads: %lu (%llu bytes), "
+                "uploads saved: %lu\n", stats.syncRequests, stats.uploads, 
+                stats.bytesUploaded, stats.uploadsSaved);
+        fprintf(stderr, "Timestamp updates: %lu sent alone, %lu sent with "
+                "uploads\n", stats.metadataUpdates, stats.metadataFolded);
+    }
+    if (fudr_print_memstats)
+    {
+        gdrive_print_memstats(stderr);
+    }
+    
     gdrive_cleanup();
 }
 
@@ -459,7 +493,9 @@ static int fudr_fsync(const char* path, int isdatasync,
         return -EBADF;
     }
     
-    return gdrive_file_sync((Gdrive_File*) fi->fh);
+    // This either uploads the file, or if there is a cache directory, saves
+    // the changes there to be uploaded when the file is closed.
+    return gdrive_file_persist((Gdrive_File*) fi->fh);
 }
 
 /* static int fudr_fsyncdir(const char* path, int isdatasync, 
@@ -514,12 +550,47 @@ static int fudr_getattr(const char *path, struct stat *stbuf)
     return fudr_stat_from_fileinfo(pFileinfo, strcmp(path, "/") == 0, stbuf);
 }
 
-/* static int fudr_getxattr(const char* path, const char* name, char* value, 
- *                          size_t size)
- * {
- *     return -ENOSYS;
- * }
- */
+static int fudr_getxattr(const char* path, const char* name, char* value, 
+                         size_t size)
+{
+    // The only attribute is the status, which doesn't need to contact Google
+    // Drive (and works even when Google Drive can't be reached). Anything else
+    // simply isn't there.
+    if (strcmp(path, "/") != 0 || strcmp(name, FUDR_XATTR_STATUS) != 0)
+    {
+        return -ENODATA;
+    }
+    
+    int length = gdrive_get_status(NULL, 0);
+    if (size == 0)
+    {
+        // Just asking how much room is needed
+        return length;
+    }
+    if (size < (size_t) length)
+    {
+        return -ERANGE;
+    }
+    
+    // The value isn't null-terminated, but gdrive_get_status() needs room for
+    // the terminator.
+    char* status = malloc(length + 1);
+    if (status == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+    int written = gdrive_get_status(status, length + 1);
+    if (written > length)
+    {
+        // Grew in the meantime
+        free(status);
+        return -ERANGE;
+    }
+    memcpy(value, status, written);
+    free(status);
+    return written;
+}
 
 static void* fudr_init(struct fuse_conn_info *conn)
 {
@@ -771,6 +842,9 @@ static int fudr_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         return -ENOENT;
     }
     
+    // Whatever lists a folder usually looks at what's inside next.
+    gdrive_folder_prefetch(path, pFileArray);
+    
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
     const Gdrive_Fileinfo* pCurrentFile;
@@ -892,12 +966,13 @@ static int fudr_rename(const char* from, const char* to)
                 free(fromFileId);
                 return -ENOTDIR;
             }
-            if (pToInfo && pToInfo->nChildren > 0)
+            int isEmpty = pToInfo ? gdrive_folder_is_empty(toFileId) : 1;
+            if (isEmpty <= 0)
             {
-                // Destination is not empty
+                // Destination is not empty, or couldn't tell
                 free(toFileId);
                 free(fromFileId);
-                return -ENOTEMPTY;
+                return isEmpty ? isEmpty : -ENOTEMPTY;
             }
         }
         
@@ -965,44 +1040,17 @@ static int fudr_rename(const char* from, const char* to)
         return accessResult;
     }
     
-    // If the directories are different, create a new hard link and delete
-    // the original. Compare the actual file IDs of the parents, not the paths,
-    // because different paths could refer to the same directory.
-    if (strcmp(fromParentId, toParentId))
-    {
-        int result = gdrive_add_parent(fromFileId, toParentId);
-        if (result != 0)
-        {
-            // An error occurred
-            free(toParentId);
-            free(fromParentId);
-            gdrive_path_free(pToPath);
-            gdrive_path_free(pFromPath);
-            free(fromFileId);
-            return result;
-        }
-        result = fudr_unlink(from);
-        if (result != 0)
-        {
-            // An error occurred
-            free(toParentId);
-            free(fromParentId);
-            gdrive_path_free(pToPath);
-            gdrive_path_free(pFromPath);
-            free(fromFileId);
-            return result;
-        }
-    }
-    
+    // Move to the new directory and/or change the basename. Compare the actual
+    // file IDs of the parents, not the paths, because different paths could 
+    // refer to the same directory. NOTE: If there are any other hard links to 
+    // the file, changing the basename will also change their names.
     int returnVal = 0;
-    
-    // If the basenames are different, change the basename. NOTE: If there are
-    // any other hard links to the file, this will also change their names.
-    const char* fromBasename = gdrive_path_get_basename(pFromPath);
     const char* toBasename = gdrive_path_get_basename(pToPath);
-    if (strcmp(fromBasename, toBasename))
+    if (strcmp(fromParentId, toParentId) || 
+            strcmp(gdrive_path_get_basename(pFromPath), toBasename))
     {
-        returnVal = gdrive_change_basename(fromFileId, toBasename);
+        returnVal = gdrive_move(fromFileId, fromParentId, toParentId, 
+                                toBasename, from, to);
     }
     
     // If successful, and if to already existed, delete it
@@ -1050,11 +1098,12 @@ static int fudr_rmdir(const char* path)
         free(fileId);
         return -ENOTDIR;
     }
-    if (pFileinfo->nChildren > 0)
+    int isEmpty = gdrive_folder_is_empty(fileId);
+    if (isEmpty <= 0)
     {
-        // Not empty
+        // Not empty, or couldn't tell
         free(fileId);
-        return -ENOTEMPTY;
+        return isEmpty ? isEmpty : -ENOTEMPTY;
     }
     
     // Need write access
@@ -1083,12 +1132,49 @@ static int fudr_rmdir(const char* path)
     return returnVal;
 }
 
-/* static int fudr_setxattr(const char* path, const char* name, 
- *                          const char* value, size_t size, int flags)
- * {
- *     return -ENOSYS;
- * }
- */
+static int fudr_setxattr(const char* path, const char* name, 
+                         const char* value, size_t size, int flags)
+{
+    // The attribute is never stored, so XATTR_CREATE and XATTR_REPLACE don't 
+    // mean anything.
+    (void) flags;
+    
+    // The only supported attribute is the copy trigger.
+    if (strcmp(name, FUDR_XATTR_COPY_TO) != 0)
+    {
+        return -ENOTSUP;
+    }
+    
+    // The value is the destination path within the mount. It isn't
+    // null-terminated.
+    if (size == 0 || value[0] != '/')
+    {
+        return -EINVAL;
+    }
+    char* toPath = malloc(size + 1);
+    if (toPath == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+    memcpy(toPath, value, size);
+    toPath[size] = '\0';
+    
+    char* fileId = gdrive_filepath_to_id(path);
+    if (fileId == NULL)
+    {
+        // File not found
+        free(toPath);
+        return -ENOENT;
+    }
+    
+    int error = 0;
+    char* newFileId = gdrive_file_copy(fileId, toPath, &error);
+    free(newFileId);
+    free(fileId);
+    free(toPath);
+    return -error;
+}
 
 static int fudr_statfs(const char* path, struct statvfs* stbuf)
 {
@@ -1286,8 +1372,7 @@ static struct fuse_operations fo = {
     .fsyncdir       = NULL,
     .ftruncate      = fudr_ftruncate,
     .getattr        = fudr_getattr,
-    // getxattr is not needed
-    .getxattr       = NULL,
+    .getxattr       = fudr_getxattr,
     .init           = fudr_init,
     // ioctl is not needed
     .ioctl          = NULL,
@@ -1317,8 +1402,7 @@ static struct fuse_operations fo = {
     .removexattr    = NULL,
     .rename         = fudr_rename,
     .rmdir          = fudr_rmdir,
-    // setxattr is not needed
-    .setxattr       = NULL,
+    .setxattr       = fudr_setxattr,
     .statfs         = fudr_statfs,
     // Might consider later whether symlink and readlink can/should be added
     .symlink        = NULL,
@@ -1360,6 +1444,38 @@ int main(int argc, char* argv[])
         return 1;
     }
     
+    gdrive_set_writebehind(pOptions->gdrive_writebehind);
+    gdrive_set_syncpolicy(pOptions->gdrive_sync_policy, 
+                          pOptions->gdrive_sync_window);
+    gdrive_set_atimepolicy(pOptions->gdrive_atime_policy);
+    gdrive_set_fullindex(pOptions->gdrive_fullindex);
+    gdrive_set_cachelimits(pOptions->gdrive_max_cached_files, 
+                           pOptions->gdrive_max_cache_memory, 
+                           pOptions->gdrive_memory_pressure);
+    gdrive_set_stalegrace(pOptions->gdrive_stale_grace);
+    for (int i = 0; i < GDRIVE_CLASS_COUNT; i++)
+    {
+        if (pOptions->gdrive_retry_budget[i] >= 0)
+        {
+            gdrive_set_retrybudget(i, pOptions->gdrive_retry_budget[i]);
+        }
+        if (pOptions->gdrive_deadline[i] >= 0)
+        {
+            gdrive_set_deadline(i, pOptions->gdrive_deadline[i]);
+        }
+    }
+    if (pOptions->gdrive_stall_time >= 0)
+    {
+        gdrive_set_stalltime(pOptions->gdrive_stall_time);
+    }
+    gdrive_set_hedging(pOptions->gdrive_hedge);
+    fudr_print_memstats = pOptions->print_memstats;
+    if (gdrive_set_cachedir(pOptions->gdrive_cache_dir) != 0)
+    {
+        fputs("Could not set the cache directory.\n", stderr);
+        return 1;
+    }
+    
     if (gdrive_init(pOptions->gdrive_access, pOptions->gdrive_auth_file, 
                     pOptions->gdrive_cachettl, 
                     pOptions->gdrive_interaction_type, 
@@ -0,0 +1,221 @@
+
+
+#include "gdrive-breaker.h"
+
+#include <time.h>
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+enum Gdrive_Breaker_State
+{
+    // Requests are sent as usual
+    GDRIVE_BREAKER_CLOSED,
+    // Requests fail right away until the cooldown is over
+    GDRIVE_BREAKER_OPEN,
+    // Requests are sent one at a time as probes
+    GDRIVE_BREAKER_HALF_OPEN
+};
+
+typedef struct Gdrive_Breaker
+{
+    enum Gdrive_Breaker_State state;
+    // failures: Failed attempts in a row
+    int failures;
+    // successes: Successful probes in a row
+    int successes;
+    double cooldown;
+    // openedAt: When the breaker last opened, in seconds on the monotonic
+    // clock
+    double openedAt;
+    // probing: A probe has been let through and hasn't been reported yet
+    bool probing;
+    double probeStart;
+    // Totals for the report
+    unsigned long nOpened;
+    unsigned long nRefused;
+} Gdrive_Breaker;
+
+static Gdrive_Breaker* gdrive_breaker_get_internal(void);
+
+static double gdrive_breaker_now(void);
+
+static void gdrive_breaker_open(Gdrive_Breaker* pBreaker, double now);
+
+static bool gdrive_breaker_refuses(Gdrive_Breaker* pBreaker, double now);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Other accessible functions
+ ******************/
+
+bool gdrive_breaker_allow(void)
+{
+    Gdrive_Breaker* pBreaker = gdrive_breaker_get_internal();
+    double now = gdrive_breaker_now();
+    if (gdrive_breaker_refuses(pBreaker, now))
+    {
+        pBreaker->nRefused++;
+        return false;
+    }
+
+    if (pBreaker->state != GDRIVE_BREAKER_CLOSED)
+    {
+        // Let this one through as a probe.
+        pBreaker->state = GDRIVE_BREAKER_HALF_OPEN;
+        pBreaker->probing = true;
+        pBreaker->probeStart = now;
+    }
+    return true;
+}
+
+void gdrive_breaker_report(bool failed)
+{
+    Gdrive_Breaker* pBreaker = gdrive_breaker_get_internal();
+    pBreaker->probing = false;
+
+    if (!failed)
+    {
+        pBreaker->failures = 0;
+        if (pBreaker->state == GDRIVE_BREAKER_HALF_OPEN &&
+                ++pBreaker->successes >= GDRIVE_BREAKER_PROBES)
+        {
+            // Google Drive is back.
+            pBreaker->state = GDRIVE_BREAKER_CLOSED;
+            pBreaker->cooldown = GDRIVE_BREAKER_COOLDOWN;
+        }
+        return;
+    }
+
+    double now = gdrive_breaker_now();
+    switch (pBreaker->state)
+    {
+        case GDRIVE_BREAKER_CLOSED:
+            if (++pBreaker->failures >= GDRIVE_BREAKER_THRESHOLD)
+            {
+                gdrive_breaker_open(pBreaker, now);
+            }
+            break;
+
+        case GDRIVE_BREAKER_HALF_OPEN:
+            // Still not working, so wait longer before the next probe.
+            pBreaker->cooldown *= 2;
+            if (pBreaker->cooldown > GDRIVE_BREAKER_MAX_COOLDOWN)
+            {
+                pBreaker->cooldown = GDRIVE_BREAKER_MAX_COOLDOWN;
+            }
+            gdrive_breaker_open(pBreaker, now);
+            break;
+
+        default:
+            // Already open. This was sent before it opened.
+            break;
+    }
+}
+
+bool gdrive_breaker_is_open(void)
+{
+    Gdrive_Breaker* pBreaker = gdrive_breaker_get_internal();
+    return gdrive_breaker_refuses(pBreaker, gdrive_breaker_now());
+}
+
+int gdrive_breaker_describe(char* dest, size_t size)
+{
+    Gdrive_Breaker* pBreaker = gdrive_breaker_get_internal();
+    double now = gdrive_breaker_now();
+    switch (pBreaker->state)
+    {
+        case GDRIVE_BREAKER_OPEN:
+        {
+            double wait = pBreaker->openedAt + pBreaker->cooldown - now;
+            return snprintf(dest, size, "breaker: open, next probe in %.0f "
+                            "s\nopened: %lu times\nrefused: %lu requests\n",
+                            (wait > 0) ? wait : 0, pBreaker->nOpened,
+                            pBreaker->nRefused);
+        }
+
+        case GDRIVE_BREAKER_HALF_OPEN:
+            return snprintf(dest, size, "breaker: half-open, %d of %d probes "
+                            "succeeded\nopened: %lu times\nrefused: %lu "
+                            "requests\n", pBreaker->successes,
+                            GDRIVE_BREAKER_PROBES, pBreaker->nOpened,
+                            pBreaker->nRefused);
+
+        default:
+            return snprintf(dest, size, "breaker: closed, %d recent failures"
+                            "\nopened: %lu times\nrefused: %lu requests\n",
+                            pBreaker->failures, pBreaker->nOpened,
+                            pBreaker->nRefused);
+    }
+}
+
+void gdrive_breaker_print_stats(FILE* stream)
+{
+    Gdrive_Breaker* pBreaker = gdrive_breaker_get_internal();
+    fprintf(stream, "  circuit breaker: opened %lu times, %lu requests "
+            "failed without being sent\n", pBreaker->nOpened,
+            pBreaker->nRefused);
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Breaker* gdrive_breaker_get_internal(void)
+{
+    static Gdrive_Breaker breaker =
+    {
+        .state = GDRIVE_BREAKER_CLOSED,
+        .cooldown = GDRIVE_BREAKER_COOLDOWN
+    };
+    return &breaker;
+}
+
+/*
+ * Returns the time in seconds on the monotonic clock.
+ */
+static double gdrive_breaker_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void gdrive_breaker_open(Gdrive_Breaker* pBreaker, double now)
+{
+    pBreaker->state = GDRIVE_BREAKER_OPEN;
+    pBreaker->openedAt = now;
+    pBreaker->successes = 0;
+    pBreaker->failures = 0;
+    pBreaker->nOpened++;
+}
+
+/*
+ * Returns true if a request sent now would be refused: the breaker is open
+ * and cooling down, or a probe is already on its way.
+ */
+static bool gdrive_breaker_refuses(Gdrive_Breaker* pBreaker, double now)
+{
+    switch (pBreaker->state)
+    {
+        case GDRIVE_BREAKER_OPEN:
+            return now < pBreaker->openedAt + pBreaker->cooldown;
+
+        case GDRIVE_BREAKER_HALF_OPEN:
+            // A probe that was never reported (such as a background request
+            // that was abandoned) doesn't hold things up forever.
+            return pBreaker->probing &&
+                    now < pBreaker->probeStart + GDRIVE_BREAKER_MAX_COOLDOWN;
+
+        default:
+            return false;
+    }
+}
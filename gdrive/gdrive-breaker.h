@@ -0,0 +1,112 @@
+/*
+ * File:   gdrive-breaker.h
+ * Author: me
+ *
+ * A circuit breaker for requests to Google Drive. When Google Drive can't be
+ * reached, or keeps answering with server errors, every request would
+ * otherwise go through all of its retries before failing, and everything
+ * that uses the filesystem piles up behind it.
+ *
+ * After GDRIVE_BREAKER_THRESHOLD attempts in a row fail that way, the breaker
+ * opens, and requests fail right away instead of being sent (so filesystem
+ * calls fail with EIO, and cached information is used even after it expires).
+ * After a cooldown, requests are let through one at a time as probes. Once
+ * GDRIVE_BREAKER_PROBES of them in a row succeed, the breaker closes and
+ * everything goes back to normal. If a probe fails, the breaker opens again,
+ * with twice the cooldown (up to GDRIVE_BREAKER_MAX_COOLDOWN).
+ *
+ * Rate limit errors don't count, since they mean Google Drive is working
+ * (see gdrive-ratelimit.h).
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_BREAKER_H
+#define	GDRIVE_BREAKER_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+// Failed attempts in a row that open the breaker
+#define GDRIVE_BREAKER_THRESHOLD 5
+// Successful probes in a row that close it again
+#define GDRIVE_BREAKER_PROBES 3
+// Seconds to wait before the first probe, and the most it can grow to
+#define GDRIVE_BREAKER_COOLDOWN 5
+#define GDRIVE_BREAKER_MAX_COOLDOWN 60
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_breaker_allow():  Decides whether a request can be sent. Should be
+ *                          called right before each attempt, including
+ *                          retries, and followed by gdrive_breaker_report()
+ *                          if it returns true.
+ * Return value (bool):
+ *      True if the request can be sent, false if it should fail right away.
+ */
+bool gdrive_breaker_allow(void);
+
+/*
+ * gdrive_breaker_report(): Records how an attempt that was allowed by
+ *                          gdrive_breaker_allow() went.
+ * Parameters:
+ *      failed (bool):
+ *              True if Google Drive couldn't be reached or answered with a
+ *              server error (see gdrive_dlbuf_is_unavailable()), false for
+ *              any other outcome.
+ */
+void gdrive_breaker_report(bool failed);
+
+/*
+ * gdrive_breaker_is_open():    Checks whether requests are failing right away,
+ *                              without letting one through as a probe.
+ * Return value (bool):
+ *      True if gdrive_breaker_allow() would currently return false, 
+ *      otherwise false.
+ */
+bool gdrive_breaker_is_open(void);
+
+/*
+ * gdrive_breaker_describe():   Describes the state of the breaker, for
+ *                              people to read.
+ * Parameters:
+ *      dest (char*):
+ *              Where to write the description, which is null terminated and
+ *              cut short if needed. Can be NULL if size is 0.
+ *      size (size_t):
+ *              The size of dest in bytes.
+ * Return value (int):
+ *      The length of the whole description, not counting the null
+ *      terminator, as for snprintf().
+ */
+int gdrive_breaker_describe(char* dest, size_t size);
+
+/*
+ * gdrive_breaker_print_stats():    Prints how often the breaker opened, and
+ *                                  how many requests failed right away.
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_breaker_print_stats(FILE* stream);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_BREAKER_H */
+
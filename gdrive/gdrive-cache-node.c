@@ -1,11 +1,26 @@
 
 #include "gdrive-cache-node.h"
 #include "gdrive-cache.h"
+#include "gdrive-ns-journal.h"
+#include "gdrive-id-pool.h"
+#include "gdrive-data-journal.h"
+#include "gdrive-index.h"
+#include "gdrive-pool.h"
 
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/stat.h>
+
+
+// Separates the parts of a multipart upload. Must not appear in the file's
+// contents.
+#define GDRIVE_MULTIPART_BOUNDARY "fuse_drive_3c0e7a91d2b84f56_part"
+
+// A rough allowance for the strings (ID, title, MIME type and so on) that each
+// cache node owns, used in estimating how much memory the cache takes up.
+#define GDRIVE_CNODE_STRING_ESTIMATE 160
 
 
 /*************************************************************************
@@ -15,20 +30,76 @@
 
 typedef struct Gdrive_Cache_Node
 {
+    // Searching the tree only looks at the links and fileinfo.id, so they
+    // come first, where they share a cache line.
+    struct Gdrive_Cache_Node* pLeft;
+    struct Gdrive_Cache_Node* pRight;
+    struct Gdrive_Cache_Node* pParent;
+    Gdrive_Fileinfo fileinfo;
     time_t lastUpdateTime;
     int openCount;
     int openWrites;
     bool dirty;
     bool deleted;
-    Gdrive_Fileinfo fileinfo;
     Gdrive_File_Contents* pContents;
-    struct Gdrive_Cache_Node* pParent;
-    struct Gdrive_Cache_Node* pLeft;
-    struct Gdrive_Cache_Node* pRight;
+    // pJournal: On-disk record of unuploaded changes, if a cache directory is
+    // in use and there are any. journalHasData is true once the file's chunks
+    // and size have been recorded there (as opposed to just timestamps).
+    Gdrive_Data_Journal* pJournal;
+    bool journalHasData;
+    // lastUploadTime: When the contents were last uploaded. uploadDeferred is
+    // true while the file is in the list of files whose uploads (of contents
+    // or just timestamps) were put off, linked through pNextDeferred. 
+    // deferredSince is when it was added to the list.
+    time_t lastUploadTime;
+    bool uploadDeferred;
+    time_t deferredSince;
+    struct Gdrive_Cache_Node* pNextDeferred;
+    // referenced: Set whenever the node is looked up, and cleared when 
+    // eviction passes over it (see gdrive_cnode_evict()).
+    bool referenced;
 } Gdrive_Cache_Node;
 
+// Where the last eviction sweep stopped: the ID of the next node to look at,
+// or NULL to start from the beginning.
+typedef struct Gdrive_Evict_State
+{
+    char* nextId;
+} Gdrive_Evict_State;
+
+typedef struct Gdrive_Sync_State
+{
+    // Files with uploads put off by the sync policy
+    Gdrive_Cache_Node* pDeferred;
+    Gdrive_Sync_Stats stats;
+} Gdrive_Sync_State;
+
+/*
+ * What gets sent as the body of an upload: the file's contents, and for a
+ * multipart upload, the framing (including the metadata part) around them.
+ */
+typedef struct Gdrive_Upload_Body
+{
+    Gdrive_File* pFile;
+    char* prefix;
+    size_t prefixLength;
+    const char* suffix;
+    size_t suffixLength;
+} Gdrive_Upload_Body;
+
+static Gdrive_Pool* gdrive_cnode_get_pool(void);
+
 static Gdrive_Cache_Node* gdrive_cnode_create(Gdrive_Cache_Node* pParent);
 
+static Gdrive_Evict_State* gdrive_cnode_get_evictstate(void);
+
+static Gdrive_Cache_Node* gdrive_cnode_first_from(Gdrive_Cache_Node* pRoot, 
+                                                 const char* fileId);
+
+static Gdrive_Cache_Node* gdrive_cnode_next(Gdrive_Cache_Node* pNode);
+
+static bool gdrive_cnode_can_evict(const Gdrive_Cache_Node* pNode);
+
 static void gdrive_cnode_swap(Gdrive_Cache_Node** ppFromParentOne, 
                               Gdrive_Cache_Node* pNodeOne, 
                               Gdrive_Cache_Node** ppFromParentTwo, 
@@ -52,14 +123,64 @@ static off_t gdrive_file_write_next_chunk(Gdrive_File* pFile, const char* buf,
 static bool gdrive_file_check_perm(const Gdrive_Cache_Node* pNode, 
                                    int accessFlags);
 
+static Gdrive_Data_Journal* gdrive_cnode_get_journal(Gdrive_Cache_Node* pNode);
+
+static Gdrive_Data_Journal* 
+gdrive_cnode_get_data_journal(Gdrive_Cache_Node* pNode);
+
+static void gdrive_cnode_settle_journal(Gdrive_Cache_Node* pNode);
+
+static void gdrive_cnode_park_journal(Gdrive_Cache_Node* pNode);
+
+static int gdrive_cnode_load_journal(Gdrive_Cache_Node* pNode);
+
+static Gdrive_Sync_State* gdrive_cnode_get_syncstate(void);
+
+static int gdrive_cnode_request_sync(Gdrive_Cache_Node* pNode);
+
+static int gdrive_cnode_persist_local(Gdrive_Cache_Node* pNode);
+
+static void gdrive_cnode_defer_upload(Gdrive_Cache_Node* pNode);
+
+static void gdrive_cnode_undefer_upload(Gdrive_Cache_Node* pNode);
+
+static bool gdrive_cnode_sync_is_due(const Gdrive_Cache_Node* pNode, bool all,
+                                     time_t now);
+
+static void gdrive_cnode_touch_atime(Gdrive_Cache_Node* pNode);
+
+static char* gdrive_file_get_new_parent(Gdrive_Path* pGpath, int* pError);
+
+static char* gdrive_file_new_writebehind(const char* parentId, 
+                                         const char* filename, bool isFolder);
+
 static size_t gdrive_file_uploadcallback(char* buffer, off_t offset, 
                                          size_t size, void* userdata);
 
+static int gdrive_file_add_times_json(Gdrive_Json_Object* pObj, 
+                                      Gdrive_Fileinfo* pFileinfo, 
+                                      bool* pHasMtime);
+
+static char* gdrive_file_multipart_prefix(Gdrive_Fileinfo* pFileinfo, 
+                                          bool* pHasMtime);
+
+static Gdrive_Transfer* gdrive_file_metadata_xfer(Gdrive_Fileinfo* pFileinfo, 
+                                                  const char* newFileId, 
+                                                  const char* parentId, 
+                                                  const char* filename, 
+                                                  bool isFolder, int* pError);
+
 static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo, 
+                                                 const char* newFileId, 
                                                  const char* parentId, 
                                                  const char* filename, 
                                                  bool isFolder, int* pError);
 
+static void gdrive_file_metadata_synced(Gdrive_Cache_Node* pNode);
+
+static int gdrive_file_sync_metadata_batch(Gdrive_Cache_Node** pNodes, 
+                                           int nNodes);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -99,44 +220,43 @@ Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cache_Node* pParent,
         // Convenience to avoid things like "return &((*ppNode)->fileinfo);"
         Gdrive_Cache_Node* pNode = *ppNode;
         
-        // Get the fileinfo
-        char* url = malloc(strlen(GDRIVE_URL_FILES) + strlen(fileId) + 2);
-        if (!url)
+        // The full index, if there is one, already has everything.
+        if (gdrive_idx_get_fileinfo(fileId, &(pNode->fileinfo)) == 0)
         {
-            // Memory error
-            return NULL;
+            pNode->lastUpdateTime = time(NULL);
+            return pNode;
         }
-        strcpy(url, GDRIVE_URL_FILES);
-        strcat(url, "/");
-        strcat(url, fileId);
+        
+        // If the file was created or changed by a queued change, Google Drive
+        // needs to know about it first.
+        gdrive_nsj_commit_for(fileId);
+        
+        // Get the fileinfo
+        Gdrive_Json_Object* pObj = NULL;
         Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-        if (!pTransfer)
-        {
-            // Memory error
-            return NULL;
-        }
-        if (gdrive_xfer_set_url(pTransfer, url))
+        if (pTransfer != NULL)
         {
-            // Error, probably memory
-            free(url);
-            return NULL;
+            if (gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_FILES, fileId, 
+                                         NULL) == 0)
+            {
+                gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
+                Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+                if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+                {
+                    pObj = gdrive_json_from_string(
+                            gdrive_dlbuf_get_data(pBuf));
+                }
+                gdrive_dlbuf_free(pBuf);
+            }
         }
-        free(url);
-        gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
-        Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
         gdrive_xfer_free(pTransfer);
-        if (!pBuf || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
-        {
-            // Download or request error
-            free(pBuf);
-            return NULL;
-        }
-        Gdrive_Json_Object* pObj = 
-                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-        gdrive_dlbuf_free(pBuf);
         if (!pObj)
         {
-            // Couldn't convert network response to JSON
+            // Memory, download or request error, or couldn't convert the
+            // network response to JSON. Don't leave an empty node (with no
+            // file ID) in the tree.
+            gdrive_cnode_free(pNode);
+            *ppNode = NULL;
             return NULL;
         }
         gdrive_cnode_update_from_json(pNode, pObj);
@@ -161,6 +281,7 @@ Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cache_Node* pParent,
         {
             *pAlreadyExists = true;
         }
+        pNode->referenced = true;
         return pNode;
     }
     else if (cmp < 0)
@@ -180,6 +301,73 @@ Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cache_Node* pParent,
 }
 
 
+Gdrive_Cache_Node* gdrive_cnode_insert_new(Gdrive_Cache_Node** ppRoot, 
+                                           const char* fileId, 
+                                           const char* filename, 
+                                           bool isFolder)
+{
+    assert(ppRoot != NULL && fileId != NULL && filename != NULL);
+    
+    // Find where the node belongs in the tree.
+    Gdrive_Cache_Node* pParent = NULL;
+    Gdrive_Cache_Node** ppNode = ppRoot;
+    while (*ppNode != NULL)
+    {
+        int cmp = strcmp(fileId, (*ppNode)->fileinfo.id);
+        if (cmp == 0)
+        {
+            // Already exists
+            return *ppNode;
+        }
+        pParent = *ppNode;
+        ppNode = (cmp < 0) ? &(pParent->pLeft) : &(pParent->pRight);
+    }
+    
+    Gdrive_Cache_Node* pNode = gdrive_cnode_create(pParent);
+    if (pNode == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    Gdrive_Fileinfo* pFileinfo = &(pNode->fileinfo);
+    pFileinfo->id = malloc(strlen(fileId) + 1);
+    pFileinfo->filename = malloc(strlen(filename) + 1);
+    if (pFileinfo->id == NULL || pFileinfo->filename == NULL)
+    {
+        // Memory error
+        gdrive_cnode_free(pNode);
+        return NULL;
+    }
+    strcpy(pFileinfo->id, fileId);
+    strcpy(pFileinfo->filename, filename);
+    
+    // The user owns anything they create, so they get full access (and 
+    // folders always get execute permission).
+    if (isFolder)
+    {
+        pFileinfo->type = GDRIVE_FILETYPE_FOLDER;
+        pFileinfo->basePermission = S_IROTH | S_IWOTH | S_IXOTH;
+    }
+    else
+    {
+        pFileinfo->type = GDRIVE_FILETYPE_FILE;
+        pFileinfo->basePermission = S_IROTH | S_IWOTH;
+    }
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) == 0)
+    {
+        pFileinfo->creationTime = ts;
+        pFileinfo->accessTime = ts;
+        pFileinfo->modificationTime = ts;
+    }
+    // else leave the times at 0 on failure
+    pFileinfo->nParents = 1;
+    
+    pNode->lastUpdateTime = time(NULL);
+    *ppNode = pNode;
+    return pNode;
+}
+
 void gdrive_cnode_delete(Gdrive_Cache_Node* pNode, 
                          Gdrive_Cache_Node** ppToRoot)
 {
@@ -282,6 +470,11 @@ void gdrive_cnode_mark_deleted(Gdrive_Cache_Node* pNode,
 
 void gdrive_cnode_free_all(Gdrive_Cache_Node* pRoot)
 {
+    // Whatever the next eviction would have started from is going away.
+    Gdrive_Evict_State* pEvict = gdrive_cnode_get_evictstate();
+    free(pEvict->nextId);
+    pEvict->nextId = NULL;
+    
     if (pRoot == NULL)
     {
         // Nothing to do.
@@ -316,6 +509,17 @@ Gdrive_Fileinfo* gdrive_cnode_get_fileinfo(Gdrive_Cache_Node* pNode)
     return &(pNode->fileinfo);
 }
 
+size_t gdrive_cnode_get_count(void)
+{
+    return gdrive_cnode_get_pool()->nLive;
+}
+
+size_t gdrive_cnode_get_bytes(void)
+{
+    return gdrive_cnode_get_pool()->nLive * 
+            (sizeof(Gdrive_Cache_Node) + GDRIVE_CNODE_STRING_ESTIMATE);
+}
+
 
 /******************
  * Other accessible functions
@@ -346,7 +550,7 @@ void gdrive_cnode_delete_file_contents(Gdrive_Cache_Node* pNode,
 
 bool gdrive_cnode_is_dirty(const Gdrive_Cache_Node* pNode)
 {
-    return pNode->dirty;
+    return pNode->dirty || pNode->fileinfo.dirtyMetainfo;
 }
 
 bool gdrive_cnode_isdeleted(const Gdrive_Cache_Node* pNode)
@@ -355,6 +559,59 @@ bool gdrive_cnode_isdeleted(const Gdrive_Cache_Node* pNode)
     return pNode->deleted;
 }
 
+size_t gdrive_cnode_evict(Gdrive_Cache_Node** ppRoot, size_t count)
+{
+    assert(ppRoot != NULL);
+    
+    // CLOCK: Go around the tree in order, starting where the last sweep 
+    // stopped. A node that has been looked up since the hand last passed it 
+    // gets another chance, anything else that's safe to drop is removed. 
+    // Going around at most once means nothing that was looked up before this
+    // call is removed by it.
+    Gdrive_Evict_State* pEvict = gdrive_cnode_get_evictstate();
+    Gdrive_Cache_Node* pNode = (pEvict->nextId != NULL) ? 
+        gdrive_cnode_first_from(*ppRoot, pEvict->nextId) : NULL;
+    size_t nNodes = gdrive_cnode_get_count();
+    size_t nEvicted = 0;
+    for (size_t i = 0; i < nNodes && nEvicted < count && *ppRoot != NULL; i++)
+    {
+        if (pNode == NULL)
+        {
+            // Wrap around to the first node.
+            pNode = gdrive_cnode_first_from(*ppRoot, "");
+        }
+        
+        // Deleting a node only moves other nodes around within the tree, so
+        // the next one stays valid.
+        Gdrive_Cache_Node* pNext = gdrive_cnode_next(pNode);
+        if (pNode->referenced)
+        {
+            pNode->referenced = false;
+        }
+        else if (gdrive_cnode_can_evict(pNode))
+        {
+            gdrive_cnode_delete(pNode, ppRoot);
+            nEvicted++;
+        }
+        pNode = pNext;
+    }
+    
+    // Remember where to pick up next time.
+    free(pEvict->nextId);
+    pEvict->nextId = NULL;
+    if (pNode != NULL)
+    {
+        pEvict->nextId = malloc(strlen(pNode->fileinfo.id) + 1);
+        if (pEvict->nextId != NULL)
+        {
+            strcpy(pEvict->nextId, pNode->fileinfo.id);
+        }
+        // else memory error, just start over from the beginning next time.
+    }
+    
+    return nEvicted;
+}
+
 
 /*************************************************************************
  * Public functions to support Gdrive_File usage
@@ -404,6 +661,21 @@ Gdrive_File* gdrive_file_open(const char* fileId, int flags, int* pError)
     }
     
     
+    // Pick up any changes that were saved on disk but never uploaded, so that
+    // they're visible through this handle and get uploaded when it closes.
+    if (pNode->openCount == 0 && pNode->pJournal == NULL && 
+            gdrive_dj_exists(fileId))
+    {
+        gdrive_cnode_load_journal(pNode);
+    }
+    
+    // Opening to read counts as access, as far as the atime policy says it 
+    // does. (Files opened for writing get their times set explicitly.)
+    if ((flags & O_ACCMODE) == O_RDONLY)
+    {
+        gdrive_cnode_touch_atime(pNode);
+    }
+    
     // Increment the open counter
     pNode->openCount++;
     
@@ -431,13 +703,35 @@ void gdrive_file_close(Gdrive_File* pFile, int flags)
     if ((flags & O_WRONLY) || (flags & O_RDWR))
     {
         // Was opened for writing
-        
-        // Upload any changes back to Google Drive
-        gdrive_file_sync(pFile);
-        gdrive_file_sync_metadata(pFile);
-        
-        // Close the file
         pNode->openWrites--;
+        
+        if (pNode->openWrites == 0 || 
+                gdrive_get_syncpolicy() == GDRIVE_SYNC_STRICT)
+        {
+            if (pNode->dirty)
+            {
+                gdrive_cnode_get_syncstate()->stats.syncRequests++;
+            }
+            // Upload any changes back to Google Drive. Changed timestamps
+            // go along with the contents if there are any.
+            gdrive_file_sync(pFile);
+            if (gdrive_get_syncpolicy() == GDRIVE_SYNC_STRICT)
+            {
+                gdrive_file_sync_metadata(pFile);
+            }
+            else if (pNode->fileinfo.dirtyMetainfo)
+            {
+                // Only timestamps left. Wait a little in case more changes
+                // come along.
+                gdrive_cnode_defer_upload(pNode);
+            }
+        }
+        else
+        {
+            // Somebody else is still writing. Let the sync policy decide 
+            // whether to upload now.
+            gdrive_cnode_request_sync(pNode);
+        }
     }
     
     // Decrement open file counts.
@@ -448,6 +742,20 @@ void gdrive_file_close(Gdrive_File* pFile, int flags)
     // TODO: Consider keeping some closed files around in case they're reopened
     if (pNode->openCount == 0)
     {
+        // Timestamps that are only waiting on the timer can keep waiting
+        // (along with their journal) after the file is closed.
+        bool timesWaiting = pNode->uploadDeferred && !pNode->dirty && 
+            pNode->fileinfo.dirtyMetainfo && !gdrive_cnode_isdeleted(pNode);
+        if (!timesWaiting)
+        {
+            gdrive_cnode_undefer_upload(pNode);
+        }
+        if (pNode->pJournal != NULL && !timesWaiting)
+        {
+            // Some changes couldn't be uploaded. Leave them on disk to be
+            // tried again later.
+            gdrive_cnode_park_journal(pNode);
+        }
         gdrive_fcontents_free_all(&(pNode->pContents));
         if (gdrive_cnode_isdeleted(pNode))
         {
@@ -589,9 +897,14 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size)
     // Case B: Delete all cached file contents, set the length to 0.
     if (size == 0)
     {
+        if (fh->journalHasData)
+        {
+            gdrive_dj_add_drop_all(fh->pJournal);
+        }
         gdrive_fcontents_free_all(&(fh->pContents));
         fh->fileinfo.size = 0;
         fh->dirty = true;
+        gdrive_dj_add_size(gdrive_cnode_get_data_journal(fh), 0);
         return 0;
     }
     
@@ -646,6 +959,10 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size)
         pFinalChunk = gdrive_fcontents_find_chunk(fh->pContents, size - 1);
         
         // Delete any chunks past the new EOF
+        if (fh->journalHasData)
+        {
+            gdrive_dj_add_drop_after(fh->pJournal, size - 1);
+        }
         gdrive_fcontents_delete_after_offset(&(fh->pContents), size - 1);
     }
     
@@ -663,6 +980,7 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size)
         // Successfully truncated the chunk. Update the file's size.
         fh->fileinfo.size = size;
         fh->dirty = true;
+        gdrive_dj_add_size(gdrive_cnode_get_data_journal(fh), size);
     }
     
     return returnVal;
@@ -690,56 +1008,106 @@ int gdrive_file_sync(Gdrive_File* fh)
         return -EACCES;
     }
     
-    // Just using simple upload for now.
+    // The file has to exist on Google Drive before we can upload to it. If 
+    // its creation (or another change to it) is still queued, leave it dirty
+    // so the upload is tried again later.
+    if (gdrive_nsj_commit_for(pNode->fileinfo.id) != 0)
+    {
+        return -EIO;
+    }
+    
+    // If any timestamps changed, send them in the same request as a multipart
+    // upload instead of following up with a separate metadata request.
+    Gdrive_Upload_Body body = {.pFile = fh};
+    bool withMetadata = pNode->fileinfo.dirtyMetainfo;
+    bool hasMtime = false;
+    if (withMetadata)
+    {
+        body.prefix = gdrive_file_multipart_prefix(&(pNode->fileinfo), 
+                                                   &hasMtime);
+        if (body.prefix == NULL)
+        {
+            // Memory error
+            return -ENOMEM;
+        }
+        body.prefixLength = strlen(body.prefix);
+        body.suffix = "\r\n--" GDRIVE_MULTIPART_BOUNDARY "--\r\n";
+        body.suffixLength = strlen(body.suffix);
+    }
+    
+    // Not using resumable upload for now.
     // TODO: Consider using resumable upload, possibly only for large files.
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
     if (pTransfer == NULL)
     {
         // Memory error
+        free(body.prefix);
         return -ENOMEM;
     }
     gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_PUT);
     
-    // Assemble the URL
-    size_t urlSize = strlen(GDRIVE_URL_UPLOAD) + strlen(pNode->fileinfo.id) + 2;
-    char* url = malloc(urlSize);
-    if (url == NULL)
-    {
-        // Memory error
-        gdrive_xfer_free(pTransfer);
-        return -ENOMEM;
-    }
-    strcpy(url, GDRIVE_URL_UPLOAD);
-    strcat(url, "/");
-    strcat(url, pNode->fileinfo.id);
-    if (gdrive_xfer_set_url(pTransfer, url) != 0)
+    // The URL is the upload URL + '/' + file ID
+    if (gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_UPLOAD, 
+                                 pNode->fileinfo.id, NULL) != 0)
     {
         // Error, probably memory
-        free(url);
         gdrive_xfer_free(pTransfer);
+        free(body.prefix);
         return -ENOMEM;
     }
-    free(url);
     
-    // Add query parameter(s)
-    if (gdrive_xfer_add_query(pTransfer, "uploadType", "media") != 0)
+    // Add query parameter(s) and header(s)
+    int error = 0;
+    if (withMetadata)
+    {
+        error = gdrive_xfer_add_query(pTransfer, "uploadType", "multipart") || 
+            gdrive_xfer_add_header(pTransfer, "Content-Type: multipart/related; "
+                                   "boundary=" GDRIVE_MULTIPART_BOUNDARY) || 
+            (hasMtime && 
+            gdrive_xfer_add_query(pTransfer, "setModifiedDate", "true")) || 
+            gdrive_xfer_add_query(pTransfer, "updateViewedDate", "false");
+    }
+    else
+    {
+        error = gdrive_xfer_add_query(pTransfer, "uploadType", "media");
+    }
+    if (error != 0)
     {
         // Error, probably memory
         gdrive_xfer_free(pTransfer);
+        free(body.prefix);
         return -ENOMEM;
     }
     
     // Set upload callback
-    gdrive_xfer_set_uploadcallback(pTransfer, gdrive_file_uploadcallback, fh);
+    gdrive_xfer_set_uploadcallback(pTransfer, gdrive_file_uploadcallback, 
+                                   &body);
     
     // Do the transfer
     Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
     gdrive_xfer_free(pTransfer);
-    int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400);
+    free(body.prefix);
+    int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400) ? 
+        -EIO : 0;
     if (returnVal == 0)
     {
-        // Success. Clear the dirty flag
+        // Success. Clear the dirty flag(s)
         pNode->dirty = false;
+        if (withMetadata)
+        {
+            pNode->fileinfo.dirtyMetainfo = false;
+        }
+        gdrive_cnode_settle_journal(pNode);
+        
+        pNode->lastUploadTime = time(NULL);
+        gdrive_cnode_undefer_upload(pNode);
+        Gdrive_Sync_Stats* pStats = &(gdrive_cnode_get_syncstate()->stats);
+        pStats->uploads++;
+        pStats->bytesUploaded += pNode->fileinfo.size;
+        if (withMetadata)
+        {
+            pStats->metadataFolded++;
+        }
     }
     gdrive_dlbuf_free(pBuf);
     return returnVal;
@@ -763,15 +1131,42 @@ int gdrive_file_sync_metadata(Gdrive_File* fh)
         return -EACCES;
     }
     
+    // The file has to exist on Google Drive before we can change it. If it 
+    // doesn't yet, the timestamps stay dirty and are sent later.
+    if (gdrive_nsj_commit_for(pFileinfo->id) != 0)
+    {
+        return -EIO;
+    }
+    
     int error = 0;
     char* dummy = 
-        gdrive_file_sync_metadata_or_create(pFileinfo, NULL, NULL, 
+        gdrive_file_sync_metadata_or_create(pFileinfo, NULL, NULL, NULL, 
                                             (pFileinfo->type == 
                                             GDRIVE_FILETYPE_FOLDER), 
                                             &error
     );
     free(dummy);
-    return error;
+    if (error == 0)
+    {
+        gdrive_file_metadata_synced(pNode);
+    }
+    return -error;
+}
+
+int gdrive_file_persist(Gdrive_File* fh)
+{
+    assert(fh != NULL);
+    
+    return gdrive_cnode_request_sync(fh);
+}
+
+void gdrive_file_get_syncstats(Gdrive_Sync_Stats* pStats)
+{
+    assert(pStats != NULL);
+    
+    *pStats = gdrive_cnode_get_syncstate()->stats;
+    pStats->uploadsSaved = (pStats->syncRequests > pStats->uploads) ? 
+        pStats->syncRequests - pStats->uploads : 0;
 }
 
 int gdrive_file_set_atime(Gdrive_File* fh, const struct timespec* ts)
@@ -787,6 +1182,8 @@ int gdrive_file_set_atime(Gdrive_File* fh, const struct timespec* ts)
     }
 
     gdrive_finfo_set_atime(&(pNode->fileinfo), ts);
+    gdrive_dj_add_times(gdrive_cnode_get_journal(pNode), NULL, 
+                        &(pNode->fileinfo.accessTime));
     return 0;
 }
 
@@ -803,6 +1200,8 @@ int gdrive_file_set_mtime(Gdrive_File* fh, const struct timespec* ts)
     }
 
     gdrive_finfo_set_mtime(&(pNode->fileinfo), ts);
+    gdrive_dj_add_times(gdrive_cnode_get_journal(pNode), 
+                        &(pNode->fileinfo.modificationTime), NULL);
     return 0;
 }
 
@@ -818,68 +1217,41 @@ char* gdrive_file_new(const char* path, bool createFolder, int* pError)
         *pError = ENOMEM;
         return NULL;
     }
-    const char* folderName = gdrive_path_get_dirname(pGpath);
     const char* filename = gdrive_path_get_basename(pGpath);
-    
-    // Check basename for validity (non-NULL, not a directory link such as "..")
-    if (filename == NULL || filename[0] == '/' || 
-            strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
-    {
-        *pError = EISDIR;
-        gdrive_path_free(pGpath);
-        return NULL;
-    }
-    
-    // Check folder for validity (non-NULL, starts with '/', and is an existing
-    // folder)
-    if (folderName == NULL || folderName[0] != '/')
-    {
-        // Path wasn't in the form of an absolute path
-        *pError = ENOTDIR;
-        gdrive_path_free(pGpath);
-        return NULL;
-    }
-    char* parentId = gdrive_filepath_to_id(folderName);
+    char* parentId = gdrive_file_get_new_parent(pGpath, pError);
     if (parentId == NULL)
     {
-        // Folder doesn't exist
-        *pError = ENOTDIR;
-        gdrive_path_free(pGpath);
-        return NULL;
-    }
-    Gdrive_Cache_Node* pFolderNode = 
-            gdrive_cache_get_node(parentId, true, NULL);
-    if (pFolderNode == NULL)
-    {
-        // Couldn't get a node for the parent folder
-        *pError = EIO;
-        gdrive_path_free(pGpath);
-        free(parentId);
-        return NULL;
-    }
-    const Gdrive_Fileinfo* pFolderinfo = gdrive_cnode_get_fileinfo(pFolderNode);
-    if (pFolderinfo == NULL || pFolderinfo->type != GDRIVE_FILETYPE_FOLDER)
-    {
-        // Not an actual folder
-        *pError = ENOTDIR;
         gdrive_path_free(pGpath);
-        free(parentId);
         return NULL;
     }
     
-    // Make sure we have write access to the folder
-    if (!gdrive_file_check_perm(pFolderNode, O_WRONLY))
+    
+    if (gdrive_get_writebehind())
     {
-        // Don't have the needed permission
-        *pError = EACCES;
-        gdrive_path_free(pGpath);
-        free(parentId);
-        return NULL;
+        // Try to create the file locally with a reserved ID, and queue the
+        // creation on Google Drive for later.
+        char* fileId = 
+                gdrive_file_new_writebehind(parentId, filename, createFolder);
+        if (fileId != NULL)
+        {
+            gdrive_path_free(pGpath);
+            free(parentId);
+            if (gdrive_cache_add_fileid(path, fileId) != 0)
+            {
+                // Probably a memory error. The file will still be created,
+                // and the path can be looked up again later.
+                *pError = ENOMEM;
+                free(fileId);
+                return NULL;
+            }
+            return fileId;
+        }
+        // else fall back to creating the file right away
     }
     
-    
-    char* fileId = gdrive_file_sync_metadata_or_create(NULL, parentId, filename,
-                                                       createFolder, pError);
+    char* fileId = gdrive_file_sync_metadata_or_create(NULL, NULL, parentId, 
+                                                       filename, createFolder, 
+                                                       pError);
     gdrive_path_free(pGpath);
     free(parentId);
     
@@ -899,20 +1271,331 @@ char* gdrive_file_new(const char* path, bool createFolder, int* pError)
     return gdrive_filepath_to_id(path);
 }
 
-Gdrive_Fileinfo* gdrive_file_get_info(Gdrive_File* fh)
+char* gdrive_file_copy(const char* fileId, const char* path, int* pError)
 {
-    assert(fh != NULL);
+    assert(fileId != NULL && path != NULL && path[0] == '/' && 
+            pError != NULL);
     
-    // No need to check permissions. This is just metadata, and metadata 
-    // permissions were already needed just to access the filesystem and get a
-    // filehandle in the first place.
+    // The destination must not already exist.
+    char* existingId = gdrive_filepath_to_id(path);
+    if (existingId != NULL)
+    {
+        free(existingId);
+        *pError = EEXIST;
+        return NULL;
+    }
     
-    // Gdrive_Filehandle and Gdrive_Cache_Node are typedefs of the same struct,
-    // but it's easier to think about them differently. A filehandle is a token,
-    // and a cache node has an internal structure.
-    Gdrive_Cache_Node* pNode = fh;
-    return gdrive_cnode_get_fileinfo(pNode);
-}
+    Gdrive_Path* pGpath = gdrive_path_create(path);
+    if (pGpath == NULL)
+    {
+        // Memory error
+        *pError = ENOMEM;
+        return NULL;
+    }
+    char* parentId = gdrive_file_get_new_parent(pGpath, pError);
+    if (parentId == NULL)
+    {
+        gdrive_path_free(pGpath);
+        return NULL;
+    }
+    
+    // Google Drive can only copy regular files, and it copies what it has, so
+    // any queued changes and unuploaded contents have to reach it first. The
+    // same goes for the folder the copy goes in.
+    if (gdrive_nsj_commit_for(fileId) != 0 || 
+            gdrive_nsj_commit_for(parentId) != 0)
+    {
+        // One of them may not even exist on Google Drive yet.
+        *pError = EIO;
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    Gdrive_Cache_Node* pSourceNode = gdrive_cache_get_node(fileId, true, NULL);
+    int error = 0;
+    if (pSourceNode == NULL)
+    {
+        error = ENOENT;
+    }
+    else if (pSourceNode->fileinfo.type == GDRIVE_FILETYPE_FOLDER)
+    {
+        error = EISDIR;
+    }
+    else if (!gdrive_file_check_perm(pSourceNode, O_RDONLY))
+    {
+        error = EACCES;
+    }
+    else if (pSourceNode->dirty)
+    {
+        error = -gdrive_file_sync(pSourceNode);
+    }
+    else if (pSourceNode->fileinfo.dirtyMetainfo)
+    {
+        error = -gdrive_file_sync_metadata(pSourceNode);
+    }
+    if (error != 0)
+    {
+        *pError = error;
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    
+    // The new file's resource only needs a title and parent. Everything else
+    // is copied from the original.
+    Gdrive_Json_Object* pResourceJson = gdrive_json_new();
+    if (pResourceJson == NULL)
+    {
+        *pError = ENOMEM;
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    gdrive_json_add_string(pResourceJson, "title", 
+                           gdrive_path_get_basename(pGpath));
+    Gdrive_Json_Object* parentsArray = 
+            gdrive_json_add_new_array(pResourceJson, "parents");
+    Gdrive_Json_Object* parentIdObj = gdrive_json_new();
+    if (parentsArray == NULL || parentIdObj == NULL)
+    {
+        *pError = ENOMEM;
+        gdrive_json_kill(parentIdObj);
+        gdrive_json_kill(pResourceJson);
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    gdrive_json_add_string(parentIdObj, "id", parentId);
+    gdrive_json_array_append_object(parentsArray, parentIdObj);
+    char* resourceStr = gdrive_json_to_new_string(pResourceJson, false);
+    gdrive_json_kill(pResourceJson);
+    
+    // URL is base URL + '/' + file ID + "/copy"
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (resourceStr == NULL || pTransfer == NULL)
+    {
+        *pError = ENOMEM;
+        gdrive_xfer_free(pTransfer);
+        free(resourceStr);
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    if (gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_FILES, fileId, 
+                                 "/copy") || 
+            gdrive_xfer_add_header(pTransfer, 
+                                   "Content-Type: application/json")
+        )
+    {
+        *pError = ENOMEM;
+        gdrive_xfer_free(pTransfer);
+        free(resourceStr);
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_POST);
+    gdrive_xfer_set_body(pTransfer, resourceStr);
+    
+    // Do the transfer
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    free(resourceStr);
+    if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    {
+        // Transfer was unsuccessful
+        *pError = EIO;
+        gdrive_dlbuf_free(pBuf);
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    Gdrive_Json_Object* pObj = 
+            gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+    gdrive_dlbuf_free(pBuf);
+    char* newId = (pObj != NULL) ? 
+        gdrive_json_get_new_string(pObj, "id", NULL) : NULL;
+    if (newId == NULL)
+    {
+        // The copy may have been made, but we can't tell what it is. It will
+        // show up after the next cache update.
+        *pError = EIO;
+        gdrive_json_kill(pObj);
+        gdrive_path_free(pGpath);
+        free(parentId);
+        return NULL;
+    }
+    
+    // The response is the new file's complete resource, so it can go straight
+    // into the cache without another request.
+    Gdrive_Fileinfo* pNewinfo = gdrive_cache_add_new_item(
+            newId, gdrive_path_get_basename(pGpath), false);
+    Gdrive_Cache_Node* pNewNode = (pNewinfo != NULL) ? 
+        gdrive_cache_get_node(newId, false, NULL) : NULL;
+    gdrive_cnode_update_from_json(pNewNode, pObj);
+    gdrive_idx_update_from_json(pObj);
+    gdrive_json_kill(pObj);
+    gdrive_path_free(pGpath);
+    
+    // The destination folder now has one more child, if it had been counted.
+    Gdrive_Cache_Node* pParentNode = 
+            gdrive_cache_get_node(parentId, false, NULL);
+    free(parentId);
+    Gdrive_Fileinfo* pParentinfo = (pParentNode != NULL) ? 
+        gdrive_cnode_get_fileinfo(pParentNode) : NULL;
+    if (pParentinfo != NULL && pParentinfo->nChildren >= 0)
+    {
+        pParentinfo->nChildren++;
+    }
+    
+    if (gdrive_cache_add_fileid(path, newId) != 0)
+    {
+        // Probably a memory error. The copy was still made, and the path can
+        // be looked up again later.
+        *pError = ENOMEM;
+        free(newId);
+        return NULL;
+    }
+    return newId;
+}
+
+int gdrive_file_create_remote(const char* fileId, const char* parentId, 
+                              const char* filename, bool isFolder)
+{
+    assert(fileId != NULL && parentId != NULL && filename != NULL);
+    
+    int error = 0;
+    char* newId = gdrive_file_sync_metadata_or_create(NULL, fileId, parentId, 
+                                                      filename, isFolder, 
+                                                      &error);
+    free(newId);
+    return -error;
+}
+
+int gdrive_file_sync_due(bool all)
+{
+    time_t now = time(NULL);
+    int returnVal = 0;
+    
+    // Any queued namespace changes have to reach Google Drive before the 
+    // files they affect can be updated. Send them all up front, because a 
+    // failed change can drop nodes from the cache, and this function holds
+    // on to node pointers.
+    bool anyDue = false;
+    for (Gdrive_Cache_Node* pNode = gdrive_cnode_get_syncstate()->pDeferred;
+            pNode != NULL && !anyDue;
+            pNode = pNode->pNextDeferred)
+    {
+        anyDue = gdrive_cnode_sync_is_due(pNode, all, now);
+    }
+    if (!anyDue)
+    {
+        // Nothing to do
+        return 0;
+    }
+    gdrive_nsj_commit_all();
+    
+    // Files with only timestamps waiting are collected and sent together in
+    // batches.
+    Gdrive_Cache_Node* pMetaNodes[GDRIVE_XFER_BATCH_MAX];
+    int nMetaNodes = 0;
+    
+    Gdrive_Cache_Node* pNode = gdrive_cnode_get_syncstate()->pDeferred;
+    while (pNode != NULL)
+    {
+        // A successful upload takes the node out of the list, so find the next
+        // one first.
+        Gdrive_Cache_Node* pNext = pNode->pNextDeferred;
+        
+        bool due = gdrive_cnode_sync_is_due(pNode, all, now);
+        if (due && !pNode->dirty)
+        {
+            pMetaNodes[nMetaNodes++] = pNode;
+            if (nMetaNodes == GDRIVE_XFER_BATCH_MAX)
+            {
+                int error = 
+                        gdrive_file_sync_metadata_batch(pMetaNodes, nMetaNodes);
+                returnVal = (error != 0) ? error : returnVal;
+                nMetaNodes = 0;
+            }
+        }
+        else if (due)
+        {
+            int error = gdrive_file_sync(pNode);
+            if (error == 0)
+            {
+                gdrive_cnode_undefer_upload(pNode);
+            }
+            else
+            {
+                returnVal = error;
+            }
+        }
+        pNode = pNext;
+    }
+    if (nMetaNodes > 0)
+    {
+        int error = gdrive_file_sync_metadata_batch(pMetaNodes, nMetaNodes);
+        returnVal = (error != 0) ? error : returnVal;
+    }
+    return returnVal;
+}
+
+int gdrive_file_recover(const char* fileId)
+{
+    assert(fileId != NULL);
+    
+    // Make sure the file exists on Google Drive. If it was still waiting to be
+    // created when the changes were saved, create it now.
+    if (gdrive_cache_get_node(fileId, true, NULL) == NULL)
+    {
+        Gdrive_Dj_State state;
+        if (gdrive_dj_read(fileId, &state) != 0)
+        {
+            return -EIO;
+        }
+        int returnVal = -ENOENT;
+        if (state.createParentId != NULL)
+        {
+            returnVal = gdrive_file_create_remote(fileId, 
+                                                  state.createParentId, 
+                                                  state.createTitle, 
+                                                  state.createIsFolder);
+        }
+        gdrive_dj_state_cleanup(&state);
+        if (returnVal != 0)
+        {
+            return returnVal;
+        }
+    }
+    
+    // Opening the file reloads the saved changes, and closing it uploads them.
+    int error = 0;
+    Gdrive_File* fh = gdrive_file_open(fileId, O_RDWR, &error);
+    if (fh == NULL)
+    {
+        return -error;
+    }
+    gdrive_file_close(fh, O_RDWR);
+    
+    // If anything is still left, the upload failed.
+    return gdrive_dj_exists(fileId) ? -EIO : 0;
+}
+
+Gdrive_Fileinfo* gdrive_file_get_info(Gdrive_File* fh)
+{
+    assert(fh != NULL);
+    
+    // No need to check permissions. This is just metadata, and metadata 
+    // permissions were already needed just to access the filesystem and get a
+    // filehandle in the first place.
+    
+    // Gdrive_Filehandle and Gdrive_Cache_Node are typedefs of the same struct,
+    // but it's easier to think about them differently. A filehandle is a token,
+    // and a cache node has an internal structure.
+    Gdrive_Cache_Node* pNode = fh;
+    return gdrive_cnode_get_fileinfo(pNode);
+}
 
 unsigned int gdrive_file_get_perms(const Gdrive_File* fh)
 {
@@ -925,21 +1608,95 @@ unsigned int gdrive_file_get_perms(const Gdrive_File* fh)
  * Implementations of private functions for use within this file
  *************************************************************************/
 
+static Gdrive_Pool* gdrive_cnode_get_pool(void)
+{
+    static Gdrive_Pool pool = 
+            GDRIVE_POOL_INIT("cache nodes", Gdrive_Cache_Node);
+    return &pool;
+}
+
 /*
  * Set pParent to NULL for the root node of the tree (the node that has no
  * parent).
  */
 static Gdrive_Cache_Node* gdrive_cnode_create(Gdrive_Cache_Node* pParent)
 {
-    Gdrive_Cache_Node* result = malloc(sizeof(Gdrive_Cache_Node));
+    Gdrive_Cache_Node* result = gdrive_pool_alloc(gdrive_cnode_get_pool());
     if (result != NULL)
     {
-        memset(result, 0, sizeof(Gdrive_Cache_Node));
         result->pParent = pParent;
+        result->referenced = true;
     }
     return result;
 }
 
+static Gdrive_Evict_State* gdrive_cnode_get_evictstate(void)
+{
+    static Gdrive_Evict_State state = {0};
+    return &state;
+}
+
+/*
+ * Returns the first node (in file ID order) whose file ID is not less than
+ * fileId, or NULL if there isn't one.
+ */
+static Gdrive_Cache_Node* gdrive_cnode_first_from(Gdrive_Cache_Node* pRoot, 
+                                                 const char* fileId)
+{
+    Gdrive_Cache_Node* pResult = NULL;
+    Gdrive_Cache_Node* pNode = pRoot;
+    while (pNode != NULL)
+    {
+        if (strcmp(pNode->fileinfo.id, fileId) >= 0)
+        {
+            pResult = pNode;
+            pNode = pNode->pLeft;
+        }
+        else
+        {
+            pNode = pNode->pRight;
+        }
+    }
+    return pResult;
+}
+
+/*
+ * Returns the node that comes after pNode in file ID order, or NULL if pNode
+ * is the last one.
+ */
+static Gdrive_Cache_Node* gdrive_cnode_next(Gdrive_Cache_Node* pNode)
+{
+    if (pNode->pRight != NULL)
+    {
+        // Leftmost node of the right subtree
+        pNode = pNode->pRight;
+        while (pNode->pLeft != NULL)
+        {
+            pNode = pNode->pLeft;
+        }
+        return pNode;
+    }
+    
+    // Otherwise, the first ancestor that pNode is on the left side of
+    while (pNode->pParent != NULL && pNode->pParent->pRight == pNode)
+    {
+        pNode = pNode->pParent;
+    }
+    return pNode->pParent;
+}
+
+/*
+ * Whether a node can be dropped from the cache and looked up again later 
+ * without losing anything.
+ */
+static bool gdrive_cnode_can_evict(const Gdrive_Cache_Node* pNode)
+{
+    return pNode->openCount == 0 && !pNode->deleted && 
+            !gdrive_cnode_is_dirty(pNode) && pNode->pJournal == NULL && 
+            !pNode->uploadDeferred && 
+            !gdrive_nsj_is_pending_create(pNode->fileinfo.id);
+}
+
 /*
  * pNodeTwo must be a descendent of pNodeOne, or neither node is descended from
  * the other.
@@ -1027,12 +1784,20 @@ static void gdrive_cnode_swap(Gdrive_Cache_Node** ppFromParentOne,
  */
 static void gdrive_cnode_free(Gdrive_Cache_Node* pNode)
 {
+    gdrive_cnode_undefer_upload(pNode);
+    if (pNode->pJournal != NULL)
+    {
+        // Unuploaded changes. Keep the chunk files for recovery.
+        gdrive_fcontents_release_all(&(pNode->pContents));
+        gdrive_dj_close(pNode->pJournal, false);
+        pNode->pJournal = NULL;
+    }
     gdrive_finfo_cleanup(&(pNode->fileinfo));
     gdrive_fcontents_free_all(&(pNode->pContents));
     pNode->pContents = NULL;
     pNode->pLeft = NULL;
     pNode->pRight = NULL;
-    free(pNode);
+    gdrive_pool_free(gdrive_cnode_get_pool(), pNode);
 }
 
 static Gdrive_File_Contents* gdrive_cnode_add_contents(Gdrive_Cache_Node* pNode)
@@ -1103,6 +1868,13 @@ gdrive_cnode_create_chunk(Gdrive_Cache_Node* pNode, off_t offset, size_t size,
     }
     // else we're not filling the chunk, do nothing
     
+    if (pNode->journalHasData)
+    {
+        // Dirty data may end up in this chunk, so make sure it can be found
+        // again.
+        gdrive_fcontents_journal_chunk(pContents, pNode->pJournal);
+    }
+    
     // Success
     return pContents;
 }
@@ -1199,6 +1971,8 @@ static off_t gdrive_file_write_next_chunk(Gdrive_File* pFile, const char* buf,
             // Update the file size
             pNode->fileinfo.size = offset + bytesWritten;
         }
+        gdrive_dj_add_size(gdrive_cnode_get_data_journal(pNode), 
+                           pNode->fileinfo.size);
     }
     
     return bytesWritten;
@@ -1234,63 +2008,615 @@ static size_t gdrive_file_uploadcallback(char* buffer, off_t offset,
                                          size_t size, 
                                          void* userdata)
 {
-    // All we need to do is read from a Gdrive_File* file handle into a buffer.
-    // We already know how to do exactly that.
-    int returnVal = gdrive_file_read((Gdrive_File*) userdata, 
-                                     buffer, 
-                                     size, 
-                                     offset
-    );
-    return (returnVal >= 0) ? (size_t) returnVal: (size_t)(-1);
-}
-
-static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo, 
-                                                 const char* parentId, 
-                                                 const char* filename, 
-                                                 bool isFolder, int* pError)
-{
-    // For existing file, pFileinfo must be non-NULL. For creating new file,
-    // both parentId and filename must be non-NULL.
-    assert(pFileinfo || (parentId && filename));
+    Gdrive_Upload_Body* pBody = (Gdrive_Upload_Body*) userdata;
+    size_t fileSize = pBody->pFile->fileinfo.size;
+    size_t copied = 0;
     
-    Gdrive_Fileinfo myFileinfo = {0};
-    Gdrive_Fileinfo* pMyFileinfo;
-    if (pFileinfo != NULL)
+    // Multipart framing (and metadata) before the contents
+    if ((size_t) offset < pBody->prefixLength)
     {
-        pMyFileinfo = pFileinfo;
-        isFolder = (pMyFileinfo->type == GDRIVE_FILETYPE_FOLDER);
+        copied = pBody->prefixLength - offset;
+        if (copied > size)
+        {
+            copied = size;
+        }
+        memcpy(buffer, pBody->prefix + offset, copied);
     }
-    else
+    
+    // The contents. All we need to do is read from a Gdrive_File* file handle 
+    // into a buffer. We already know how to do exactly that.
+    size_t contentOffset = offset + copied - pBody->prefixLength;
+    if (copied < size && contentOffset < fileSize)
     {
-        // We won't change anything, but need to cast away the const to make
-        // this assignment.
-        myFileinfo.filename = (char*) filename;
-        myFileinfo.type = isFolder ? 
-            GDRIVE_FILETYPE_FOLDER : GDRIVE_FILETYPE_FILE;
-        struct timespec ts;
-        if (clock_gettime(CLOCK_REALTIME, &ts) == 0)
+        size_t wanted = size - copied;
+        if (wanted > fileSize - contentOffset)
         {
-            myFileinfo.creationTime = ts;
-            myFileinfo.accessTime = ts;
-            myFileinfo.modificationTime = ts;
+            wanted = fileSize - contentOffset;
         }
-        // else leave the times at 0 on failure
-        
-        pMyFileinfo = &myFileinfo;
+        int returnVal = gdrive_file_read(pBody->pFile, buffer + copied, 
+                                         wanted, contentOffset);
+        if (returnVal <= 0)
+        {
+            // Error, or the contents ended before the file's size
+            return (size_t)(-1);
+        }
+        // Pick up from here (whether more contents or the closing framing)
+        // next time.
+        return copied + returnVal;
     }
     
-    
-    // Set up the file resource as a JSON object
-    Gdrive_Json_Object* uploadResourceJson = gdrive_json_new();
-    if (uploadResourceJson == NULL)
+    // Closing multipart framing
+    if (copied < size && contentOffset - fileSize < pBody->suffixLength)
     {
-        *pError = ENOMEM;
-        return NULL;
+        size_t suffixOffset = contentOffset - fileSize;
+        size_t length = pBody->suffixLength - suffixOffset;
+        if (length > size - copied)
+        {
+            length = size - copied;
+        }
+        memcpy(buffer + copied, pBody->suffix + suffixOffset, length);
+        copied += length;
     }
-    gdrive_json_add_string(uploadResourceJson, "title", pMyFileinfo->filename);
-    if (pFileinfo == NULL)
-    {
-        // Only set parents when creating a new file
+    return copied;
+}
+
+/*
+ * Adds the access and modification times to a JSON file resource. On success,
+ * *pHasMtime says whether the modification time was added. Returns 0 on 
+ * success or ENOMEM.
+ */
+static int gdrive_file_add_times_json(Gdrive_Json_Object* pObj, 
+                                      Gdrive_Fileinfo* pFileinfo, 
+                                      bool* pHasMtime)
+{
+    char* timeString = malloc(GDRIVE_TIMESTRING_LENGTH);
+    if (timeString == NULL)
+    {
+        // Memory error
+        return ENOMEM;
+    }
+    // Reuse the same timeString for atime and mtime. Can't change ctime.
+    if (gdrive_finfo_get_atime_string(pFileinfo, timeString, 
+                                      GDRIVE_TIMESTRING_LENGTH) 
+            != 0)
+    {
+        gdrive_json_add_string(pObj, "lastViewedByMeDate", timeString);
+    }
+    *pHasMtime = false;
+    if (gdrive_finfo_get_mtime_string(pFileinfo, timeString, 
+                                      GDRIVE_TIMESTRING_LENGTH) 
+            != 0)
+    {
+        gdrive_json_add_string(pObj, "modifiedDate", timeString);
+        *pHasMtime = true;
+    }
+    free(timeString);
+    return 0;
+}
+
+/*
+ * Builds everything in a multipart upload that comes before the file's 
+ * contents: the metadata part holding the changed timestamps, and the headers
+ * of the contents part. Returns NULL on memory error. The caller is 
+ * responsible for freeing the returned string.
+ */
+static char* gdrive_file_multipart_prefix(Gdrive_Fileinfo* pFileinfo, 
+                                          bool* pHasMtime)
+{
+    Gdrive_Json_Object* pObj = gdrive_json_new();
+    if (pObj == NULL)
+    {
+        return NULL;
+    }
+    char* metadata = NULL;
+    if (gdrive_file_add_times_json(pObj, pFileinfo, pHasMtime) == 0)
+    {
+        metadata = gdrive_json_to_new_string(pObj, false);
+    }
+    gdrive_json_kill(pObj);
+    if (metadata == NULL)
+    {
+        return NULL;
+    }
+    
+    const char* fmtStr = "--" GDRIVE_MULTIPART_BOUNDARY "\r\n"
+                         "Content-Type: application/json; charset=UTF-8\r\n"
+                         "\r\n"
+                         "%s\r\n"
+                         "--" GDRIVE_MULTIPART_BOUNDARY "\r\n"
+                         "Content-Type: application/octet-stream\r\n"
+                         "\r\n";
+    size_t length = snprintf(NULL, 0, fmtStr, metadata);
+    char* prefix = malloc(length + 1);
+    if (prefix != NULL)
+    {
+        snprintf(prefix, length + 1, fmtStr, metadata);
+    }
+    free(metadata);
+    return prefix;
+}
+
+static Gdrive_Data_Journal* gdrive_cnode_get_journal(Gdrive_Cache_Node* pNode)
+{
+    if (pNode->pJournal != NULL || !gdrive_dj_enabled())
+    {
+        // Either already open, or not in use
+        return pNode->pJournal;
+    }
+    
+    pNode->pJournal = gdrive_dj_open(pNode->fileinfo.id, false);
+    if (pNode->pJournal == NULL)
+    {
+        // Carry on without it. Changes will still be uploaded as usual, they
+        // just won't survive a crash.
+        return NULL;
+    }
+    
+    // If Google Drive doesn't know about the file yet, remember where it 
+    // belongs.
+    const char* parentId;
+    const char* title;
+    if (gdrive_nsj_get_pending_create(pNode->fileinfo.id, &parentId, &title))
+    {
+        gdrive_dj_add_create(pNode->pJournal, parentId, title, 
+                             pNode->fileinfo.type == GDRIVE_FILETYPE_FOLDER);
+    }
+    return pNode->pJournal;
+}
+
+static Gdrive_Data_Journal* 
+gdrive_cnode_get_data_journal(Gdrive_Cache_Node* pNode)
+{
+    Gdrive_Data_Journal* pJournal = gdrive_cnode_get_journal(pNode);
+    if (pJournal == NULL || pNode->journalHasData)
+    {
+        return pJournal;
+    }
+    
+    // First data change. Record every chunk we have, since any of them may 
+    // end up holding changed data. Chunks created after this are recorded as
+    // they're created.
+    if (gdrive_fcontents_journal_all(pNode->pContents, pJournal) != 0 || 
+            gdrive_dj_add_size(pJournal, pNode->fileinfo.size) != 0)
+    {
+        // The log is incomplete and can't be trusted.
+        gdrive_dj_close(pJournal, true);
+        pNode->pJournal = NULL;
+        return NULL;
+    }
+    pNode->journalHasData = true;
+    return pJournal;
+}
+
+static void gdrive_cnode_settle_journal(Gdrive_Cache_Node* pNode)
+{
+    if (pNode->pJournal != NULL && !pNode->dirty && 
+            !pNode->fileinfo.dirtyMetainfo)
+    {
+        // Everything has been uploaded, the record is no longer needed.
+        gdrive_dj_close(pNode->pJournal, true);
+        pNode->pJournal = NULL;
+        pNode->journalHasData = false;
+    }
+}
+
+static void gdrive_cnode_park_journal(Gdrive_Cache_Node* pNode)
+{
+    if (gdrive_cnode_isdeleted(pNode))
+    {
+        // Nobody can open the file again, so there's nothing to retry.
+        gdrive_dj_close(pNode->pJournal, true);
+    }
+    else
+    {
+        // Make sure everything is on disk, then let go of it without deleting
+        // anything.
+        gdrive_fcontents_persist(pNode->pContents);
+        gdrive_dj_persist(pNode->pJournal);
+        gdrive_fcontents_release_all(&(pNode->pContents));
+        gdrive_dj_close(pNode->pJournal, false);
+        
+        // The cached information no longer matches Google Drive. Let the next
+        // cache update replace it.
+        pNode->lastUpdateTime = 0;
+    }
+    pNode->pJournal = NULL;
+    pNode->journalHasData = false;
+    pNode->dirty = false;
+    pNode->fileinfo.dirtyMetainfo = false;
+}
+
+static Gdrive_Sync_State* gdrive_cnode_get_syncstate(void)
+{
+    static Gdrive_Sync_State state = {0};
+    return &state;
+}
+
+/*
+ * Handles a request to upload a file's contents from fsync, or from closing a
+ * handle while other writers remain, according to the sync policy.
+ */
+static int gdrive_cnode_request_sync(Gdrive_Cache_Node* pNode)
+{
+    if (!pNode->dirty)
+    {
+        // No contents to upload. Changed timestamps are sent when the last
+        // writer closes the file, but keep them safe on disk until then.
+        return gdrive_cnode_persist_local(pNode);
+    }
+    
+    gdrive_cnode_get_syncstate()->stats.syncRequests++;
+    
+    enum Gdrive_Sync_Policy policy = gdrive_get_syncpolicy();
+    if (policy == GDRIVE_SYNC_STRICT && gdrive_dj_enabled())
+    {
+        // The file is uploaded whenever a writer closes it. Until then, it's
+        // enough for the changes to be safe in the cache directory.
+        if (gdrive_cnode_persist_local(pNode) == 0)
+        {
+            return 0;
+        }
+        // Couldn't keep the changes safe on disk, so upload them instead.
+        return gdrive_file_sync(pNode);
+    }
+    bool uploadNow = (policy == GDRIVE_SYNC_STRICT) || 
+        (policy == GDRIVE_SYNC_COALESCE && 
+            time(NULL) - pNode->lastUploadTime >= gdrive_get_syncwindow());
+    if (!uploadNow && gdrive_cnode_persist_local(pNode) != 0)
+    {
+        // Couldn't keep the changes safe on disk, so don't leave them waiting.
+        uploadNow = true;
+    }
+    
+    if (uploadNow)
+    {
+        return gdrive_file_sync(pNode);
+    }
+    
+    gdrive_cnode_defer_upload(pNode);
+    return 0;
+}
+
+/*
+ * Flushes a file's unuploaded changes and its journal to the cache directory.
+ * Does nothing (successfully) if there is no cache directory.
+ */
+static int gdrive_cnode_persist_local(Gdrive_Cache_Node* pNode)
+{
+    if (!gdrive_dj_enabled() || 
+            (!pNode->dirty && !pNode->fileinfo.dirtyMetainfo))
+    {
+        // Nothing to do
+        return 0;
+    }
+    
+    Gdrive_Data_Journal* pJournal = pNode->dirty ? 
+        gdrive_cnode_get_data_journal(pNode) : 
+        gdrive_cnode_get_journal(pNode);
+    if (pJournal == NULL)
+    {
+        // Couldn't record the changes on disk
+        return -EIO;
+    }
+    
+    int returnVal = gdrive_fcontents_persist(pNode->pContents);
+    if (returnVal == 0)
+    {
+        returnVal = gdrive_dj_persist(pJournal);
+    }
+    return returnVal;
+}
+
+static void gdrive_cnode_defer_upload(Gdrive_Cache_Node* pNode)
+{
+    if (pNode->uploadDeferred)
+    {
+        // Already waiting
+        return;
+    }
+    
+    Gdrive_Sync_State* pState = gdrive_cnode_get_syncstate();
+    pNode->pNextDeferred = pState->pDeferred;
+    pState->pDeferred = pNode;
+    pNode->uploadDeferred = true;
+    pNode->deferredSince = time(NULL);
+}
+
+static void gdrive_cnode_undefer_upload(Gdrive_Cache_Node* pNode)
+{
+    if (!pNode->uploadDeferred)
+    {
+        // Not in the list
+        return;
+    }
+    
+    Gdrive_Cache_Node** ppNode = &(gdrive_cnode_get_syncstate()->pDeferred);
+    while (*ppNode != pNode)
+    {
+        assert(*ppNode != NULL);
+        ppNode = &((*ppNode)->pNextDeferred);
+    }
+    *ppNode = pNode->pNextDeferred;
+    pNode->pNextDeferred = NULL;
+    pNode->uploadDeferred = false;
+}
+
+/*
+ * Returns true if a deferred node's upload or timestamp update should be sent
+ * now. If all is true, everything is due.
+ */
+static bool gdrive_cnode_sync_is_due(const Gdrive_Cache_Node* pNode, bool all,
+                                     time_t now)
+{
+    // Contents only wait on a timer with the coalesce policy (otherwise they
+    // wait for the last writer to close the file). Timestamps on their own
+    // always do.
+    time_t window = gdrive_get_syncwindow();
+    return all || (pNode->dirty ? 
+        (gdrive_get_syncpolicy() == GDRIVE_SYNC_COALESCE && 
+            now - pNode->lastUploadTime >= window) : 
+        (now - pNode->deferredSince >= window));
+}
+
+/*
+ * Updates a file's access time, if the atime policy calls for it, when the 
+ * file is opened for reading. The change is sent to Google Drive lazily.
+ */
+static void gdrive_cnode_touch_atime(Gdrive_Cache_Node* pNode)
+{
+    enum Gdrive_Atime_Policy policy = gdrive_get_atimepolicy();
+    if (policy == GDRIVE_ATIME_NOATIME || 
+            !gdrive_file_check_perm(pNode, O_RDWR))
+    {
+        // Not wanted, or not allowed
+        return;
+    }
+    
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) != 0)
+    {
+        return;
+    }
+    
+    const struct timespec* pAtime = &(pNode->fileinfo.accessTime);
+    if (policy == GDRIVE_ATIME_RELATIME)
+    {
+        // Like the relatime mount option: Only update if the file has been 
+        // modified since it was last accessed, or the last access was at 
+        // least a day ago.
+        const struct timespec* pMtime = &(pNode->fileinfo.modificationTime);
+        bool olderThanMtime = (pAtime->tv_sec < pMtime->tv_sec) || 
+            (pAtime->tv_sec == pMtime->tv_sec && 
+            pAtime->tv_nsec <= pMtime->tv_nsec);
+        if (!olderThanMtime && now.tv_sec - pAtime->tv_sec < 24 * 60 * 60)
+        {
+            return;
+        }
+    }
+    
+    gdrive_finfo_set_atime(&(pNode->fileinfo), &now);
+    gdrive_dj_add_times(gdrive_cnode_get_journal(pNode), NULL, pAtime);
+    gdrive_cnode_defer_upload(pNode);
+}
+
+static int gdrive_cnode_load_journal(Gdrive_Cache_Node* pNode)
+{
+    Gdrive_Dj_State state;
+    int returnVal = gdrive_dj_read(pNode->fileinfo.id, &state);
+    if (returnVal != 0)
+    {
+        return returnVal;
+    }
+    
+    // Anything already cached is from Google Drive and is older than the 
+    // saved changes.
+    gdrive_fcontents_free_all(&(pNode->pContents));
+    for (int i = 0; i < state.nChunks; i++)
+    {
+        Gdrive_File_Contents* pContents = 
+                gdrive_fcontents_add_existing(pNode->pContents, 
+                                              state.chunkPaths[i], 
+                                              state.chunkStarts[i]);
+        if (pContents == NULL)
+        {
+            // A missing chunk means the saved data is incomplete. Don't 
+            // upload half of it.
+            gdrive_fcontents_release_all(&(pNode->pContents));
+            gdrive_dj_state_cleanup(&state);
+            return -EIO;
+        }
+        if (pNode->pContents == NULL)
+        {
+            pNode->pContents = pContents;
+        }
+    }
+    
+    pNode->pJournal = gdrive_dj_open(pNode->fileinfo.id, true);
+    if (pNode->pJournal == NULL)
+    {
+        gdrive_fcontents_release_all(&(pNode->pContents));
+        gdrive_dj_state_cleanup(&state);
+        return -EIO;
+    }
+    if (state.nChunks > 0 || state.hasSize)
+    {
+        pNode->journalHasData = true;
+        pNode->dirty = true;
+        if (state.hasSize)
+        {
+            pNode->fileinfo.size = state.size;
+        }
+    }
+    if (state.hasMtime)
+    {
+        pNode->fileinfo.modificationTime = state.mtime;
+        pNode->fileinfo.dirtyMetainfo = true;
+    }
+    if (state.hasAtime)
+    {
+        pNode->fileinfo.accessTime = state.atime;
+        pNode->fileinfo.dirtyMetainfo = true;
+    }
+    
+    gdrive_dj_state_cleanup(&state);
+    return 0;
+}
+
+static char* gdrive_file_get_new_parent(Gdrive_Path* pGpath, int* pError)
+{
+    const char* folderName = gdrive_path_get_dirname(pGpath);
+    const char* filename = gdrive_path_get_basename(pGpath);
+    
+    // Check basename for validity (non-NULL, not a directory link such as "..")
+    if (filename == NULL || filename[0] == '/' || 
+            strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
+    {
+        *pError = EISDIR;
+        return NULL;
+    }
+    
+    // Check folder for validity (non-NULL, starts with '/', and is an existing
+    // folder)
+    if (folderName == NULL || folderName[0] != '/')
+    {
+        // Path wasn't in the form of an absolute path
+        *pError = ENOTDIR;
+        return NULL;
+    }
+    char* parentId = gdrive_filepath_to_id(folderName);
+    if (parentId == NULL)
+    {
+        // Folder doesn't exist
+        *pError = ENOTDIR;
+        return NULL;
+    }
+    Gdrive_Cache_Node* pFolderNode = 
+            gdrive_cache_get_node(parentId, true, NULL);
+    if (pFolderNode == NULL)
+    {
+        // Couldn't get a node for the parent folder
+        *pError = EIO;
+        free(parentId);
+        return NULL;
+    }
+    const Gdrive_Fileinfo* pFolderinfo = gdrive_cnode_get_fileinfo(pFolderNode);
+    if (pFolderinfo == NULL || pFolderinfo->type != GDRIVE_FILETYPE_FOLDER)
+    {
+        // Not an actual folder
+        *pError = ENOTDIR;
+        free(parentId);
+        return NULL;
+    }
+    
+    // Make sure we have write access to the folder
+    if (!gdrive_file_check_perm(pFolderNode, O_WRONLY))
+    {
+        // Don't have the needed permission
+        *pError = EACCES;
+        free(parentId);
+        return NULL;
+    }
+    
+    return parentId;
+}
+
+static char* gdrive_file_new_writebehind(const char* parentId, 
+                                         const char* filename, bool isFolder)
+{
+    char* fileId = gdrive_idpool_get();
+    if (fileId == NULL)
+    {
+        // No reserved IDs available
+        return NULL;
+    }
+    
+    if (gdrive_cache_add_new_item(fileId, filename, isFolder) == NULL)
+    {
+        // Memory error
+        free(fileId);
+        return NULL;
+    }
+    if (gdrive_nsj_add_create(fileId, parentId, filename, isFolder) != 0)
+    {
+        // Memory error. Forget the cache entry we just made.
+        gdrive_cache_delete_id(fileId);
+        free(fileId);
+        return NULL;
+    }
+    
+    // The parent folder now has one more child. Look the folder up again
+    // rather than reusing an earlier pointer, because queueing the creation 
+    // may have committed older changes and refreshed parts of the cache.
+    Gdrive_Cache_Node* pParentNode = 
+            gdrive_cache_get_node(parentId, false, NULL);
+    Gdrive_Fileinfo* pParentinfo = (pParentNode != NULL) ? 
+        gdrive_cnode_get_fileinfo(pParentNode) : NULL;
+    if (pParentinfo != NULL && pParentinfo->nChildren >= 0)
+    {
+        pParentinfo->nChildren++;
+    }
+    
+    return fileId;
+}
+
+/*
+ * Builds, but doesn't send, the request used by 
+ * gdrive_file_sync_metadata_or_create(), which has the same parameters. On
+ * failure, returns NULL and stores an error number at pError.
+ */
+static Gdrive_Transfer* gdrive_file_metadata_xfer(Gdrive_Fileinfo* pFileinfo, 
+                                                  const char* newFileId, 
+                                                  const char* parentId, 
+                                                  const char* filename, 
+                                                  bool isFolder, int* pError)
+{
+    // For existing file, pFileinfo must be non-NULL. For creating new file,
+    // both parentId and filename must be non-NULL.
+    assert(pFileinfo || (parentId && filename));
+    
+    Gdrive_Fileinfo myFileinfo = {0};
+    Gdrive_Fileinfo* pMyFileinfo;
+    if (pFileinfo != NULL)
+    {
+        pMyFileinfo = pFileinfo;
+        isFolder = (pMyFileinfo->type == GDRIVE_FILETYPE_FOLDER);
+    }
+    else
+    {
+        // We won't change anything, but need to cast away the const to make
+        // this assignment.
+        myFileinfo.filename = (char*) filename;
+        myFileinfo.type = isFolder ? 
+            GDRIVE_FILETYPE_FOLDER : GDRIVE_FILETYPE_FILE;
+        struct timespec ts;
+        if (clock_gettime(CLOCK_REALTIME, &ts) == 0)
+        {
+            myFileinfo.creationTime = ts;
+            myFileinfo.accessTime = ts;
+            myFileinfo.modificationTime = ts;
+        }
+        // else leave the times at 0 on failure
+        
+        pMyFileinfo = &myFileinfo;
+    }
+    
+    
+    // Set up the file resource as a JSON object
+    Gdrive_Json_Object* uploadResourceJson = gdrive_json_new();
+    if (uploadResourceJson == NULL)
+    {
+        *pError = ENOMEM;
+        return NULL;
+    }
+    gdrive_json_add_string(uploadResourceJson, "title", pMyFileinfo->filename);
+    if (pFileinfo == NULL && newFileId != NULL)
+    {
+        // Creating a new file with an ID reserved ahead of time
+        gdrive_json_add_string(uploadResourceJson, "id", newFileId);
+    }
+    if (pFileinfo == NULL)
+    {
+        // Only set parents when creating a new file
         Gdrive_Json_Object* parentsArray = 
                 gdrive_json_add_new_array(uploadResourceJson, "parents");
         if (parentsArray == NULL)
@@ -1309,34 +2635,15 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
                                "application/vnd.google-apps.folder"
                 );
     }
-    char* timeString = malloc(GDRIVE_TIMESTRING_LENGTH);
-    if (timeString == NULL)
+    bool hasMtime = false;
+    if (gdrive_file_add_times_json(uploadResourceJson, pMyFileinfo, 
+                                   &hasMtime) != 0)
     {
         // Memory error
         gdrive_json_kill(uploadResourceJson);
         *pError = ENOMEM;
         return NULL;
     }
-    // Reuse the same timeString for atime and mtime. Can't change ctime.
-    if (gdrive_finfo_get_atime_string(pMyFileinfo, timeString, 
-                                      GDRIVE_TIMESTRING_LENGTH) 
-            != 0)
-    {
-        gdrive_json_add_string(uploadResourceJson, 
-                               "lastViewedByMeDate", 
-                               timeString
-                );
-    }
-    bool hasMtime = false;
-    if (gdrive_finfo_get_mtime_string(pMyFileinfo, timeString, 
-                                      GDRIVE_TIMESTRING_LENGTH) 
-            != 0)
-    {
-        gdrive_json_add_string(uploadResourceJson, "modifiedDate", timeString);
-        hasMtime = true;
-    }
-    free(timeString);
-    timeString = NULL;
     
     // Convert the JSON into a string
     char* uploadResourceStr = 
@@ -1349,37 +2656,6 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
     }
     
     
-    // Full URL has '/' and the file ID appended for an existing file, or just
-    // the base URL for a new one.
-    char* url;
-    if (pFileinfo == NULL)
-    {
-        // New file, just need the base URL
-        size_t urlSize = strlen(GDRIVE_URL_FILES) + 1;
-        url = malloc(urlSize);
-        if (url == NULL)
-        {
-            *pError = ENOMEM;
-            return NULL;
-        }
-        strncpy(url, GDRIVE_URL_FILES, urlSize);
-    }
-    else
-    {
-        // Existing file, need base URL + '/' + file ID
-        size_t baseUrlLength = strlen(GDRIVE_URL_FILES);
-        size_t fileIdLength = strlen(pMyFileinfo->id);
-        url = malloc(baseUrlLength + fileIdLength + 2);
-        if (url == NULL)
-        {
-            *pError = ENOMEM;
-            return NULL;
-        }
-        strncpy(url, GDRIVE_URL_FILES, baseUrlLength);
-        url[baseUrlLength] = '/';
-        strncpy(url + baseUrlLength + 1, pMyFileinfo->id, fileIdLength + 1);
-    }
-    
     // Set up the network request
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
     if (pTransfer == NULL)
@@ -1392,34 +2668,53 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
     // URL, header, and updateViewedDate query parameter always get added. The 
     // setModifiedDate query parameter only gets set when hasMtime is true. Any 
     // of these can fail with an out of memory error (returning non-zero).
-    if ((gdrive_xfer_set_url(pTransfer, url) || 
+    // Full URL has '/' and the file ID appended for an existing file, or just
+    // the base URL for a new one.
+    if ((gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_FILES, 
+                                  (pFileinfo != NULL) ? pMyFileinfo->id : NULL,
+                                  NULL) || 
             gdrive_xfer_add_header(pTransfer, "Content-Type: application/json"))
             || 
             (hasMtime && 
             gdrive_xfer_add_query(pTransfer, "setModifiedDate", "true")) || 
-            gdrive_xfer_add_query(pTransfer, "updateViewedDate", "false")
+            gdrive_xfer_add_query(pTransfer, "updateViewedDate", "false") || 
+            gdrive_xfer_copy_body(pTransfer, uploadResourceStr)
         )
     {
         *pError = ENOMEM;
         gdrive_xfer_free(pTransfer);
         free(uploadResourceStr);
-        free(url);
         return NULL;
     }
-    free(url);
+    free(uploadResourceStr);
     gdrive_xfer_set_requesttype(pTransfer, (pFileinfo != NULL) ? 
         GDRIVE_REQUEST_PATCH : GDRIVE_REQUEST_POST);
-    gdrive_xfer_set_body(pTransfer, uploadResourceStr);
+    return pTransfer;
+}
+    
+
+static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo, 
+                                                 const char* newFileId, 
+                                                 const char* parentId, 
+                                                 const char* filename, 
+                                                 bool isFolder, int* pError)
+{
+    Gdrive_Transfer* pTransfer = 
+            gdrive_file_metadata_xfer(pFileinfo, newFileId, parentId, 
+                                      filename, isFolder, pError);
+    if (pTransfer == NULL)
+    {
+        return NULL;
+    }
     
     // Do the transfer
     Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
     gdrive_xfer_free(pTransfer);
-    free(uploadResourceStr);
     
     if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
     {
         // Transfer was unsuccessful
-        *pError = EIO;
+        *pError = -gdrive_request_error(pBuf);
         gdrive_dlbuf_free(pBuf);
         return NULL;
     }
@@ -1435,6 +2730,7 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         *pError = ENOMEM;
         return NULL;
     }
+    gdrive_idx_update_from_json(pObj);
     char* fileId = gdrive_json_get_new_string(pObj, "id", NULL);
     gdrive_json_kill(pObj);
     if (fileId == NULL)
@@ -1445,9 +2741,105 @@ static char* gdrive_file_sync_metadata_or_create(Gdrive_Fileinfo* pFileinfo,
         return NULL;
     }
     
-    pMyFileinfo->dirtyMetainfo = false;
+    if (pFileinfo != NULL)
+    {
+        pFileinfo->dirtyMetainfo = false;
+    }
     return fileId;
 }
 
+/*
+ * Bookkeeping after a file's changed timestamps have reached Google Drive.
+ */
+static void gdrive_file_metadata_synced(Gdrive_Cache_Node* pNode)
+{
+    pNode->fileinfo.dirtyMetainfo = false;
+    gdrive_cnode_settle_journal(pNode);
+    if (!pNode->dirty)
+    {
+        // Nothing left waiting
+        gdrive_cnode_undefer_upload(pNode);
+    }
+    gdrive_cnode_get_syncstate()->stats.metadataUpdates++;
+}
+
+/*
+ * The same as calling gdrive_file_sync_metadata() on each of nNodes nodes
+ * (no more than GDRIVE_XFER_BATCH_MAX), but sends all of the requests in a 
+ * single batch. Returns 0 if all succeeded, or the last error number.
+ */
+static int gdrive_file_sync_metadata_batch(Gdrive_Cache_Node** pNodes, 
+                                           int nNodes)
+{
+    if (nNodes == 1)
+    {
+        // Nothing to gain from a batch
+        return gdrive_file_sync_metadata(pNodes[0]);
+    }
+    
+    Gdrive_Xfer_Batch* pBatch = gdrive_xfer_batch_create();
+    if (pBatch == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+    int returnVal = 0;
+    int indices[GDRIVE_XFER_BATCH_MAX];
+    for (int i = 0; i < nNodes; i++)
+    {
+        Gdrive_Fileinfo* pFileinfo = &(pNodes[i]->fileinfo);
+        indices[i] = -1;
+        if (!pFileinfo->dirtyMetainfo)
+        {
+            // Nothing to sync
+            continue;
+        }
+        if (!gdrive_file_check_perm(pNodes[i], O_RDWR))
+        {
+            returnVal = -EACCES;
+            continue;
+        }
+        
+        // The file has to exist on Google Drive before we can change it.
+        if (gdrive_nsj_commit_for(pFileinfo->id) != 0)
+        {
+            returnVal = -EIO;
+            continue;
+        }
+        
+        int error = 0;
+        Gdrive_Transfer* pTransfer = 
+                gdrive_file_metadata_xfer(pFileinfo, NULL, NULL, NULL, 
+                                          (pFileinfo->type == 
+                                          GDRIVE_FILETYPE_FOLDER), 
+                                          &error);
+        indices[i] = gdrive_xfer_batch_add(pBatch, pTransfer);
+        if (indices[i] < 0)
+        {
+            returnVal = (error != 0) ? -error : -ENOMEM;
+        }
+    }
+    
+    gdrive_xfer_batch_execute(pBatch);
+    for (int i = 0; i < nNodes; i++)
+    {
+        if (indices[i] < 0)
+        {
+            continue;
+        }
+        Gdrive_Download_Buffer* pBuf = 
+                gdrive_xfer_batch_get_response(pBatch, indices[i]);
+        if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+        {
+            // Transfer was unsuccessful
+            returnVal = -EIO;
+            continue;
+        }
+        gdrive_file_metadata_synced(pNodes[i]);
+    }
+    gdrive_xfer_batch_free(pBatch);
+    return returnVal;
+}
+
 
 
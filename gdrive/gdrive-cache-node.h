@@ -66,6 +66,32 @@ Gdrive_Cache_Node* gdrive_cnode_get(Gdrive_Cache_Node* pParent,
                                     const char* fileId, bool addIfDoesntExist, 
                                     bool* pAlreadyExists);
 
+/*
+ * gdrive_cnode_insert_new():   Adds a node for a file or folder that has just
+ *                              been created locally, filling in its 
+ *                              information without contacting Google Drive.
+ *                              The new item is treated as owned by the user,
+ *                              with a size of 0 and the current time for all
+ *                              its timestamps.
+ * Parameters:
+ *      ppRoot (Gdrive_Cache_Node**):
+ *              The address of a pointer to the root node. This pointer may be
+ *              changed.
+ *      fileId (const char*):
+ *              The Google Drive file ID of the new item. This is copied.
+ *      filename (const char*):
+ *              The basename of the new item. This is copied.
+ *      isFolder (bool):
+ *              True for a folder, false for a regular file.
+ * Return value (Gdrive_Cache_Node*):
+ *      A pointer to the new node, or to the existing node if fileId was already
+ *      in the cache. NULL on failure.
+ */
+Gdrive_Cache_Node* gdrive_cnode_insert_new(Gdrive_Cache_Node** ppRoot, 
+                                           const char* fileId, 
+                                           const char* filename, 
+                                           bool isFolder);
+
 /*
  *  gdrive_cnode_delete():  Deletes a node and safely frees its memory, 
  *                          preserving the structure of the remaining nodes.
@@ -146,6 +172,22 @@ enum Gdrive_Filetype gdrive_cnode_get_filetype(Gdrive_Cache_Node* pNode);
  */
 Gdrive_Fileinfo* gdrive_cnode_get_fileinfo(Gdrive_Cache_Node* pNode);
 
+/*
+ * gdrive_cnode_get_count():    Retrieve the number of cache nodes that exist.
+ * Return value (size_t):
+ *      The number of nodes.
+ */
+size_t gdrive_cnode_get_count(void);
+
+/*
+ * gdrive_cnode_get_bytes():    Estimate the memory used by all cache nodes. 
+ *                              The estimate assumes an average size for each
+ *                              node's strings rather than measuring them.
+ * Return value (size_t):
+ *      The approximate number of bytes.
+ */
+size_t gdrive_cnode_get_bytes(void);
+
 
 /*************************************************************************
  * Other accessible functions
@@ -194,6 +236,71 @@ void gdrive_cnode_delete_file_contents(Gdrive_Cache_Node* pNode,
  */
 bool gdrive_cnode_is_dirty(const Gdrive_Cache_Node* pNode);
 
+/*
+ * gdrive_cnode_evict():    Removes up to count nodes from the tree, choosing
+ *                          ones that haven't been looked up recently. Nodes
+ *                          for files that are open, have changes that haven't
+ *                          been uploaded, or are waiting to be created are 
+ *                          never removed, and neither is any node that was 
+ *                          looked up since the previous call.
+ * Parameters:
+ *      ppRoot (Gdrive_Cache_Node**):
+ *              The address of a pointer to the root node. The pointer at this
+ *              location may be changed to point to a different memory location.
+ *      count (size_t):
+ *              The most nodes to remove.
+ * Return value (size_t):
+ *      The number of nodes removed, which may be less than count.
+ */
+size_t gdrive_cnode_evict(Gdrive_Cache_Node** ppRoot, size_t count);
+
+/*
+ * gdrive_file_create_remote(): Creates a file or folder on Google Drive using
+ *                              an ID reserved in advance, without touching the
+ *                              cache. Used to commit queued creations.
+ * Parameters:
+ *      fileId (const char*):
+ *              The reserved file ID to give the new item.
+ *      parentId (const char*):
+ *              The file ID of the folder to create the item in.
+ *      filename (const char*):
+ *              The basename of the new item.
+ *      isFolder (bool):
+ *              True to create a folder, false to create a regular file.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_file_create_remote(const char* fileId, const char* parentId, 
+                              const char* filename, bool isFolder);
+
+/*
+ * gdrive_file_recover():   Uploads changes to a file that were saved in the
+ *                          cache directory but never uploaded, creating the
+ *                          file first if needed. Used by gdrive_dj_recover().
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file.
+ * Return value (int):
+ *      0 if everything was uploaded, or a negative error number if the 
+ *      changes are still waiting.
+ */
+int gdrive_file_recover(const char* fileId);
+
+/*
+ * gdrive_file_sync_due():  Uploads any files whose uploads (of contents, or of
+ *                          changed timestamps alone) were put off and are now
+ *                          due. Files that fail to upload stay in line for the
+ *                          next call.
+ * Parameters:
+ *      all (bool):
+ *              If true, upload everything that is waiting, whether it is due
+ *              or not.
+ * Return value (int):
+ *      0 if every due upload succeeded, or a negative error number if any 
+ *      failed.
+ */
+int gdrive_file_sync_due(bool all);
+
 
 #ifdef	__cplusplus
 }
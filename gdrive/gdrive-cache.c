@@ -1,10 +1,29 @@
 
 #include "gdrive-cache.h"
+#include "gdrive-ns-journal.h"
+#include "gdrive-index.h"
+#include "gdrive-negcache.h"
+#include "gdrive-json-stream.h"
+#include "gdrive-breaker.h"
 
 #include <string.h>
 #include <assert.h>
 
 
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+// How often (in seconds) the memory pressure is checked, at most
+#define GDRIVE_CACHE_PRESSURE_INTERVAL 5
+
+// The "some avg10" memory pressure (the percentage of the last 10 seconds in
+// which at least one task was stalled waiting for memory) above which the
+// caches are shrunk
+#define GDRIVE_CACHE_PRESSURE_THRESHOLD 10.0
+
+#define GDRIVE_CACHE_SYSTEM_PRESSURE "/proc/pressure/memory"
+
 
 /*************************************************************************
  * Private struct and declarations of private functions for use within 
@@ -18,12 +37,64 @@ typedef struct Gdrive_Cache
     int64_t nextChangeId;
     Gdrive_Cache_Node* pCacheHead;
     Gdrive_Fileid_Cache_Node* pFileIdCacheHead; 
+    // lastTrimTime: When the cache sizes were last checked against the limits
+    time_t lastTrimTime;
+    // lastPressureCheck: When the memory pressure was last read, from 
+    // pressurePath. noPressureFile is true if there's nothing to read it from.
+    time_t lastPressureCheck;
+    char* pressurePath;
+    bool noPressureFile;
+    // Totals for the memory report
+    unsigned long nEvicted;
+    unsigned long nPressureTrims;
+    // pRefresh: The request for the list of changes that's running in the 
+    // background while expired entries are used (see gdrive_set_stalegrace()),
+    // or NULL. refreshStarted is when its first page was asked for, and 
+    // refreshChangeId is the next change ID according to the pages so far.
+    Gdrive_Xfer_Async* pRefresh;
+    time_t refreshStarted;
+    int64_t refreshChangeId;
+    // Totals for the memory report
+    unsigned long nStaleServed;
+    unsigned long nRefreshes;
+    // nOutageServed: Expired entries used because Google Drive was failing
+    unsigned long nOutageServed;
 } Gdrive_Cache;
 
 static Gdrive_Cache* gdrive_cache_get_internal(void);
 
 static void gdrive_cache_remove_id(const char* fileId);
 
+static void gdrive_cache_trim(Gdrive_Cache* pCache);
+
+static size_t gdrive_cache_trim_target(size_t count, size_t maxCount);
+
+static bool gdrive_cache_under_pressure(Gdrive_Cache* pCache, time_t now);
+
+static char* gdrive_cache_find_pressure_file(void);
+
+static void gdrive_cache_apply_changes(Gdrive_Cache* pCache, 
+                                       Gdrive_Json_Object* pObj);
+
+static int gdrive_cache_apply_change(Gdrive_Json_Object* pItem, 
+                                     void* userdata);
+
+static Gdrive_Json_Object* 
+gdrive_cache_request_changes(const char* startChangeId, const char* pageToken,
+                             Gdrive_Json_Stream* pStream);
+
+static Gdrive_Transfer* 
+gdrive_cache_changes_xfer(const char* startChangeId, const char* pageToken);
+
+static bool gdrive_cache_revalidate(Gdrive_Cache* pCache, time_t expireTime);
+
+static bool gdrive_cache_start_refresh(Gdrive_Cache* pCache, 
+                                       const char* pageToken);
+
+static bool gdrive_cache_finish_refresh(Gdrive_Cache* pCache);
+
+static void gdrive_cache_cancel_refresh(Gdrive_Cache* pCache);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -110,6 +181,9 @@ void gdrive_cache_cleanup(void)
     pCache->pFileIdCacheHead = NULL;
     gdrive_cnode_free_all(pCache->pCacheHead);
     pCache->pCacheHead = NULL;
+    gdrive_cache_cancel_refresh(pCache);
+    free(pCache->pressurePath);
+    pCache->pressurePath = NULL;
 }
 
 
@@ -137,6 +211,11 @@ int64_t gdrive_cache_get_nextchangeid()
     return gdrive_cache_get()->nextChangeId;
 }
 
+void gdrive_cache_set_nextchangeid(int64_t changeId)
+{
+    gdrive_cache_get_internal()->nextChangeId = changeId;
+}
+
 
 /******************
  * Other accessible functions
@@ -157,6 +236,17 @@ int gdrive_cache_update()
 {
     Gdrive_Cache* pCache = gdrive_cache_get_internal();
     
+    // This covers anything a background refresh would have found.
+    gdrive_cache_cancel_refresh(pCache);
+    
+    // This is a good time to send any queued namespace changes that have 
+    // waited long enough, and sending them first means they show up in the
+    // list of changes.
+    gdrive_nsj_commit_due();
+    
+    // Likewise for file uploads and timestamp changes that were put off
+    gdrive_file_sync_due(false);
+    
     // Convert the numeric largest change ID into a string
     char* changeIdString = NULL;
     size_t changeIdStringLen = snprintf(NULL, 0, "%lu", pCache->nextChangeId);
@@ -170,132 +260,68 @@ int gdrive_cache_update()
             pCache->nextChangeId
             );
     
-    // Prepare the request, using the string change ID, and send it
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    if (pTransfer == NULL)
+    // Each change is applied as soon as it arrives, instead of holding the
+    // whole page first.
+    Gdrive_Json_Stream* pStream = 
+            gdrive_jstream_create("items", gdrive_cache_apply_change, pCache);
+    if (pStream == NULL)
     {
         // Memory error
         free(changeIdString);
         return -1;
     }
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
-    if (
-            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_CHANGES) || 
-            gdrive_xfer_add_query(pTransfer, "startChangeId", 
-                                  changeIdString) || 
-            gdrive_xfer_add_query(pTransfer, "includeSubscribed", "false")
-        )
-    {
-        // Error
-        free(changeIdString);
-        gdrive_xfer_free(pTransfer);
-    }
-    free(changeIdString);
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
     
-    
-    int returnVal = -1;
-    if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+    // Ask for every page of changes. Later pages are requested with the 
+    // token from the previous one instead of the change ID.
+    int returnVal = 0;
+    int64_t nextChangeId = pCache->nextChangeId;
+    char* pageToken = NULL;
+    do
     {
-        // Response was good, try extracting the data.
         Gdrive_Json_Object* pObj = 
-                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-        if (pObj != NULL)
+                gdrive_cache_request_changes(changeIdString, pageToken, 
+                                             pStream);
+        free(pageToken);
+        pageToken = NULL;
+        if (pObj == NULL)
         {
-            // Update or remove cached data for each item in the "items" array.
-            Gdrive_Json_Object* pChangeArray = 
-                    gdrive_json_get_nested_object(pObj, "items");
-            int arraySize = gdrive_json_array_length(pChangeArray, NULL);
-            for (int i = 0; i < arraySize; i++)
-            {
-                Gdrive_Json_Object* pItem = 
-                        gdrive_json_array_get(pChangeArray, NULL, i);
-                if (pItem == NULL)
-                {
-                    // Couldn't get this item, skip to the next one.
-                    continue;
-                }
-                char* fileId = 
-                        gdrive_json_get_new_string(pItem, "fileId", NULL);
-                if (fileId == NULL)
-                {
-                    // Couldn't get an ID for the changed file, skip to the
-                    // next one.
-                    continue;
-                }
-                
-                // We don't know whether the file has been renamed or moved,
-                // so remove it from the fileId cache.
-                gdrive_fidnode_remove_by_id(&pCache->pFileIdCacheHead, fileId);
-                
-                // Update the file metadata cache, but only if the file is not
-                // opened for writing with dirty data.
-                Gdrive_Cache_Node* pCacheNode = 
-                        gdrive_cnode_get(NULL,
-                                               &(pCache->pCacheHead), 
-                                               fileId, 
-                                               false, 
-                                               NULL
-                        );
-                if (pCacheNode != NULL && !gdrive_cnode_is_dirty(pCacheNode))
-                {
-                    // If this file was in the cache, update its information
-                    gdrive_cnode_update_from_json(
-                            pCacheNode, 
-                            gdrive_json_get_nested_object(pItem, "file")
-                            );
-                }
-                // else either not in the cache, or there is dirty data we don't
-                // want to overwrite.
-                
-                
-                // The file's parents may now have a different number of 
-                // children.  Remove the parents from the cache.
-                int numParents = 
-                        gdrive_json_array_length(pItem, "file/parents");
-                for (int nParent = 0; nParent < numParents; nParent++)
-                {
-                    // Get the fileId of the current parent in the array.
-                    char* parentId = NULL;
-                    Gdrive_Json_Object* pParentObj = 
-                            gdrive_json_array_get(pItem, "file/parents", 
-                                                  nParent);
-                    if (pParentObj != NULL)
-                    {
-                        parentId = gdrive_json_get_new_string(pParentObj, 
-                                                                "id", 
-                                                                NULL);
-                    }
-                    // Remove the parent from the cache, if present.
-                    if (parentId != NULL)
-                    {
-                        gdrive_cache_remove_id(parentId);
-                    }
-                    free(parentId);
-                }
-                
-                free(fileId);
-            }
-            
-            bool success = false;
-            int64_t nextChangeId = gdrive_json_get_int64(pObj, 
-                                                         "largestChangeId", 
-                                                         true, &success
-                    ) + 1;
-            if (success)
-            {
-                pCache->nextChangeId = nextChangeId;
-            }
-            returnVal = success ? 0 : -1;
-            gdrive_json_kill(pObj);
+            // Changes that were already applied will be applied again next
+            // time, which does no harm.
+            returnVal = -1;
+            break;
+        }
+        
+        bool success = false;
+        int64_t largestChangeId = gdrive_json_get_int64(pObj, 
+                                                        "largestChangeId", 
+                                                        true, &success
+                );
+        if (success)
+        {
+            nextChangeId = largestChangeId + 1;
         }
+        else
+        {
+            returnVal = -1;
+        }
+        pageToken = gdrive_json_get_new_string(pObj, "nextPageToken", NULL);
+        gdrive_json_kill(pObj);
+    } while (pageToken != NULL);
+    free(changeIdString);
+    gdrive_jstream_free(pStream);
+    
+    if (returnVal == 0)
+    {
+        pCache->nextChangeId = nextChangeId;
     }
     
     // Reset the last updated time
     pCache->lastUpdateTime = time(NULL);
     
-    gdrive_dlbuf_free(pBuf);
+    // Now that the changes have been applied, make sure the cache hasn't 
+    // outgrown its limits.
+    gdrive_cache_trim(pCache);
+    
     return returnVal;
 }
 
@@ -326,16 +352,21 @@ Gdrive_Fileinfo* gdrive_cache_get_item(const char* fileId,
     time_t nodeUpdated = gdrive_cnode_get_update_time(pNode);
     time_t expireTime = (nodeUpdated > cacheUpdated ? 
         nodeUpdated : cacheUpdated) + pCache->cacheTTL;
-    if (expireTime < time(NULL) || nodeUpdated == (time_t) 0)
+    if (nodeUpdated == (time_t) 0 || 
+            (expireTime < time(NULL) && 
+            gdrive_cache_revalidate(pCache, expireTime)))
     {
-        // Update the cache and try again.
+        // The cache was updated (or is being updated), try again.
         
         // Folder nodes may be deleted by cache updates, but regular file nodes
         // are safe.
         bool isFolder = (gdrive_cnode_get_filetype(pNode) == 
                 GDRIVE_FILETYPE_FOLDER);
         
-        gdrive_cache_update();
+        if (nodeUpdated == (time_t) 0)
+        {
+            gdrive_cache_update();
+        }
         
         return (isFolder ? 
                 gdrive_cache_get_item(fileId, addIfDoesntExist, 
@@ -343,7 +374,7 @@ Gdrive_Fileinfo* gdrive_cache_get_item(const char* fileId,
                 gdrive_cnode_get_fileinfo(pNode));
     }
     
-    // We have a good node that's not too old.
+    // We have a good node that's not too old (or is within the grace period).
     return gdrive_cnode_get_fileinfo(pNode);
 }
 
@@ -353,6 +384,52 @@ int gdrive_cache_add_fileid(const char* path, const char* fileId)
     return gdrive_fidnode_add(&(pCache->pFileIdCacheHead), path, fileId);
 }
 
+Gdrive_Fileinfo* gdrive_cache_add_new_item(const char* fileId, 
+                                           const char* filename, 
+                                           bool isFolder)
+{
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    Gdrive_Cache_Node* pNode = gdrive_cnode_insert_new(&(pCache->pCacheHead), 
+                                                       fileId, filename, 
+                                                       isFolder);
+    return (pNode != NULL) ? gdrive_cnode_get_fileinfo(pNode) : NULL;
+}
+
+Gdrive_Fileinfo* gdrive_cache_add_fileinfo(const Gdrive_Fileinfo* pFileinfo)
+{
+    assert(pFileinfo != NULL && pFileinfo->id != NULL && 
+            pFileinfo->filename != NULL);
+    
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    if (gdrive_cnode_get(NULL, &(pCache->pCacheHead), pFileinfo->id, false, 
+                         NULL) != NULL)
+    {
+        // Already cached, and the cached copy may have local changes.
+        return NULL;
+    }
+    
+    Gdrive_Cache_Node* pNode = gdrive_cnode_insert_new(
+            &(pCache->pCacheHead), pFileinfo->id, pFileinfo->filename, 
+            pFileinfo->type == GDRIVE_FILETYPE_FOLDER
+            );
+    if (pNode == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    
+    // Keep the node's own copies of the strings, and take everything else.
+    Gdrive_Fileinfo* pCached = gdrive_cnode_get_fileinfo(pNode);
+    char* id = pCached->id;
+    char* filename = pCached->filename;
+    *pCached = *pFileinfo;
+    pCached->id = id;
+    pCached->filename = filename;
+    pCached->dirtyMetainfo = false;
+    
+    return pCached;
+}
+
 Gdrive_Cache_Node* gdrive_cache_get_node(const char* fileId, 
                                          bool addIfDoesntExist, 
                                          bool* pAlreadyExists
@@ -385,16 +462,44 @@ char* gdrive_cache_get_fileid(const char* path)
     time_t cacheTTL = gdrive_cache_get_ttl(pCache);
     time_t expireTime = ((nodeUpdateTime > cacheUpdateTime) ? 
         nodeUpdateTime : cacheUpdateTime) + cacheTTL;
-    if (time(NULL) > expireTime)
+    if (time(NULL) > expireTime && gdrive_cache_revalidate(pCache, expireTime))
     {
         // Item is expired.  Check for updates and try again.
-        gdrive_cache_update(pCache);
         return gdrive_cache_get_fileid(path);
     }
     
     return gdrive_fidnode_get_fileid(pNode);
 }
 
+void gdrive_cache_remove_fileid(const char* fileId)
+{
+    assert(fileId != NULL);
+    
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    gdrive_fidnode_remove_by_id(&pCache->pFileIdCacheHead, fileId);
+}
+
+int gdrive_cache_move_fileid(const char* fileId, const char* fromPath, 
+                             const char* toPath, bool renamed)
+{
+    assert(fileId != NULL && fromPath != NULL && toPath != NULL);
+    
+    Gdrive_Cache* pCache = gdrive_cache_get_internal();
+    if (renamed)
+    {
+        // Other hard links to the file have the new name now, too.
+        gdrive_fidnode_remove_by_id(&pCache->pFileIdCacheHead, fileId);
+    }
+    int returnVal = gdrive_fidnode_move_prefix(&pCache->pFileIdCacheHead, 
+                                               fromPath, toPath);
+    if (returnVal == 0)
+    {
+        returnVal = gdrive_fidnode_add(&pCache->pFileIdCacheHead, toPath, 
+                                       fileId);
+    }
+    return returnVal;
+}
+
 void gdrive_cache_delete_id(const char* fileId)
 {
     assert(fileId != NULL);
@@ -425,6 +530,28 @@ void gdrive_cache_delete_node(Gdrive_Cache_Node* pNode)
     gdrive_cnode_delete(pNode, &pCache->pCacheHead);
 }
 
+void gdrive_cache_print_stats(FILE* stream)
+{
+    const Gdrive_Cache* pCache = gdrive_cache_get();
+    size_t bytes = gdrive_cnode_get_bytes() + gdrive_fidnode_get_bytes();
+    fprintf(stream, "  metadata cache: %lu files, %lu paths, about %lu KiB, "
+            "%lu dropped (%lu times for memory pressure)\n", 
+            (unsigned long) gdrive_cnode_get_count(), 
+            (unsigned long) gdrive_fidnode_get_count(), 
+            (unsigned long) (bytes / 1024), pCache->nEvicted, 
+            pCache->nPressureTrims);
+    if (gdrive_get_stalegrace() > 0)
+    {
+        fprintf(stream, "  expired entries used: %lu, background refreshes: "
+                "%lu\n", pCache->nStaleServed, pCache->nRefreshes);
+    }
+    if (pCache->nOutageServed > 0)
+    {
+        fprintf(stream, "  expired entries used while Google Drive was "
+                "failing: %lu\n", pCache->nOutageServed);
+    }
+}
+
 
 /*************************************************************************
  * Implementations of private functions for use within this file
@@ -453,5 +580,481 @@ static void gdrive_cache_remove_id(const char* fileId)
     gdrive_cnode_delete(pNode, &(pCache->pCacheHead));
 }
 
+/*
+ * Drops the least recently used entries from the file information and path
+ * caches if they're over the configured limits (down to 7/8 of the limit, so
+ * that it isn't needed again right away), or by half if memory is under 
+ * pressure. Runs at most once per second.
+ */
+static void gdrive_cache_trim(Gdrive_Cache* pCache)
+{
+    time_t now = time(NULL);
+    if (now == pCache->lastTrimTime)
+    {
+        return;
+    }
+    pCache->lastTrimTime = now;
+    
+    size_t nNodes = gdrive_cnode_get_count();
+    size_t nPaths = gdrive_fidnode_get_count();
+    
+    // Each cache gets the whole entry limit.
+    size_t maxFiles = gdrive_get_maxcachedfiles();
+    size_t nodeTarget = gdrive_cache_trim_target(nNodes, maxFiles);
+    size_t pathTarget = gdrive_cache_trim_target(nPaths, maxFiles);
+    
+    // The memory limit is for both together, so shrink them in proportion.
+    size_t maxBytes = gdrive_get_maxcachememory();
+    size_t bytes = gdrive_cnode_get_bytes() + gdrive_fidnode_get_bytes();
+    if (maxBytes > 0 && bytes > maxBytes)
+    {
+        double fraction = (double) (maxBytes - maxBytes / 8) / bytes;
+        size_t nodeLimit = (size_t) (nNodes * fraction);
+        size_t pathLimit = (size_t) (nPaths * fraction);
+        nodeTarget = (nodeLimit < nodeTarget) ? nodeLimit : nodeTarget;
+        pathTarget = (pathLimit < pathTarget) ? pathLimit : pathTarget;
+    }
+    
+    if (gdrive_get_memorypressure() && gdrive_cache_under_pressure(pCache, now))
+    {
+        nodeTarget = (nNodes / 2 < nodeTarget) ? nNodes / 2 : nodeTarget;
+        pathTarget = (nPaths / 2 < pathTarget) ? nPaths / 2 : pathTarget;
+        pCache->nPressureTrims++;
+    }
+    
+    if (nNodes > nodeTarget)
+    {
+        pCache->nEvicted += gdrive_cnode_evict(&pCache->pCacheHead, 
+                                               nNodes - nodeTarget);
+    }
+    if (nPaths > pathTarget)
+    {
+        pCache->nEvicted += gdrive_fidnode_evict(&pCache->pFileIdCacheHead, 
+                                                 nPaths - pathTarget);
+    }
+}
 
+/*
+ * How many entries a cache with count entries should be trimmed to, given an
+ * entry limit of maxCount (0 for no limit).
+ */
+static size_t gdrive_cache_trim_target(size_t count, size_t maxCount)
+{
+    if (maxCount == 0 || count <= maxCount)
+    {
+        return count;
+    }
+    return maxCount - maxCount / 8;
+}
 
+/*
+ * Reads the memory pressure, if it hasn't been read in the last few seconds,
+ * and returns true if it's high.
+ */
+static bool gdrive_cache_under_pressure(Gdrive_Cache* pCache, time_t now)
+{
+    if (pCache->noPressureFile || 
+            now - pCache->lastPressureCheck < GDRIVE_CACHE_PRESSURE_INTERVAL)
+    {
+        return false;
+    }
+    pCache->lastPressureCheck = now;
+    
+    if (pCache->pressurePath == NULL)
+    {
+        pCache->pressurePath = gdrive_cache_find_pressure_file();
+        if (pCache->pressurePath == NULL)
+        {
+            // No PSI on this system (or a memory error). Don't keep trying.
+            fputs("Memory pressure information is not available, the caches "
+                  "will not shrink under pressure.\n", stderr);
+            pCache->noPressureFile = true;
+            return false;
+        }
+    }
+    
+    FILE* pressureFile = fopen(pCache->pressurePath, "r");
+    if (pressureFile == NULL)
+    {
+        return false;
+    }
+    // The first line looks like
+    // "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+    double avg10 = 0;
+    int matched = fscanf(pressureFile, "some avg10=%lf", &avg10);
+    fclose(pressureFile);
+    return matched == 1 && avg10 > GDRIVE_CACHE_PRESSURE_THRESHOLD;
+}
+
+/*
+ * Finds the memory pressure file for the process's cgroup (with cgroup v2), 
+ * falling back to the one for the whole system. Returns a path that the 
+ * caller must free, or NULL if neither can be read.
+ */
+static char* gdrive_cache_find_pressure_file(void)
+{
+    const char* prefix = "/sys/fs/cgroup";
+    const char* suffix = "/memory.pressure";
+    char* path = NULL;
+    
+    // With cgroup v2, /proc/self/cgroup has a line "0::<cgroup path>".
+    FILE* cgroupFile = fopen("/proc/self/cgroup", "r");
+    if (cgroupFile != NULL)
+    {
+        char line[4096];
+        while (path == NULL && fgets(line, sizeof(line), cgroupFile) != NULL)
+        {
+            if (strncmp(line, "0::", 3) != 0)
+            {
+                continue;
+            }
+            line[strcspn(line, "\n")] = '\0';
+            path = malloc(strlen(prefix) + strlen(line + 3) + 
+                    strlen(suffix) + 1);
+            if (path != NULL)
+            {
+                strcpy(path, prefix);
+                strcat(path, line + 3);
+                strcat(path, suffix);
+            }
+        }
+        fclose(cgroupFile);
+    }
+    
+    FILE* pressureFile = (path != NULL) ? fopen(path, "r") : NULL;
+    if (pressureFile != NULL)
+    {
+        fclose(pressureFile);
+        return path;
+    }
+    free(path);
+    
+    pressureFile = fopen(GDRIVE_CACHE_SYSTEM_PRESSURE, "r");
+    if (pressureFile == NULL)
+    {
+        return NULL;
+    }
+    fclose(pressureFile);
+    path = malloc(strlen(GDRIVE_CACHE_SYSTEM_PRESSURE) + 1);
+    if (path != NULL)
+    {
+        strcpy(path, GDRIVE_CACHE_SYSTEM_PRESSURE);
+    }
+    return path;
+}
+
+/*
+ * Applies one page of the list of changes to the cache and the file index.
+ */
+static void gdrive_cache_apply_changes(Gdrive_Cache* pCache, 
+                                       Gdrive_Json_Object* pObj)
+{
+    // Update or remove cached data for each item in the "items" array.
+    Gdrive_Json_Object* pChangeArray = 
+            gdrive_json_get_nested_object(pObj, "items");
+    int arraySize = gdrive_json_array_length(pChangeArray, NULL);
+    for (int i = 0; i < arraySize; i++)
+    {
+        Gdrive_Json_Object* pItem = 
+                gdrive_json_array_get(pChangeArray, NULL, i);
+        if (pItem != NULL)
+        {
+            gdrive_cache_apply_change(pItem, pCache);
+        }
+        // else couldn't get this item, skip to the next one.
+    }
+}
+
+/*
+ * Updates or removes cached data for one item in the list of changes. Used as
+ * a gdrive_jstream_callback, with a Gdrive_Cache as userdata. Always returns
+ * 0, since a change that can't be applied shouldn't stop the others.
+ */
+static int gdrive_cache_apply_change(Gdrive_Json_Object* pItem, 
+                                     void* userdata)
+{
+    Gdrive_Cache* pCache = (Gdrive_Cache*) userdata;
+    
+    // Lookups made before this change may no longer be right.
+    gdrive_negcache_clear();
+    
+    char* fileId = 
+            gdrive_json_get_new_string(pItem, "fileId", NULL);
+    if (fileId == NULL)
+    {
+        // Couldn't get an ID for the changed file, nothing to do.
+        return 0;
+    }
+    
+    // We don't know whether the file has been renamed or moved,
+    // so remove it from the fileId cache.
+    gdrive_fidnode_remove_by_id(&pCache->pFileIdCacheHead, fileId);
+    
+    // Keep the full index (if there is one) in step.
+    bool success = false;
+    if (gdrive_json_get_boolean(pItem, "deleted", &success) && success)
+    {
+        gdrive_idx_remove(fileId);
+    }
+    else
+    {
+        gdrive_idx_update_from_json(
+                gdrive_json_get_nested_object(pItem, "file"));
+    }
+    
+    // Update the file metadata cache, but only if the file is not
+    // opened for writing with dirty data.
+    Gdrive_Cache_Node* pCacheNode = 
+            gdrive_cnode_get(NULL,
+                             &(pCache->pCacheHead), 
+                             fileId, 
+                             false, 
+                             NULL
+            );
+    if (pCacheNode != NULL && !gdrive_cnode_is_dirty(pCacheNode))
+    {
+        // If this file was in the cache, update its information
+        gdrive_cnode_update_from_json(
+                pCacheNode, 
+                gdrive_json_get_nested_object(pItem, "file")
+                );
+    }
+    // else either not in the cache, or there is dirty data we don't
+    // want to overwrite.
+    
+    
+    // The file's parents may now have a different number of 
+    // children.  Remove the parents from the cache.
+    int numParents = 
+            gdrive_json_array_length(pItem, "file/parents");
+    for (int nParent = 0; nParent < numParents; nParent++)
+    {
+        // Get the fileId of the current parent in the array.
+        char* parentId = NULL;
+        Gdrive_Json_Object* pParentObj = 
+                gdrive_json_array_get(pItem, "file/parents", 
+                                      nParent);
+        if (pParentObj != NULL)
+        {
+            parentId = gdrive_json_get_new_string(pParentObj, 
+                                                    "id", 
+                                                    NULL);
+        }
+        // Remove the parent from the cache, if present.
+        if (parentId != NULL)
+        {
+            gdrive_cache_remove_id(parentId);
+        }
+        free(parentId);
+    }
+    
+    free(fileId);
+    return 0;
+}
+
+/*
+ * Requests one page of the list of changes, starting from startChangeId for
+ * the first page or from pageToken for later pages. The changes are handed to
+ * pStream as they arrive. Returns the rest of the response as a JSON object, 
+ * or NULL on failure.
+ */
+static Gdrive_Json_Object* 
+gdrive_cache_request_changes(const char* startChangeId, const char* pageToken,
+                             Gdrive_Json_Stream* pStream)
+{
+    Gdrive_Transfer* pTransfer = 
+            gdrive_cache_changes_xfer(startChangeId, pageToken);
+    if (pTransfer == NULL)
+    {
+        // Memory or other error
+        return NULL;
+    }
+    gdrive_xfer_set_jstream(pTransfer, pStream);
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    
+    // Even if the response wasn't good, get the stream ready for next time.
+    Gdrive_Json_Object* pObj = gdrive_jstream_finish(pStream);
+    if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    {
+        gdrive_json_kill(pObj);
+        pObj = NULL;
+    }
+    gdrive_dlbuf_free(pBuf);
+    return pObj;
+}
+
+/*
+ * Sets up the request for one page of the list of changes, as described for
+ * gdrive_cache_request_changes(). Returns NULL on error.
+ */
+static Gdrive_Transfer* 
+gdrive_cache_changes_xfer(const char* startChangeId, const char* pageToken)
+{
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
+    if (
+            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_CHANGES) || 
+            (pageToken != NULL ? 
+                gdrive_xfer_add_query(pTransfer, "pageToken", pageToken) : 
+                gdrive_xfer_add_query(pTransfer, "startChangeId", 
+                                      startChangeId)) || 
+            gdrive_xfer_add_query(pTransfer, "includeSubscribed", "false")
+        )
+    {
+        // Error
+        gdrive_xfer_free(pTransfer);
+        return NULL;
+    }
+    return pTransfer;
+}
+
+/*
+ * Called when an entry that expired at expireTime is looked up. While the 
+ * circuit breaker is open (see gdrive-breaker.h), the expired entry is used 
+ * as it is. Within the grace period, makes sure the list of changes is being
+ * fetched in the background, and applies it if it has arrived. After the 
+ * grace period (or with no grace period), updates the cache and waits for 
+ * it. Returns true if
+ * the cache may have changed, so the entry needs to be looked up again, or 
+ * false if the expired entry should be used as it is.
+ */
+static bool gdrive_cache_revalidate(Gdrive_Cache* pCache, time_t expireTime)
+{
+    if (pCache->pRefresh == NULL && gdrive_breaker_is_open())
+    {
+        // Asking Google Drive would fail right away, and the expired entry 
+        // is better than nothing.
+        pCache->nOutageServed++;
+        return false;
+    }
+    
+    time_t grace = gdrive_get_stalegrace();
+    if (grace <= 0 || time(NULL) > expireTime + grace)
+    {
+        // Too old to use
+        gdrive_cache_update();
+        return true;
+    }
+    
+    if (pCache->pRefresh == NULL)
+    {
+        // Sending due uploads and queued changes happens here, the same as 
+        // with a normal update, and can change the cache.
+        if (!gdrive_cache_start_refresh(pCache, NULL))
+        {
+            // Couldn't start it, so do it the slow way.
+            gdrive_cache_update();
+        }
+        return true;
+    }
+    
+    if (gdrive_xfer_poll(pCache->pRefresh))
+    {
+        return gdrive_cache_finish_refresh(pCache);
+    }
+    
+    // Still waiting for the list of changes
+    pCache->nStaleServed++;
+    return false;
+}
+
+/*
+ * Starts fetching a page of the list of changes in the background, with 
+ * pageToken for later pages or NULL to start from the first one. Returns true
+ * if it was started.
+ */
+static bool gdrive_cache_start_refresh(Gdrive_Cache* pCache, 
+                                       const char* pageToken)
+{
+    assert(pCache->pRefresh == NULL);
+    
+    char changeIdString[32] = "";
+    if (pageToken == NULL)
+    {
+        // Like gdrive_cache_update(), send anything that's due first so it
+        // shows up in the list of changes.
+        gdrive_nsj_commit_due();
+        gdrive_file_sync_due(false);
+        
+        pCache->refreshStarted = time(NULL);
+        pCache->refreshChangeId = pCache->nextChangeId;
+        snprintf(changeIdString, sizeof(changeIdString), "%lld", 
+                 (long long) pCache->nextChangeId);
+        pCache->nRefreshes++;
+    }
+    
+    Gdrive_Transfer* pTransfer = 
+            gdrive_cache_changes_xfer(changeIdString, pageToken);
+    if (pTransfer != NULL)
+    {
+        pCache->pRefresh = gdrive_xfer_start(pTransfer);
+        gdrive_xfer_free(pTransfer);
+    }
+    return pCache->pRefresh != NULL;
+}
+
+/*
+ * Applies a page of the list of changes that has been fetched in the 
+ * background, and starts on the next page if there is one. Returns true if 
+ * anything was applied.
+ */
+static bool gdrive_cache_finish_refresh(Gdrive_Cache* pCache)
+{
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_finish(pCache->pRefresh);
+    pCache->pRefresh = NULL;
+    Gdrive_Json_Object* pObj = NULL;
+    if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+    {
+        pObj = gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+    }
+    gdrive_dlbuf_free(pBuf);
+    if (pObj == NULL)
+    {
+        // The request failed. The next lookup of an expired entry tries 
+        // again, and once the grace period runs out, gdrive_cache_update() 
+        // takes over (and handles errors properly).
+        return false;
+    }
+    
+    gdrive_cache_apply_changes(pCache, pObj);
+    bool success = false;
+    int64_t largestChangeId = gdrive_json_get_int64(pObj, "largestChangeId", 
+                                                    true, &success);
+    char* pageToken = gdrive_json_get_new_string(pObj, "nextPageToken", NULL);
+    gdrive_json_kill(pObj);
+    if (!success)
+    {
+        // Don't trust the rest of the list.
+        free(pageToken);
+        return true;
+    }
+    pCache->refreshChangeId = largestChangeId + 1;
+    
+    if (pageToken != NULL)
+    {
+        // If the next page can't be started, the next lookup of an expired
+        // entry starts over from the first page.
+        gdrive_cache_start_refresh(pCache, pageToken);
+        free(pageToken);
+        return true;
+    }
+    
+    // That was the last page. Everything is now as fresh as when the first
+    // page was asked for.
+    pCache->nextChangeId = pCache->refreshChangeId;
+    pCache->lastUpdateTime = pCache->refreshStarted;
+    gdrive_cache_trim(pCache);
+    return true;
+}
+
+static void gdrive_cache_cancel_refresh(Gdrive_Cache* pCache)
+{
+    gdrive_dlbuf_free(gdrive_xfer_finish(pCache->pRefresh));
+    pCache->pRefresh = NULL;
+}
@@ -101,6 +101,18 @@ time_t gdrive_cache_get_lastupdatetime();
  */
 int64_t gdrive_cache_get_nextchangeid();
 
+/*
+ * gdrive_cache_set_nextchangeid(): Sets the first change ID that the next 
+ *                                  cache update asks for, so that changes 
+ *                                  since an earlier point (such as when a
+ *                                  saved copy of the file index was made) are
+ *                                  seen again.
+ * Parameters:
+ *      changeId (int64_t):
+ *              The next change ID to ask for.
+ */
+void gdrive_cache_set_nextchangeid(int64_t changeId);
+
 
 /*************************************************************************
  * Other accessible functions
@@ -179,6 +191,41 @@ Gdrive_Fileinfo* gdrive_cache_get_item(const char* fileId,
  */
 int gdrive_cache_add_fileid(const char* path, const char* fileId);
 
+/*
+ * gdrive_cache_add_new_item(): Adds a cache entry for a file or folder that 
+ *                              has just been created locally, filling in its 
+ *                              information without contacting Google Drive.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the new item. This is copied.
+ *      filename (const char*):
+ *              The basename of the new item. This is copied.
+ *      isFolder (bool):
+ *              True for a folder, false for a regular file.
+ * Return value (Gdrive_Fileinfo*):
+ *      A pointer to the cached Gdrive_Fileinfo struct for the new item, or NULL
+ *      on failure. The pointed-to memory should NOT be freed.
+ */
+Gdrive_Fileinfo* gdrive_cache_add_new_item(const char* fileId, 
+                                           const char* filename, 
+                                           bool isFolder);
+
+/*
+ * gdrive_cache_add_fileinfo(): Adds a cache entry for a file that isn't 
+ *                              cached yet, using information that has already
+ *                              been retrieved (for example, from a folder
+ *                              listing) instead of contacting Google Drive.
+ * Parameters:
+ *      pFileinfo (const Gdrive_Fileinfo*):
+ *              The information to cache. This is copied, including the 
+ *              strings.
+ * Return value (Gdrive_Fileinfo*):
+ *      A pointer to the cached Gdrive_Fileinfo struct for the new item, or NULL
+ *      if the file was already cached (in which case the existing entry is left
+ *      alone) or on failure. The pointed-to memory should NOT be freed.
+ */
+Gdrive_Fileinfo* gdrive_cache_add_fileinfo(const Gdrive_Fileinfo* pFileinfo);
+
 /*
  * gdrive_cache_get_node(): Retrieves a pointer to the cache node used to store
  *                          information about a file and to manage on-disk 
@@ -225,6 +272,40 @@ Gdrive_Cache_Node* gdrive_cache_get_node(const char* fileId,
  */
 char* gdrive_cache_get_fileid(const char* path);
 
+/*
+ * gdrive_cache_remove_fileid():    Remove every path that maps to a given file
+ *                                  ID from the file ID cache, leaving the main
+ *                                  cache alone. Used when a file has been 
+ *                                  moved or renamed.
+ * Parameters:
+ *      fileId (const char*):
+ *              The Google Drive file ID to remove from the file ID cache.
+ */
+void gdrive_cache_remove_fileid(const char* fileId);
+
+/*
+ * gdrive_cache_move_fileid():  Updates the file ID cache after a file has been
+ *                              moved or renamed, so that the cached path (and
+ *                              the cached paths of everything inside it, if it
+ *                              is a folder) point to the new location.
+ * Parameters:
+ *      fileId (const char*):
+ *              The Google Drive file ID of the file that was moved.
+ *      fromPath (const char*):
+ *              The file's old path.
+ *      toPath (const char*):
+ *              The file's new path.
+ *      renamed (bool):
+ *              True if the file's basename changed. Any other paths to the 
+ *              file (through other parents) are removed, since they have the
+ *              old name.
+ * Return value (int):
+ *      0 on success, other on error. On error, some cached paths may have 
+ *      been lost, but none are left pointing to the wrong place.
+ */
+int gdrive_cache_move_fileid(const char* fileId, const char* fromPath, 
+                             const char* toPath, bool renamed);
+
 /*
  * gdrive_cache_delete_id():    Remove a file ID from the file ID cache, and 
  *                              mark the file ID for removal from the main 
@@ -246,6 +327,17 @@ void gdrive_cache_delete_id(const char* fileId);
  */
 void gdrive_cache_delete_node(Gdrive_Cache_Node* pNode);
 
+/*
+ * gdrive_cache_print_stats():  Prints the number of cached files and paths, 
+ *                              their approximate memory use, and how many 
+ *                              entries have been dropped to stay within the
+ *                              limits set with gdrive_set_cachelimits().
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_cache_print_stats(FILE* stream);
+
 
     
 
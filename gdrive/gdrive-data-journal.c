@@ -0,0 +1,775 @@
+
+
+#include "gdrive-data-journal.h"
+
+#include "gdrive-info.h"
+#include "gdrive-cache-node.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+#define GDRIVE_DJ_JOURNAL_SUBDIR "journal"
+#define GDRIVE_DJ_CHUNK_SUBDIR "chunks"
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+typedef struct Gdrive_Data_Journal
+{
+    int fd;
+    char* path;
+    // dirSynced: Whether the directory entry for a newly created log has been
+    // flushed to disk.
+    bool dirSynced;
+    bool hasSize;
+    size_t lastSize;
+} Gdrive_Data_Journal;
+
+typedef struct Gdrive_Dj_Dirs
+{
+    bool enabled;
+    char* journalDir;
+    char* chunkDir;
+} Gdrive_Dj_Dirs;
+
+static Gdrive_Dj_Dirs* gdrive_dj_get_internal(void);
+
+static char* gdrive_dj_join_path(const char* dir, const char* name);
+
+static int gdrive_dj_make_dir(const char* path);
+
+static bool gdrive_dj_name_ok(const char* name);
+
+static int gdrive_dj_write(Gdrive_Data_Journal* pJournal, const char* fmt,
+                           ...);
+
+static int gdrive_dj_state_add_chunk(Gdrive_Dj_State* pState, off_t start,
+                                     const char* chunkName);
+
+static void gdrive_dj_state_drop_chunk(Gdrive_Dj_State* pState, int index);
+
+static int gdrive_dj_read_line(Gdrive_Dj_State* pState, char* line);
+
+static int gdrive_dj_list_logs(char*** pFileIds);
+
+static bool gdrive_dj_in_list(char** names, int nNames, const char* name);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+int gdrive_dj_init(const char* cacheDir)
+{
+    Gdrive_Dj_Dirs* pDirs = gdrive_dj_get_internal();
+    if (cacheDir == NULL)
+    {
+        // No cache directory, leave the journal disabled.
+        return 0;
+    }
+
+    pDirs->journalDir = gdrive_dj_join_path(cacheDir, GDRIVE_DJ_JOURNAL_SUBDIR);
+    pDirs->chunkDir = gdrive_dj_join_path(cacheDir, GDRIVE_DJ_CHUNK_SUBDIR);
+    if (pDirs->journalDir == NULL || pDirs->chunkDir == NULL)
+    {
+        // Memory error
+        gdrive_dj_cleanup();
+        return -1;
+    }
+
+    if (gdrive_dj_make_dir(cacheDir) != 0 ||
+            gdrive_dj_make_dir(pDirs->journalDir) != 0 ||
+            gdrive_dj_make_dir(pDirs->chunkDir) != 0)
+    {
+        fprintf(stderr, "Could not use cache directory %s: %s\n", cacheDir,
+                strerror(errno));
+        gdrive_dj_cleanup();
+        return -1;
+    }
+
+    pDirs->enabled = true;
+    return 0;
+}
+
+void gdrive_dj_cleanup(void)
+{
+    Gdrive_Dj_Dirs* pDirs = gdrive_dj_get_internal();
+    pDirs->enabled = false;
+    free(pDirs->journalDir);
+    pDirs->journalDir = NULL;
+    free(pDirs->chunkDir);
+    pDirs->chunkDir = NULL;
+}
+
+Gdrive_Data_Journal* gdrive_dj_open(const char* fileId, bool keepExisting)
+{
+    Gdrive_Dj_Dirs* pDirs = gdrive_dj_get_internal();
+    if (!pDirs->enabled || !gdrive_dj_name_ok(fileId))
+    {
+        // Either not in use, or we can't safely name a log after this ID.
+        return NULL;
+    }
+
+    Gdrive_Data_Journal* pJournal = malloc(sizeof(Gdrive_Data_Journal));
+    if (pJournal == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    memset(pJournal, 0, sizeof(Gdrive_Data_Journal));
+    pJournal->path = gdrive_dj_join_path(pDirs->journalDir, fileId);
+    if (pJournal->path == NULL)
+    {
+        // Memory error
+        free(pJournal);
+        return NULL;
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_APPEND | (keepExisting ? 0 : O_TRUNC);
+    pJournal->fd = open(pJournal->path, flags, S_IRUSR | S_IWUSR);
+    if (pJournal->fd < 0)
+    {
+        // Couldn't open the log
+        free(pJournal->path);
+        free(pJournal);
+        return NULL;
+    }
+
+    return pJournal;
+}
+
+void gdrive_dj_close(Gdrive_Data_Journal* pJournal, bool discard)
+{
+    if (pJournal == NULL)
+    {
+        // Nothing to do
+        return;
+    }
+
+    close(pJournal->fd);
+    if (discard)
+    {
+        unlink(pJournal->path);
+    }
+    free(pJournal->path);
+    free(pJournal);
+}
+
+void gdrive_dj_state_cleanup(Gdrive_Dj_State* pState)
+{
+    free(pState->createParentId);
+    free(pState->createTitle);
+    for (int i = 0; i < pState->nChunks; i++)
+    {
+        free(pState->chunkPaths[i]);
+    }
+    free(pState->chunkPaths);
+    free(pState->chunkStarts);
+    memset(pState, 0, sizeof(Gdrive_Dj_State));
+}
+
+
+/******************
+ * Getter and setter functions
+ ******************/
+
+bool gdrive_dj_enabled(void)
+{
+    return gdrive_dj_get_internal()->enabled;
+}
+
+const char* gdrive_dj_get_chunkdir(void)
+{
+    Gdrive_Dj_Dirs* pDirs = gdrive_dj_get_internal();
+    return pDirs->enabled ? pDirs->chunkDir : NULL;
+}
+
+bool gdrive_dj_exists(const char* fileId)
+{
+    Gdrive_Dj_Dirs* pDirs = gdrive_dj_get_internal();
+    if (!pDirs->enabled || !gdrive_dj_name_ok(fileId))
+    {
+        return false;
+    }
+
+    char* path = gdrive_dj_join_path(pDirs->journalDir, fileId);
+    bool exists = (path != NULL && access(path, F_OK) == 0);
+    free(path);
+    return exists;
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+int gdrive_dj_add_create(Gdrive_Data_Journal* pJournal, const char* parentId,
+                         const char* title, bool isFolder)
+{
+    if (pJournal == NULL)
+    {
+        return 0;
+    }
+    if (strchr(parentId, ' ') != NULL || strchr(parentId, '\n') != NULL ||
+            strchr(title, '\n') != NULL)
+    {
+        // Can't be represented in a single-line record. Leave it out. The
+        // contents can still be recovered if the creation reaches Google
+        // Drive some other way.
+        return 0;
+    }
+    return gdrive_dj_write(pJournal, "C %d %s %s\n", isFolder ? 1 : 0,
+                           parentId, title);
+}
+
+int gdrive_dj_add_chunk(Gdrive_Data_Journal* pJournal, off_t start,
+                        const char* chunkPath)
+{
+    if (pJournal == NULL || chunkPath == NULL)
+    {
+        return 0;
+    }
+    const char* chunkName = strrchr(chunkPath, '/');
+    chunkName = (chunkName != NULL) ? chunkName + 1 : chunkPath;
+    return gdrive_dj_write(pJournal, "K %lld %s\n", (long long) start,
+                           chunkName);
+}
+
+int gdrive_dj_add_drop_after(Gdrive_Data_Journal* pJournal, off_t offset)
+{
+    if (pJournal == NULL)
+    {
+        return 0;
+    }
+    return gdrive_dj_write(pJournal, "T %lld\n", (long long) offset);
+}
+
+int gdrive_dj_add_drop_all(Gdrive_Data_Journal* pJournal)
+{
+    if (pJournal == NULL)
+    {
+        return 0;
+    }
+    return gdrive_dj_write(pJournal, "Z\n");
+}
+
+int gdrive_dj_add_size(Gdrive_Data_Journal* pJournal, size_t size)
+{
+    if (pJournal == NULL || (pJournal->hasSize && pJournal->lastSize == size))
+    {
+        // Nothing to do
+        return 0;
+    }
+    int returnVal = gdrive_dj_write(pJournal, "S %llu\n",
+                                    (unsigned long long) size);
+    if (returnVal == 0)
+    {
+        pJournal->hasSize = true;
+        pJournal->lastSize = size;
+    }
+    return returnVal;
+}
+
+int gdrive_dj_add_times(Gdrive_Data_Journal* pJournal,
+                        const struct timespec* pMtime,
+                        const struct timespec* pAtime)
+{
+    if (pJournal == NULL)
+    {
+        return 0;
+    }
+    int returnVal = 0;
+    if (pMtime != NULL)
+    {
+        returnVal = gdrive_dj_write(pJournal, "M %lld %ld\n",
+                                    (long long) pMtime->tv_sec,
+                                    (long) pMtime->tv_nsec);
+    }
+    if (returnVal == 0 && pAtime != NULL)
+    {
+        returnVal = gdrive_dj_write(pJournal, "A %lld %ld\n",
+                                    (long long) pAtime->tv_sec,
+                                    (long) pAtime->tv_nsec);
+    }
+    return returnVal;
+}
+
+int gdrive_dj_persist(Gdrive_Data_Journal* pJournal)
+{
+    if (pJournal == NULL)
+    {
+        return 0;
+    }
+    if (fsync(pJournal->fd) != 0)
+    {
+        return -errno;
+    }
+
+    if (!pJournal->dirSynced)
+    {
+        // The log itself is safe, but a newly created log also needs its
+        // directory entry flushed.
+        int dirFd = open(gdrive_dj_get_internal()->journalDir, O_RDONLY);
+        if (dirFd >= 0)
+        {
+            if (fsync(dirFd) == 0)
+            {
+                pJournal->dirSynced = true;
+            }
+            close(dirFd);
+        }
+    }
+    return 0;
+}
+
+int gdrive_dj_read(const char* fileId, Gdrive_Dj_State* pState)
+{
+    memset(pState, 0, sizeof(Gdrive_Dj_State));
+
+    Gdrive_Dj_Dirs* pDirs = gdrive_dj_get_internal();
+    if (!pDirs->enabled || !gdrive_dj_name_ok(fileId))
+    {
+        return -ENOENT;
+    }
+
+    char* path = gdrive_dj_join_path(pDirs->journalDir, fileId);
+    if (path == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+    FILE* inFile = fopen(path, "r");
+    free(path);
+    if (inFile == NULL)
+    {
+        return -errno;
+    }
+
+    int returnVal = 0;
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    while (returnVal == 0 && (length = getline(&line, &lineSize, inFile)) > 0)
+    {
+        if (line[length - 1] != '\n')
+        {
+            // The last record was cut short, so it never took effect.
+            break;
+        }
+        line[length - 1] = '\0';
+        returnVal = gdrive_dj_read_line(pState, line);
+    }
+    free(line);
+    fclose(inFile);
+
+    if (returnVal != 0)
+    {
+        gdrive_dj_state_cleanup(pState);
+    }
+    return returnVal;
+}
+
+void gdrive_dj_recover(void)
+{
+    Gdrive_Dj_Dirs* pDirs = gdrive_dj_get_internal();
+    if (!pDirs->enabled)
+    {
+        // Nothing to do
+        return;
+    }
+
+    char** fileIds = NULL;
+    int nFileIds = gdrive_dj_list_logs(&fileIds);
+    if (nFileIds < 0)
+    {
+        // Couldn't read the whole directory. Everything stays on disk for 
+        // next time.
+        return;
+    }
+
+    // Gather the names of every chunk file that a log still refers to.
+    char** keepNames = NULL;
+    int nKeepNames = 0;
+    bool listComplete = true;
+    for (int i = 0; i < nFileIds && listComplete; i++)
+    {
+        Gdrive_Dj_State state;
+        if (gdrive_dj_read(fileIds[i], &state) != 0)
+        {
+            // If we can't tell what a log needs, don't delete anything.
+            listComplete = false;
+            break;
+        }
+        char** newNames = realloc(keepNames,
+                                  (nKeepNames + state.nChunks + 1) *
+                                  sizeof(char*));
+        if (newNames == NULL)
+        {
+            listComplete = false;
+            gdrive_dj_state_cleanup(&state);
+            break;
+        }
+        keepNames = newNames;
+        for (int j = 0; j < state.nChunks; j++)
+        {
+            // Take ownership of the path
+            keepNames[nKeepNames++] = state.chunkPaths[j];
+            state.chunkPaths[j] = NULL;
+        }
+        gdrive_dj_state_cleanup(&state);
+    }
+
+    // Anything else in the chunk directory was left behind by files that had
+    // already been uploaded, and can go.
+    DIR* pDir = listComplete ? opendir(pDirs->chunkDir) : NULL;
+    if (pDir != NULL)
+    {
+        struct dirent* pEntry;
+        while ((pEntry = readdir(pDir)) != NULL)
+        {
+            if (pEntry->d_name[0] == '.')
+            {
+                continue;
+            }
+            char* chunkPath = gdrive_dj_join_path(pDirs->chunkDir,
+                                                  pEntry->d_name);
+            if (chunkPath != NULL &&
+                    !gdrive_dj_in_list(keepNames, nKeepNames, chunkPath))
+            {
+                unlink(chunkPath);
+            }
+            free(chunkPath);
+        }
+        closedir(pDir);
+    }
+    for (int i = 0; i < nKeepNames; i++)
+    {
+        free(keepNames[i]);
+    }
+    free(keepNames);
+
+    // Now upload whatever the logs describe.
+    for (int i = 0; i < nFileIds; i++)
+    {
+        if (gdrive_file_recover(fileIds[i]) != 0)
+        {
+            fprintf(stderr, "Could not upload saved changes to file ID %s. "
+                    "They remain in %s and will be tried again later.\n",
+                    fileIds[i], pDirs->journalDir);
+        }
+        free(fileIds[i]);
+    }
+    free(fileIds);
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Dj_Dirs* gdrive_dj_get_internal(void)
+{
+    static Gdrive_Dj_Dirs dirs = {0};
+    return &dirs;
+}
+
+static char* gdrive_dj_join_path(const char* dir, const char* name)
+{
+    char* path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    strcpy(path, dir);
+    strcat(path, "/");
+    strcat(path, name);
+    return path;
+}
+
+static int gdrive_dj_make_dir(const char* path)
+{
+    if (access(path, F_OK) == 0)
+    {
+        // Already exists
+        return 0;
+    }
+    if (gdrive_recursive_mkdir(path) != 0)
+    {
+        return -1;
+    }
+    // The directory may hold private file contents.
+    return chmod(path, S_IRWXU);
+}
+
+static bool gdrive_dj_name_ok(const char* name)
+{
+    // Logs are named after file IDs, so make sure an ID can't point anywhere
+    // outside the journal directory.
+    return name != NULL && name[0] != '\0' && name[0] != '.' &&
+            strchr(name, '/') == NULL;
+}
+
+static int gdrive_dj_write(Gdrive_Data_Journal* pJournal, const char* fmt,
+                           ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    char* record = malloc(length + 1);
+    if (record == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+    va_start(args, fmt);
+    vsnprintf(record, length + 1, fmt, args);
+    va_end(args);
+
+    // A single write() to a file opened with O_APPEND keeps each record in one
+    // piece.
+    ssize_t written = write(pJournal->fd, record, length);
+    int err = errno;
+    free(record);
+    if (written < 0)
+    {
+        return -err;
+    }
+    return (written == length) ? 0 : -EIO;
+}
+
+static int gdrive_dj_state_add_chunk(Gdrive_Dj_State* pState, off_t start,
+                                     const char* chunkName)
+{
+    if (!gdrive_dj_name_ok(chunkName))
+    {
+        // Corrupt record
+        return -EINVAL;
+    }
+    char* chunkPath =
+            gdrive_dj_join_path(gdrive_dj_get_internal()->chunkDir, chunkName);
+    if (chunkPath == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+
+    if (pState->nChunks == pState->maxChunks)
+    {
+        int newMax = (pState->maxChunks > 0) ? pState->maxChunks * 2 : 4;
+        off_t* newStarts =
+                realloc(pState->chunkStarts, newMax * sizeof(off_t));
+        if (newStarts != NULL)
+        {
+            pState->chunkStarts = newStarts;
+        }
+        char** newPaths = realloc(pState->chunkPaths, newMax * sizeof(char*));
+        if (newPaths != NULL)
+        {
+            pState->chunkPaths = newPaths;
+        }
+        if (newStarts == NULL || newPaths == NULL)
+        {
+            // Memory error
+            free(chunkPath);
+            return -ENOMEM;
+        }
+        pState->maxChunks = newMax;
+    }
+
+    pState->chunkStarts[pState->nChunks] = start;
+    pState->chunkPaths[pState->nChunks] = chunkPath;
+    pState->nChunks++;
+    return 0;
+}
+
+static void gdrive_dj_state_drop_chunk(Gdrive_Dj_State* pState, int index)
+{
+    free(pState->chunkPaths[index]);
+    pState->nChunks--;
+    pState->chunkPaths[index] = pState->chunkPaths[pState->nChunks];
+    pState->chunkStarts[index] = pState->chunkStarts[pState->nChunks];
+}
+
+static int gdrive_dj_read_line(Gdrive_Dj_State* pState, char* line)
+{
+    char* pos = (line[0] != '\0') ? line + 1 : line;
+    switch (line[0])
+    {
+        case 'C':
+        {
+            // "C <isFolder> <parentId> <title>"
+            char* parentId = strchr(pos + 1, ' ');
+            char* title = (parentId != NULL) ? strchr(parentId + 1, ' ') : NULL;
+            if (title == NULL)
+            {
+                return -EINVAL;
+            }
+            *title = '\0';
+            free(pState->createParentId);
+            free(pState->createTitle);
+            pState->createIsFolder = (strtol(pos, NULL, 10) != 0);
+            pState->createParentId = malloc(strlen(parentId + 1) + 1);
+            pState->createTitle = malloc(strlen(title + 1) + 1);
+            if (pState->createParentId == NULL || pState->createTitle == NULL)
+            {
+                return -ENOMEM;
+            }
+            strcpy(pState->createParentId, parentId + 1);
+            strcpy(pState->createTitle, title + 1);
+            return 0;
+        }
+        case 'K':
+        {
+            // "K <start> <chunkName>"
+            char* end;
+            off_t start = strtoll(pos, &end, 10);
+            if (*end != ' ')
+            {
+                return -EINVAL;
+            }
+            return gdrive_dj_state_add_chunk(pState, start, end + 1);
+        }
+        case 'T':
+        {
+            // "T <offset>"
+            off_t offset = strtoll(pos, NULL, 10);
+            for (int i = pState->nChunks - 1; i >= 0; i--)
+            {
+                if (pState->chunkStarts[i] > offset)
+                {
+                    gdrive_dj_state_drop_chunk(pState, i);
+                }
+            }
+            return 0;
+        }
+        case 'Z':
+            while (pState->nChunks > 0)
+            {
+                gdrive_dj_state_drop_chunk(pState, pState->nChunks - 1);
+            }
+            return 0;
+        case 'S':
+            pState->hasSize = true;
+            pState->size = strtoull(pos, NULL, 10);
+            return 0;
+        case 'M':
+        case 'A':
+        {
+            char* end;
+            struct timespec ts;
+            ts.tv_sec = strtoll(pos, &end, 10);
+            ts.tv_nsec = strtol(end, NULL, 10);
+            if (line[0] == 'M')
+            {
+                pState->hasMtime = true;
+                pState->mtime = ts;
+            }
+            else
+            {
+                pState->hasAtime = true;
+                pState->atime = ts;
+            }
+            return 0;
+        }
+        default:
+            // Unknown record
+            return -EINVAL;
+    }
+}
+
+/*
+ * Lists the file IDs of every log in the journal directory. Returns the number
+ * of IDs, and stores a newly allocated array of newly allocated strings in
+ * *pFileIds. Returns -1 if the directory couldn't be read in full (including
+ * on memory error), since a partial list would make the chunks of the logs
+ * left out look unused.
+ */
+static int gdrive_dj_list_logs(char*** pFileIds)
+{
+    DIR* pDir = opendir(gdrive_dj_get_internal()->journalDir);
+    if (pDir == NULL)
+    {
+        return -1;
+    }
+
+    char** fileIds = NULL;
+    int nFileIds = 0;
+    bool complete = true;
+    struct dirent* pEntry;
+    errno = 0;
+    while ((pEntry = readdir(pDir)) != NULL)
+    {
+        if (!gdrive_dj_name_ok(pEntry->d_name))
+        {
+            continue;
+        }
+        char** newIds = realloc(fileIds, (nFileIds + 1) * sizeof(char*));
+        if (newIds != NULL)
+        {
+            fileIds = newIds;
+        }
+        char* fileId = malloc(strlen(pEntry->d_name) + 1);
+        if (newIds == NULL || fileId == NULL)
+        {
+            // Memory error
+            free(fileId);
+            complete = false;
+            break;
+        }
+        strcpy(fileId, pEntry->d_name);
+        fileIds[nFileIds++] = fileId;
+        errno = 0;
+    }
+    if (pEntry == NULL && errno != 0)
+    {
+        // Error reading the directory
+        complete = false;
+    }
+    closedir(pDir);
+
+    if (!complete)
+    {
+        for (int i = 0; i < nFileIds; i++)
+        {
+            free(fileIds[i]);
+        }
+        free(fileIds);
+        return -1;
+    }
+    *pFileIds = fileIds;
+    return nFileIds;
+}
+
+static bool gdrive_dj_in_list(char** names, int nNames, const char* name)
+{
+    for (int i = 0; i < nNames; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,263 @@
+/*
+ * File:   gdrive-data-journal.h
+ * Author: me
+ *
+ * A persistent, on-disk record of file contents and metadata that have been
+ * changed locally but not yet uploaded to Google Drive. This is only used when
+ * a cache directory is set with gdrive_set_cachedir().
+ *
+ * While the journal is enabled, file chunks are kept in named files inside the
+ * cache directory rather than in anonymous temporary files. Each file with
+ * unuploaded changes also has a small append-only log, named after its file
+ * ID, recording which chunk files belong to it, its size, and any changed
+ * timestamps. If fuse-drive exits before the changes are uploaded (including
+ * by crashing or being killed), the log and chunk files are still there the
+ * next time, and gdrive_dj_recover() uploads them.
+ *
+ * Log records are single lines, each written with a single write() call:
+ *      C <isFolder> <parentId> <title>     File was still waiting to be created
+ *      K <start> <chunkName>               Chunk added
+ *      T <offset>                          Chunks starting after offset dropped
+ *      Z                                   All chunks dropped
+ *      S <size>                            File size changed
+ *      M <seconds> <nanoseconds>           Modification time changed
+ *      A <seconds> <nanoseconds>           Access time changed
+ * A partially written final line (from a crash in the middle of a write) is
+ * ignored.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_DATA_JOURNAL_H
+#define	GDRIVE_DATA_JOURNAL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+
+typedef struct Gdrive_Data_Journal Gdrive_Data_Journal;
+
+/*
+ * The contents of a log as read back by gdrive_dj_read().
+ */
+typedef struct Gdrive_Dj_State
+{
+    // Information needed to create the file if it never reached Google Drive.
+    // createParentId and createTitle are NULL if there was no 'C' record.
+    char* createParentId;
+    char* createTitle;
+    bool createIsFolder;
+
+    bool hasSize;
+    size_t size;
+
+    bool hasMtime;
+    struct timespec mtime;
+    bool hasAtime;
+    struct timespec atime;
+
+    // Parallel arrays describing the surviving chunks. chunkPaths holds full
+    // paths, not just the names stored in the log.
+    int nChunks;
+    int maxChunks;
+    off_t* chunkStarts;
+    char** chunkPaths;
+} Gdrive_Dj_State;
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+/*
+ * gdrive_dj_init():    Sets up the journal directories under a cache
+ *                      directory, creating them if needed. Until this
+ *                      succeeds, the journal is disabled and every other
+ *                      function does nothing.
+ * Parameters:
+ *      cacheDir (const char*):
+ *              The cache directory. If NULL, the journal stays disabled.
+ * Return value (int):
+ *      0 on success (including when cacheDir is NULL), other on failure.
+ */
+int gdrive_dj_init(const char* cacheDir);
+
+/*
+ * gdrive_dj_cleanup(): Frees memory associated with the journal and disables
+ *                      it. Does not remove anything from disk.
+ */
+void gdrive_dj_cleanup(void);
+
+/*
+ * gdrive_dj_open():    Opens the log for a file, so that changes to the file
+ *                      can be recorded.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file.
+ *      keepExisting (bool):
+ *              If true, new records are appended to any existing log for the
+ *              file. If false, any existing log is discarded first.
+ * Return value (Gdrive_Data_Journal*):
+ *      A handle to the open log, or NULL if the journal is disabled or on
+ *      error. Pass the handle to gdrive_dj_close() when done with it.
+ */
+Gdrive_Data_Journal* gdrive_dj_open(const char* fileId, bool keepExisting);
+
+/*
+ * gdrive_dj_close():   Closes a log that was opened with gdrive_dj_open().
+ * Parameters:
+ *      pJournal (Gdrive_Data_Journal*):
+ *              The log to close. The handle should not be used after this
+ *              function returns. If NULL, nothing happens.
+ *      discard (bool):
+ *              True if the file's changes have all reached Google Drive and
+ *              the log should be deleted. False to leave the log on disk so
+ *              that the changes can be recovered later.
+ */
+void gdrive_dj_close(Gdrive_Data_Journal* pJournal, bool discard);
+
+/*
+ * gdrive_dj_state_cleanup():   Frees the memory held by a Gdrive_Dj_State
+ *                              filled in by gdrive_dj_read(). Does not free
+ *                              the struct itself.
+ * Parameters:
+ *      pState (Gdrive_Dj_State*):
+ *              The struct to clean up.
+ */
+void gdrive_dj_state_cleanup(Gdrive_Dj_State* pState);
+
+
+/*************************************************************************
+ * Getter and setter functions
+ *************************************************************************/
+
+/*
+ * gdrive_dj_enabled(): Determines whether the journal is in use.
+ * Return value (bool):
+ *      True if gdrive_dj_init() was given a cache directory and succeeded.
+ */
+bool gdrive_dj_enabled(void);
+
+/*
+ * gdrive_dj_get_chunkdir():    Retrieves the directory that holds chunk files.
+ * Return value (const char*):
+ *      The directory path, or NULL if the journal is disabled. The returned
+ *      string should not be freed or changed.
+ */
+const char* gdrive_dj_get_chunkdir(void);
+
+/*
+ * gdrive_dj_exists():  Determines whether a log exists for a file, meaning
+ *                      the file has changes that were never uploaded.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID to check.
+ * Return value (bool):
+ *      True if a log exists, otherwise false.
+ */
+bool gdrive_dj_exists(const char* fileId);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * The gdrive_dj_add_*() functions each append one record to an open log. All
+ * of them do nothing and return 0 if pJournal is NULL.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+
+/*
+ * gdrive_dj_add_create():  Records that the file has not been created on
+ *                          Google Drive yet, and where it belongs.
+ */
+int gdrive_dj_add_create(Gdrive_Data_Journal* pJournal, const char* parentId,
+                         const char* title, bool isFolder);
+
+/*
+ * gdrive_dj_add_chunk():   Records a chunk that belongs to the file.
+ * Parameters:
+ *      chunkPath (const char*):
+ *              The full path of the chunk file, which must be inside the
+ *              directory returned by gdrive_dj_get_chunkdir().
+ */
+int gdrive_dj_add_chunk(Gdrive_Data_Journal* pJournal, off_t start,
+                        const char* chunkPath);
+
+/*
+ * gdrive_dj_add_drop_after():  Records that all chunks starting after offset
+ *                              were discarded, as by
+ *                              gdrive_fcontents_delete_after_offset().
+ */
+int gdrive_dj_add_drop_after(Gdrive_Data_Journal* pJournal, off_t offset);
+
+/*
+ * gdrive_dj_add_drop_all():    Records that all chunks were discarded.
+ */
+int gdrive_dj_add_drop_all(Gdrive_Data_Journal* pJournal);
+
+/*
+ * gdrive_dj_add_size():    Records the file's size. Does nothing if the size
+ *                          is the same as the last size recorded.
+ */
+int gdrive_dj_add_size(Gdrive_Data_Journal* pJournal, size_t size);
+
+/*
+ * gdrive_dj_add_times():   Records the file's modification and access times.
+ *                          Either pointer may be NULL to leave that time out.
+ */
+int gdrive_dj_add_times(Gdrive_Data_Journal* pJournal,
+                        const struct timespec* pMtime,
+                        const struct timespec* pAtime);
+
+/*
+ * gdrive_dj_persist(): Forces the log to stable storage. Chunk files need to
+ *                      be flushed separately, see gdrive_fcontents_persist().
+ * Parameters:
+ *      pJournal (Gdrive_Data_Journal*):
+ *              The log to flush. If NULL, nothing happens.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_dj_persist(Gdrive_Data_Journal* pJournal);
+
+/*
+ * gdrive_dj_read():    Reads back and replays a file's log.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file.
+ *      pState (Gdrive_Dj_State*):
+ *              Location of a struct to fill in. Any existing contents are
+ *              overwritten without being freed. On success, the caller is
+ *              responsible for calling gdrive_dj_state_cleanup().
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_dj_read(const char* fileId, Gdrive_Dj_State* pState);
+
+/*
+ * gdrive_dj_recover(): Deletes chunk files that no log refers to, then
+ *                      uploads the changes recorded in every remaining log.
+ *                      Logs for files that still cannot be uploaded are left
+ *                      in place for the next attempt. Should be called once,
+ *                      after authentication and after the cache is set up.
+ */
+void gdrive_dj_recover(void);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_DATA_JOURNAL_H */
+
@@ -1,7 +1,16 @@
 #include "gdrive-download-buffer.h"
 #include "gdrive-info.h"
+#include "gdrive-transfer.h"
+#include "gdrive-retry.h"
+#include "gdrive-ratelimit.h"
+#include "gdrive-hedge.h"
+#include "gdrive-breaker.h"
 
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
 
 
 
@@ -12,24 +21,82 @@
 #define GDRIVE_403_RATELIMIT "rateLimitExceeded"
 #define GDRIVE_403_USERRATELIMIT "userRateLimitExceeded"
 
+// The most freed buffers to keep for reuse
+#define GDRIVE_DLBUF_POOL_SIZE 8
+// Freed buffers that grew larger than this give their memory back instead of
+// keeping it for the next transfer.
+#define GDRIVE_DLBUF_POOL_MAX_KEEP (64 * 1024)
+// The most memory to set aside ahead of time because of a Content-Length 
+// header. Anything larger grows as it arrives, as usual.
+#define GDRIVE_DLBUF_MAX_PRESIZE (16 * 1024 * 1024)
+
 
 /*************************************************************************
  * Private struct and declarations of private functions for use within 
  * this file
  *************************************************************************/
 
+// The response headers that are kept, in the order of enum 
+// Gdrive_Dlbuf_Header
+static const char* const gdrive_dlbuf_header_names[GDRIVE_HEADER_COUNT] = 
+{
+    "Content-Type",
+    "Content-Range",
+    "ETag",
+    "Location",
+    "Retry-After"
+};
+
+typedef struct Gdrive_Dlbuf_Header_Value
+{
+    // value: Reused from one response to the next
+    char* value;
+    size_t size;
+    // present: The last response had this header
+    bool present;
+} Gdrive_Dlbuf_Header_Value;
+
 typedef struct Gdrive_Download_Buffer
 {
+    // pNext: The next free buffer, while this one is in the pool
+    struct Gdrive_Download_Buffer* pNext;
     size_t allocatedSize;
     size_t usedSize;
     long httpResp;
     CURLcode resultCode;
     char* data;
-    char* pReturnedHeaders;
-    size_t returnedHeaderSize;
+    Gdrive_Dlbuf_Header_Value headers[GDRIVE_HEADER_COUNT];
     FILE* fh;
+    // pStream: If not NULL, where successful responses go instead of data
+    Gdrive_Json_Stream* pStream;
+    // receivingResp: The HTTP status code of the response being received, 
+    // from its status line
+    long receivingResp;
+    // hedge: A second copy of the request can be sent if this one is slow
+    bool hedge;
+    // pRival: Another buffer racing this one for the same destination (see
+    // gdrive_dlbuf_create_rival())
+    struct Gdrive_Download_Buffer* pRival;
+    // writing: A body has started arriving in this buffer's transfer
+    bool writing;
 } Gdrive_Download_Buffer;
 
+typedef struct Gdrive_Dlbuf_Pool
+{
+    // pHead: Freed buffers, ready to be handed out again
+    Gdrive_Download_Buffer* pHead;
+    int count;
+} Gdrive_Dlbuf_Pool;
+
+static Gdrive_Dlbuf_Pool* gdrive_dlbuf_get_pool(void);
+
+static void gdrive_dlbuf_destroy(Gdrive_Download_Buffer* pBuf);
+
+static int gdrive_dlbuf_reserve(Gdrive_Download_Buffer* pBuf, size_t size);
+
+static void gdrive_dlbuf_keep_header(Gdrive_Download_Buffer* pBuf, 
+                                     const char* line, size_t length);
+
 static size_t 
 gdrive_dlbuf_callback(char *newData, size_t size, size_t nmemb, void *userdata);
 
@@ -40,7 +107,7 @@ gdrive_dlbuf_header_callback(char* buffer, size_t size, size_t nitems,
 static enum Gdrive_Retry_Method 
 gdrive_dlbuf_retry_on_error(Gdrive_Download_Buffer* pBuf, long httpResp);
 
-static void gdrive_exponential_wait(int tryNum);
+static bool gdrive_dlbuf_has_ratelimit_reason(Gdrive_Download_Buffer* pBuf);
 
 
 /*************************************************************************
@@ -53,34 +120,98 @@ static void gdrive_exponential_wait(int tryNum);
 
 Gdrive_Download_Buffer* gdrive_dlbuf_create(size_t initialSize, FILE* fh)
 {
-    Gdrive_Download_Buffer* pBuf = malloc(sizeof(Gdrive_Download_Buffer));
-    if (pBuf == NULL)
+    // Reuse a freed buffer if there is one.
+    Gdrive_Dlbuf_Pool* pPool = gdrive_dlbuf_get_pool();
+    Gdrive_Download_Buffer* pBuf = pPool->pHead;
+    if (pBuf != NULL)
     {
-        // Couldn't allocate memory for the struct.
-        return NULL;
+        pPool->pHead = pBuf->pNext;
+        pPool->count--;
     }
+    else
+    {
+        pBuf = malloc(sizeof(Gdrive_Download_Buffer));
+        if (pBuf == NULL)
+        {
+            // Couldn't allocate memory for the struct.
+            return NULL;
+        }
+        memset(pBuf, 0, sizeof(Gdrive_Download_Buffer));
+    }
+    pBuf->pNext = NULL;
     pBuf->usedSize = 0;
-    pBuf->allocatedSize = initialSize;
     pBuf->httpResp = 0;
     pBuf->resultCode = 0;
-    pBuf->data = NULL;
-    pBuf->pReturnedHeaders = malloc(1);
-    pBuf->pReturnedHeaders[0] = '\0';
-    pBuf->returnedHeaderSize = 1;
+    for (int i = 0; i < GDRIVE_HEADER_COUNT; i++)
+    {
+        pBuf->headers[i].present = false;
+    }
     pBuf->fh = fh;
-    if (initialSize != 0)
+    pBuf->pStream = NULL;
+    pBuf->receivingResp = 0;
+    pBuf->hedge = false;
+    pBuf->pRival = NULL;
+    pBuf->writing = false;
+    if (initialSize != 0 && gdrive_dlbuf_reserve(pBuf, initialSize) != 0)
     {
-        if ((pBuf->data = malloc(initialSize)) == NULL)
-        {
-            // Couldn't allocate the requested memory for the data.
-            // Free the struct's memory and return NULL.
-            free(pBuf);
-            return NULL;
-        }
+        // Couldn't allocate the requested memory for the data.
+        gdrive_dlbuf_destroy(pBuf);
+        return NULL;
+    }
+    if (pBuf->data != NULL)
+    {
+        pBuf->data[0] = '\0';
     }
     return pBuf;
 }
 
+Gdrive_Download_Buffer* gdrive_dlbuf_create_filled(long httpResp, 
+                                                   const char* data, 
+                                                   size_t size)
+{
+    // Leave room for a null terminator, the same as a real download.
+    Gdrive_Download_Buffer* pBuf = gdrive_dlbuf_create(size + 1, NULL);
+    if (pBuf == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    memcpy(pBuf->data, data, size);
+    pBuf->data[size] = '\0';
+    pBuf->usedSize = size;
+    pBuf->httpResp = httpResp;
+    pBuf->resultCode = CURLE_OK;
+    return pBuf;
+}
+
+Gdrive_Download_Buffer* 
+gdrive_dlbuf_create_rival(Gdrive_Download_Buffer* pBuf)
+{
+    Gdrive_Download_Buffer* pRival = 
+            gdrive_dlbuf_create((pBuf->fh == NULL) ? 512 : 0, pBuf->fh);
+    if (pRival == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    pRival->pStream = pBuf->pStream;
+    pRival->hedge = pBuf->hedge;
+    pRival->pRival = pBuf;
+    pBuf->pRival = pRival;
+    return pRival;
+}
+
+void gdrive_dlbuf_adopt(Gdrive_Download_Buffer* pBuf, 
+                        Gdrive_Download_Buffer* pRival)
+{
+    // Neither buffer is in the pool, so the whole struct can be swapped.
+    pBuf->pRival = NULL;
+    pRival->pRival = NULL;
+    Gdrive_Download_Buffer temp = *pBuf;
+    *pBuf = *pRival;
+    *pRival = temp;
+}
+
 void gdrive_dlbuf_free(Gdrive_Download_Buffer* pBuf)
 {
     if (pBuf == NULL)
@@ -88,23 +219,45 @@ void gdrive_dlbuf_free(Gdrive_Download_Buffer* pBuf)
         // Nothing to do
         return;
     }
+    if (pBuf->pRival != NULL)
+    {
+        pBuf->pRival->pRival = NULL;
+        pBuf->pRival = NULL;
+    }
+    
+    Gdrive_Dlbuf_Pool* pPool = gdrive_dlbuf_get_pool();
+    if (pPool->count >= GDRIVE_DLBUF_POOL_SIZE)
+    {
+        // Already keeping enough buffers
+        gdrive_dlbuf_destroy(pBuf);
+        return;
+    }
     
-    // Free data
-    if (pBuf->data != NULL && pBuf->allocatedSize > 0)
+    // Keep the buffer for the next transfer, but don't hold onto memory from
+    // an unusually large response.
+    if (pBuf->allocatedSize > GDRIVE_DLBUF_POOL_MAX_KEEP)
     {
         free(pBuf->data);
         pBuf->data = NULL;
+        pBuf->allocatedSize = 0;
     }
-    
-    // Free headers
-    if (pBuf->pReturnedHeaders != NULL)
+    pBuf->fh = NULL;
+    pBuf->pStream = NULL;
+    pBuf->pNext = pPool->pHead;
+    pPool->pHead = pBuf;
+    pPool->count++;
+}
+
+void gdrive_dlbuf_cleanup(void)
+{
+    Gdrive_Dlbuf_Pool* pPool = gdrive_dlbuf_get_pool();
+    while (pPool->pHead != NULL)
     {
-        free(pBuf->pReturnedHeaders);
-        pBuf->pReturnedHeaders = NULL;
+        Gdrive_Download_Buffer* pNext = pPool->pHead->pNext;
+        gdrive_dlbuf_destroy(pPool->pHead);
+        pPool->pHead = pNext;
     }
-    
-    // Free the actual struct
-    free(pBuf);
+    pPool->count = 0;
 }
 
 
@@ -112,6 +265,22 @@ void gdrive_dlbuf_free(Gdrive_Download_Buffer* pBuf)
  * Getter and setter functions
  ******************/
 
+void gdrive_dlbuf_set_jstream(Gdrive_Download_Buffer* pBuf, 
+                              Gdrive_Json_Stream* pStream)
+{
+    pBuf->pStream = pStream;
+}
+
+void gdrive_dlbuf_set_hedge(Gdrive_Download_Buffer* pBuf, bool hedge)
+{
+    pBuf->hedge = hedge;
+}
+
+bool gdrive_dlbuf_get_responding(Gdrive_Download_Buffer* pBuf)
+{
+    return pBuf->receivingResp != 0;
+}
+
 long gdrive_dlbuf_get_httpresp(Gdrive_Download_Buffer* pBuf)
 {
     return pBuf->httpResp;
@@ -127,120 +296,209 @@ bool gdrive_dlbuf_get_success(Gdrive_Download_Buffer* pBuf)
     return (pBuf->resultCode == CURLE_OK);
 }
 
+const char* gdrive_dlbuf_get_header(Gdrive_Download_Buffer* pBuf, 
+                                    enum Gdrive_Dlbuf_Header header)
+{
+    return pBuf->headers[header].present ? pBuf->headers[header].value : NULL;
+}
+
 
 /******************
  * Other accessible functions
  ******************/
 
 CURLcode gdrive_dlbuf_download(Gdrive_Download_Buffer* pBuf, CURL* curlHandle)
+{
+    gdrive_dlbuf_attach(pBuf, curlHandle);
+    
+    // Do the transfer.
+    gdrive_dlbuf_set_result(pBuf, curlHandle, curl_easy_perform(curlHandle));
+    
+    return pBuf->resultCode;
+}
+
+void gdrive_dlbuf_attach(Gdrive_Download_Buffer* pBuf, CURL* curlHandle)
 {
     // Make sure data gets written at the start of the buffer.
     pBuf->usedSize = 0;
-    
-    // Set the destination - either our own callback function to fill the
-    // in-memory buffer, or the default libcurl function to write to a FILE*.
-    if (pBuf->fh == NULL)
-    {
-        curl_easy_setopt(curlHandle, 
-                         CURLOPT_WRITEFUNCTION, 
-                         gdrive_dlbuf_callback
-                );
-        curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, pBuf);
-    }
-    else
+    pBuf->receivingResp = 0;
+    pBuf->writing = false;
+    if (pBuf->data != NULL)
     {
-        curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, NULL);
-        curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, pBuf->fh);
+        // A streamed response leaves nothing here.
+        pBuf->data[0] = '\0';
     }
     
+    // Our own callback function either fills the in-memory buffer or writes 
+    // to the FILE*.
+    curl_easy_setopt(curlHandle, 
+                     CURLOPT_WRITEFUNCTION, 
+                     gdrive_dlbuf_callback
+            );
+    curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, pBuf);
+    
     // Capture the returned headers with a callback
     curl_easy_setopt(curlHandle, 
                      CURLOPT_HEADERFUNCTION, 
                      gdrive_dlbuf_header_callback
             );
     curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, pBuf);
-    
-    // Do the transfer.
-    pBuf->resultCode = curl_easy_perform(curlHandle);
+}
+
+void gdrive_dlbuf_set_result(Gdrive_Download_Buffer* pBuf, CURL* curlHandle, 
+                             CURLcode result)
+{
+    pBuf->resultCode = result;
     
     // Get the HTTP response
     curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &(pBuf->httpResp));
-    
-    return pBuf->resultCode;
 }
 
-int gdrive_dlbuf_download_with_retry(Gdrive_Download_Buffer* pBuf, 
-                                     CURL* curlHandle, bool retryOnAuthError, 
-                                     int tryNum, int maxTries)
+enum Gdrive_Retry_Method 
+gdrive_dlbuf_get_retrymethod(Gdrive_Download_Buffer* pBuf)
+{
+    if (pBuf->resultCode != CURLE_OK || pBuf->httpResp < 400)
+    {
+        // Either not an error response, or no response at all
+        return GDRIVE_RETRY_NORETRY;
+    }
+    return gdrive_dlbuf_retry_on_error(pBuf, pBuf->httpResp);
+}
+
+bool gdrive_dlbuf_is_unavailable(Gdrive_Download_Buffer* pBuf)
+{
+    switch (pBuf->resultCode)
+    {
+        case CURLE_OK:
+            return pBuf->httpResp >= 500;
+            
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_PARTIAL_FILE:
+            return true;
+            
+        default:
+            // Something on this end, such as a memory error
+            return false;
+    }
+}
+
+bool gdrive_dlbuf_is_ratelimited(Gdrive_Download_Buffer* pBuf)
 {
-    CURLcode curlResult = gdrive_dlbuf_download(pBuf, curlHandle);
+    return pBuf->resultCode == CURLE_OK && (pBuf->httpResp == 429 || 
+            (pBuf->httpResp == 403 && gdrive_dlbuf_has_ratelimit_reason(pBuf)));
+}
 
+long gdrive_dlbuf_get_retryafter(Gdrive_Download_Buffer* pBuf)
+{
+    const char* value = gdrive_dlbuf_get_header(pBuf, 
+                                                GDRIVE_HEADER_RETRY_AFTER);
+    if (value == NULL || *value == '\0')
+    {
+        // The server didn't say
+        return -1;
+    }
+    
+    if (isdigit((unsigned char) value[0]))
+    {
+        // A number of seconds
+        char* end = NULL;
+        long seconds = strtol(value, &end, 10);
+        if (*end != '\0' || seconds > LONG_MAX / 1000)
+        {
+            return -1;
+        }
+        return seconds * 1000;
+    }
     
-    if (curlResult != CURLE_OK)
+    // Otherwise an HTTP date
+    time_t when = curl_getdate(value, NULL);
+    if (when == -1)
     {
-        // Download error
+        // Not a valid date
         return -1;
     }
-    if (gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    time_t now = time(NULL);
+    return (when > now) ? (long) (when - now) * 1000 : 0;
+}
+
+int gdrive_dlbuf_download_with_retry(Gdrive_Download_Buffer* pBuf, 
+                                     CURL* curlHandle, bool retryOnAuthError, 
+                                     enum Gdrive_Request_Class requestClass, 
+                                     int cost)
+{
+    Gdrive_Retry retry;
+    gdrive_retry_init(&retry, requestClass);
+    
+    while (true)
     {
-        // Handle HTTP error responses.  Normal error handling - 5xx gets 
-        // retried, 403 gets retried if it's due to rate limits, 401 gets
-        // retried after refreshing auth.  If retryOnAuthError is false, 
-        // suppress the normal behavior for 401 and don't retry.
-        
-        // See whether we've already used our maximum attempts.
-        if (tryNum == maxTries)
+        if (!gdrive_breaker_allow())
+        {
+            // Google Drive has been failing, so don't wait on it.
+            pBuf->resultCode = CURLE_COULDNT_CONNECT;
+            pBuf->httpResp = 0;
+            return -1;
+        }
+        gdrive_rate_acquire(requestClass, cost);
+        CURLcode result = pBuf->hedge ? 
+            gdrive_hedge_download(pBuf, curlHandle, requestClass) : 
+            gdrive_dlbuf_download(pBuf, curlHandle);
+        gdrive_breaker_report(gdrive_dlbuf_is_unavailable(pBuf));
+        if (result != CURLE_OK)
         {
+            // Download error
             return -1;
         }
+        gdrive_rate_report(requestClass, gdrive_dlbuf_is_ratelimited(pBuf));
+        if (gdrive_dlbuf_get_httpresp(pBuf) < 400)
+        {
+            // If we're here, we have a good response.  Return success.
+            return 0;
+        }
         
-        bool retry = false;
-        switch (gdrive_dlbuf_retry_on_error(pBuf, 
-                                            gdrive_dlbuf_get_httpresp(pBuf)))
+        // Handle HTTP error responses.  Normal error handling - 5xx and 429 
+        // get retried, 403 gets retried if it's due to rate limits, 401 gets
+        // retried after refreshing auth.  If retryOnAuthError is false, 
+        // suppress the normal behavior for 401 and don't retry.
+        switch (gdrive_dlbuf_get_retrymethod(pBuf))
         {
             case GDRIVE_RETRY_RETRY:
-                // Normal retry, use exponential backoff.
-                gdrive_exponential_wait(tryNum);
-                retry = true;
+            {
+                // Normal retry, after waiting as long as the server asked or
+                // with jittered backoff, if the budget allows.
+                long retryAfterMs = gdrive_dlbuf_get_retryafter(pBuf);
+                long waitMs = gdrive_retry_next_wait(&retry, retryAfterMs);
+                if (waitMs < 0 || gdrive_breaker_is_open())
+                {
+                    return -1;
+                }
+                gdrive_retry_sleep(waitMs);
                 break;
+            }
 
             case GDRIVE_RETRY_RENEWAUTH:
                 // Authentication error, probably expired access token.
                 // If retryOnAuthError is true, refresh auth and retry (unless 
                 // auth fails).
-                if (retryOnAuthError)
+                if (retryOnAuthError && gdrive_retry_again_now(&retry) && 
+                        gdrive_auth() == 0 &&
+                        gdrive_xfer_renew_auth(curlHandle) == 0)
                 {
-                    retry = (gdrive_auth() == 0);
                     break;
                 }
-                // else fall through
+                return -1;
 
             case GDRIVE_RETRY_NORETRY:
                 // Fall through
-                default:
-                {
-                    retry = false;
-                    break;
-                }
-        }
-        
-        if (retry)
-        {
-            return gdrive_dlbuf_download_with_retry(pBuf, 
-                                                    curlHandle,
-                                                    retryOnAuthError,
-                                                    tryNum + 1,
-                                                    maxTries
-                    );
-        }
-        else
-        {
-            return -1;
+            default:
+                return -1;
         }
     }
-    
-    // If we're here, we have a good response.  Return success.
-    return 0;
 }
 
 
@@ -248,6 +506,47 @@ int gdrive_dlbuf_download_with_retry(Gdrive_Download_Buffer* pBuf,
  * Implementations of private functions for use within this file
  *************************************************************************/
 
+static Gdrive_Dlbuf_Pool* gdrive_dlbuf_get_pool(void)
+{
+    static Gdrive_Dlbuf_Pool pool = {0};
+    return &pool;
+}
+
+/*
+ * Frees a buffer for good, instead of keeping it in the pool.
+ */
+static void gdrive_dlbuf_destroy(Gdrive_Download_Buffer* pBuf)
+{
+    free(pBuf->data);
+    for (int i = 0; i < GDRIVE_HEADER_COUNT; i++)
+    {
+        free(pBuf->headers[i].value);
+    }
+    free(pBuf);
+}
+
+/*
+ * Makes sure the in-memory buffer can hold at least size bytes. Returns 0 on
+ * success, other on memory error (in which case the buffer is unchanged).
+ */
+static int gdrive_dlbuf_reserve(Gdrive_Download_Buffer* pBuf, size_t size)
+{
+    if (size <= pBuf->allocatedSize)
+    {
+        // Already big enough
+        return 0;
+    }
+    char* newData = realloc(pBuf->data, size);
+    if (newData == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    pBuf->data = newData;
+    pBuf->allocatedSize = size;
+    return 0;
+}
+
 static size_t gdrive_dlbuf_callback(char *newData, size_t size, size_t nmemb, 
                                     void *userdata)
 {
@@ -258,13 +557,40 @@ static size_t gdrive_dlbuf_callback(char *newData, size_t size, size_t nmemb,
     }
     
     Gdrive_Download_Buffer* pBuffer = (Gdrive_Download_Buffer*) userdata;
+    size_t dataSize = size * nmemb;
+    
+    if (!pBuffer->writing)
+    {
+        if (pBuffer->pRival != NULL && pBuffer->pRival->writing)
+        {
+            // Lost the race to a second copy of the request, which owns the
+            // destination now.
+            return 0;
+        }
+        pBuffer->writing = true;
+    }
+    
+    if (pBuffer->fh != NULL && pBuffer->receivingResp < 400)
+    {
+        // Downloading to a file. Error responses are kept in memory instead,
+        // so they don't end up in the file and the reason can be checked.
+        return fwrite(newData, 1, dataSize, pBuffer->fh);
+    }
+    
+    if (pBuffer->pStream != NULL && 
+            pBuffer->receivingResp >= 200 && pBuffer->receivingResp < 300)
+    {
+        // Parse the response as it arrives instead of keeping it. Error 
+        // responses are still kept, so the reason can be checked.
+        return (gdrive_jstream_feed(pBuffer->pStream, newData, dataSize) == 0) ?
+            dataSize : 0;
+    }
     
     // Find the length of the data, and allocate more memory if needed.  If
     // textMode is true, include an extra byte to explicitly null terminate.
     // If downloading text data that's already null terminated, the extra NULL
     // doesn't hurt anything. If downloading binary data, the NULL is past the
     // end of the data and still doesn't hurt anything.
-    size_t dataSize = size * nmemb;
     size_t totalSize = dataSize + pBuffer->usedSize + 1;
     if (totalSize > pBuffer->allocatedSize)
     {
@@ -272,14 +598,11 @@ static size_t gdrive_dlbuf_callback(char *newData, size_t size, size_t nmemb,
         size_t minSize = totalSize + dataSize;
         size_t doubleSize = 2 * pBuffer->allocatedSize;
         size_t allocSize = (minSize > doubleSize) ? minSize : doubleSize;
-        pBuffer->data = realloc(pBuffer->data, allocSize);
-        if (pBuffer->data == NULL)
+        if (gdrive_dlbuf_reserve(pBuffer, allocSize) != 0)
         {
             // Memory allocation error.
-            pBuffer->allocatedSize = 0;
             return 0;
         }
-        pBuffer->allocatedSize = allocSize;
     }
     
     // Copy the data
@@ -296,46 +619,116 @@ static size_t gdrive_dlbuf_header_callback(char* buffer, size_t size,
                                            size_t nitems, void* userdata)
 {
     Gdrive_Download_Buffer* pDlBuf = (Gdrive_Download_Buffer*) userdata;
+    size_t length = size * nitems;
     
-    // Header data in passed in may not be null terminated or end in a newline, 
-    // so allow space for the newline and null terminator.
-    size_t oldSize = pDlBuf->returnedHeaderSize;
-    oldSize = (oldSize > 0) ? oldSize : 1;
-    size_t newHeaderLength = size * nitems;
-    size_t totalSize = oldSize + newHeaderLength + 1;
-    pDlBuf->pReturnedHeaders = realloc(pDlBuf->pReturnedHeaders, totalSize);
-    if (pDlBuf->pReturnedHeaders == NULL)
+    // Each response starts with a status line, such as "HTTP/1.1 200 OK". 
+    // There can be more than one (after "100 Continue", or when a transfer is
+    // retried), and the last one is for the response whose body follows, so 
+    // only the headers after it are kept.
+    if (length > 5 && strncmp(buffer, "HTTP/", 5) == 0)
     {
-        // Memory error
-        return 0;
+        const char* space = memchr(buffer, ' ', length);
+        pDlBuf->receivingResp = 
+                (space != NULL) ? strtol(space + 1, NULL, 10) : 0;
+        for (int i = 0; i < GDRIVE_HEADER_COUNT; i++)
+        {
+            pDlBuf->headers[i].present = false;
+        }
+        return length;
     }
-    pDlBuf->returnedHeaderSize = totalSize;
     
-    strncpy(pDlBuf->pReturnedHeaders + oldSize - 1, buffer, newHeaderLength);
-    pDlBuf->pReturnedHeaders[totalSize - 2] = '\n';
-    pDlBuf->pReturnedHeaders[totalSize - 1] = '\0';
+    // If the size of the body is known ahead of time, make room for all of
+    // it at once (plus the null terminator) instead of growing as it arrives.
+    // Not needed when the body goes to a file or a JSON stream.
+    const size_t contentLengthSize = strlen("Content-Length:");
+    if (pDlBuf->fh == NULL && 
+            !(pDlBuf->pStream != NULL && pDlBuf->receivingResp >= 200 && 
+            pDlBuf->receivingResp < 300) && 
+            length > contentLengthSize && 
+            strncasecmp(buffer, "Content-Length:", contentLengthSize) == 0)
+    {
+        // The header isn't null terminated, but it always ends in "\r\n", 
+        // which stops strtoul().
+        unsigned long contentLength = 
+                strtoul(buffer + contentLengthSize, NULL, 10);
+        if (contentLength > 0 && contentLength <= GDRIVE_DLBUF_MAX_PRESIZE)
+        {
+            // Memory errors don't matter here, the buffer can still grow 
+            // later.
+            gdrive_dlbuf_reserve(pDlBuf, 
+                                 pDlBuf->usedSize + contentLength + 1);
+        }
+        return length;
+    }
     
-    return newHeaderLength;
+    gdrive_dlbuf_keep_header(pDlBuf, buffer, length);
+    return length;
+}
+
+/*
+ * If line is one of the headers in gdrive_dlbuf_header_names, stores its 
+ * value. Other headers are ignored.
+ */
+static void gdrive_dlbuf_keep_header(Gdrive_Download_Buffer* pBuf, 
+                                     const char* line, size_t length)
+{
+    for (int i = 0; i < GDRIVE_HEADER_COUNT; i++)
+    {
+        size_t nameLength = strlen(gdrive_dlbuf_header_names[i]);
+        if (length <= nameLength || line[nameLength] != ':' || 
+                strncasecmp(line, gdrive_dlbuf_header_names[i], nameLength) 
+                != 0)
+        {
+            continue;
+        }
+        
+        // Leave out the surrounding whitespace, including the "\r\n".
+        const char* value = line + nameLength + 1;
+        const char* end = line + length;
+        while (value < end && (*value == ' ' || *value == '\t'))
+        {
+            value++;
+        }
+        while (end > value && (end[-1] == '\r' || end[-1] == '\n' || 
+                end[-1] == ' ' || end[-1] == '\t'))
+        {
+            end--;
+        }
+        
+        Gdrive_Dlbuf_Header_Value* pHeader = &(pBuf->headers[i]);
+        size_t valueLength = end - value;
+        if (valueLength + 1 > pHeader->size)
+        {
+            char* newValue = realloc(pHeader->value, valueLength + 1);
+            if (newValue == NULL)
+            {
+                // Memory error. Act as if the header wasn't there.
+                pHeader->present = false;
+                return;
+            }
+            pHeader->value = newValue;
+            pHeader->size = valueLength + 1;
+        }
+        memcpy(pHeader->value, value, valueLength);
+        pHeader->value[valueLength] = '\0';
+        pHeader->present = true;
+        return;
+    }
 }
 
 static enum Gdrive_Retry_Method gdrive_dlbuf_retry_on_error(
         Gdrive_Download_Buffer* pBuf, long httpResp)
 {
-    /* TODO:    Currently only handles 403 errors correctly when pBuf->fh is 
-     *          NULL (when the downloaded data is stored in-memory, not in a 
-     *          file).
-     */
-          
-    
     /* Most transfers should retry:
-     * A. After HTTP 5xx errors, using exponential backoff
+     * A. After HTTP 5xx and 429 errors, using jittered backoff or the 
+     *    server's Retry-After
      * B. After HTTP 403 errors with a reason of "rateLimitExceeded" or 
-     *    "userRateLimitExceeded", using exponential backoff
+     *    "userRateLimitExceeded", the same way
      * C. After HTTP 401, after refreshing credentials
      * If not one of the above cases, should not retry.
      */
     
-    if (httpResp >= 500)
+    if (httpResp >= 500 || httpResp == 429)
     {
         // Always retry these
         return GDRIVE_RETRY_RETRY;
@@ -345,72 +738,57 @@ static enum Gdrive_Retry_Method gdrive_dlbuf_retry_on_error(
         // Always refresh credentials for 401.
         return GDRIVE_RETRY_RENEWAUTH;
     }
-    else if (httpResp == 403)
+    else if (httpResp == 403 && gdrive_dlbuf_is_ratelimited(pBuf))
     {
-        // Retry ONLY if the reason for the 403 was an exceeded rate limit
-        bool retry = false;
-        int reasonLength = strlen(GDRIVE_403_USERRATELIMIT) + 1;
-        char* reason = malloc(reasonLength);
-        if (reason == NULL)
-        {
-            // Memory error
-            return -1;
-        }
-        reason[0] = '\0';
-        Gdrive_Json_Object* pRoot = 
-                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-        if (pRoot != NULL)
-        {
-            Gdrive_Json_Object* pErrors = 
-                    gdrive_json_get_nested_object(pRoot, "error/errors");
-            gdrive_json_get_string(pErrors, "reason", reason, reasonLength);
-            if ((strcmp(reason, GDRIVE_403_RATELIMIT) == 0) || 
-                    (strcmp(reason, GDRIVE_403_USERRATELIMIT) == 0))
-            {
-                // Rate limit exceeded, retry.
-                retry = true;
-            }
-            // else do nothing (retry remains false for all other 403 
-            // errors)
-
-            // Cleanup
-            gdrive_json_kill(pRoot);
-        }
-        free(reason);
-        if (retry)
-        {
-            return GDRIVE_RETRY_RENEWAUTH;
-        }
+        // Retry ONLY if the reason for the 403 was an exceeded rate limit. 
+        // The credentials are fine, so there's no point refreshing them.
+        return GDRIVE_RETRY_RETRY;
     }
     
     // For all other errors, don't retry.
     return GDRIVE_RETRY_NORETRY;
 }
 
-static void gdrive_exponential_wait(int tryNum)
+/*
+ * Checks whether an error response gives an exceeded rate limit as one of its
+ * reasons.
+ */
+static bool gdrive_dlbuf_has_ratelimit_reason(Gdrive_Download_Buffer* pBuf)
 {
-    // Number of milliseconds to wait before retrying
-    long waitTime;
-    int i;
-    // Start with 2^tryNum seconds.
-    for (i = 0, waitTime = 1000; i < tryNum; i++, waitTime *= 2)
+    // Skip parsing responses that can't possibly match. This is the part 
+    // that GDRIVE_403_RATELIMIT and GDRIVE_403_USERRATELIMIT have in common.
+    if (pBuf->data == NULL || strstr(pBuf->data, "ateLimitExceeded") == NULL)
+    {
+        return false;
+    }
+    
+    bool rateLimited = false;
+    Gdrive_Json_Object* pRoot = gdrive_json_from_string(pBuf->data);
+    int nErrors = (pRoot != NULL) ? 
+        gdrive_json_array_length(pRoot, "error/errors") : 0;
+    for (int i = 0; i < nErrors && !rateLimited; i++)
     {
-        // Empty loop
+        Gdrive_Json_Object* pError = 
+                gdrive_json_array_get(pRoot, "error/errors", i);
+        const char* reason = gdrive_json_peek_string(pError, "reason", NULL);
+        rateLimited = (reason != NULL && 
+                (strcmp(reason, GDRIVE_403_RATELIMIT) == 0 || 
+                strcmp(reason, GDRIVE_403_USERRATELIMIT) == 0));
     }
-    // Randomly add up to 1 second more.
-    waitTime += (rand() % 1000) + 1;
-    // Convert waitTime to a timespec for use with nanosleep.
-    struct timespec waitTimeNano;
-    // Intentional integer division:
-    waitTimeNano.tv_sec = waitTime / 1000;
-    waitTimeNano.tv_nsec = (waitTime % 1000) * 1000000L;
-    nanosleep(&waitTimeNano, NULL);
+    gdrive_json_kill(pRoot);
+    return rateLimited;
 }
 
-
 // Just for temporary debugging purposes. This might be kept around and moved to
 // a more appropriate place, or it might be removed.
 void gdrive_dlbuf_print_headers(const Gdrive_Download_Buffer* pBuf)
 {
-    puts(pBuf->pReturnedHeaders);
+    for (int i = 0; i < GDRIVE_HEADER_COUNT; i++)
+    {
+        if (pBuf->headers[i].present)
+        {
+            printf("%s: %s\n", gdrive_dlbuf_header_names[i], 
+                   pBuf->headers[i].value);
+        }
+    }
 }
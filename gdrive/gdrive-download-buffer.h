@@ -20,6 +20,7 @@ extern "C" {
 #endif
     
 #include "gdrive.h"
+#include "gdrive-json-stream.h"
     
 #include <curl/curl.h>
     
@@ -33,6 +34,18 @@ enum Gdrive_Retry_Method
     GDRIVE_RETRY_RENEWAUTH
 };
 
+// The response headers that are kept. Any others are ignored.
+enum Gdrive_Dlbuf_Header
+{
+    GDRIVE_HEADER_CONTENT_TYPE,
+    GDRIVE_HEADER_CONTENT_RANGE,
+    GDRIVE_HEADER_ETAG,
+    GDRIVE_HEADER_LOCATION,
+    GDRIVE_HEADER_RETRY_AFTER,
+    // GDRIVE_HEADER_COUNT: The number of headers, not a header itself
+    GDRIVE_HEADER_COUNT
+};
+
 enum Gdrive_Request_Type
 {
     GDRIVE_REQUEST_GET,
@@ -48,16 +61,18 @@ enum Gdrive_Request_Type
  *************************************************************************/
 
 /*
- * gdrive_dlbuf_create():   Creates a new Gdrive_Download_Buffer struct. Once 
- *                          this struct is no longer needed, the caller should
- *                          call gdrive_dlbuf_free().
+ * gdrive_dlbuf_create():   Creates a new Gdrive_Download_Buffer struct, or 
+ *                          reuses one that was freed earlier. Once this 
+ *                          struct is no longer needed, the caller should call
+ *                          gdrive_dlbuf_free().
  * Parameters:
  *      initialSize (size_t):
  *              The in-memory buffer will be initially allocated with a size
- *              of initialSize bytes. The buffer will grow dynamically as needed
- *              so this is not a limitation on the size of downloaded data. If
- *              a file handle is given in the fh parameter, then initialSize is
- *              recommended to be 0.
+ *              of at least initialSize bytes. The buffer will grow dynamically 
+ *              as needed (all at once if the response has a Content-Length
+ *              header), so this is not a limitation on the size of downloaded 
+ *              data. If a file handle is given in the fh parameter, then 
+ *              initialSize is recommended to be 0.
  *      fh (FILE*):
  *              If fh is NULL, the downloaded data will be stored in an 
  *              in-memory buffer. Otherwise, it will be written to the stream
@@ -69,8 +84,67 @@ enum Gdrive_Request_Type
 Gdrive_Download_Buffer* gdrive_dlbuf_create(size_t initialSize, FILE* fh);
 
 /*
- * gdrive_dlbuf_free(): Frees the memory associated with the struct and any
- *                      in-memory data buffer. If data was written to a FILE*
+ * gdrive_dlbuf_create_filled():    Creates a new Gdrive_Download_Buffer struct
+ *                                  holding a response that was received some
+ *                                  other way, such as one part of a batch 
+ *                                  response, as if it had been downloaded 
+ *                                  directly. Once this struct is no longer 
+ *                                  needed, the caller should call 
+ *                                  gdrive_dlbuf_free().
+ * Parameters:
+ *      httpResp (long):
+ *              The HTTP status code of the response.
+ *      data (const char*):
+ *              The response body. This is copied.
+ *      size (size_t):
+ *              The length of the response body in bytes.
+ * Return value (Gdrive_Download_Buffer*):
+ *      NULL on error, or a pointer to a newly allocated Gdrive_Download_Buffer
+ *      struct on success.
+ */
+Gdrive_Download_Buffer* gdrive_dlbuf_create_filled(long httpResp, 
+                                                   const char* data, 
+                                                   size_t size);
+
+/*
+ * gdrive_dlbuf_create_rival():     Creates a new Gdrive_Download_Buffer struct
+ *                                  for a second copy of the same request, 
+ *                                  racing the first. It writes to the same 
+ *                                  FILE* stream or JSON stream, if any, but 
+ *                                  only one of the two buffers ever does: once
+ *                                  either one starts receiving a body, the 
+ *                                  other's transfer fails with 
+ *                                  CURLE_WRITE_ERROR as soon as it receives 
+ *                                  one. Once this struct is no longer needed,
+ *                                  the caller should call gdrive_dlbuf_free().
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer for the first copy of the request.
+ * Return value (Gdrive_Download_Buffer*):
+ *      NULL on error, or a pointer to a newly allocated Gdrive_Download_Buffer
+ *      struct on success.
+ */
+Gdrive_Download_Buffer* 
+gdrive_dlbuf_create_rival(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * gdrive_dlbuf_adopt():    Moves the result of a rival's transfer (see 
+ *                          gdrive_dlbuf_create_rival()) into pBuf, as if pBuf 
+ *                          had performed it. What pBuf held before is moved 
+ *                          into pRival, which should then be freed.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer for the first copy of the request.
+ *      pRival (Gdrive_Download_Buffer*):
+ *              The download buffer whose result is used.
+ */
+void gdrive_dlbuf_adopt(Gdrive_Download_Buffer* pBuf, 
+                        Gdrive_Download_Buffer* pRival);
+
+/*
+ * gdrive_dlbuf_free(): Frees the struct and any in-memory data buffer, or 
+ *                      keeps them to be handed out again by a later call to 
+ *                      gdrive_dlbuf_create(). If data was written to a FILE*
  *                      stream, does NOT close the stream.
  * Parameters:
  *      pBuf (Gdrive_Download_Buffer*):
@@ -79,10 +153,62 @@ Gdrive_Download_Buffer* gdrive_dlbuf_create(size_t initialSize, FILE* fh);
  */
 void gdrive_dlbuf_free(Gdrive_Download_Buffer* pBuf);
 
+/*
+ * gdrive_dlbuf_cleanup():  Frees the buffers that gdrive_dlbuf_free() kept for
+ *                          reuse. Should be called once no more downloads will
+ *                          be made.
+ */
+void gdrive_dlbuf_cleanup(void);
+
 /*************************************************************************
  * Getter and setter functions
  *************************************************************************/
 
+/*
+ * gdrive_dlbuf_set_jstream():  Sends the body of a successful (2xx) response
+ *                              to a JSON stream as it arrives, instead of 
+ *                              keeping it. Bodies of error responses are kept
+ *                              as usual, so that gdrive_dlbuf_get_data() can 
+ *                              still be used to find out what went wrong. 
+ *                              Only used with an in-memory buffer.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer.
+ *      pStream (Gdrive_Json_Stream*):
+ *              The stream to feed, or NULL to keep everything. The caller 
+ *              keeps ownership, and calls gdrive_jstream_finish() once the 
+ *              transfer has succeeded.
+ */
+void gdrive_dlbuf_set_jstream(Gdrive_Download_Buffer* pBuf, 
+                              Gdrive_Json_Stream* pStream);
+
+/*
+ * gdrive_dlbuf_set_hedge():    Sets whether gdrive_dlbuf_download_with_retry()
+ *                              can send a second copy of the request when the
+ *                              first is slow to answer (see gdrive-hedge.h).
+ *                              Only safe for requests that don't change 
+ *                              anything.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer.
+ *      hedge (bool):
+ *              True to allow a second copy, false (the default) otherwise.
+ */
+void gdrive_dlbuf_set_hedge(Gdrive_Download_Buffer* pBuf, bool hedge);
+
+/*
+ * gdrive_dlbuf_get_responding():   Checks whether the response to the 
+ *                                  transfer in progress has started to 
+ *                                  arrive.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer given to gdrive_dlbuf_attach().
+ * Return value (bool):
+ *      True if the status line of a response has been received, otherwise 
+ *      false.
+ */
+bool gdrive_dlbuf_get_responding(Gdrive_Download_Buffer* pBuf);
+
 /*
  * gdrive_dlbuf_get_httpresp(): Returns the HTTP status code for the transfer.
  * Parameters:
@@ -103,8 +229,10 @@ long gdrive_dlbuf_get_httpresp(Gdrive_Download_Buffer* pBuf);
  *              A pointer to the download buffer that performed the transfer.
  * Return value (const char*):
  *      The location of the in-memory buffer that holds the contents of the last
- *      download using pBuf. If pBuf has not completed a transfer, or if the
- *      transfer used a FILE* stream, the return value is undefined. Note: The 
+ *      download using pBuf. If pBuf has not completed a transfer, the return
+ *      value is undefined. If the transfer used a FILE* stream, only the body
+ *      of an error response (HTTP 400 or above) is kept here instead of in 
+ *      the file, and otherwise the return value is undefined. Note: The 
  *      memory pointed to by this function's return value will be freed by 
  *      calling gdrive_dlbuf_free(pBuf).
  */
@@ -127,6 +255,26 @@ const char* gdrive_dlbuf_get_data(Gdrive_Download_Buffer* pBuf);
  */
 bool gdrive_dlbuf_get_success(Gdrive_Download_Buffer* pBuf);
 
+/*
+ * gdrive_dlbuf_get_header():   Retrieves one of the HTTP headers received with
+ *                              the last response to a download using the 
+ *                              specified download buffer. Only the headers in
+ *                              enum Gdrive_Dlbuf_Header are kept.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A pointer to the download buffer that performed the transfer.
+ *      header (enum Gdrive_Dlbuf_Header):
+ *              Which header to get.
+ * Return value (const char*):
+ *      The header's value, without the name or surrounding whitespace, or NULL
+ *      if the response didn't have that header. If the transfer was retried, 
+ *      only the last attempt counts. The memory pointed to by this function's 
+ *      return value will be reused or freed by later downloads with pBuf, or 
+ *      by calling gdrive_dlbuf_free(pBuf).
+ */
+const char* gdrive_dlbuf_get_header(Gdrive_Download_Buffer* pBuf, 
+                                    enum Gdrive_Dlbuf_Header header);
+
 
 /*************************************************************************
  * Other accessible functions
@@ -149,30 +297,122 @@ bool gdrive_dlbuf_get_success(Gdrive_Download_Buffer* pBuf);
  */
 CURLcode gdrive_dlbuf_download(Gdrive_Download_Buffer* pBuf, CURL* curlHandle);
 
+/*
+ * gdrive_dlbuf_attach():   Sets up a curl handle to store what it receives in
+ *                          a download buffer, without performing the transfer.
+ *                          Used for transfers that are carried out some other
+ *                          way, such as with a curl multi handle. Once the
+ *                          transfer is done, call gdrive_dlbuf_set_result().
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer to store the results in, as for 
+ *              gdrive_dlbuf_download().
+ *      curlHandle (CURL*):
+ *              The curl handle that will perform the transfer.
+ */
+void gdrive_dlbuf_attach(Gdrive_Download_Buffer* pBuf, CURL* curlHandle);
+
+/*
+ * gdrive_dlbuf_set_result():   Records the outcome of a transfer set up with
+ *                              gdrive_dlbuf_attach().
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer given to gdrive_dlbuf_attach().
+ *      curlHandle (CURL*):
+ *              The curl handle that performed the transfer.
+ *      result (CURLcode):
+ *              The result of the transfer, as reported by curl.
+ */
+void gdrive_dlbuf_set_result(Gdrive_Download_Buffer* pBuf, CURL* curlHandle, 
+                             CURLcode result);
+
+/*
+ * gdrive_dlbuf_get_retrymethod():  Decides what to do about the response to 
+ *                                  the last download.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A pointer to the download buffer that performed the transfer.
+ * Return value (enum Gdrive_Retry_Method):
+ *      GDRIVE_RETRY_RETRY for server errors and exceeded rate limits, 
+ *      GDRIVE_RETRY_RENEWAUTH for authentication errors, or 
+ *      GDRIVE_RETRY_NORETRY for successful responses, failed transfers and 
+ *      any other errors.
+ */
+enum Gdrive_Retry_Method 
+gdrive_dlbuf_get_retrymethod(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * gdrive_dlbuf_is_unavailable():   Checks whether the last download failed 
+ *                                  in a way that suggests Google Drive can't 
+ *                                  be reached or isn't working: a network 
+ *                                  error, a timeout, or a server error (HTTP 
+ *                                  500 or above).
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A pointer to the download buffer that performed the transfer.
+ * Return value (bool):
+ *      True if Google Drive seems to be unavailable, otherwise false.
+ */
+bool gdrive_dlbuf_is_unavailable(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * gdrive_dlbuf_is_ratelimited():   Checks whether the response to the last 
+ *                                  download says that a rate limit was 
+ *                                  exceeded: HTTP 429, or HTTP 403 with a 
+ *                                  reason of "rateLimitExceeded" or 
+ *                                  "userRateLimitExceeded".
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A pointer to the download buffer that performed the transfer.
+ * Return value (bool):
+ *      True if a rate limit was exceeded, otherwise false.
+ */
+bool gdrive_dlbuf_is_ratelimited(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * gdrive_dlbuf_get_retryafter():   Reads the Retry-After header from the 
+ *                                  response to the last download.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              A pointer to the download buffer that performed the transfer.
+ * Return value (long):
+ *      How long the server asked to wait before retrying, in milliseconds, 
+ *      whether it gave a number of seconds or a date. -1 if there was no 
+ *      usable Retry-After header.
+ */
+long gdrive_dlbuf_get_retryafter(Gdrive_Download_Buffer* pBuf);
+
 /*
  * gdrive_dlbuf_download_with_retry():  Perform a download, retrying on any 
- *                                      HTTP 5xx errors or rate limit exceeded
- *                                      errors. Optionally, refreshes auth
- *                                      credentials and retries on 
+ *                                      HTTP 5xx or 429 errors or rate limit 
+ *                                      exceeded errors, as decided by 
+ *                                      gdrive-retry.h. Optionally, refreshes 
+ *                                      auth credentials and retries on 
  *                                      authentication errors.
  * Parameters:
  *      pBuf (Gdrive_Download_Buffer*):
  *              A pointer to a Gdrive_Download_Buffer struct that will be used
  *              to store the results of the download.
+ *      curlHandle (CURL*):
+ *              The curl handle, set up for the request.
  *      retryOnAuthError (bool):
  *              Determines whether to renew authorization and retry on
  *              authentication failure.
- *      tryNum (int):
- *              Reserved for internal use. Must be 0.
- *      maxTries (int):
- *              Maximum number of attempts before finally failing.
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request, which decides how long it can spend 
+ *              waiting to retry (see gdrive_set_retrybudget()), how it is
+ *              paced (see gdrive-ratelimit.h), and when it is sent a second
+ *              time if gdrive_dlbuf_set_hedge() allows it.
+ *      cost (int):
+ *              How many requests this counts as against Google Drive's quota,
+ *              normally 1.
  * Return value (int):
  *      0 on success, other on failure.
  */
 int gdrive_dlbuf_download_with_retry(Gdrive_Download_Buffer* pBuf, 
                                      CURL* curlHandle, bool retryOnAuthError, 
-                                     int tryNum, int maxTries);
-
+                                     enum Gdrive_Request_Class requestClass, 
+                                     int cost);
 
 #ifdef	__cplusplus
 }
@@ -17,11 +17,20 @@ typedef struct Gdrive_File_Contents
     off_t start;
     off_t end;
     FILE* fh;
+    // path: The chunk file's name if it is kept in the cache directory, or 
+    // NULL for an anonymous temporary file.
+    char* path;
     struct Gdrive_File_Contents* pNext;
 } Gdrive_File_Contents;
 
 static Gdrive_File_Contents* gdrive_fcontents_create();
 
+static void gdrive_fcontents_append(Gdrive_File_Contents* pHead, 
+                                    Gdrive_File_Contents* pNew);
+
+static void gdrive_fcontents_close(Gdrive_File_Contents* pContents, 
+                                   bool keepFile);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -36,19 +45,54 @@ Gdrive_File_Contents* gdrive_fcontents_add(Gdrive_File_Contents* pHead)
     // Create the actual file contents struct.
     Gdrive_File_Contents* pNew = gdrive_fcontents_create();
     
-    // Find the last entry in the file contents list, and add the new one to
-    // the end.
-    Gdrive_File_Contents* pContents = pHead;
-    if (pHead != NULL)
+    // Add the new one to the end of the list.
+    if (pNew != NULL)
     {
-        while (pContents->pNext != NULL)
+        gdrive_fcontents_append(pHead, pNew);
+    }
+    
+    return pNew;
+}
+
+Gdrive_File_Contents* gdrive_fcontents_add_existing(Gdrive_File_Contents* pHead,
+                                                    const char* path, 
+                                                    off_t start)
+{
+    Gdrive_File_Contents* pNew = malloc(sizeof(Gdrive_File_Contents));
+    if (pNew == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    memset(pNew, 0, sizeof(Gdrive_File_Contents));
+    pNew->path = malloc(strlen(path) + 1);
+    if (pNew->path == NULL)
+    {
+        // Memory error
+        free(pNew);
+        return NULL;
+    }
+    strcpy(pNew->path, path);
+    
+    pNew->fh = fopen(path, "r+");
+    if (pNew->fh == NULL || fseeko(pNew->fh, 0, SEEK_END) != 0)
+    {
+        // The file is missing or unusable
+        if (pNew->fh != NULL)
         {
-            pContents = pContents->pNext;
+            fclose(pNew->fh);
         }
-        pContents->pNext = pNew;
+        free(pNew->path);
+        free(pNew);
+        return NULL;
     }
-    // else we weren't given a list to append to, do nothing.
     
+    // A zero-length chunk ends just before it starts, the same as a freshly
+    // created chunk for an empty file.
+    pNew->start = start;
+    pNew->end = start + ftello(pNew->fh) - 1;
+    
+    gdrive_fcontents_append(pHead, pNew);
     return pNew;
 }
 
@@ -69,12 +113,8 @@ void gdrive_fcontents_delete(Gdrive_File_Contents* pContents,
         *ppContents = pContents->pNext;
     }
     
-    // Close the temp file
-    if (pContents->fh != NULL)
-    {
-        fclose(pContents->fh);
-        pContents->fh = NULL;
-    }
+    // Close and delete the temp file
+    gdrive_fcontents_close(pContents, false);
     
     free(pContents);
 }
@@ -136,12 +176,8 @@ void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents)
     // Free the rest of the list after the current item.
     gdrive_fcontents_free_all(&(pContents->pNext));
     
-    // Close the temp file, which will automatically delete it.
-    if (pContents->fh != NULL)
-    {
-        fclose(pContents->fh);
-        pContents->fh = NULL;
-    }
+    // Close and delete the temp file.
+    gdrive_fcontents_close(pContents, false);
     
     // Free the memory associated with the item
     free(pContents);
@@ -150,6 +186,17 @@ void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents)
     *ppContents = NULL;
 }
 
+void gdrive_fcontents_release_all(Gdrive_File_Contents** ppContents)
+{
+    while (ppContents != NULL && *ppContents != NULL)
+    {
+        Gdrive_File_Contents* pContents = *ppContents;
+        *ppContents = pContents->pNext;
+        gdrive_fcontents_close(pContents, true);
+        free(pContents);
+    }
+}
+
 
 /******************
  * Getter and setter functions
@@ -198,27 +245,14 @@ int gdrive_fcontents_fill_chunk(Gdrive_File_Contents* pContents,
     }
     gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
     
-    // Construct the base URL in the form of "<GDRIVE_URL_FILES>/<fileId>".
-    char* fileUrl = malloc(strlen(GDRIVE_URL_FILES) + 
-                           strlen(fileId) + 2
-    );
-    if (fileUrl == NULL)
-    {
-        // Memory error
-        gdrive_xfer_free(pTransfer);
-        return -1;
-    }
-    strcpy(fileUrl, GDRIVE_URL_FILES);
-    strcat(fileUrl, "/");
-    strcat(fileUrl, fileId);
-    if (gdrive_xfer_set_url(pTransfer, fileUrl) != 0)
+    // The base URL is in the form of "<GDRIVE_URL_FILES>/<fileId>".
+    if (gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_FILES, fileId, NULL) 
+            != 0)
     {
         // Error
-        free(fileUrl);
         gdrive_xfer_free(pTransfer);
         return -1;
     }
-    free(fileUrl);
     
     // Construct query parameters
     if (
@@ -321,6 +355,12 @@ off_t gdrive_fcontents_write(Gdrive_File_Contents* pContents, const char* buf,
     FILE* chunkFile = pContents->fh;
     fseek(chunkFile, offset - pContents->start, SEEK_SET);
     size_t bytesWritten = fwrite(buf, 1, size, chunkFile);
+    if (pContents->path != NULL)
+    {
+        // Hand the data to the kernel now, so that it survives this process
+        // dying. Flushing it all the way to disk waits for an fsync().
+        fflush(chunkFile);
+    }
     
     // Extend the chunk's ending offset if needed
     if ((off_t) (offset + bytesWritten - 1) > pContents->end)
@@ -365,6 +405,51 @@ int gdrive_fcontents_truncate(Gdrive_File_Contents* pContents, size_t size)
     return 0;
 }
 
+int gdrive_fcontents_persist(Gdrive_File_Contents* pHead)
+{
+    for (Gdrive_File_Contents* pContents = pHead; 
+            pContents != NULL; 
+            pContents = pContents->pNext)
+    {
+        if (pContents->fh == NULL)
+        {
+            continue;
+        }
+        if (fflush(pContents->fh) != 0 || fsync(fileno(pContents->fh)) != 0)
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+int gdrive_fcontents_journal_chunk(const Gdrive_File_Contents* pContents, 
+                                   Gdrive_Data_Journal* pJournal)
+{
+    if (pContents->path == NULL)
+    {
+        // Anonymous temp file, can't be found again later.
+        return 0;
+    }
+    return gdrive_dj_add_chunk(pJournal, pContents->start, pContents->path);
+}
+
+int gdrive_fcontents_journal_all(const Gdrive_File_Contents* pHead, 
+                                 Gdrive_Data_Journal* pJournal)
+{
+    for (const Gdrive_File_Contents* pContents = pHead; 
+            pContents != NULL; 
+            pContents = pContents->pNext)
+    {
+        int returnVal = gdrive_fcontents_journal_chunk(pContents, pJournal);
+        if (returnVal != 0)
+        {
+            return returnVal;
+        }
+    }
+    return 0;
+}
+
 
 /*************************************************************************
  * Implementations of private functions for use within this file
@@ -379,7 +464,38 @@ static Gdrive_File_Contents* gdrive_fcontents_create()
         return NULL;
     }
     memset(pContents, 0, sizeof(Gdrive_File_Contents));
-        
+    
+    const char* chunkDir = gdrive_dj_get_chunkdir();
+    if (chunkDir != NULL)
+    {
+        // Create a named file in the cache directory, so that any changes 
+        // written to it can be found again if we exit before uploading them.
+        pContents->path = malloc(strlen(chunkDir) + strlen("/chunk-XXXXXX") + 1);
+        if (pContents->path == NULL)
+        {
+            // Memory error
+            free(pContents);
+            return NULL;
+        }
+        strcpy(pContents->path, chunkDir);
+        strcat(pContents->path, "/chunk-XXXXXX");
+        int fd = mkstemp(pContents->path);
+        pContents->fh = (fd >= 0) ? fdopen(fd, "w+") : NULL;
+        if (pContents->fh == NULL)
+        {
+            // File creation error
+            if (fd >= 0)
+            {
+                close(fd);
+                unlink(pContents->path);
+            }
+            free(pContents->path);
+            free(pContents);
+            return NULL;
+        }
+        return pContents;
+    }
+    
     // Create a temporary file on disk.  This will automatically be deleted
     // when the file is closed or when this program terminates, so no 
     // cleanup is needed.
@@ -393,3 +509,41 @@ static Gdrive_File_Contents* gdrive_fcontents_create()
     
     return pContents;
 }
+
+static void gdrive_fcontents_append(Gdrive_File_Contents* pHead, 
+                                    Gdrive_File_Contents* pNew)
+{
+    // Find the last entry in the file contents list, and add the new one to
+    // the end.
+    Gdrive_File_Contents* pContents = pHead;
+    if (pHead != NULL)
+    {
+        while (pContents->pNext != NULL)
+        {
+            pContents = pContents->pNext;
+        }
+        pContents->pNext = pNew;
+    }
+    // else we weren't given a list to append to, do nothing.
+}
+
+static void gdrive_fcontents_close(Gdrive_File_Contents* pContents, 
+                                   bool keepFile)
+{
+    // Close the temp file. Anonymous temp files are deleted automatically, but
+    // named chunk files need to be removed unless they're being kept.
+    if (pContents->fh != NULL)
+    {
+        fclose(pContents->fh);
+        pContents->fh = NULL;
+    }
+    if (pContents->path != NULL)
+    {
+        if (!keepFile)
+        {
+            unlink(pContents->path);
+        }
+        free(pContents->path);
+        pContents->path = NULL;
+    }
+}
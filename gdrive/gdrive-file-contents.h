@@ -20,6 +20,7 @@ extern "C" {
 #endif
 
 #include "gdrive-info.h"
+#include "gdrive-data-journal.h"
 
     
 typedef struct Gdrive_File_Contents Gdrive_File_Contents;
@@ -46,6 +47,29 @@ typedef struct Gdrive_File_Contents Gdrive_File_Contents;
  */
 Gdrive_File_Contents* gdrive_fcontents_add(Gdrive_File_Contents* pHead);
 
+/*
+ * gdrive_fcontents_add_existing(): Creates a new Gdrive_File_Contents struct 
+ *                                  for a chunk file that already exists on
+ *                                  disk, such as one left over from an earlier
+ *                                  run. Optionally adds the new struct to an
+ *                                  existing list.
+ * Parameters:
+ *      pHead (Gdrive_File_Contents*):
+ *              If non-NULL, a pointer to the head of an existing list to which
+ *              to add the newly created struct.
+ *      path (const char*):
+ *              The path of the existing chunk file.
+ *      start (off_t):
+ *              The offset within the entire Google Drive file at which the 
+ *              chunk starts. The chunk's length is the length of the file.
+ * Return value (Gdrive_File_Contents*):
+ *      A pointer to the newly created struct, or NULL on error. The same 
+ *      responsibilities apply as for gdrive_fcontents_add().
+ */
+Gdrive_File_Contents* gdrive_fcontents_add_existing(Gdrive_File_Contents* pHead,
+                                                    const char* path, 
+                                                    off_t start);
+
 /*
  * gdrive_fcontents_delete():   Removes a Gdrive_File_Contents struct from a
  *                              list of such structs, safely freeing its memory
@@ -104,6 +128,19 @@ void gdrive_fcontents_delete_after_offset(Gdrive_File_Contents** ppHead,
  */
 void gdrive_fcontents_free_all(Gdrive_File_Contents** ppContents);
 
+/*
+ * gdrive_fcontents_release_all():  Similar to gdrive_fcontents_free_all(), but
+ *                                  leaves any chunk files kept in the cache 
+ *                                  directory on disk, so that their contents 
+ *                                  can be recovered later.
+ * Parameters:
+ *      ppContents (Gdrive_File_Contents**):
+ *              The address of a pointer to the head struct in the list to be
+ *              freed. The pointer at this memory location will be NULL after
+ *              this function returns.
+ */
+void gdrive_fcontents_release_all(Gdrive_File_Contents** ppContents);
+
 
 /*************************************************************************
  * Getter and setter functions
@@ -232,6 +269,47 @@ off_t gdrive_fcontents_write(Gdrive_File_Contents* pContents, const char* buf,
  */
 int gdrive_fcontents_truncate(Gdrive_File_Contents* pContents, size_t size);
 
+/*
+ * gdrive_fcontents_persist():  Flushes every chunk in a list to stable 
+ *                              storage.
+ * Parameters:
+ *      pHead (Gdrive_File_Contents*):
+ *              A pointer to the head struct in the list. May be NULL.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_fcontents_persist(Gdrive_File_Contents* pHead);
+
+/*
+ * gdrive_fcontents_journal_chunk():    Records a chunk in a file's journal, 
+ *                                      if the chunk is kept in the cache 
+ *                                      directory.
+ * Parameters:
+ *      pContents (const Gdrive_File_Contents*):
+ *              The chunk to record.
+ *      pJournal (Gdrive_Data_Journal*):
+ *              The open journal. If NULL, nothing happens.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_fcontents_journal_chunk(const Gdrive_File_Contents* pContents, 
+                                   Gdrive_Data_Journal* pJournal);
+
+/*
+ * gdrive_fcontents_journal_all():  Records every chunk in a list in a file's 
+ *                                  journal, as gdrive_fcontents_journal_chunk()
+ *                                  does.
+ * Parameters:
+ *      pHead (const Gdrive_File_Contents*):
+ *              A pointer to the head struct in the list. May be NULL.
+ *      pJournal (Gdrive_Data_Journal*):
+ *              The open journal. If NULL, nothing happens.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_fcontents_journal_all(const Gdrive_File_Contents* pHead, 
+                                 Gdrive_Data_Journal* pJournal);
+
 
 #ifdef	__cplusplus
 }
@@ -22,6 +22,27 @@ extern "C" {
 #include <stdbool.h>
     
 typedef struct Gdrive_Cache_Node Gdrive_File;
+
+/*
+ * Counters kept about uploads of file contents, to see how many uploads the
+ * sync policy (see gdrive_set_syncpolicy()) has avoided.
+ */
+typedef struct Gdrive_Sync_Stats
+{
+    // Number of times fsync or a close asked for a file's changes to be 
+    // uploaded
+    unsigned long syncRequests;
+    // Number of uploads actually made
+    unsigned long uploads;
+    // Number of requests that did not need an upload of their own
+    unsigned long uploadsSaved;
+    // Total size of all uploads
+    unsigned long long bytesUploaded;
+    // Number of times changed timestamps were sent in their own request
+    unsigned long metadataUpdates;
+    // Number of times changed timestamps were sent along with an upload
+    unsigned long metadataFolded;
+} Gdrive_Sync_Stats;
     
 /*
  * gdrive_file_open():  Opens a specified Google Drive file and returns a handle
@@ -142,6 +163,26 @@ int gdrive_file_truncate(Gdrive_File* fh, off_t size);
  */
 char* gdrive_file_new(const char* path, bool createFolder, int* pError);
 
+/*
+ * gdrive_file_copy():  Copy a regular file to a new path, using Google
+ *                      Drive's files.copy request so that the contents never
+ *                      pass through the local machine. Any unuploaded changes
+ *                      to the original are uploaded first.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file to copy.
+ *      path (const char*):
+ *              The path for the new copy, which must not already exist.
+ *      pError (int*):
+ *              Pointer to a memory location to hold an integer error value. On
+ *              success, this will be 0.
+ * Return value (char*):
+ *      A pointer to a null-terminated string containing the Google Drive file
+ *      ID of the new copy, or NULL on failure. The caller is responsible for
+ *      freeing the pointed-to memory.
+ */
+char* gdrive_file_copy(const char* fileId, const char* path, int* pError);
+
 /*
  * gdrive_file_sync():  Sync a file with Google Drive. In particular, if the 
  *                      file has been written to, then the modified file is
@@ -154,6 +195,26 @@ char* gdrive_file_new(const char* path, bool createFolder, int* pError);
  */
 int gdrive_file_sync(Gdrive_File* fh);
 
+/*
+ * gdrive_file_persist():   Handle a request (such as fsync) to make sure a 
+ *                          file's changes will not be lost. If a cache 
+ *                          directory was set with gdrive_set_cachedir() and 
+ *                          the policy is GDRIVE_SYNC_STRICT, the changes are
+ *                          only flushed to disk there, and are uploaded when
+ *                          the file is closed. Otherwise, with 
+ *                          GDRIVE_SYNC_STRICT or when the sync window has 
+ *                          passed with GDRIVE_SYNC_COALESCE, this is the same
+ *                          as gdrive_file_sync(). In the remaining cases, the
+ *                          upload is put off, and the changes are flushed to 
+ *                          the cache directory (if any) in the meantime.
+ * Parameters:
+ *      fh (Gdrive_File*):
+ *              The file handle for an open file to persist.
+ * Return value:
+ *      0 on success, a negative error number on failure.
+ */
+int gdrive_file_persist(Gdrive_File* fh);
+
 /*
  * gdrive_file_sync():  Sync a file's metadata (the information stored in a 
  *                      Gdrive_Fileinfo struct) with Google Drive.
@@ -165,6 +226,14 @@ int gdrive_file_sync(Gdrive_File* fh);
  */
 int gdrive_file_sync_metadata(Gdrive_File* fh);
 
+/*
+ * gdrive_file_get_syncstats(): Retrieve the upload counters.
+ * Parameters:
+ *      pStats (Gdrive_Sync_Stats*):
+ *              Location of a struct to fill in with the current counts.
+ */
+void gdrive_file_get_syncstats(Gdrive_Sync_Stats* pStats);
+
 /*
  * gdrive_file_set_atime(): Set the access time for an open file.
  * Parameters:
@@ -1,5 +1,7 @@
 
 #include "gdrive-fileid-cache-node.h"
+#include "gdrive-pool.h"
+#include "gdrive-intern.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -14,12 +16,30 @@
 
 typedef struct Gdrive_Fileid_Cache_Node
 {
-    time_t lastUpdateTime;
+    // path and pNext are what a search looks at, so they come first.
     char* path;
-    char* fileId;
     struct Gdrive_Fileid_Cache_Node* pNext;
+    // fileId: Shared with other nodes for the same file (see gdrive-intern.h)
+    const char* fileId;
+    time_t lastUpdateTime;
+    // referenced: Set whenever the node is looked up, and cleared when 
+    // eviction passes over it (see gdrive_fidnode_evict()).
+    bool referenced;
 } Gdrive_Fileid_Cache_Node;
 
+typedef struct Gdrive_Fidnode_State
+{
+    // Total size of all the nodes' paths
+    size_t pathBytes;
+    // Where the last eviction sweep stopped: the path of the next node to 
+    // look at, or NULL to start from the beginning.
+    char* nextPath;
+} Gdrive_Fidnode_State;
+
+static Gdrive_Pool* gdrive_fidnode_get_pool(void);
+
+static Gdrive_Fidnode_State* gdrive_fidnode_get_state(void);
+
 static Gdrive_Fileid_Cache_Node* gdrive_fidnode_create(const char* filename, 
                                                        const char* fileId);
 
@@ -28,6 +48,9 @@ static int gdrive_fidnode_update_item(Gdrive_Fileid_Cache_Node* pNode,
 
 static void gdrive_fidnode_free(Gdrive_Fileid_Cache_Node* pNode);
 
+static void gdrive_fidnode_insert(Gdrive_Fileid_Cache_Node** ppHead, 
+                                  Gdrive_Fileid_Cache_Node* pNode);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -122,14 +145,74 @@ void gdrive_fidnode_remove_by_id(Gdrive_Fileid_Cache_Node** ppHead,
 
 void gdrive_fidnode_clear_all(Gdrive_Fileid_Cache_Node* pHead)
 {
-    // Free the rest of the chain.
-    if (pHead->pNext != NULL)
+    while (pHead != NULL)
     {
-        gdrive_fidnode_clear_all(pHead->pNext);
+        Gdrive_Fileid_Cache_Node* pNext = pHead->pNext;
+        gdrive_fidnode_free(pHead);
+        pHead = pNext;
+    }
+    
+    // Whatever the next eviction would have started from is gone.
+    Gdrive_Fidnode_State* pState = gdrive_fidnode_get_state();
+    free(pState->nextPath);
+    pState->nextPath = NULL;
+}
+
+
+int gdrive_fidnode_move_prefix(Gdrive_Fileid_Cache_Node** ppHead, 
+                               const char* fromPath, const char* toPath)
+{
+    // Take out every node that needs to move. They aren't necessarily next to
+    // each other in the list (for example, "/a b" sorts between "/a" and 
+    // "/a/c"), so check them all.
+    size_t fromLength = strlen(fromPath);
+    Gdrive_Fileid_Cache_Node* pMoving = NULL;
+    Gdrive_Fileid_Cache_Node** ppFromPrev = ppHead;
+    Gdrive_Fileid_Cache_Node* pNext = *ppHead;
+    while (pNext != NULL)
+    {
+        if (strncmp(pNext->path, fromPath, fromLength) == 0 && 
+                (pNext->path[fromLength] == '\0' || 
+                pNext->path[fromLength] == '/'))
+        {
+            *ppFromPrev = pNext->pNext;
+            pNext->pNext = pMoving;
+            pMoving = pNext;
+        }
+        else
+        {
+            ppFromPrev = &(pNext->pNext);
+        }
+        pNext = *ppFromPrev;
     }
     
-    // Free the head node.
-    gdrive_fidnode_free(pHead);
+    // Give each one its new path, and put it back in order.
+    int returnVal = 0;
+    size_t toLength = strlen(toPath);
+    while (pMoving != NULL)
+    {
+        Gdrive_Fileid_Cache_Node* pNode = pMoving;
+        pMoving = pNode->pNext;
+        pNode->pNext = NULL;
+        
+        const char* rest = pNode->path + fromLength;
+        char* newPath = malloc(toLength + strlen(rest) + 1);
+        if (newPath == NULL)
+        {
+            // Memory error. Just drop this one.
+            gdrive_fidnode_free(pNode);
+            returnVal = -1;
+            continue;
+        }
+        strcpy(newPath, toPath);
+        strcat(newPath, rest);
+        gdrive_fidnode_get_state()->pathBytes += strlen(newPath) - 
+                strlen(pNode->path);
+        free(pNode->path);
+        pNode->path = newPath;
+        gdrive_fidnode_insert(ppHead, pNode);
+    }
+    return returnVal;
 }
 
 
@@ -152,6 +235,19 @@ char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode)
     return result;
 }
 
+size_t gdrive_fidnode_get_count(void)
+{
+    return gdrive_fidnode_get_pool()->nLive;
+}
+
+size_t gdrive_fidnode_get_bytes(void)
+{
+    // The file IDs are shared, so they aren't counted here.
+    return gdrive_fidnode_get_pool()->nLive * 
+            (sizeof(Gdrive_Fileid_Cache_Node) + 1) + 
+            gdrive_fidnode_get_state()->pathBytes;
+}
+
 
 /******************
  * Other accessible functions
@@ -173,6 +269,7 @@ gdrive_fidnode_get_node(Gdrive_Fileid_Cache_Node* pHead, const char* path)
         if (cmp == 0)
         {
             // Found it!
+            pNode->referenced = true;
             return pNode;
         }
         else if (cmp < 0)
@@ -188,48 +285,121 @@ gdrive_fidnode_get_node(Gdrive_Fileid_Cache_Node* pHead, const char* path)
     return NULL;
 }
 
+size_t gdrive_fidnode_evict(Gdrive_Fileid_Cache_Node** ppHead, size_t count)
+{
+    // CLOCK, the same as gdrive_cnode_evict(): Go around the list once at 
+    // most, starting where the last sweep stopped, giving recently looked up
+    // nodes another chance and removing the rest.
+    Gdrive_Fidnode_State* pState = gdrive_fidnode_get_state();
+    Gdrive_Fileid_Cache_Node** ppFromPrev = ppHead;
+    if (pState->nextPath != NULL)
+    {
+        while (*ppFromPrev != NULL && 
+                strcmp((*ppFromPrev)->path, pState->nextPath) < 0)
+        {
+            ppFromPrev = &((*ppFromPrev)->pNext);
+        }
+    }
+    
+    size_t nNodes = gdrive_fidnode_get_count();
+    size_t nEvicted = 0;
+    for (size_t i = 0; i < nNodes && nEvicted < count && *ppHead != NULL; i++)
+    {
+        if (*ppFromPrev == NULL)
+        {
+            // Wrap around to the first node.
+            ppFromPrev = ppHead;
+        }
+        
+        Gdrive_Fileid_Cache_Node* pNode = *ppFromPrev;
+        if (pNode->referenced)
+        {
+            pNode->referenced = false;
+            ppFromPrev = &(pNode->pNext);
+        }
+        else
+        {
+            *ppFromPrev = pNode->pNext;
+            gdrive_fidnode_free(pNode);
+            nEvicted++;
+        }
+    }
+    
+    // Remember where to pick up next time.
+    free(pState->nextPath);
+    pState->nextPath = NULL;
+    if (*ppFromPrev != NULL)
+    {
+        pState->nextPath = malloc(strlen((*ppFromPrev)->path) + 1);
+        if (pState->nextPath != NULL)
+        {
+            strcpy(pState->nextPath, (*ppFromPrev)->path);
+        }
+        // else memory error, just start over from the beginning next time.
+    }
+    
+    return nEvicted;
+}
+
 
 /*************************************************************************
  * Implementations of private functions for use within this file
  *************************************************************************/
 
+static Gdrive_Pool* gdrive_fidnode_get_pool(void)
+{
+    static Gdrive_Pool pool = 
+            GDRIVE_POOL_INIT("path cache entries", Gdrive_Fileid_Cache_Node);
+    return &pool;
+}
+
+static Gdrive_Fidnode_State* gdrive_fidnode_get_state(void)
+{
+    static Gdrive_Fidnode_State state = {0};
+    return &state;
+}
+
 static Gdrive_Fileid_Cache_Node* gdrive_fidnode_create(const char* filename, 
                                                        const char* fileId)
 {
     Gdrive_Fileid_Cache_Node* pResult = 
-            malloc(sizeof(Gdrive_Fileid_Cache_Node));
+            gdrive_pool_alloc(gdrive_fidnode_get_pool());
     if (pResult != NULL)
     {
-        memset(pResult, 0, sizeof(Gdrive_Fileid_Cache_Node));
-        
         if (filename != NULL)
         {
             pResult->path = malloc(strlen(filename) + 1);
             if (pResult->path == NULL)
             {
                 // Memory error.
-                free(pResult);
+                gdrive_pool_free(gdrive_fidnode_get_pool(), pResult);
                 return NULL;
             }
             strcpy(pResult->path, filename);
+            gdrive_fidnode_get_state()->pathBytes += strlen(filename) + 1;
         }
         
-        // Only try copying the fileId if it was specified.
+        // Only try getting the fileId if it was specified.
         if (fileId != NULL)
         {
-            pResult->fileId = malloc(strlen(fileId) + 1);
+            pResult->fileId = gdrive_intern_get(fileId);
             if (pResult->fileId == NULL)
             {
                 // Memory error.
+                if (pResult->path != NULL)
+                {
+                    gdrive_fidnode_get_state()->pathBytes -= 
+                            strlen(pResult->path) + 1;
+                }
                 free(pResult->path);
-                free(pResult);
+                gdrive_pool_free(gdrive_fidnode_get_pool(), pResult);
                 return NULL;
             }
-            strcpy(pResult->fileId, fileId);
         }
         
         // Set the updated time.
         pResult->lastUpdateTime = time(NULL);
+        pResult->referenced = true;
     }
     return pResult;
 }
@@ -242,34 +412,66 @@ static int gdrive_fidnode_update_item(Gdrive_Fileid_Cache_Node* pNode,
     
     if ((pNode->fileId == NULL) || (strcmp(fileId, pNode->fileId) != 0))
     {
-        // pNode doesn't have a fileId or the IDs don't match. Copy the new
-        // fileId in.
-        free(pNode->fileId);
-        pNode->fileId = malloc(strlen(fileId) + 1);
+        // pNode doesn't have a fileId or the IDs don't match. Use the new
+        // fileId.
+        gdrive_intern_release(pNode->fileId);
+        pNode->fileId = gdrive_intern_get(fileId);
         if (pNode->fileId == NULL)
         {
             // Memory error.
             return -1;
         }
-        strcpy(pNode->fileId, fileId);
         return 0;
     }
     // else the IDs already match.
     return 0;
 }
 
+/*
+ * Puts an existing node into its sorted place in the list. If another node
+ * already has the same path, it is replaced and freed.
+ */
+static void gdrive_fidnode_insert(Gdrive_Fileid_Cache_Node** ppHead, 
+                                  Gdrive_Fileid_Cache_Node* pNode)
+{
+    Gdrive_Fileid_Cache_Node** ppFromPrev = ppHead;
+    Gdrive_Fileid_Cache_Node* pNext = *ppFromPrev;
+    int cmp = -1;
+    while (pNext != NULL && (cmp = strcmp(pNode->path, pNext->path)) > 0)
+    {
+        ppFromPrev = &(pNext->pNext);
+        pNext = *ppFromPrev;
+    }
+    
+    if (pNext != NULL && cmp == 0)
+    {
+        // Replace the old node
+        pNode->pNext = pNext->pNext;
+        gdrive_fidnode_free(pNext);
+    }
+    else
+    {
+        pNode->pNext = pNext;
+    }
+    *ppFromPrev = pNode;
+}
+
 /*
  * DOES NOT REMOVE FROM LIST.  FREES ONLY THE SINGLE NODE.
  */
 static void gdrive_fidnode_free(Gdrive_Fileid_Cache_Node* pNode)
 {
-    free(pNode->fileId);
+    gdrive_intern_release(pNode->fileId);
     pNode->fileId = NULL;
+    if (pNode->path != NULL)
+    {
+        gdrive_fidnode_get_state()->pathBytes -= strlen(pNode->path) + 1;
+    }
     free(pNode->path);
     pNode->path = NULL;
     pNode->pNext = NULL;
     memset(pNode, 0xFF, sizeof(Gdrive_Fileid_Cache_Node));
-    free(pNode);
+    gdrive_pool_free(gdrive_fidnode_get_pool(), pNode);
 }
 
 
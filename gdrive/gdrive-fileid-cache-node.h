@@ -67,6 +67,26 @@ void gdrive_fidnode_remove_by_id(Gdrive_Fileid_Cache_Node** ppHead,
  */
 void gdrive_fidnode_clear_all(Gdrive_Fileid_Cache_Node* pHead);
 
+/*
+ * gdrive_fidnode_move_prefix():    Changes the path of every node whose path
+ *                                  is fromPath or is inside fromPath, so that
+ *                                  it is under toPath instead. For example, 
+ *                                  moving "/a" to "/b/c" changes "/a/d" to 
+ *                                  "/b/c/d". Nodes keep their update times.
+ * Parameters:
+ *      ppHead (Gdrive_Fileid_Cache_Node**):
+ *              A pointer to the pointer to the first node in the list.
+ *      fromPath (const char*):
+ *              The old path.
+ *      toPath (const char*):
+ *              The new path.
+ * Return value (int):
+ *      0 on success, other on error. On error, any node that could not be
+ *      moved is removed.
+ */
+int gdrive_fidnode_move_prefix(Gdrive_Fileid_Cache_Node** ppHead, 
+                               const char* fromPath, const char* toPath);
+
 
 /*************************************************************************
  * Getter and setter functions
@@ -97,6 +117,23 @@ time_t gdrive_fidnode_get_lastupdatetime(Gdrive_Fileid_Cache_Node* pNode);
  */
 char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode);
 
+/*
+ * gdrive_fidnode_get_count():  Retrieve the number of file ID nodes that 
+ *                              exist.
+ * Return value (size_t):
+ *      The number of nodes.
+ */
+size_t gdrive_fidnode_get_count(void);
+
+/*
+ * gdrive_fidnode_get_bytes():  Retrieve the memory used by all file ID nodes
+ *                              and their paths, not counting the shared file
+ *                              IDs.
+ * Return value (size_t):
+ *      The number of bytes.
+ */
+size_t gdrive_fidnode_get_bytes(void);
+
 
 /*************************************************************************
  * Other accessible functions
@@ -117,6 +154,21 @@ char* gdrive_fidnode_get_fileid(Gdrive_Fileid_Cache_Node* pNode);
 Gdrive_Fileid_Cache_Node* gdrive_fidnode_get_node(
         Gdrive_Fileid_Cache_Node* pHead, const char* path);
 
+/*
+ * gdrive_fidnode_evict():  Removes up to count nodes from the list, choosing
+ *                          ones that haven't been looked up recently. No node
+ *                          that was looked up since the previous call is 
+ *                          removed.
+ * Parameters:
+ *      ppHead (Gdrive_Fileid_Cache_Node**):
+ *              A pointer to the pointer to the first node in the list.
+ *      count (size_t):
+ *              The most nodes to remove.
+ * Return value (size_t):
+ *      The number of nodes removed, which may be less than count.
+ */
+size_t gdrive_fidnode_evict(Gdrive_Fileid_Cache_Node** ppHead, size_t count);
+
 
 #ifdef	__cplusplus
 }
@@ -16,7 +16,7 @@ typedef struct Gdrive_Fileinfo_Array
     Gdrive_Fileinfo* pArray;
 } Gdrive_Fileinfo_Array;
 
-// No private functions
+static char* gdrive_finfoarray_strdup(const char* str);
 
 
 /*************************************************************************
@@ -35,14 +35,17 @@ Gdrive_Fileinfo_Array* gdrive_finfoarray_create(int maxSize)
         size_t byteSize = maxSize * sizeof(Gdrive_Fileinfo);
         pArray->nItems = 0;
         pArray->nMax = maxSize;
-        pArray->pArray = malloc(byteSize);
-        if (pArray->pArray == NULL)
+        pArray->pArray = (byteSize > 0) ? malloc(byteSize) : NULL;
+        if (pArray->pArray == NULL && byteSize > 0)
         {
             // Memory error
             free(pArray);
             return NULL;
         }
-        memset(pArray->pArray, 0, byteSize);
+        if (byteSize > 0)
+        {
+            memset(pArray->pArray, 0, byteSize);
+        }
     }
     // else memory error, do nothing and return NULL (the value of pArray).
     
@@ -63,10 +66,7 @@ void gdrive_finfoarray_free(Gdrive_Fileinfo_Array* pArray)
         gdrive_finfo_cleanup(pArray->pArray + i);
     }
     
-    if (pArray->nItems > 0)
-    {
-        free(pArray->pArray);
-    }
+    free(pArray->pArray);
     
     // Not really necessary, but doesn't harm anything
     pArray->nItems = 0;
@@ -95,7 +95,7 @@ gdrive_finfoarray_get_next(Gdrive_Fileinfo_Array* pArray,
         // Invalid arguments
         return NULL;
     }
-    const Gdrive_Fileinfo* pEnd = pArray->pArray + pArray->nMax;
+    const Gdrive_Fileinfo* pEnd = pArray->pArray + pArray->nItems;
     const Gdrive_Fileinfo* pNext = pPrev + 1;
     return (pNext < pEnd) ? pNext : NULL;
 }
@@ -130,9 +130,104 @@ int gdrive_finfoarray_add_from_json(Gdrive_Fileinfo_Array* pArray,
     
 }
 
+int gdrive_finfoarray_add_copy(Gdrive_Fileinfo_Array* pArray, 
+                               const Gdrive_Fileinfo* pFileinfo)
+{
+    if (pArray == NULL || pFileinfo == NULL)
+    {
+        // Invalid parameters
+        return -1;
+    }
+    if (pArray->nItems >= pArray->nMax)
+    {
+        // Make room
+        int newMax = (pArray->nMax > 0) ? pArray->nMax * 2 : 4;
+        Gdrive_Fileinfo* pNewArray = 
+                realloc(pArray->pArray, newMax * sizeof(Gdrive_Fileinfo));
+        if (pNewArray == NULL)
+        {
+            // Memory error
+            return -1;
+        }
+        pArray->pArray = pNewArray;
+        pArray->nMax = newMax;
+    }
+    
+    // Copy the struct, then make our own copies of the strings.
+    Gdrive_Fileinfo* pDest = pArray->pArray + pArray->nItems;
+    *pDest = *pFileinfo;
+    pDest->id = gdrive_finfoarray_strdup(pFileinfo->id);
+    pDest->filename = gdrive_finfoarray_strdup(pFileinfo->filename);
+    if ((pFileinfo->id != NULL && pDest->id == NULL) || 
+            (pFileinfo->filename != NULL && pDest->filename == NULL))
+    {
+        // Memory error
+        gdrive_finfo_cleanup(pDest);
+        return -1;
+    }
+    pArray->nItems++;
+    
+    return 0;
+}
+
+const Gdrive_Fileinfo* 
+gdrive_finfoarray_remove(Gdrive_Fileinfo_Array* pArray, 
+                         const Gdrive_Fileinfo* pItem)
+{
+    int index = pItem - pArray->pArray;
+    if (index < 0 || index >= pArray->nItems)
+    {
+        // Not in this array
+        return NULL;
+    }
+    
+    gdrive_finfo_cleanup(pArray->pArray + index);
+    memmove(pArray->pArray + index, pArray->pArray + index + 1, 
+            (pArray->nItems - index - 1) * sizeof(Gdrive_Fileinfo));
+    pArray->nItems--;
+    
+    // Whatever followed the removed item has moved into its place.
+    return (index < pArray->nItems) ? pArray->pArray + index : NULL;
+}
+
+int gdrive_finfoarray_rename(Gdrive_Fileinfo_Array* pArray, 
+                             const Gdrive_Fileinfo* pItem, 
+                             const char* newName)
+{
+    int index = pItem - pArray->pArray;
+    if (index < 0 || index >= pArray->nItems || newName == NULL)
+    {
+        // Invalid parameters
+        return -1;
+    }
+    
+    char* filename = gdrive_finfoarray_strdup(newName);
+    if (filename == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    free(pArray->pArray[index].filename);
+    pArray->pArray[index].filename = filename;
+    
+    return 0;
+}
+
 
 /*************************************************************************
  * Implementations of private functions for use within this file
  *************************************************************************/
 
-// No private functions
\ No newline at end of file
+static char* gdrive_finfoarray_strdup(const char* str)
+{
+    if (str == NULL)
+    {
+        return NULL;
+    }
+    char* result = malloc(strlen(str) + 1);
+    if (result != NULL)
+    {
+        strcpy(result, str);
+    }
+    return result;
+}
\ No newline at end of file
@@ -127,6 +127,56 @@ int gdrive_finfoarray_get_count(Gdrive_Fileinfo_Array* pArray);
 int gdrive_finfoarray_add_from_json(Gdrive_Fileinfo_Array* pArray, 
                                         Gdrive_Json_Object* pObj);
 
+/*
+ * gdrive_finfoarray_add_copy():    Adds a copy of an existing Gdrive_Fileinfo
+ *                                  struct to a fileinfo array, growing the 
+ *                                  array if it is already full.
+ * Parameters:
+ *      pArray (Gdrive_Fileinfo_Array*):
+ *              A pointer to the array.
+ *      pFileinfo (const Gdrive_Fileinfo*):
+ *              The struct to copy. Its strings are copied as well, so the 
+ *              caller keeps ownership of the original.
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_finfoarray_add_copy(Gdrive_Fileinfo_Array* pArray, 
+                               const Gdrive_Fileinfo* pFileinfo);
+
+/*
+ * gdrive_finfoarray_remove():  Removes one item from a fileinfo array.
+ * Parameters:
+ *      pArray (Gdrive_Fileinfo_Array*):
+ *              A pointer to the array.
+ *      pItem (const Gdrive_Fileinfo*):
+ *              The item to remove, as obtained from gdrive_finfoarray_get_*().
+ *              This pointer should not be used after the function returns.
+ * Return value (const Gdrive_Fileinfo*):
+ *      A pointer to the item that followed the removed item, or NULL if there
+ *      was none. This can be used to continue iterating over the array.
+ */
+const Gdrive_Fileinfo* 
+gdrive_finfoarray_remove(Gdrive_Fileinfo_Array* pArray, 
+                         const Gdrive_Fileinfo* pItem);
+
+/*
+ * gdrive_finfoarray_rename():  Changes the filename of one item in a fileinfo
+ *                              array.
+ * Parameters:
+ *      pArray (Gdrive_Fileinfo_Array*):
+ *              A pointer to the array.
+ *      pItem (const Gdrive_Fileinfo*):
+ *              The item to change, as obtained from gdrive_finfoarray_get_*().
+ *      newName (const char*):
+ *              The new filename. This is copied, so the caller keeps 
+ *              ownership.
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_finfoarray_rename(Gdrive_Fileinfo_Array* pArray, 
+                             const Gdrive_Fileinfo* pItem, 
+                             const char* newName);
+
 
 #ifdef	__cplusplus
 }
@@ -4,11 +4,12 @@
 #include "gdrive-info.h"
 #include "gdrive-cache.h"
 #include "gdrive-file.h"
+#include "gdrive-index.h"
+#include "gdrive-negcache.h"
 
 #include <sys/stat.h>
 #include <string.h>
 #include <ctype.h>
-#include <math.h>
 #include <assert.h>
 
 
@@ -25,15 +26,74 @@ enum GDRIVE_FINFO_TIME
     GDRIVE_FINFO_MTIME
 };
 
+// The keys of a Google Drive file resource that gdrive_finfo_read_json() uses
+enum GDRIVE_FINFO_FIELD
+{
+    GDRIVE_FINFO_FIELD_TITLE,
+    GDRIVE_FINFO_FIELD_ID,
+    GDRIVE_FINFO_FIELD_SIZE,
+    GDRIVE_FINFO_FIELD_MIMETYPE,
+    GDRIVE_FINFO_FIELD_PERMISSION,
+    GDRIVE_FINFO_FIELD_CTIME,
+    GDRIVE_FINFO_FIELD_MTIME,
+    GDRIVE_FINFO_FIELD_ATIME,
+    GDRIVE_FINFO_FIELD_PARENTS
+};
+
+static const Gdrive_Json_Field gdrive_finfo_fields[] = 
+{
+    {"title", GDRIVE_FINFO_FIELD_TITLE},
+    {"id", GDRIVE_FINFO_FIELD_ID},
+    {"fileSize", GDRIVE_FINFO_FIELD_SIZE},
+    {"mimeType", GDRIVE_FINFO_FIELD_MIMETYPE},
+    {"userPermission", GDRIVE_FINFO_FIELD_PERMISSION},
+    {"createdDate", GDRIVE_FINFO_FIELD_CTIME},
+    {"modifiedDate", GDRIVE_FINFO_FIELD_MTIME},
+    {"lastViewedByMeDate", GDRIVE_FINFO_FIELD_ATIME},
+    {"parents", GDRIVE_FINFO_FIELD_PARENTS}
+};
+
+#define GDRIVE_FINFO_NFIELDS \
+        ((int) (sizeof(gdrive_finfo_fields) / sizeof(gdrive_finfo_fields[0])))
+
+// The user's role for a file, from userPermission/role
+enum GDRIVE_FINFO_ROLE
+{
+    // No role was given
+    GDRIVE_FINFO_ROLE_NONE,
+    // A role that doesn't give any access that we know of
+    GDRIVE_FINFO_ROLE_OTHER,
+    GDRIVE_FINFO_ROLE_OWNER,
+    GDRIVE_FINFO_ROLE_WRITER,
+    GDRIVE_FINFO_ROLE_READER
+};
+
 
 /*************************************************************************
  * Private struct and declarations of private functions for use within 
  * this file
  *************************************************************************/
 
+// What gdrive_finfo_read_json() has found so far
+typedef struct Gdrive_Finfo_Reader
+{
+    Gdrive_Fileinfo* pFileinfo;
+    enum GDRIVE_FINFO_ROLE role;
+} Gdrive_Finfo_Reader;
+
+static void gdrive_finfo_read_field(int field, Gdrive_Json_Object* pValue, 
+                                    void* userdata);
+
+static void gdrive_finfo_read_string(char** pDest, Gdrive_Json_Object* pValue);
+
+static void gdrive_finfo_read_time(struct timespec* pDest, 
+                                   Gdrive_Json_Object* pValue);
+
 static int gdrive_rfc3339_to_epoch_timens(const char* rfcTime, 
                                           struct timespec* pResultTime);
 
+static bool gdrive_rfc3339_digits(const char** pStr, int count, int* pResult);
+
 static size_t gdrive_epoch_timens_to_rfc3339(char* dest, size_t max, 
                                              const struct timespec* ts);
 
@@ -69,38 +129,58 @@ const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
         // Don't need to do anything else.
         return pFileinfo;
     }
+    if (gdrive_idx_contains(fileId))
+    {
+        // Already filled in from the full index. Only the child count needs
+        // to account for queued changes, and listing from the index is cheap.
+        if (pFileinfo->type == GDRIVE_FILETYPE_FOLDER)
+        {
+            Gdrive_Fileinfo_Array* pFileArray = gdrive_folder_list(fileId);
+            pFileinfo->nChildren = (pFileArray != NULL) ? 
+                gdrive_finfoarray_get_count(pFileArray) : 
+                GDRIVE_FINFO_CHILDREN_UNKNOWN;
+            gdrive_finfoarray_free(pFileArray);
+        }
+        return pFileinfo;
+    }
     // else it wasn't cached, need to fill in the struct
     
+    // A file that was found is cached from now on, but one that doesn't exist
+    // isn't. Remember that answer for a moment, in the form of 
+    // "info:<fileId>".
+    char* key = malloc(strlen("info:") + strlen(fileId) + 1);
+    if (key == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    strcpy(key, "info:");
+    strcat(key, fileId);
+    if (gdrive_negcache_has(key))
+    {
+        free(key);
+        return NULL;
+    }
+    
     // Prepare the request
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
     if (pTransfer == NULL)
     {
         // Memory error
+        free(key);
         return NULL;
     }
     gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
     
-    // Add the URL.
-    // String to hold the url.  Add 2 to the end to account for the '/' before
-    // the file ID, as well as the terminating null.
-    char* baseUrl = malloc(strlen(GDRIVE_URL_FILES) + strlen(fileId) + 2);
-    if (baseUrl == NULL)
-    {
-        // Memory error.
-        gdrive_xfer_free(pTransfer);
-        return NULL;
-    }
-    strcpy(baseUrl, GDRIVE_URL_FILES);
-    strcat(baseUrl, "/");
-    strcat(baseUrl, fileId);
-    if (gdrive_xfer_set_url(pTransfer, baseUrl) != 0)
+    // Add the URL, in the form of "<GDRIVE_URL_FILES>/<fileId>".
+    if (gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_FILES, fileId, NULL) 
+            != 0)
     {
         // Error
-        free(baseUrl);
         gdrive_xfer_free(pTransfer);
+        free(key);
         return NULL;
     }
-    free(baseUrl);
     
     // Add query parameters
     if (gdrive_xfer_add_query(pTransfer, "fields", 
@@ -110,6 +190,7 @@ const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
     {
         // Error
         gdrive_xfer_free(pTransfer);
+        free(key);
         return NULL;
     }
     
@@ -120,6 +201,7 @@ const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
     if (pBuf == NULL)
     {
         // Download error
+        free(key);
         return NULL;
     }
     
@@ -127,9 +209,15 @@ const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
     {
         // Server returned an error that couldn't be retried, or continued
         // returning an error after retrying
+        if (gdrive_dlbuf_get_httpresp(pBuf) == 404)
+        {
+            gdrive_negcache_add(key);
+        }
         gdrive_dlbuf_free(pBuf);
+        free(key);
         return NULL;
     }
+    free(key);
     
     // If we're here, we have a good response.  Extract the ID from the 
     // response.
@@ -145,20 +233,12 @@ const Gdrive_Fileinfo* gdrive_finfo_get_by_id(const char* fileId)
         return NULL;
     }
     
+    // Folders aren't listed here. The number of children is only needed to 
+    // tell whether a folder is empty, and gdrive_folder_is_empty() can find 
+    // that out much more cheaply when it's actually needed.
     gdrive_finfo_read_json(pFileinfo, pObj);
     gdrive_json_kill(pObj);
     
-    // If it's a folder, get the number of children.
-    if (pFileinfo->type == GDRIVE_FILETYPE_FOLDER)
-    {
-        Gdrive_Fileinfo_Array* pFileArray = gdrive_folder_list(fileId);
-        if (pFileArray != NULL)
-        {
-            
-            pFileinfo->nChildren = gdrive_finfoarray_get_count(pFileArray);
-        }
-        gdrive_finfoarray_free(pFileArray);
-    }
     return pFileinfo;
 }
 
@@ -236,104 +316,45 @@ int gdrive_finfo_set_mtime(Gdrive_Fileinfo* pFileinfo,
 void gdrive_finfo_read_json(Gdrive_Fileinfo* pFileinfo, 
                             Gdrive_Json_Object* pObj)
 {
-    long length = 0;
-    gdrive_json_realloc_string(pObj, "title", &(pFileinfo->filename), &length);
-    length = 0;
-    gdrive_json_realloc_string(pObj, "id", &(pFileinfo->id), &length);
-    bool success;
-    pFileinfo->size = gdrive_json_get_int64(pObj, "fileSize", true, &success);
-    if (!success)
-    {
-        pFileinfo->size = 0;
-    }
+    // Anything that's missing gets these values (or, for the strings, type
+    // and permissions, keeps its old value).
+    pFileinfo->size = 0;
+    memset(&(pFileinfo->creationTime), 0, sizeof(struct timespec));
+    memset(&(pFileinfo->modificationTime), 0, sizeof(struct timespec));
+    memset(&(pFileinfo->accessTime), 0, sizeof(struct timespec));
+    pFileinfo->nParents = -1;
     
-    char* mimeType = gdrive_json_get_new_string(pObj, "mimeType", NULL);
-    if (mimeType != NULL)
-    {
-        if (strcmp(mimeType, GDRIVE_MIMETYPE_FOLDER) == 0)
-        {
-            // Folder
-            pFileinfo->type = GDRIVE_FILETYPE_FOLDER;
-        }
-        else if (false)
-        {
-            // TODO: Add any other special file types.  This
-            // will likely include Google Docs.
-        }
-        else
-        {
-            // Regular file
-            pFileinfo->type = GDRIVE_FILETYPE_FILE;
-        }
-        free(mimeType);
-    }
+    // Go through the object once, instead of looking up each key separately.
+    Gdrive_Finfo_Reader reader = {pFileinfo, GDRIVE_FINFO_ROLE_NONE};
+    gdrive_json_walk(pObj, gdrive_finfo_fields, GDRIVE_FINFO_NFIELDS, 
+                     gdrive_finfo_read_field, &reader);
     
-    // Get the user's permissions for the file on the Google Drive account.
-    char* role = gdrive_json_get_new_string(pObj, "userPermission/role", NULL);
-    if (role != NULL)
+    // The permissions depend on the type, which may have come later.
+    if (reader.role != GDRIVE_FINFO_ROLE_NONE)
     {
-        int basePerm = 0;
-        if (strcmp(role, "owner") == 0)
-        {
-            // Full read-write access
-            basePerm = S_IWOTH | S_IROTH;
-        }
-        else if (strcmp(role, "writer") == 0)
-        {
-            // Full read-write access
-            basePerm = S_IWOTH | S_IROTH;
-        }
-        else if (strcmp(role, "reader") == 0)
+        switch (reader.role)
         {
-            // Read-only access
-            basePerm = S_IROTH;
+            case GDRIVE_FINFO_ROLE_OWNER:
+            case GDRIVE_FINFO_ROLE_WRITER:
+                // Full read-write access
+                pFileinfo->basePermission = S_IWOTH | S_IROTH;
+                break;
+            case GDRIVE_FINFO_ROLE_READER:
+                // Read-only access
+                pFileinfo->basePermission = S_IROTH;
+                break;
+            default:
+                pFileinfo->basePermission = 0;
+                break;
         }
         
-        pFileinfo->basePermission = basePerm;
-        
         // Directories need read and execute permissions to be navigable, and 
         // write permissions to create files. 
         if (pFileinfo->type == GDRIVE_FILETYPE_FOLDER)
         {
             pFileinfo->basePermission = S_IROTH | S_IWOTH | S_IXOTH;
         }
-        free(role);
-    }
-    
-    char* cTime = gdrive_json_get_new_string(pObj, "createdDate", NULL);
-    if (cTime == NULL || 
-            gdrive_rfc3339_to_epoch_timens
-            (cTime, &(pFileinfo->creationTime)) != 0)
-    {
-        // Didn't get a createdDate or failed to convert it.
-        memset(&(pFileinfo->creationTime), 0, sizeof(struct timespec));
     }
-    free(cTime);
-    
-    char* mTime = gdrive_json_get_new_string(pObj, "modifiedDate", NULL);
-    if (mTime == NULL || 
-            gdrive_rfc3339_to_epoch_timens
-            (mTime, &(pFileinfo->modificationTime)) != 0)
-    {
-        // Didn't get a modifiedDate or failed to convert it.
-        memset(&(pFileinfo->modificationTime), 0, sizeof(struct timespec));
-    }
-    free(mTime);
-    
-    char* aTime = gdrive_json_get_new_string(pObj, 
-            "lastViewedByMeDate", 
-            NULL
-    );
-    if (aTime == NULL || 
-            gdrive_rfc3339_to_epoch_timens
-            (aTime, &(pFileinfo->accessTime)) != 0)
-    {
-        // Didn't get an accessed date or failed to convert it.
-        memset(&(pFileinfo->accessTime), 0, sizeof(struct timespec));
-    }
-    free(aTime);
-    
-    pFileinfo->nParents = gdrive_json_array_length(pObj, "parents");
     
     pFileinfo->dirtyMetainfo = false;
 }
@@ -353,89 +374,253 @@ unsigned int gdrive_finfo_real_perms(const Gdrive_Fileinfo* pFileinfo)
  * Implementations of private functions for use within this file
  *************************************************************************/
 
-static int gdrive_rfc3339_to_epoch_timens(const char* rfcTime, 
-                                          struct timespec* pResultTime)
+/*
+ * Stores one key of a file resource, found by gdrive_json_walk(), in the 
+ * Gdrive_Finfo_Reader pointed to by userdata.
+ */
+static void gdrive_finfo_read_field(int field, Gdrive_Json_Object* pValue, 
+                                    void* userdata)
 {
-    // Get the time down to seconds. Don't do anything with it yet, because
-    // we still need to confirm the timezone.
-    struct tm epochTime = {0};
-    char* remainder = strptime(rfcTime, "%Y-%m-%dT%H:%M:%S", &epochTime);
-    if (remainder == NULL)
+    Gdrive_Finfo_Reader* pReader = userdata;
+    Gdrive_Fileinfo* pFileinfo = pReader->pFileinfo;
+    const char* str;
+    bool success;
+    
+    switch (field)
     {
-        // Conversion failure.  
-        return -1;
+        case GDRIVE_FINFO_FIELD_TITLE:
+            gdrive_finfo_read_string(&(pFileinfo->filename), pValue);
+            break;
+            
+        case GDRIVE_FINFO_FIELD_ID:
+            gdrive_finfo_read_string(&(pFileinfo->id), pValue);
+            break;
+            
+        case GDRIVE_FINFO_FIELD_SIZE:
+            // Google Drive sends the size as a string.
+            pFileinfo->size = gdrive_json_get_int64(pValue, NULL, true, 
+                                                    &success);
+            if (!success)
+            {
+                pFileinfo->size = 0;
+            }
+            break;
+            
+        case GDRIVE_FINFO_FIELD_MIMETYPE:
+            str = gdrive_json_peek_string(pValue, NULL, NULL);
+            if (str == NULL)
+            {
+                break;
+            }
+            if (strcmp(str, GDRIVE_MIMETYPE_FOLDER) == 0)
+            {
+                // Folder
+                pFileinfo->type = GDRIVE_FILETYPE_FOLDER;
+                pFileinfo->nChildren = GDRIVE_FINFO_CHILDREN_UNKNOWN;
+            }
+            else
+            {
+                // Regular file. TODO: Add any other special file types. 
+                // This will likely include Google Docs.
+                pFileinfo->type = GDRIVE_FILETYPE_FILE;
+                pFileinfo->nChildren = 0;
+            }
+            break;
+            
+        case GDRIVE_FINFO_FIELD_PERMISSION:
+            // Get the user's permissions for the file on the Google Drive 
+            // account.
+            str = gdrive_json_peek_string(pValue, "role", NULL);
+            if (str == NULL)
+            {
+                break;
+            }
+            if (strcmp(str, "owner") == 0)
+            {
+                pReader->role = GDRIVE_FINFO_ROLE_OWNER;
+            }
+            else if (strcmp(str, "writer") == 0)
+            {
+                pReader->role = GDRIVE_FINFO_ROLE_WRITER;
+            }
+            else if (strcmp(str, "reader") == 0)
+            {
+                pReader->role = GDRIVE_FINFO_ROLE_READER;
+            }
+            else
+            {
+                pReader->role = GDRIVE_FINFO_ROLE_OTHER;
+            }
+            break;
+            
+        case GDRIVE_FINFO_FIELD_CTIME:
+            gdrive_finfo_read_time(&(pFileinfo->creationTime), pValue);
+            break;
+            
+        case GDRIVE_FINFO_FIELD_MTIME:
+            gdrive_finfo_read_time(&(pFileinfo->modificationTime), pValue);
+            break;
+            
+        case GDRIVE_FINFO_FIELD_ATIME:
+            gdrive_finfo_read_time(&(pFileinfo->accessTime), pValue);
+            break;
+            
+        case GDRIVE_FINFO_FIELD_PARENTS:
+            pFileinfo->nParents = gdrive_json_array_length(pValue, NULL);
+            break;
+            
+        default:
+            break;
     }
-    
-    // Get the fraction of a second.  The remainder variable points to the next 
-    // character after seconds.  If and only if there are fractional seconds 
-    // (which Google Drive does use but which are optional per the RFC 3339 
-    // specification),  this will be the '.' character.
-    if (*remainder == '.')
+}
+
+/*
+ * Copies a JSON string into *pDest, reusing the existing memory if there is
+ * any. Leaves *pDest alone if pValue isn't a string or on memory error.
+ */
+static void gdrive_finfo_read_string(char** pDest, Gdrive_Json_Object* pValue)
+{
+    int length = 0;
+    const char* str = gdrive_json_peek_string(pValue, NULL, &length);
+    if (str == NULL)
     {
-        // Rather than getting the integer after the decimal and needing to 
-        // count digits or count leading "0" characters, it's easier just to
-        // get a floating point (or double) fraction between 0 and 1, then
-        // multiply by 1000000000 to get nanoseconds.
-        char* start = remainder;
-        pResultTime->tv_nsec = lround(1000000000L * strtod(start, &remainder));
+        return;
     }
-    else
+    char* newDest = realloc(*pDest, length + 1);
+    if (newDest == NULL)
     {
-        // No fractional part.
-        pResultTime->tv_nsec = 0;
+        // Memory error
+        return;
     }
-    
-    // Get the timezone offset from UTC. Google Drive appears to use UTC (offset
-    // is "Z"), but I don't know whether that's guaranteed. If not using UTC,
-    // the offset will start with either '+' or '-'.
-    if (*remainder != '+' && *remainder != '-' && toupper(*remainder) != 'Z')
+    memcpy(newDest, str, length + 1);
+    *pDest = newDest;
+}
+
+/*
+ * Converts a JSON RFC 3339 time string into *pDest, or leaves it alone if
+ * pValue isn't a valid time.
+ */
+static void gdrive_finfo_read_time(struct timespec* pDest, 
+                                   Gdrive_Json_Object* pValue)
+{
+    const char* str = gdrive_json_peek_string(pValue, NULL, NULL);
+    struct timespec result;
+    if (str != NULL && gdrive_rfc3339_to_epoch_timens(str, &result) == 0)
     {
-        // Invalid offset.
+        *pDest = result;
+    }
+}
+
+/*
+ * Converts a time in the form "YYYY-MM-DDTHH:MM:SS[.fraction](Z|+HH:MM|-HH:MM)"
+ * into seconds and nanoseconds since the epoch. Returns 0 on success, other 
+ * on failure (in which case *pResultTime may have been changed). Works 
+ * directly from the calendar date, so the local timezone doesn't matter.
+ */
+static int gdrive_rfc3339_to_epoch_timens(const char* rfcTime, 
+                                          struct timespec* pResultTime)
+{
+    const char* str = rfcTime;
+    int year, month, day, hour, minute, second;
+    if (!gdrive_rfc3339_digits(&str, 4, &year) || *str++ != '-' || 
+            !gdrive_rfc3339_digits(&str, 2, &month) || *str++ != '-' || 
+            !gdrive_rfc3339_digits(&str, 2, &day) || 
+            toupper(*str++) != 'T' || 
+            !gdrive_rfc3339_digits(&str, 2, &hour) || *str++ != ':' || 
+            !gdrive_rfc3339_digits(&str, 2, &minute) || *str++ != ':' || 
+            !gdrive_rfc3339_digits(&str, 2, &second)
+        )
+    {
+        // Conversion failure
         return -1;
     }
-    if (toupper(*remainder) != 'Z')
+    if (month < 1 || month > 12 || day < 1 || day > 31 || 
+            hour > 23 || minute > 59 || second > 60)
     {
-        // Get the hour portion of the offset.
-        char* start = remainder;
-        long offHour = strtol(start, &remainder, 10);
-        if (remainder != start + 2 || *remainder != ':')
+        // Out of range (60 seconds is allowed for leap seconds)
+        return -1;
+    }
+    
+    // Get the fraction of a second, which Google Drive does use but which is
+    // optional per the RFC 3339 specification. Digits past nanoseconds are
+    // ignored.
+    long nsec = 0;
+    if (*str == '.')
+    {
+        str++;
+        if (*str < '0' || *str > '9')
         {
-            // Invalid offset, not in the form of "+HH:MM" / "-HH:MM"
+            // Invalid fraction
             return -1;
         }
-        
-        // Get the minute portion of the offset
-        start = remainder + 1;
-        long offMinute = strtol(start, &remainder, 10);
-        if (remainder != start + 2)
+        long scale = 100000000L;
+        for (; *str >= '0' && *str <= '9'; str++)
         {
-            // Invalid offset, minute isn't a 2-digit number.
-            return -1;
+            nsec += (*str - '0') * scale;
+            scale /= 10;
         }
-        
-        // Subtract the offset from the hour/minute parts of the tm struct.
-        // This may give out-of-range values (e.g., tm_hour could be -2 or 26),
-        // but mktime() is supposed to handle those.
-        epochTime.tm_hour -= offHour;
-        epochTime.tm_min -= offMinute;
     }
     
-    // Convert the broken-down time into seconds.
-    pResultTime->tv_sec = mktime(&epochTime);
-    
-    // Failure if mktime returned -1, success otherwise.
-    if (pResultTime->tv_sec == (time_t) (-1))
+    // Get the timezone offset from UTC. Google Drive appears to use UTC 
+    // (offset is "Z"), but I don't know whether that's guaranteed.
+    long offset = 0;
+    if (*str == '+' || *str == '-')
+    {
+        int sign = (*str == '-') ? -1 : 1;
+        str++;
+        int offHour, offMinute;
+        if (!gdrive_rfc3339_digits(&str, 2, &offHour) || *str++ != ':' || 
+                !gdrive_rfc3339_digits(&str, 2, &offMinute))
+        {
+            // Invalid offset, not in the form of "+HH:MM" / "-HH:MM"
+            return -1;
+        }
+        offset = sign * (offHour * 3600L + offMinute * 60L);
+    }
+    else if (toupper(*str) != 'Z')
     {
+        // Invalid offset.
         return -1;
     }
     
-    // Correct for local timezone, converting back to UTC
-    // (Probably unnecessary to call tzset(), but it doesn't hurt)
-    tzset();
-    pResultTime->tv_sec -= timezone;
+    // Count the days since 1970-01-01, using years that start in March so 
+    // that the leap day comes last.
+    int y = (month <= 2) ? year - 1 : year;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yearOfEra = y - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + 
+            dayOfYear;
+    int64_t days = (int64_t) era * 146097 + dayOfEra - 719468;
+    
+    pResultTime->tv_sec = (time_t) (days * 86400 + hour * 3600L + 
+            minute * 60L + second - offset);
+    pResultTime->tv_nsec = nsec;
     return 0;
 }
 
+/*
+ * Reads exactly count decimal digits from *pStr into *pResult, and moves 
+ * *pStr past them. Returns true on success, false if there aren't enough 
+ * digits.
+ */
+static bool gdrive_rfc3339_digits(const char** pStr, int count, int* pResult)
+{
+    int result = 0;
+    for (int i = 0; i < count; i++)
+    {
+        char c = (*pStr)[i];
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    *pStr += count;
+    *pResult = result;
+    return true;
+}
+
 static size_t gdrive_epoch_timens_to_rfc3339(char* dest, size_t max, 
                                              const struct timespec* ts)
 {
@@ -485,9 +670,9 @@ static int gdrive_finfo_set_time(Gdrive_Fileinfo* pFileinfo,
     
     // Set current time if ts is a NULL pointer
     const struct timespec* pTime = ts;
+    struct timespec currentTime;
     if (pTime == NULL)
     {
-        struct timespec currentTime;
         if (clock_gettime(CLOCK_REALTIME, &currentTime) != 0)
         {
             // Fail
@@ -510,4 +695,4 @@ static int gdrive_finfo_set_time(Gdrive_Fileinfo* pFileinfo,
     // of pFileinfo)/
     *pDest = *pTime;
     return 0;
-}
\ No newline at end of file
+}
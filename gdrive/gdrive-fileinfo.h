@@ -27,6 +27,9 @@ typedef struct Gdrive_Fileinfo Gdrive_Fileinfo;
 
 #define GDRIVE_TIMESTRING_LENGTH 31
 
+// nChildren of a folder whose contents haven't been counted
+#define GDRIVE_FINFO_CHILDREN_UNKNOWN (-1)
+
     
 typedef struct Gdrive_Fileinfo
 {
@@ -45,7 +48,9 @@ typedef struct Gdrive_Fileinfo
     struct timespec accessTime;
     // nParents: Number of parent directories
     int nParents;
-    // nChildren: Number of children if type is GDRIVE_FILETYPE_FOLDER
+    // nChildren: Number of children if type is GDRIVE_FILETYPE_FOLDER, or
+    // GDRIVE_FINFO_CHILDREN_UNKNOWN if the folder hasn't been listed. Use
+    // gdrive_folder_is_empty() to find out whether a folder is empty.
     int nChildren;
     // dirtyMetainfo: Currently only tracks accessTime and modificationTime
     bool dirtyMetainfo;
@@ -0,0 +1,364 @@
+
+
+#include "gdrive-hedge.h"
+#include "gdrive-ratelimit.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+// Longest time (in milliseconds) to wait for activity before checking again
+#define GDRIVE_HEDGE_POLL_MS 1000
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+typedef struct Gdrive_Hedge_Latency
+{
+    // samples: Milliseconds from sending a request until its response
+    // started to arrive, oldest overwritten first
+    long samples[GDRIVE_HEDGE_SAMPLES];
+    int count;
+    int next;
+} Gdrive_Hedge_Latency;
+
+typedef struct Gdrive_Hedge_State
+{
+    // multiHandle: Performs every hedgeable request, so that connections are
+    // kept open from one request to the next.
+    CURLM* multiHandle;
+    Gdrive_Hedge_Latency latency[GDRIVE_CLASS_COUNT];
+    // Totals for the report
+    unsigned long nHedged;
+    unsigned long nWon;
+} Gdrive_Hedge_State;
+
+// One copy of a request in the race
+typedef struct Gdrive_Hedge_Copy
+{
+    CURL* curlHandle;
+    Gdrive_Download_Buffer* pBuf;
+    bool active;
+} Gdrive_Hedge_Copy;
+
+static Gdrive_Hedge_State* gdrive_hedge_get_internal(void);
+
+static long gdrive_hedge_now(void);
+
+static long gdrive_hedge_get_delay(const Gdrive_Hedge_Latency* pLatency);
+
+static void gdrive_hedge_record(Gdrive_Hedge_Latency* pLatency, long ms);
+
+static int gdrive_hedge_compare(const void* a, const void* b);
+
+static bool gdrive_hedge_launch(Gdrive_Hedge_State* pState,
+                                enum Gdrive_Request_Class requestClass,
+                                Gdrive_Hedge_Copy* pFirst,
+                                Gdrive_Hedge_Copy* pSecond);
+
+static void gdrive_hedge_cancel(Gdrive_Hedge_State* pState,
+                                Gdrive_Hedge_Copy* pCopy);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+void gdrive_hedge_cleanup(void)
+{
+    Gdrive_Hedge_State* pState = gdrive_hedge_get_internal();
+    if (pState->multiHandle != NULL)
+    {
+        curl_multi_cleanup(pState->multiHandle);
+        pState->multiHandle = NULL;
+    }
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+CURLcode gdrive_hedge_download(Gdrive_Download_Buffer* pBuf, CURL* curlHandle,
+                               enum Gdrive_Request_Class requestClass)
+{
+    Gdrive_Hedge_State* pState = gdrive_hedge_get_internal();
+    if (pState->multiHandle == NULL)
+    {
+        pState->multiHandle = curl_multi_init();
+    }
+    if (pState->multiHandle == NULL)
+    {
+        // Memory error. Send the request the usual way.
+        return gdrive_dlbuf_download(pBuf, curlHandle);
+    }
+
+    Gdrive_Hedge_Latency* pLatency = &pState->latency[requestClass];
+    long delay = gdrive_hedge_get_delay(pLatency);
+    long start = gdrive_hedge_now();
+
+    Gdrive_Hedge_Copy copies[2] =
+    {
+        {.curlHandle = curlHandle, .pBuf = pBuf, .active = true},
+        {.curlHandle = NULL, .pBuf = NULL, .active = false}
+    };
+    gdrive_dlbuf_attach(pBuf, curlHandle);
+    if (curl_multi_add_handle(pState->multiHandle, curlHandle) != CURLM_OK)
+    {
+        // Send the request the usual way.
+        return gdrive_dlbuf_download(pBuf, curlHandle);
+    }
+
+    // used: The copy whose result counts, which is the first one to succeed,
+    // or the last one to fail.
+    int used = 0;
+    CURLcode result = CURLE_FAILED_INIT;
+    bool hedged = false;
+    bool responded = false;
+    while (copies[0].active || copies[1].active)
+    {
+        int running;
+        if (curl_multi_perform(pState->multiHandle, &running) != CURLM_OK)
+        {
+            // Give up on both copies.
+            for (int i = 0; i < 2; i++)
+            {
+                if (copies[i].active)
+                {
+                    gdrive_hedge_cancel(pState, &copies[i]);
+                }
+            }
+            break;
+        }
+        long elapsed = gdrive_hedge_now() - start;
+
+        // Once one copy has started to answer, there's no need for a copy
+        // that hasn't.
+        for (int i = 0; i < 2 && !responded; i++)
+        {
+            if (copies[i].active && 
+                    gdrive_dlbuf_get_responding(copies[i].pBuf))
+            {
+                responded = true;
+                gdrive_hedge_record(pLatency, elapsed);
+                Gdrive_Hedge_Copy* pOther = &copies[1 - i];
+                if (pOther->active &&
+                        !gdrive_dlbuf_get_responding(pOther->pBuf))
+                {
+                    gdrive_hedge_cancel(pState, pOther);
+                }
+            }
+        }
+
+        CURLMsg* pMsg;
+        int nMsgs;
+        while ((pMsg = curl_multi_info_read(pState->multiHandle, &nMsgs)) !=
+                NULL)
+        {
+            if (pMsg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            int i = (pMsg->easy_handle == copies[0].curlHandle) ? 0 : 1;
+            CURLcode copyResult = pMsg->data.result;
+            if (!copies[i].active)
+            {
+                // Already cancelled
+                continue;
+            }
+            gdrive_dlbuf_set_result(copies[i].pBuf, copies[i].curlHandle,
+                                    copyResult);
+            curl_multi_remove_handle(pState->multiHandle,
+                                     copies[i].curlHandle);
+            copies[i].active = false;
+
+            if (copyResult == CURLE_OK || !copies[1 - i].active)
+            {
+                used = i;
+                result = copyResult;
+                if (copies[1 - i].active)
+                {
+                    gdrive_hedge_cancel(pState, &copies[1 - i]);
+                }
+            }
+        }
+
+        if (!(copies[0].active || copies[1].active))
+        {
+            break;
+        }
+
+        // Send the second copy if the first is taking unusually long.
+        long wait = GDRIVE_HEDGE_POLL_MS;
+        if (!hedged && !responded && delay >= 0)
+        {
+            if (elapsed >= delay)
+            {
+                hedged = true;
+                if (gdrive_hedge_launch(pState, requestClass, &copies[0], 
+                                        &copies[1]))
+                {
+                    // Check on it right away.
+                    continue;
+                }
+            }
+            else if (delay - elapsed < wait)
+            {
+                wait = delay - elapsed;
+            }
+        }
+        curl_multi_wait(pState->multiHandle, NULL, 0, (int) wait, NULL);
+    }
+
+    if (used == 1)
+    {
+        gdrive_dlbuf_adopt(pBuf, copies[1].pBuf);
+        if (result == CURLE_OK)
+        {
+            pState->nWon++;
+        }
+    }
+    if (copies[1].curlHandle != NULL)
+    {
+        curl_easy_cleanup(copies[1].curlHandle);
+    }
+    gdrive_dlbuf_free(copies[1].pBuf);
+    return result;
+}
+
+void gdrive_hedge_print_stats(FILE* stream)
+{
+    Gdrive_Hedge_State* pState = gdrive_hedge_get_internal();
+    fprintf(stream, "  hedged requests: %lu sent twice, second copy answered "
+            "first %lu times\n", pState->nHedged, pState->nWon);
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Hedge_State* gdrive_hedge_get_internal(void)
+{
+    static Gdrive_Hedge_State state = {0};
+    return &state;
+}
+
+/*
+ * Returns the time in milliseconds on the monotonic clock.
+ */
+static long gdrive_hedge_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Returns how long (in milliseconds) to wait for a response before sending a
+ * second copy, which is the 95th percentile of recent response times, or -1
+ * if there aren't enough of them yet.
+ */
+static long gdrive_hedge_get_delay(const Gdrive_Hedge_Latency* pLatency)
+{
+    if (pLatency->count < GDRIVE_HEDGE_MIN_SAMPLES)
+    {
+        // Not enough to go on
+        return -1;
+    }
+    long sorted[GDRIVE_HEDGE_SAMPLES];
+    for (int i = 0; i < pLatency->count; i++)
+    {
+        sorted[i] = pLatency->samples[i];
+    }
+    qsort(sorted, pLatency->count, sizeof(long), gdrive_hedge_compare);
+    long delay = sorted[(pLatency->count * 95 + 99) / 100 - 1];
+    return (delay > GDRIVE_HEDGE_MIN_DELAY) ? delay : GDRIVE_HEDGE_MIN_DELAY;
+}
+
+static void gdrive_hedge_record(Gdrive_Hedge_Latency* pLatency, long ms)
+{
+    pLatency->samples[pLatency->next] = ms;
+    pLatency->next = (pLatency->next + 1) % GDRIVE_HEDGE_SAMPLES;
+    if (pLatency->count < GDRIVE_HEDGE_SAMPLES)
+    {
+        pLatency->count++;
+    }
+}
+
+static int gdrive_hedge_compare(const void* a, const void* b)
+{
+    long first = *(const long*) a;
+    long second = *(const long*) b;
+    return (first > second) - (first < second);
+}
+
+/*
+ * Starts pSecond as a copy of the request in pFirst, on a new connection.
+ * Returns true if it was sent, false if it couldn't be (including when it
+ * would have to wait for the rate limiter).
+ */
+static bool gdrive_hedge_launch(Gdrive_Hedge_State* pState,
+                                enum Gdrive_Request_Class requestClass,
+                                Gdrive_Hedge_Copy* pFirst,
+                                Gdrive_Hedge_Copy* pSecond)
+{
+    if (!gdrive_rate_try_acquire(requestClass))
+    {
+        // Not worth waiting for
+        return false;
+    }
+    
+    CURL* curlHandle = curl_easy_duphandle(pFirst->curlHandle);
+    Gdrive_Download_Buffer* pBuf = gdrive_dlbuf_create_rival(pFirst->pBuf);
+    if (curlHandle == NULL || pBuf == NULL)
+    {
+        // Memory error
+        if (curlHandle != NULL)
+        {
+            curl_easy_cleanup(curlHandle);
+        }
+        gdrive_dlbuf_free(pBuf);
+        return false;
+    }
+
+    // The first copy is probably stuck on its connection, so don't reuse
+    // one.
+    curl_easy_setopt(curlHandle, CURLOPT_FRESH_CONNECT, 1L);
+    gdrive_dlbuf_attach(pBuf, curlHandle);
+
+    // Keep the buffer and handle either way, so they get freed.
+    pSecond->curlHandle = curlHandle;
+    pSecond->pBuf = pBuf;
+    if (curl_multi_add_handle(pState->multiHandle, curlHandle) != CURLM_OK)
+    {
+        return false;
+    }
+    pSecond->active = true;
+    pState->nHedged++;
+    return true;
+}
+
+/*
+ * Abandons a copy of the request that is still going.
+ */
+static void gdrive_hedge_cancel(Gdrive_Hedge_State* pState,
+                                Gdrive_Hedge_Copy* pCopy)
+{
+    curl_multi_remove_handle(pState->multiHandle, pCopy->curlHandle);
+    gdrive_dlbuf_set_result(pCopy->pBuf, pCopy->curlHandle,
+                            CURLE_ABORTED_BY_CALLBACK);
+    pCopy->active = false;
+}
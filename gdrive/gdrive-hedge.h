@@ -0,0 +1,96 @@
+/*
+ * File:   gdrive-hedge.h
+ * Author: me
+ *
+ * Hedged requests. Now and then a request gets stuck, usually on a
+ * connection that has quietly stopped working, and takes far longer than
+ * usual to answer. When hedging is turned on (see gdrive_set_hedging()), a
+ * request that has had no response after longer than 95% of recent requests
+ * of the same class is sent a second time on a fresh connection, and
+ * whichever copy answers first is used. The other one is abandoned.
+ *
+ * Only requests that don't change anything (file information, listings and
+ * downloads) are hedged. The second copy is paced like any other request
+ * (see gdrive-ratelimit.h), and is simply not sent if it would have to wait.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_HEDGE_H
+#define	GDRIVE_HEDGE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "gdrive.h"
+#include "gdrive-download-buffer.h"
+
+#include <stdio.h>
+#include <curl/curl.h>
+
+
+// How many recent response times are kept for each class of request, and how
+// many are needed before any request is hedged
+#define GDRIVE_HEDGE_SAMPLES 64
+#define GDRIVE_HEDGE_MIN_SAMPLES 20
+// Never hedge sooner than this many milliseconds
+#define GDRIVE_HEDGE_MIN_DELAY 50
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+/*
+ * gdrive_hedge_cleanup():  Closes the connections kept for hedged requests.
+ *                          Should be called once no more requests will be
+ *                          made.
+ */
+void gdrive_hedge_cleanup(void);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_hedge_download(): Performs a transfer like gdrive_dlbuf_download(),
+ *                          sending a second copy of the request if the first
+ *                          is slow to answer.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The download buffer to store the results in, as for
+ *              gdrive_dlbuf_download(). Whichever copy of the request answers
+ *              first ends up here.
+ *      curlHandle (CURL*):
+ *              The curl handle for the request. It is not cleaned up.
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request, which decides how long is unusually long.
+ * Return value (CURLcode):
+ *      The result of the copy of the request that was used, as reported by
+ *      curl.
+ */
+CURLcode gdrive_hedge_download(Gdrive_Download_Buffer* pBuf, CURL* curlHandle,
+                               enum Gdrive_Request_Class requestClass);
+
+/*
+ * gdrive_hedge_print_stats():  Prints how many requests were sent a second
+ *                              time, and how often the second copy answered
+ *                              first.
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_hedge_print_stats(FILE* stream);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_HEDGE_H */
+
@@ -0,0 +1,172 @@
+
+
+#include "gdrive-id-pool.h"
+
+#include "gdrive-info.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+// How many IDs to hold at most, and how low the pool can get before
+// gdrive_idpool_fill() asks for more.
+#define GDRIVE_IDPOOL_SIZE 32
+#define GDRIVE_IDPOOL_LOW_WATER 8
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+typedef struct Gdrive_Id_Pool
+{
+    // used: Whether any ID has ever been taken. There's no point reserving
+    // IDs ahead of time until something actually needs them.
+    bool used;
+    int nIds;
+    char* ids[GDRIVE_IDPOOL_SIZE];
+} Gdrive_Id_Pool;
+
+static Gdrive_Id_Pool* gdrive_idpool_get_internal(void);
+
+static int gdrive_idpool_request(Gdrive_Id_Pool* pPool, int count);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+void gdrive_idpool_cleanup(void)
+{
+    Gdrive_Id_Pool* pPool = gdrive_idpool_get_internal();
+    for (int i = 0; i < pPool->nIds; i++)
+    {
+        free(pPool->ids[i]);
+        pPool->ids[i] = NULL;
+    }
+    pPool->nIds = 0;
+}
+
+
+/******************
+ * Getter and setter functions
+ ******************/
+
+char* gdrive_idpool_get(void)
+{
+    Gdrive_Id_Pool* pPool = gdrive_idpool_get_internal();
+    pPool->used = true;
+    if (pPool->nIds == 0 &&
+            gdrive_idpool_request(pPool, GDRIVE_IDPOOL_SIZE) != 0)
+    {
+        // Couldn't get any IDs
+        return NULL;
+    }
+
+    // Hand out the most recently added ID. The caller takes ownership.
+    pPool->nIds--;
+    char* fileId = pPool->ids[pPool->nIds];
+    pPool->ids[pPool->nIds] = NULL;
+    return fileId;
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+int gdrive_idpool_fill(void)
+{
+    Gdrive_Id_Pool* pPool = gdrive_idpool_get_internal();
+    if (!pPool->used || pPool->nIds >= GDRIVE_IDPOOL_LOW_WATER)
+    {
+        // Either nothing has needed an ID yet, or we still have plenty
+        return 0;
+    }
+    return gdrive_idpool_request(pPool, GDRIVE_IDPOOL_SIZE - pPool->nIds);
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Id_Pool* gdrive_idpool_get_internal(void)
+{
+    static Gdrive_Id_Pool pool = {0};
+    return &pool;
+}
+
+static int gdrive_idpool_request(Gdrive_Id_Pool* pPool, int count)
+{
+    if (count <= 0)
+    {
+        // Nothing to do
+        return 0;
+    }
+
+    char countString[12];
+    snprintf(countString, sizeof(countString), "%d", count);
+
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
+    if (
+            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_FILES "/generateIds") ||
+            gdrive_xfer_add_query(pTransfer, "maxResults", countString) ||
+            gdrive_xfer_add_query(pTransfer, "space", "drive") ||
+            gdrive_xfer_add_query(pTransfer, "fields", "ids")
+        )
+    {
+        // Error, probably memory
+        gdrive_xfer_free(pTransfer);
+        return -1;
+    }
+
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    {
+        // Download or request error
+        gdrive_dlbuf_free(pBuf);
+        return -1;
+    }
+
+    Gdrive_Json_Object* pObj =
+            gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+    gdrive_dlbuf_free(pBuf);
+    if (pObj == NULL)
+    {
+        // Couldn't convert network response to JSON
+        return -1;
+    }
+
+    int nReceived = gdrive_json_array_length(pObj, "ids");
+    for (int i = 0; i < nReceived && pPool->nIds < GDRIVE_IDPOOL_SIZE; i++)
+    {
+        Gdrive_Json_Object* pId = gdrive_json_array_get(pObj, "ids", i);
+        char* fileId = gdrive_json_get_new_string(pId, NULL, NULL);
+        if (fileId != NULL)
+        {
+            pPool->ids[pPool->nIds++] = fileId;
+        }
+    }
+    gdrive_json_kill(pObj);
+
+    return (pPool->nIds > 0) ? 0 : -1;
+}
@@ -0,0 +1,73 @@
+/*
+ * File:   gdrive-id-pool.h
+ * Author: me
+ *
+ * A small pool of file IDs reserved ahead of time with the Drive
+ * files.generateIds request. A new file or folder can be given one of these
+ * IDs immediately, before the request that actually creates it has been sent.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_ID_POOL_H
+#define	GDRIVE_ID_POOL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+// No constructors. The pool is a single struct instance that lives in static
+// memory for the lifetime of the application.
+
+/*
+ * gdrive_idpool_cleanup(): Frees any IDs remaining in the pool. Unused IDs are
+ *                          simply discarded, which is harmless.
+ */
+void gdrive_idpool_cleanup(void);
+
+
+/*************************************************************************
+ * Getter and setter functions
+ *************************************************************************/
+
+/*
+ * gdrive_idpool_get():     Takes one ID out of the pool, refilling the pool
+ *                          from Google Drive first if it is empty.
+ * Return value (char*):
+ *      A null-terminated string holding a file ID that has not been used for
+ *      any file, or NULL on error. The caller is responsible for freeing the
+ *      returned string.
+ */
+char* gdrive_idpool_get(void);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_idpool_fill():    Tops up the pool if it is running low, so that a
+ *                          later call to gdrive_idpool_get() does not need to
+ *                          wait on the network. Does nothing if the pool
+ *                          already holds enough IDs, or if no ID has ever been
+ *                          taken from it.
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_idpool_fill(void);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_ID_POOL_H */
+
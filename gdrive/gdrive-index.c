@@ -0,0 +1,1915 @@
+
+
+#include "gdrive-index.h"
+
+#include "gdrive-info.h"
+#include "gdrive-cache.h"
+#include "gdrive-pool.h"
+#include "gdrive-intern.h"
+#include "gdrive-json-stream.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+#define GDRIVE_IDX_INITIAL_BUCKETS 1024
+#define GDRIVE_IDX_PAGE_SIZE "1000"
+// Only what's needed to fill in a Gdrive_Fileinfo struct and find its parents
+#define GDRIVE_IDX_FILE_FIELDS "title,id,mimeType,fileSize,createdDate,"\
+                               "modifiedDate,lastViewedByMeDate,parents(id),"\
+                               "userPermission(role)"
+#define GDRIVE_IDX_LIST_FIELDS "items(" GDRIVE_IDX_FILE_FIELDS "),"\
+                               "nextPageToken"
+// The snapshot file within the cache directory
+#define GDRIVE_IDX_SNAPSHOT_NAME "index"
+#define GDRIVE_IDX_SNAPSHOT_TEMP_NAME "index.tmp"
+#define GDRIVE_IDX_MAGIC "FDRVIDX"
+#define GDRIVE_IDX_VERSION 1
+#define GDRIVE_IDX_NO_RECORD UINT32_MAX
+#define GDRIVE_IDX_MIN_SLOTS 16
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+/*
+ * A snapshot file holds the whole index in a form that can be used straight
+ * from a read-only mapping. It starts with a Gdrive_Idx_Header, followed by
+ * the sections the header points to, each starting on an 8-byte boundary:
+ * - One fixed-width Gdrive_Idx_Record per file.
+ * - The links, which list the record indices of each folder's children. Each
+ *   record points to its own run of links.
+ * - A hash table from file ID to record. Each slot holds a record index plus
+ *   one, or 0 if the slot is empty.
+ * - A hash table from a parent's record and a child's name to the child's
+ *   record, with a Gdrive_Idx_Name_Slot per slot.
+ * - The string table. Each distinct file ID and filename is stored once,
+ *   null-terminated, and records refer to it by offset.
+ * Both hash tables use open addressing with linear probing, and their sizes
+ * are powers of 2 with at least one empty slot. Numbers are stored in the
+ * byte order of the machine that wrote the file.
+ */
+typedef struct Gdrive_Idx_Header
+{
+    char magic[8];
+    uint32_t version;
+    // recordSize: Catches snapshots written with a different record layout
+    uint32_t recordSize;
+    // nextChangeId: The first change that isn't reflected in the snapshot
+    int64_t nextChangeId;
+    uint32_t nRecords;
+    uint32_t rootRecord;
+    uint32_t nLinks;
+    uint32_t idSlots;
+    uint32_t nameSlots;
+    uint32_t reserved;
+    uint64_t stringsSize;
+    uint64_t recordsOffset;
+    uint64_t linksOffset;
+    uint64_t idTableOffset;
+    uint64_t nameTableOffset;
+    uint64_t stringsOffset;
+} Gdrive_Idx_Header;
+
+typedef struct Gdrive_Idx_Record
+{
+    uint32_t idOffset;
+    uint32_t nameOffset;
+    uint32_t firstLink;
+    uint32_t nLinks;
+    uint64_t size;
+    int64_t creationSec;
+    int64_t modificationSec;
+    int64_t accessSec;
+    uint32_t creationNsec;
+    uint32_t modificationNsec;
+    uint32_t accessNsec;
+    uint32_t nParents;
+    uint32_t type;
+    uint32_t basePermission;
+} Gdrive_Idx_Record;
+
+typedef struct Gdrive_Idx_Name_Slot
+{
+    // Both are record indices plus one, or 0 if the slot is empty.
+    uint32_t parent;
+    uint32_t child;
+} Gdrive_Idx_Name_Slot;
+
+typedef struct Gdrive_Idx_Snapshot
+{
+    // pMap: The mapped file, or NULL if there is no snapshot (or, while a new
+    // snapshot is being written, if the sections are in ordinary memory)
+    void* pMap;
+    size_t mapSize;
+    const Gdrive_Idx_Header* pHeader;
+    const Gdrive_Idx_Record* pRecords;
+    const uint32_t* pLinks;
+    const uint32_t* pIdTable;
+    const Gdrive_Idx_Name_Slot* pNameTable;
+    const char* pStrings;
+} Gdrive_Idx_Snapshot;
+
+typedef struct Gdrive_Idx_Entry Gdrive_Idx_Entry;
+
+/*
+ * The entries in memory are an overlay on the snapshot, holding everything
+ * that has changed since the snapshot was written (or everything, if there is
+ * no snapshot). Where an entry is known or removed, it takes the place of the
+ * snapshot's record for the same file.
+ */
+struct Gdrive_Idx_Entry
+{
+    // known: Whether fileinfo has been filled in. An entry that isn't known
+    // only exists to hold the children of a folder that hasn't been seen yet
+    // (or has been removed), or to mark a file as removed. Its fileinfo.id is
+    // still set.
+    bool known;
+    // removed: Whether the file has been removed since the snapshot was
+    // written, so the snapshot's record no longer counts
+    bool removed;
+    // fileinfo.id, fileinfo.filename and the parent IDs are shared strings
+    // (see gdrive-intern.h).
+    Gdrive_Fileinfo fileinfo;
+    int nParents;
+    const char** parentIds;
+    // The children are owned by the index, not by their parent. For a folder
+    // in the snapshot, these are only the children that have changed.
+    int nChildren;
+    int maxChildren;
+    Gdrive_Idx_Entry** pChildren;
+    // Next entry in the same hash bucket
+    Gdrive_Idx_Entry* pNext;
+};
+
+typedef struct Gdrive_Index
+{
+    bool complete;
+    char* rootId;
+    Gdrive_Idx_Snapshot snapshot;
+    size_t nEntries;
+    size_t nBuckets;
+    Gdrive_Idx_Entry** pBuckets;
+} Gdrive_Index;
+
+// A list of file IDs. The strings belong to the index, not to the list.
+typedef struct Gdrive_Idx_Idlist
+{
+    int nIds;
+    int maxIds;
+    const char** ids;
+} Gdrive_Idx_Idlist;
+
+// A snapshot that is being put together in memory before it's written out
+typedef struct Gdrive_Idx_Writer
+{
+    Gdrive_Idx_Header header;
+    Gdrive_Idx_Record* pRecords;
+    uint32_t* pLinks;
+    size_t maxLinks;
+    uint32_t* pIdTable;
+    Gdrive_Idx_Name_Slot* pNameTable;
+    char* pStrings;
+    size_t maxStrings;
+    // Offsets plus one of the strings in pStrings, so that each string is
+    // only stored once
+    uint32_t* pStringSlots;
+    size_t nStringSlots;
+} Gdrive_Idx_Writer;
+
+static Gdrive_Index* gdrive_idx_get_internal(void);
+
+static Gdrive_Pool* gdrive_idx_get_pool(void);
+
+static void gdrive_idx_release_strings(Gdrive_Idx_Entry* pEntry,
+                                       bool keepId);
+
+static size_t gdrive_idx_hash(const char* fileId);
+
+static size_t gdrive_idx_name_hash(uint32_t parent, const char* name);
+
+static size_t gdrive_idx_slots_for(size_t count);
+
+static Gdrive_Idx_Entry*
+gdrive_idx_find(Gdrive_Index* pIndex, const char* fileId, bool create);
+
+static int gdrive_idx_grow(Gdrive_Index* pIndex);
+
+static void gdrive_idx_free_entries(Gdrive_Index* pIndex);
+
+static void gdrive_idx_free_if_unused(Gdrive_Index* pIndex,
+                                      Gdrive_Idx_Entry* pEntry);
+
+static void gdrive_idx_detach(Gdrive_Index* pIndex, Gdrive_Idx_Entry* pEntry);
+
+static void gdrive_idx_drop(Gdrive_Index* pIndex, Gdrive_Idx_Entry* pEntry);
+
+static int gdrive_idx_attach(Gdrive_Index* pIndex, Gdrive_Idx_Entry* pEntry,
+                             Gdrive_Json_Object* pObj);
+
+static int gdrive_idx_set(Gdrive_Index* pIndex, Gdrive_Json_Object* pObj);
+
+static int gdrive_idx_begin(Gdrive_Index* pIndex, Gdrive_Json_Object* pRoot);
+
+static int gdrive_idx_resume(Gdrive_Index* pIndex, Gdrive_Json_Object* pRoot);
+
+static int gdrive_idx_list_all(Gdrive_Index* pIndex,
+                               Gdrive_Json_Object* pRoot);
+
+static int gdrive_idx_set_streamed(Gdrive_Json_Object* pObj, void* userdata);
+
+static Gdrive_Json_Object*
+gdrive_idx_request(const char* url, const char* fields, const char* pageToken,
+                   Gdrive_Json_Stream* pStream);
+
+static bool gdrive_idx_masked(Gdrive_Index* pIndex, const char* fileId);
+
+static bool gdrive_idx_peek(Gdrive_Index* pIndex, const char* fileId,
+                            Gdrive_Fileinfo* pDest);
+
+static int gdrive_idx_child_ids(Gdrive_Index* pIndex, const char* folderId,
+                                Gdrive_Idx_Idlist* pList);
+
+static int gdrive_idx_idlist_add(Gdrive_Idx_Idlist* pList, const char* id);
+
+static uint32_t gdrive_idx_snap_find(const Gdrive_Idx_Snapshot* pSnap,
+                                     const char* fileId);
+
+static const char*
+gdrive_idx_snap_lookup_child(Gdrive_Index* pIndex, const char* parentId,
+                             const char* childName);
+
+static void gdrive_idx_snap_fileinfo(const Gdrive_Idx_Snapshot* pSnap,
+                                     uint32_t record, Gdrive_Fileinfo* pDest);
+
+static char* gdrive_idx_snapshot_path(const char* name);
+
+static int gdrive_idx_map(Gdrive_Idx_Snapshot* pSnap, const char* path);
+
+static void gdrive_idx_unmap(Gdrive_Idx_Snapshot* pSnap);
+
+static bool gdrive_idx_section_fits(uint64_t offset, uint64_t count,
+                                    size_t elementSize, size_t fileSize);
+
+static bool gdrive_idx_check_header(const Gdrive_Idx_Header* pHeader,
+                                    size_t fileSize);
+
+static bool gdrive_idx_check_sections(const Gdrive_Idx_Snapshot* pSnap);
+
+static int gdrive_idx_write_snapshot(Gdrive_Index* pIndex, const char* path);
+
+static int gdrive_idx_writer_init(Gdrive_Idx_Writer* pWriter,
+                                  size_t nRecords);
+
+static void gdrive_idx_writer_free(Gdrive_Idx_Writer* pWriter);
+
+static int64_t gdrive_idx_writer_intern(Gdrive_Idx_Writer* pWriter,
+                                        const char* str);
+
+static int gdrive_idx_writer_add_record(Gdrive_Idx_Writer* pWriter,
+                                        const Gdrive_Fileinfo* pFileinfo);
+
+static int gdrive_idx_writer_add_links(Gdrive_Idx_Writer* pWriter,
+                                       Gdrive_Index* pIndex);
+
+static int gdrive_idx_writer_add_names(Gdrive_Idx_Writer* pWriter);
+
+static int gdrive_idx_writer_output(Gdrive_Idx_Writer* pWriter,
+                                    const char* path);
+
+static int gdrive_idx_write_at(FILE* pFile, uint64_t offset,
+                               const void* pData, size_t size);
+
+static uint64_t gdrive_idx_align(uint64_t offset);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+int gdrive_idx_bootstrap(void)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    gdrive_idx_cleanup();
+
+    // The root folder never shows up in a listing, so ask for it separately.
+    Gdrive_Json_Object* pRoot =
+            gdrive_idx_request(GDRIVE_URL_FILES "/root", 
+                               GDRIVE_IDX_FILE_FIELDS, NULL, NULL);
+    if (pRoot == NULL)
+    {
+        // Download error
+        return -1;
+    }
+
+    // Start from the snapshot left by the last run if there is one, and only
+    // list everything if that doesn't work.
+    int result = gdrive_idx_resume(pIndex, pRoot);
+    if (result != 0)
+    {
+        gdrive_idx_cleanup();
+        result = gdrive_idx_list_all(pIndex, pRoot);
+    }
+    gdrive_json_kill(pRoot);
+
+    if (result != 0)
+    {
+        // A partial index would make files seem to be missing.
+        gdrive_idx_cleanup();
+        return -1;
+    }
+    return 0;
+}
+
+void gdrive_idx_cleanup(void)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    gdrive_idx_free_entries(pIndex);
+    gdrive_idx_unmap(&(pIndex->snapshot));
+    free(pIndex->rootId);
+    pIndex->rootId = NULL;
+    pIndex->complete = false;
+}
+
+
+/******************
+ * Getter and setter functions
+ ******************/
+
+bool gdrive_idx_is_complete(void)
+{
+    return gdrive_idx_get_internal()->complete;
+}
+
+bool gdrive_idx_contains(const char* fileId)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    Gdrive_Fileinfo fileinfo;
+    return pIndex->complete && gdrive_idx_peek(pIndex, fileId, &fileinfo);
+}
+
+int gdrive_idx_get_fileinfo(const char* fileId, Gdrive_Fileinfo* pDest)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    Gdrive_Fileinfo fileinfo;
+    if (!pIndex->complete || !gdrive_idx_peek(pIndex, fileId, &fileinfo))
+    {
+        return -1;
+    }
+
+    Gdrive_Idx_Idlist children = {0};
+    int result = gdrive_idx_child_ids(pIndex, fileId, &children);
+    free(children.ids);
+    if (result != 0)
+    {
+        // Memory error
+        return -1;
+    }
+
+    *pDest = fileinfo;
+    pDest->id = malloc(strlen(fileinfo.id) + 1);
+    pDest->filename = malloc(strlen(fileinfo.filename) + 1);
+    if (pDest->id == NULL || pDest->filename == NULL)
+    {
+        // Memory error
+        gdrive_finfo_cleanup(pDest);
+        return -1;
+    }
+    strcpy(pDest->id, fileinfo.id);
+    strcpy(pDest->filename, fileinfo.filename);
+    pDest->nChildren = children.nIds;
+    return 0;
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+int gdrive_idx_save(void)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    char* path = gdrive_idx_snapshot_path(GDRIVE_IDX_SNAPSHOT_NAME);
+    if (!pIndex->complete || path == NULL)
+    {
+        // Nothing to save, or nowhere to save it
+        free(path);
+        return 0;
+    }
+    int result = gdrive_idx_write_snapshot(pIndex, path);
+    free(path);
+    return result;
+}
+
+void gdrive_idx_print_stats(FILE* stream)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    if (!pIndex->complete)
+    {
+        return;
+    }
+    const Gdrive_Idx_Snapshot* pSnap = &(pIndex->snapshot);
+    unsigned long nRecords =
+            (pSnap->pHeader != NULL) ? pSnap->pHeader->nRecords : 0;
+    fprintf(stream, "  file index: %lu files in snapshot (%lu KiB mapped), "
+            "%lu entries in memory (%lu KiB of buckets)\n", nRecords,
+            (unsigned long) (pSnap->mapSize / 1024),
+            (unsigned long) pIndex->nEntries,
+            (unsigned long) (pIndex->nBuckets * sizeof(Gdrive_Idx_Entry*) /
+                             1024));
+}
+
+Gdrive_Fileinfo_Array* gdrive_idx_list(const char* folderId)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    if (!pIndex->complete)
+    {
+        return NULL;
+    }
+
+    Gdrive_Idx_Idlist children = {0};
+    if (gdrive_idx_child_ids(pIndex, folderId, &children) != 0)
+    {
+        // Memory error
+        free(children.ids);
+        return NULL;
+    }
+    Gdrive_Fileinfo_Array* pArray = gdrive_finfoarray_create(children.nIds);
+    for (int i = 0; pArray != NULL && i < children.nIds; i++)
+    {
+        Gdrive_Fileinfo fileinfo;
+        gdrive_idx_peek(pIndex, children.ids[i], &fileinfo);
+        if (gdrive_finfoarray_add_copy(pArray, &fileinfo) != 0)
+        {
+            // Memory error
+            gdrive_finfoarray_free(pArray);
+            pArray = NULL;
+        }
+    }
+    free(children.ids);
+    return pArray;
+}
+
+bool gdrive_idx_lookup_child(const char* parentId, const char* childName,
+                             char** pChildId)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    if (!pIndex->complete)
+    {
+        return false;
+    }
+
+    // Children that have changed since the snapshot are only in memory.
+    const char* childId = NULL;
+    Gdrive_Idx_Entry* pEntry = gdrive_idx_find(pIndex, parentId, false);
+    int nChildren = (pEntry != NULL) ? pEntry->nChildren : 0;
+    for (int i = 0; i < nChildren && childId == NULL; i++)
+    {
+        const Gdrive_Fileinfo* pChild = &(pEntry->pChildren[i]->fileinfo);
+        if (strcmp(pChild->filename, childName) == 0)
+        {
+            childId = pChild->id;
+        }
+    }
+    if (childId == NULL)
+    {
+        childId = gdrive_idx_snap_lookup_child(pIndex, parentId, childName);
+    }
+
+    *pChildId = NULL;
+    if (childId != NULL)
+    {
+        *pChildId = malloc(strlen(childId) + 1);
+        if (*pChildId == NULL)
+        {
+            // Memory error. Let the caller try the slow way.
+            return false;
+        }
+        strcpy(*pChildId, childId);
+    }
+    return true;
+}
+
+void gdrive_idx_update_from_json(Gdrive_Json_Object* pObj)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    if (!pIndex->complete || pObj == NULL)
+    {
+        return;
+    }
+
+    if (gdrive_idx_set(pIndex, pObj) != 0)
+    {
+        // The index no longer matches Google Drive, and there's no way to
+        // tell how far off it is. Go back to asking Google Drive.
+        fputs("fuse-drive: Couldn't update the file index, it will no longer "
+              "be used\n", stderr);
+        gdrive_idx_cleanup();
+    }
+}
+
+void gdrive_idx_remove(const char* fileId)
+{
+    Gdrive_Index* pIndex = gdrive_idx_get_internal();
+    if (!pIndex->complete)
+    {
+        return;
+    }
+    // A file that is only in the snapshot needs an entry to mark it removed.
+    bool inSnapshot = (gdrive_idx_snap_find(&(pIndex->snapshot), fileId) !=
+            GDRIVE_IDX_NO_RECORD);
+    Gdrive_Idx_Entry* pEntry = gdrive_idx_find(pIndex, fileId, inSnapshot);
+    if (pEntry != NULL)
+    {
+        gdrive_idx_drop(pIndex, pEntry);
+    }
+    else if (inSnapshot)
+    {
+        // Memory error
+        fputs("fuse-drive: Couldn't update the file index, it will no longer "
+              "be used\n", stderr);
+        gdrive_idx_cleanup();
+    }
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Index* gdrive_idx_get_internal(void)
+{
+    static Gdrive_Index index = {0};
+    return &index;
+}
+
+static Gdrive_Pool* gdrive_idx_get_pool(void)
+{
+    static Gdrive_Pool pool = GDRIVE_POOL_INIT("index entries",
+                                               Gdrive_Idx_Entry);
+    return &pool;
+}
+
+/*
+ * Lets go of the shared strings in an entry's fileinfo. If keepId is true,
+ * fileinfo.id is left alone.
+ */
+static void gdrive_idx_release_strings(Gdrive_Idx_Entry* pEntry,
+                                       bool keepId)
+{
+    gdrive_intern_release(pEntry->fileinfo.filename);
+    pEntry->fileinfo.filename = NULL;
+    if (!keepId)
+    {
+        gdrive_intern_release(pEntry->fileinfo.id);
+        pEntry->fileinfo.id = NULL;
+    }
+}
+
+static size_t gdrive_idx_hash(const char* fileId)
+{
+    // djb2
+    size_t hash = 5381;
+    for (const unsigned char* p = (const unsigned char*) fileId; *p; p++)
+    {
+        hash = hash * 33 + *p;
+    }
+    return hash;
+}
+
+static size_t gdrive_idx_name_hash(uint32_t parent, const char* name)
+{
+    return gdrive_idx_hash(name) ^ ((size_t) parent * 2654435761u);
+}
+
+/*
+ * Returns the number of hash table slots to use for the given number of
+ * items, a power of 2 that keeps the table at most half full.
+ */
+static size_t gdrive_idx_slots_for(size_t count)
+{
+    size_t slots = GDRIVE_IDX_MIN_SLOTS;
+    while (slots < count * 2)
+    {
+        slots *= 2;
+    }
+    return slots;
+}
+
+/*
+ * Finds the entry for a file ID. If there isn't one and create is true, adds
+ * an entry that isn't known yet. Returns NULL if there is no entry, or on
+ * memory error.
+ */
+static Gdrive_Idx_Entry*
+gdrive_idx_find(Gdrive_Index* pIndex, const char* fileId, bool create)
+{
+    if (pIndex->nBuckets > 0)
+    {
+        size_t bucket = gdrive_idx_hash(fileId) % pIndex->nBuckets;
+        for (Gdrive_Idx_Entry* pEntry = pIndex->pBuckets[bucket];
+                pEntry != NULL;
+                pEntry = pEntry->pNext)
+        {
+            if (strcmp(pEntry->fileinfo.id, fileId) == 0)
+            {
+                return pEntry;
+            }
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+
+    if (pIndex->nEntries >= pIndex->nBuckets && gdrive_idx_grow(pIndex) != 0)
+    {
+        // Memory error
+        return NULL;
+    }
+    Gdrive_Idx_Entry* pEntry = gdrive_pool_alloc(gdrive_idx_get_pool());
+    const char* id = gdrive_intern_get(fileId);
+    if (pEntry == NULL || id == NULL)
+    {
+        // Memory error
+        gdrive_pool_free(gdrive_idx_get_pool(), pEntry);
+        gdrive_intern_release(id);
+        return NULL;
+    }
+    pEntry->fileinfo.id = (char*) id;
+    size_t bucket = gdrive_idx_hash(fileId) % pIndex->nBuckets;
+    pEntry->pNext = pIndex->pBuckets[bucket];
+    pIndex->pBuckets[bucket] = pEntry;
+    pIndex->nEntries++;
+    return pEntry;
+}
+
+/*
+ * Doubles the number of hash buckets (or creates the first ones). Returns 0 on
+ * success, other on memory error.
+ */
+static int gdrive_idx_grow(Gdrive_Index* pIndex)
+{
+    size_t newCount = (pIndex->nBuckets > 0) ?
+        pIndex->nBuckets * 2 : GDRIVE_IDX_INITIAL_BUCKETS;
+    Gdrive_Idx_Entry** pNewBuckets =
+            calloc(newCount, sizeof(Gdrive_Idx_Entry*));
+    if (pNewBuckets == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    for (size_t i = 0; i < pIndex->nBuckets; i++)
+    {
+        Gdrive_Idx_Entry* pEntry = pIndex->pBuckets[i];
+        while (pEntry != NULL)
+        {
+            Gdrive_Idx_Entry* pNext = pEntry->pNext;
+            size_t bucket = gdrive_idx_hash(pEntry->fileinfo.id) % newCount;
+            pEntry->pNext = pNewBuckets[bucket];
+            pNewBuckets[bucket] = pEntry;
+            pEntry = pNext;
+        }
+    }
+    free(pIndex->pBuckets);
+    pIndex->pBuckets = pNewBuckets;
+    pIndex->nBuckets = newCount;
+    return 0;
+}
+
+/*
+ * Frees every entry in memory, leaving the snapshot alone.
+ */
+static void gdrive_idx_free_entries(Gdrive_Index* pIndex)
+{
+    for (size_t i = 0; i < pIndex->nBuckets; i++)
+    {
+        Gdrive_Idx_Entry* pEntry = pIndex->pBuckets[i];
+        while (pEntry != NULL)
+        {
+            Gdrive_Idx_Entry* pNext = pEntry->pNext;
+            gdrive_idx_release_strings(pEntry, false);
+            for (int j = 0; j < pEntry->nParents; j++)
+            {
+                gdrive_intern_release(pEntry->parentIds[j]);
+            }
+            free(pEntry->parentIds);
+            free(pEntry->pChildren);
+            gdrive_pool_free(gdrive_idx_get_pool(), pEntry);
+            pEntry = pNext;
+        }
+    }
+    free(pIndex->pBuckets);
+    pIndex->pBuckets = NULL;
+    pIndex->nBuckets = 0;
+    pIndex->nEntries = 0;
+}
+
+/*
+ * Frees an entry that is not known, not marking a removed file, and not
+ * holding any children.
+ */
+static void gdrive_idx_free_if_unused(Gdrive_Index* pIndex,
+                                      Gdrive_Idx_Entry* pEntry)
+{
+    if (pEntry->known || pEntry->removed || pEntry->nChildren > 0)
+    {
+        return;
+    }
+
+    size_t bucket = gdrive_idx_hash(pEntry->fileinfo.id) % pIndex->nBuckets;
+    Gdrive_Idx_Entry** ppEntry = &(pIndex->pBuckets[bucket]);
+    while (*ppEntry != pEntry)
+    {
+        ppEntry = &((*ppEntry)->pNext);
+    }
+    *ppEntry = pEntry->pNext;
+    pIndex->nEntries--;
+
+    gdrive_idx_release_strings(pEntry, false);
+    free(pEntry->parentIds);
+    free(pEntry->pChildren);
+    gdrive_pool_free(gdrive_idx_get_pool(), pEntry);
+}
+
+/*
+ * Removes an entry from the children of each of its parents, and forgets the
+ * parents.
+ */
+static void gdrive_idx_detach(Gdrive_Index* pIndex, Gdrive_Idx_Entry* pEntry)
+{
+    for (int i = 0; i < pEntry->nParents; i++)
+    {
+        Gdrive_Idx_Entry* pParent =
+                gdrive_idx_find(pIndex, pEntry->parentIds[i], false);
+        gdrive_intern_release(pEntry->parentIds[i]);
+        if (pParent == NULL)
+        {
+            continue;
+        }
+        for (int j = 0; j < pParent->nChildren; j++)
+        {
+            if (pParent->pChildren[j] == pEntry)
+            {
+                pParent->nChildren--;
+                pParent->pChildren[j] =
+                        pParent->pChildren[pParent->nChildren];
+                break;
+            }
+        }
+        gdrive_idx_free_if_unused(pIndex, pParent);
+    }
+    free(pEntry->parentIds);
+    pEntry->parentIds = NULL;
+    pEntry->nParents = 0;
+}
+
+/*
+ * Forgets everything about a file except its children (if it's a folder that
+ * still has any), and frees the entry if nothing is left. If the file is in
+ * the snapshot, the entry stays to mark it removed.
+ */
+static void gdrive_idx_drop(Gdrive_Index* pIndex, Gdrive_Idx_Entry* pEntry)
+{
+    gdrive_idx_detach(pIndex, pEntry);
+    // Keep the ID string, because the hash table uses it.
+    gdrive_idx_release_strings(pEntry, true);
+    pEntry->known = false;
+    pEntry->removed = (gdrive_idx_snap_find(&(pIndex->snapshot),
+                                            pEntry->fileinfo.id) !=
+            GDRIVE_IDX_NO_RECORD);
+    gdrive_idx_free_if_unused(pIndex, pEntry);
+}
+
+/*
+ * Records the parents listed in a file resource, and adds the entry to each
+ * parent's children. Returns 0 on success, other on memory error.
+ */
+static int gdrive_idx_attach(Gdrive_Index* pIndex, Gdrive_Idx_Entry* pEntry,
+                             Gdrive_Json_Object* pObj)
+{
+    int nParents = gdrive_json_array_length(pObj, "parents");
+    if (nParents <= 0)
+    {
+        return 0;
+    }
+    pEntry->parentIds = malloc(nParents * sizeof(const char*));
+    if (pEntry->parentIds == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+
+    for (int i = 0; i < nParents; i++)
+    {
+        Gdrive_Json_Object* pParentObj =
+                gdrive_json_array_get(pObj, "parents", i);
+        char* parentId = (pParentObj != NULL) ?
+            gdrive_json_get_new_string(pParentObj, "id", NULL) : NULL;
+        if (parentId == NULL)
+        {
+            continue;
+        }
+        Gdrive_Idx_Entry* pParent = gdrive_idx_find(pIndex, parentId, true);
+        const char* sharedId = gdrive_intern_get(parentId);
+        free(parentId);
+        if (pParent == NULL || sharedId == NULL)
+        {
+            // Memory error
+            gdrive_intern_release(sharedId);
+            if (pParent != NULL)
+            {
+                gdrive_idx_free_if_unused(pIndex, pParent);
+            }
+            return -1;
+        }
+        if (pParent->nChildren >= pParent->maxChildren)
+        {
+            int newMax = (pParent->maxChildren > 0) ?
+                pParent->maxChildren * 2 : 4;
+            Gdrive_Idx_Entry** pNewChildren = realloc(
+                    pParent->pChildren, newMax * sizeof(Gdrive_Idx_Entry*));
+            if (pNewChildren == NULL)
+            {
+                // Memory error
+                gdrive_intern_release(sharedId);
+                gdrive_idx_free_if_unused(pIndex, pParent);
+                return -1;
+            }
+            pParent->pChildren = pNewChildren;
+            pParent->maxChildren = newMax;
+        }
+        pParent->pChildren[pParent->nChildren++] = pEntry;
+        pEntry->parentIds[pEntry->nParents++] = sharedId;
+    }
+    return 0;
+}
+
+/*
+ * Adds or replaces the entry for a file resource, or removes the entry if the
+ * file is in the trash. Returns 0 on success, other on memory error or if the
+ * resource has no ID.
+ */
+static int gdrive_idx_set(Gdrive_Index* pIndex, Gdrive_Json_Object* pObj)
+{
+    char* fileId = gdrive_json_get_new_string(pObj, "id", NULL);
+    if (fileId == NULL)
+    {
+        return -1;
+    }
+
+    bool success = false;
+    bool trashed = gdrive_json_get_boolean(pObj, "labels/trashed", &success) &&
+            success;
+    bool inSnapshot = (gdrive_idx_snap_find(&(pIndex->snapshot), fileId) !=
+            GDRIVE_IDX_NO_RECORD);
+    Gdrive_Idx_Entry* pEntry =
+            gdrive_idx_find(pIndex, fileId, !trashed || inSnapshot);
+    free(fileId);
+    if (pEntry == NULL)
+    {
+        // Memory error, unless a trashed file isn't in the index at all
+        return (trashed && !inSnapshot) ? 0 : -1;
+    }
+    if (trashed)
+    {
+        // Trashed files aren't shown.
+        gdrive_idx_drop(pIndex, pEntry);
+        return 0;
+    }
+
+    gdrive_idx_detach(pIndex, pEntry);
+    // Keep the ID string, because the hash table uses it.
+    gdrive_idx_release_strings(pEntry, true);
+    char* id = pEntry->fileinfo.id;
+    memset(&(pEntry->fileinfo), 0, sizeof(Gdrive_Fileinfo));
+    gdrive_finfo_read_json(&(pEntry->fileinfo), pObj);
+    free(pEntry->fileinfo.id);
+    pEntry->fileinfo.id = id;
+    char* filename = pEntry->fileinfo.filename;
+    pEntry->fileinfo.filename = (char*) gdrive_intern_get(filename);
+    if (filename != NULL && pEntry->fileinfo.filename == NULL)
+    {
+        // Memory error
+        free(filename);
+        pEntry->known = false;
+        gdrive_idx_free_if_unused(pIndex, pEntry);
+        return -1;
+    }
+    free(filename);
+    if (pEntry->fileinfo.filename == NULL)
+    {
+        // A file with no name can't be reached by path.
+        pEntry->known = false;
+        pEntry->removed = inSnapshot;
+        gdrive_idx_free_if_unused(pIndex, pEntry);
+        return 0;
+    }
+    pEntry->known = true;
+    pEntry->removed = false;
+
+    return gdrive_idx_attach(pIndex, pEntry, pObj);
+}
+
+/*
+ * Remembers the root folder's ID and adds it to the index. Returns 0 on
+ * success, other on error.
+ */
+static int gdrive_idx_begin(Gdrive_Index* pIndex, Gdrive_Json_Object* pRoot)
+{
+    pIndex->rootId = gdrive_json_get_new_string(pRoot, "id", NULL);
+    if (pIndex->rootId == NULL)
+    {
+        return -1;
+    }
+    return gdrive_idx_set(pIndex, pRoot);
+}
+
+/*
+ * Loads the snapshot from the cache directory, and brings it up to date with
+ * the changes made since it was written. Returns 0 on success, other if there
+ * is no usable snapshot or on error, in which case the caller needs to clean
+ * up the index.
+ */
+static int gdrive_idx_resume(Gdrive_Index* pIndex, Gdrive_Json_Object* pRoot)
+{
+    char* path = gdrive_idx_snapshot_path(GDRIVE_IDX_SNAPSHOT_NAME);
+    if (path == NULL)
+    {
+        // No cache directory, or memory error
+        return -1;
+    }
+    int result = gdrive_idx_map(&(pIndex->snapshot), path);
+    free(path);
+    if (result != 0 || gdrive_idx_begin(pIndex, pRoot) != 0)
+    {
+        return -1;
+    }
+
+    // A snapshot of a different account is no use.
+    const Gdrive_Idx_Snapshot* pSnap = &(pIndex->snapshot);
+    const Gdrive_Idx_Record* pRootRecord =
+            &(pSnap->pRecords[pSnap->pHeader->rootRecord]);
+    if (strcmp(pSnap->pStrings + pRootRecord->idOffset, pIndex->rootId) != 0)
+    {
+        return -1;
+    }
+
+    // Replay the changes since the snapshot. The cache update passes them
+    // on to the index, which needs to be marked complete to accept them.
+    int64_t latestChangeId = gdrive_cache_get_nextchangeid();
+    gdrive_cache_set_nextchangeid(pSnap->pHeader->nextChangeId);
+    pIndex->complete = true;
+    if (gdrive_cache_update() != 0 || !pIndex->complete)
+    {
+        // Listing everything instead only needs the changes from here on.
+        gdrive_cache_set_nextchangeid(latestChangeId);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Builds the index by listing every file that isn't in the trash, then saves
+ * a snapshot if there is a cache directory and switches over to it, so that
+ * the files don't need to stay in memory. Returns 0 on success, other on
+ * error, in which case the caller needs to clean up the index.
+ */
+static int gdrive_idx_list_all(Gdrive_Index* pIndex,
+                               Gdrive_Json_Object* pRoot)
+{
+    int result = gdrive_idx_begin(pIndex, pRoot);
+
+    // Pages are large, so each file goes into the index as soon as it
+    // arrives.
+    Gdrive_Json_Stream* pStream =
+            gdrive_jstream_create("items", gdrive_idx_set_streamed, pIndex);
+    if (pStream == NULL)
+    {
+        // Memory error
+        result = -1;
+    }
+
+    char* pageToken = NULL;
+    while (result == 0)
+    {
+        Gdrive_Json_Object* pObj = gdrive_idx_request(
+                GDRIVE_URL_FILES, GDRIVE_IDX_LIST_FIELDS, pageToken, pStream
+                );
+        free(pageToken);
+        pageToken = NULL;
+        if (pObj == NULL)
+        {
+            // Download error, or couldn't add a file
+            result = -1;
+            break;
+        }
+
+        pageToken = gdrive_json_get_new_string(pObj, "nextPageToken", NULL);
+        gdrive_json_kill(pObj);
+        if (pageToken == NULL)
+        {
+            // That was the last page.
+            break;
+        }
+    }
+    free(pageToken);
+    gdrive_jstream_free(pStream);
+    if (result != 0)
+    {
+        return -1;
+    }
+    pIndex->complete = true;
+
+    char* path = gdrive_idx_snapshot_path(GDRIVE_IDX_SNAPSHOT_NAME);
+    Gdrive_Idx_Snapshot snapshot = {0};
+    if (
+            path != NULL &&
+            gdrive_idx_write_snapshot(pIndex, path) == 0 &&
+            gdrive_idx_map(&snapshot, path) == 0
+        )
+    {
+        // Everything is in the snapshot now, so the entries in memory aren't
+        // needed.
+        gdrive_idx_free_entries(pIndex);
+        pIndex->snapshot = snapshot;
+    }
+    free(path);
+    return 0;
+}
+
+/*
+ * gdrive_jstream_callback for gdrive_idx_list_all(). userdata is the index.
+ */
+static int gdrive_idx_set_streamed(Gdrive_Json_Object* pObj, void* userdata)
+{
+    return gdrive_idx_set((Gdrive_Index*) userdata, pObj);
+}
+
+/*
+ * Sends a GET request for the given URL and fields, listing files that aren't
+ * trashed if the URL is GDRIVE_URL_FILES. If pStream is not NULL, the listed
+ * files are handed to it as they arrive. Returns the rest of the response as
+ * a JSON object, or NULL on failure.
+ */
+static Gdrive_Json_Object*
+gdrive_idx_request(const char* url, const char* fields, const char* pageToken,
+                   Gdrive_Json_Stream* pStream)
+{
+    bool isList = (strcmp(url, GDRIVE_URL_FILES) == 0);
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
+    if (
+            gdrive_xfer_set_url(pTransfer, url) ||
+            gdrive_xfer_add_query(pTransfer, "fields", fields) ||
+            (isList &&
+                (gdrive_xfer_add_query(pTransfer, "q", "trashed=false") ||
+                gdrive_xfer_add_query(pTransfer, "maxResults",
+                                      GDRIVE_IDX_PAGE_SIZE))) ||
+            (pageToken != NULL &&
+                gdrive_xfer_add_query(pTransfer, "pageToken", pageToken))
+        )
+    {
+        // Error
+        gdrive_xfer_free(pTransfer);
+        return NULL;
+    }
+    gdrive_xfer_set_jstream(pTransfer, pStream);
+
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    Gdrive_Json_Object* pObj = NULL;
+    if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+    {
+        pObj = (pStream != NULL) ? gdrive_jstream_finish(pStream) :
+            gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+    }
+    else if (pStream != NULL)
+    {
+        // Throw away anything that made it into the stream.
+        gdrive_jstream_finish(pStream);
+    }
+    gdrive_dlbuf_free(pBuf);
+    return pObj;
+}
+
+/*
+ * Determines whether an entry in memory takes the place of the snapshot's
+ * record for a file.
+ */
+static bool gdrive_idx_masked(Gdrive_Index* pIndex, const char* fileId)
+{
+    Gdrive_Idx_Entry* pEntry = gdrive_idx_find(pIndex, fileId, false);
+    return (pEntry != NULL && (pEntry->known || pEntry->removed));
+}
+
+/*
+ * Fills in pDest with the information on a file, without copying anything.
+ * The strings belong to the index and are only good until it next changes.
+ * Folders' children aren't counted. Returns true if the file is in the index,
+ * otherwise false.
+ */
+static bool gdrive_idx_peek(Gdrive_Index* pIndex, const char* fileId,
+                            Gdrive_Fileinfo* pDest)
+{
+    Gdrive_Idx_Entry* pEntry = gdrive_idx_find(pIndex, fileId, false);
+    if (pEntry != NULL && (pEntry->known || pEntry->removed))
+    {
+        *pDest = pEntry->fileinfo;
+        pDest->nChildren = (pDest->type == GDRIVE_FILETYPE_FOLDER) ?
+            GDRIVE_FINFO_CHILDREN_UNKNOWN : 0;
+        return pEntry->known;
+    }
+    uint32_t record = gdrive_idx_snap_find(&(pIndex->snapshot), fileId);
+    if (record == GDRIVE_IDX_NO_RECORD)
+    {
+        return false;
+    }
+    gdrive_idx_snap_fileinfo(&(pIndex->snapshot), record, pDest);
+    return true;
+}
+
+/*
+ * Fills in pList with the IDs of a folder's children, from both the snapshot
+ * and memory. Any IDs already in the list are discarded. Returns 0 on
+ * success, other on memory error.
+ */
+static int gdrive_idx_child_ids(Gdrive_Index* pIndex, const char* folderId,
+                                Gdrive_Idx_Idlist* pList)
+{
+    pList->nIds = 0;
+
+    const Gdrive_Idx_Snapshot* pSnap = &(pIndex->snapshot);
+    uint32_t record = gdrive_idx_snap_find(pSnap, folderId);
+    if (record != GDRIVE_IDX_NO_RECORD)
+    {
+        const Gdrive_Idx_Record* pRecord = &(pSnap->pRecords[record]);
+        for (uint32_t i = 0; i < pRecord->nLinks; i++)
+        {
+            uint32_t child = pSnap->pLinks[pRecord->firstLink + i];
+            const char* childId =
+                    pSnap->pStrings + pSnap->pRecords[child].idOffset;
+            // A child that has changed since the snapshot is only listed if
+            // it's still among the children in memory.
+            if (
+                    !gdrive_idx_masked(pIndex, childId) &&
+                    gdrive_idx_idlist_add(pList, childId) != 0
+                )
+            {
+                // Memory error
+                return -1;
+            }
+        }
+    }
+
+    Gdrive_Idx_Entry* pEntry = gdrive_idx_find(pIndex, folderId, false);
+    int nChildren = (pEntry != NULL) ? pEntry->nChildren : 0;
+    for (int i = 0; i < nChildren; i++)
+    {
+        if (gdrive_idx_idlist_add(pList, pEntry->pChildren[i]->fileinfo.id))
+        {
+            // Memory error
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int gdrive_idx_idlist_add(Gdrive_Idx_Idlist* pList, const char* id)
+{
+    if (pList->nIds >= pList->maxIds)
+    {
+        int newMax = (pList->maxIds > 0) ? pList->maxIds * 2 : 16;
+        const char** newIds = realloc(pList->ids, newMax * sizeof(char*));
+        if (newIds == NULL)
+        {
+            // Memory error
+            return -1;
+        }
+        pList->ids = newIds;
+        pList->maxIds = newMax;
+    }
+    pList->ids[pList->nIds++] = id;
+    return 0;
+}
+
+/*
+ * Returns the index of the snapshot's record for a file, or
+ * GDRIVE_IDX_NO_RECORD if the snapshot doesn't have the file (or there is no
+ * snapshot).
+ */
+static uint32_t gdrive_idx_snap_find(const Gdrive_Idx_Snapshot* pSnap,
+                                     const char* fileId)
+{
+    if (pSnap->pHeader == NULL)
+    {
+        return GDRIVE_IDX_NO_RECORD;
+    }
+    size_t mask = pSnap->pHeader->idSlots - 1;
+    for (size_t slot = gdrive_idx_hash(fileId) & mask;
+            pSnap->pIdTable[slot] != 0;
+            slot = (slot + 1) & mask)
+    {
+        uint32_t record = pSnap->pIdTable[slot] - 1;
+        const char* recordId = pSnap->pStrings +
+                pSnap->pRecords[record].idOffset;
+        if (strcmp(recordId, fileId) == 0)
+        {
+            return record;
+        }
+    }
+    return GDRIVE_IDX_NO_RECORD;
+}
+
+/*
+ * Returns the ID of a child in the snapshot with the given name, skipping
+ * children that have changed since. The ID belongs to the snapshot. Returns
+ * NULL if there is no such child.
+ */
+static const char*
+gdrive_idx_snap_lookup_child(Gdrive_Index* pIndex, const char* parentId,
+                             const char* childName)
+{
+    const Gdrive_Idx_Snapshot* pSnap = &(pIndex->snapshot);
+    uint32_t parent = gdrive_idx_snap_find(pSnap, parentId);
+    if (parent == GDRIVE_IDX_NO_RECORD)
+    {
+        return NULL;
+    }
+    size_t mask = pSnap->pHeader->nameSlots - 1;
+    for (size_t slot = gdrive_idx_name_hash(parent, childName) & mask;
+            pSnap->pNameTable[slot].parent != 0;
+            slot = (slot + 1) & mask)
+    {
+        const Gdrive_Idx_Name_Slot* pSlot = &(pSnap->pNameTable[slot]);
+        if (pSlot->parent - 1 != parent)
+        {
+            continue;
+        }
+        const Gdrive_Idx_Record* pChild = &(pSnap->pRecords[pSlot->child - 1]);
+        const char* childId = pSnap->pStrings + pChild->idOffset;
+        if (
+                strcmp(pSnap->pStrings + pChild->nameOffset, childName) == 0 &&
+                !gdrive_idx_masked(pIndex, childId)
+            )
+        {
+            return childId;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Fills in pDest from a snapshot record, without copying the strings.
+ */
+static void gdrive_idx_snap_fileinfo(const Gdrive_Idx_Snapshot* pSnap,
+                                     uint32_t record, Gdrive_Fileinfo* pDest)
+{
+    const Gdrive_Idx_Record* pRecord = &(pSnap->pRecords[record]);
+    pDest->id = (char*) (pSnap->pStrings + pRecord->idOffset);
+    pDest->filename = (char*) (pSnap->pStrings + pRecord->nameOffset);
+    pDest->type = (enum Gdrive_Filetype) pRecord->type;
+    pDest->size = pRecord->size;
+    pDest->basePermission = pRecord->basePermission;
+    pDest->creationTime.tv_sec = pRecord->creationSec;
+    pDest->creationTime.tv_nsec = pRecord->creationNsec;
+    pDest->modificationTime.tv_sec = pRecord->modificationSec;
+    pDest->modificationTime.tv_nsec = pRecord->modificationNsec;
+    pDest->accessTime.tv_sec = pRecord->accessSec;
+    pDest->accessTime.tv_nsec = pRecord->accessNsec;
+    pDest->nParents = pRecord->nParents;
+    pDest->nChildren = (pDest->type == GDRIVE_FILETYPE_FOLDER) ?
+        GDRIVE_FINFO_CHILDREN_UNKNOWN : 0;
+    pDest->dirtyMetainfo = false;
+}
+
+/*
+ * Returns the path of a file within the cache directory, or NULL if there is
+ * no cache directory or on memory error. The caller is responsible for
+ * freeing the path.
+ */
+static char* gdrive_idx_snapshot_path(const char* name)
+{
+    const char* cacheDir = gdrive_get_cachedir();
+    if (cacheDir == NULL)
+    {
+        return NULL;
+    }
+    char* path = malloc(strlen(cacheDir) + 1 + strlen(name) + 1);
+    if (path == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    strcpy(path, cacheDir);
+    strcat(path, "/");
+    strcat(path, name);
+    return path;
+}
+
+/*
+ * Maps a snapshot file into memory and checks that it's safe to use. Returns
+ * 0 on success, other if the file doesn't exist, can't be mapped, or isn't a
+ * valid snapshot.
+ */
+static int gdrive_idx_map(Gdrive_Idx_Snapshot* pSnap, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        // No snapshot
+        return -1;
+    }
+    struct stat st;
+    if (
+            fstat(fd, &st) != 0 ||
+            st.st_size < (off_t) sizeof(Gdrive_Idx_Header)
+        )
+    {
+        close(fd);
+        return -1;
+    }
+    size_t mapSize = st.st_size;
+    void* pMap = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    Gdrive_Idx_Snapshot snapshot = {0};
+    snapshot.pMap = pMap;
+    snapshot.mapSize = mapSize;
+    const Gdrive_Idx_Header* pHeader = pMap;
+    if (!gdrive_idx_check_header(pHeader, mapSize))
+    {
+        gdrive_idx_unmap(&snapshot);
+        return -1;
+    }
+    const char* pBase = pMap;
+    snapshot.pHeader = pHeader;
+    snapshot.pRecords = (const Gdrive_Idx_Record*)
+            (pBase + pHeader->recordsOffset);
+    snapshot.pLinks = (const uint32_t*) (pBase + pHeader->linksOffset);
+    snapshot.pIdTable = (const uint32_t*) (pBase + pHeader->idTableOffset);
+    snapshot.pNameTable = (const Gdrive_Idx_Name_Slot*)
+            (pBase + pHeader->nameTableOffset);
+    snapshot.pStrings = pBase + pHeader->stringsOffset;
+    if (!gdrive_idx_check_sections(&snapshot))
+    {
+        fputs("fuse-drive: Ignoring damaged file index snapshot\n", stderr);
+        gdrive_idx_unmap(&snapshot);
+        return -1;
+    }
+
+    *pSnap = snapshot;
+    return 0;
+}
+
+static void gdrive_idx_unmap(Gdrive_Idx_Snapshot* pSnap)
+{
+    if (pSnap->pMap != NULL)
+    {
+        munmap(pSnap->pMap, pSnap->mapSize);
+    }
+    memset(pSnap, 0, sizeof(Gdrive_Idx_Snapshot));
+}
+
+/*
+ * Determines whether a section of count elements at the given offset is
+ * aligned and lies within the file.
+ */
+static bool gdrive_idx_section_fits(uint64_t offset, uint64_t count,
+                                    size_t elementSize, size_t fileSize)
+{
+    return (offset % 8 == 0 && offset <= fileSize &&
+            count <= (fileSize - offset) / elementSize);
+}
+
+static bool gdrive_idx_check_header(const Gdrive_Idx_Header* pHeader,
+                                    size_t fileSize)
+{
+    if (
+            memcmp(pHeader->magic, GDRIVE_IDX_MAGIC,
+                   sizeof(pHeader->magic)) != 0 ||
+            pHeader->version != GDRIVE_IDX_VERSION ||
+            pHeader->recordSize != sizeof(Gdrive_Idx_Record)
+        )
+    {
+        // Not a snapshot, or one written by a different version
+        return false;
+    }
+
+    // Lookups stop at an empty slot, so each hash table needs at least one.
+    uint32_t idSlots = pHeader->idSlots;
+    uint32_t nameSlots = pHeader->nameSlots;
+    if (
+            idSlots <= pHeader->nRecords || (idSlots & (idSlots - 1)) != 0 ||
+            nameSlots <= pHeader->nLinks ||
+            (nameSlots & (nameSlots - 1)) != 0
+        )
+    {
+        return false;
+    }
+
+    return (
+            gdrive_idx_section_fits(pHeader->recordsOffset, pHeader->nRecords,
+                                    sizeof(Gdrive_Idx_Record), fileSize) &&
+            gdrive_idx_section_fits(pHeader->linksOffset, pHeader->nLinks,
+                                    sizeof(uint32_t), fileSize) &&
+            gdrive_idx_section_fits(pHeader->idTableOffset, idSlots,
+                                    sizeof(uint32_t), fileSize) &&
+            gdrive_idx_section_fits(pHeader->nameTableOffset, nameSlots,
+                                    sizeof(Gdrive_Idx_Name_Slot), fileSize) &&
+            gdrive_idx_section_fits(pHeader->stringsOffset,
+                                    pHeader->stringsSize, 1, fileSize) &&
+            pHeader->stringsSize > 0 &&
+            pHeader->rootRecord < pHeader->nRecords
+            );
+}
+
+/*
+ * Checks every offset and index in the snapshot, so that a damaged file can't
+ * lead to reading outside the mapping. Doesn't check that the hash tables
+ * agree with the records, which would only give wrong answers.
+ */
+static bool gdrive_idx_check_sections(const Gdrive_Idx_Snapshot* pSnap)
+{
+    const Gdrive_Idx_Header* pHeader = pSnap->pHeader;
+    if (pSnap->pStrings[pHeader->stringsSize - 1] != '\0')
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < pHeader->nRecords; i++)
+    {
+        const Gdrive_Idx_Record* pRecord = &(pSnap->pRecords[i]);
+        if (
+                pRecord->idOffset >= pHeader->stringsSize ||
+                pRecord->nameOffset >= pHeader->stringsSize ||
+                pRecord->firstLink > pHeader->nLinks ||
+                pRecord->nLinks > pHeader->nLinks - pRecord->firstLink ||
+                pRecord->type > GDRIVE_FILETYPE_FOLDER
+            )
+        {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < pHeader->nLinks; i++)
+    {
+        if (pSnap->pLinks[i] >= pHeader->nRecords)
+        {
+            return false;
+        }
+    }
+
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < pHeader->idSlots; i++)
+    {
+        if (pSnap->pIdTable[i] > pHeader->nRecords)
+        {
+            return false;
+        }
+        used += (pSnap->pIdTable[i] != 0);
+    }
+    if (used != pHeader->nRecords)
+    {
+        return false;
+    }
+
+    used = 0;
+    for (uint32_t i = 0; i < pHeader->nameSlots; i++)
+    {
+        const Gdrive_Idx_Name_Slot* pSlot = &(pSnap->pNameTable[i]);
+        if (
+                pSlot->parent > pHeader->nRecords ||
+                pSlot->child > pHeader->nRecords ||
+                (pSlot->parent == 0) != (pSlot->child == 0)
+            )
+        {
+            return false;
+        }
+        used += (pSlot->parent != 0);
+    }
+    return (used == pHeader->nLinks);
+}
+
+/*
+ * Writes everything in the index, from both the snapshot and memory, to a new
+ * snapshot file. The file is written under a temporary name and then renamed,
+ * so an existing snapshot (which may still be mapped) is replaced all at
+ * once. Returns 0 on success, other on error.
+ */
+static int gdrive_idx_write_snapshot(Gdrive_Index* pIndex, const char* path)
+{
+    // Count the files first, so the records and the ID table can be sized
+    // up front.
+    const Gdrive_Idx_Snapshot* pSnap = &(pIndex->snapshot);
+    uint32_t nSnapRecords =
+            (pSnap->pHeader != NULL) ? pSnap->pHeader->nRecords : 0;
+    size_t nRecords = 0;
+    for (size_t i = 0; i < pIndex->nBuckets; i++)
+    {
+        for (Gdrive_Idx_Entry* pEntry = pIndex->pBuckets[i];
+                pEntry != NULL;
+                pEntry = pEntry->pNext)
+        {
+            nRecords += pEntry->known;
+        }
+    }
+    for (uint32_t i = 0; i < nSnapRecords; i++)
+    {
+        const char* fileId = pSnap->pStrings + pSnap->pRecords[i].idOffset;
+        nRecords += !gdrive_idx_masked(pIndex, fileId);
+    }
+
+    Gdrive_Idx_Writer writer;
+    int result = gdrive_idx_writer_init(&writer, nRecords);
+    for (size_t i = 0; result == 0 && i < pIndex->nBuckets; i++)
+    {
+        for (Gdrive_Idx_Entry* pEntry = pIndex->pBuckets[i];
+                result == 0 && pEntry != NULL;
+                pEntry = pEntry->pNext)
+        {
+            if (pEntry->known)
+            {
+                result = gdrive_idx_writer_add_record(&writer,
+                                                      &(pEntry->fileinfo));
+            }
+        }
+    }
+    for (uint32_t i = 0; result == 0 && i < nSnapRecords; i++)
+    {
+        Gdrive_Fileinfo fileinfo;
+        gdrive_idx_snap_fileinfo(pSnap, i, &fileinfo);
+        if (!gdrive_idx_masked(pIndex, fileinfo.id))
+        {
+            result = gdrive_idx_writer_add_record(&writer, &fileinfo);
+        }
+    }
+
+    if (result == 0)
+    {
+        result = gdrive_idx_writer_add_links(&writer, pIndex);
+    }
+    if (result == 0)
+    {
+        result = gdrive_idx_writer_add_names(&writer);
+    }
+    if (result == 0)
+    {
+        Gdrive_Idx_Snapshot view = {0};
+        view.pHeader = &(writer.header);
+        view.pRecords = writer.pRecords;
+        view.pIdTable = writer.pIdTable;
+        view.pStrings = writer.pStrings;
+        writer.header.rootRecord = gdrive_idx_snap_find(&view, pIndex->rootId);
+        if (writer.header.rootRecord == GDRIVE_IDX_NO_RECORD)
+        {
+            result = -1;
+        }
+    }
+    if (result == 0)
+    {
+        result = gdrive_idx_writer_output(&writer, path);
+    }
+    gdrive_idx_writer_free(&writer);
+    if (result != 0)
+    {
+        fputs("fuse-drive: Couldn't save the file index\n", stderr);
+    }
+    return result;
+}
+
+static int gdrive_idx_writer_init(Gdrive_Idx_Writer* pWriter,
+                                  size_t nRecords)
+{
+    memset(pWriter, 0, sizeof(Gdrive_Idx_Writer));
+    if (nRecords >= UINT32_MAX / 4)
+    {
+        // Too big for the file format
+        return -1;
+    }
+    memcpy(pWriter->header.magic, GDRIVE_IDX_MAGIC,
+           sizeof(pWriter->header.magic));
+    pWriter->header.version = GDRIVE_IDX_VERSION;
+    pWriter->header.recordSize = sizeof(Gdrive_Idx_Record);
+    pWriter->header.nextChangeId = gdrive_cache_get_nextchangeid();
+    pWriter->header.idSlots = gdrive_idx_slots_for(nRecords);
+    // Each file has an ID and a filename.
+    pWriter->nStringSlots = gdrive_idx_slots_for(nRecords * 2);
+
+    pWriter->pRecords = calloc(nRecords + 1, sizeof(Gdrive_Idx_Record));
+    pWriter->pIdTable = calloc(pWriter->header.idSlots, sizeof(uint32_t));
+    pWriter->pStringSlots = calloc(pWriter->nStringSlots, sizeof(uint32_t));
+    if (
+            pWriter->pRecords == NULL || pWriter->pIdTable == NULL ||
+            pWriter->pStringSlots == NULL
+        )
+    {
+        // Memory error
+        return -1;
+    }
+    return 0;
+}
+
+static void gdrive_idx_writer_free(Gdrive_Idx_Writer* pWriter)
+{
+    free(pWriter->pRecords);
+    free(pWriter->pLinks);
+    free(pWriter->pIdTable);
+    free(pWriter->pNameTable);
+    free(pWriter->pStrings);
+    free(pWriter->pStringSlots);
+    memset(pWriter, 0, sizeof(Gdrive_Idx_Writer));
+}
+
+/*
+ * Adds a string to the string table, unless it's already there. Returns the
+ * string's offset, or -1 on memory error or if the table is too big.
+ */
+static int64_t gdrive_idx_writer_intern(Gdrive_Idx_Writer* pWriter,
+                                        const char* str)
+{
+    size_t mask = pWriter->nStringSlots - 1;
+    size_t slot = gdrive_idx_hash(str) & mask;
+    while (pWriter->pStringSlots[slot] != 0)
+    {
+        uint32_t offset = pWriter->pStringSlots[slot] - 1;
+        if (strcmp(pWriter->pStrings + offset, str) == 0)
+        {
+            return offset;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    size_t length = strlen(str) + 1;
+    uint64_t offset = pWriter->header.stringsSize;
+    if (offset + length >= UINT32_MAX)
+    {
+        // Offsets are only 32 bits.
+        return -1;
+    }
+    if (offset + length > pWriter->maxStrings)
+    {
+        size_t newMax = (pWriter->maxStrings > 0) ?
+            pWriter->maxStrings * 2 : 4096;
+        while (newMax < offset + length)
+        {
+            newMax *= 2;
+        }
+        char* newStrings = realloc(pWriter->pStrings, newMax);
+        if (newStrings == NULL)
+        {
+            // Memory error
+            return -1;
+        }
+        pWriter->pStrings = newStrings;
+        pWriter->maxStrings = newMax;
+    }
+    memcpy(pWriter->pStrings + offset, str, length);
+    pWriter->header.stringsSize += length;
+    pWriter->pStringSlots[slot] = offset + 1;
+    return offset;
+}
+
+static int gdrive_idx_writer_add_record(Gdrive_Idx_Writer* pWriter,
+                                        const Gdrive_Fileinfo* pFileinfo)
+{
+    int64_t idOffset = gdrive_idx_writer_intern(pWriter, pFileinfo->id);
+    int64_t nameOffset =
+            gdrive_idx_writer_intern(pWriter, pFileinfo->filename);
+    if (idOffset < 0 || nameOffset < 0)
+    {
+        return -1;
+    }
+
+    uint32_t record = pWriter->header.nRecords++;
+    Gdrive_Idx_Record* pRecord = &(pWriter->pRecords[record]);
+    pRecord->idOffset = idOffset;
+    pRecord->nameOffset = nameOffset;
+    pRecord->size = pFileinfo->size;
+    pRecord->creationSec = pFileinfo->creationTime.tv_sec;
+    pRecord->creationNsec = pFileinfo->creationTime.tv_nsec;
+    pRecord->modificationSec = pFileinfo->modificationTime.tv_sec;
+    pRecord->modificationNsec = pFileinfo->modificationTime.tv_nsec;
+    pRecord->accessSec = pFileinfo->accessTime.tv_sec;
+    pRecord->accessNsec = pFileinfo->accessTime.tv_nsec;
+    pRecord->nParents = pFileinfo->nParents;
+    pRecord->type = pFileinfo->type;
+    pRecord->basePermission = pFileinfo->basePermission;
+
+    size_t mask = pWriter->header.idSlots - 1;
+    size_t slot = gdrive_idx_hash(pFileinfo->id) & mask;
+    while (pWriter->pIdTable[slot] != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    pWriter->pIdTable[slot] = record + 1;
+    return 0;
+}
+
+/*
+ * Fills in the links for every folder that has been added, using the
+ * children the index currently has for it. Returns 0 on success, other on
+ * memory error.
+ */
+static int gdrive_idx_writer_add_links(Gdrive_Idx_Writer* pWriter,
+                                       Gdrive_Index* pIndex)
+{
+    // Look up the children among the new records, using the new snapshot as
+    // it stands.
+    Gdrive_Idx_Snapshot view = {0};
+    view.pHeader = &(pWriter->header);
+    view.pRecords = pWriter->pRecords;
+    view.pIdTable = pWriter->pIdTable;
+    view.pStrings = pWriter->pStrings;
+
+    Gdrive_Idx_Idlist children = {0};
+    int result = 0;
+    for (uint32_t i = 0; result == 0 && i < pWriter->header.nRecords; i++)
+    {
+        Gdrive_Idx_Record* pRecord = &(pWriter->pRecords[i]);
+        pRecord->firstLink = pWriter->header.nLinks;
+        if (pRecord->type != GDRIVE_FILETYPE_FOLDER)
+        {
+            continue;
+        }
+        const char* folderId = pWriter->pStrings + pRecord->idOffset;
+        result = gdrive_idx_child_ids(pIndex, folderId, &children);
+        for (int j = 0; result == 0 && j < children.nIds; j++)
+        {
+            uint32_t child = gdrive_idx_snap_find(&view, children.ids[j]);
+            if (child == GDRIVE_IDX_NO_RECORD)
+            {
+                continue;
+            }
+            if (pWriter->header.nLinks >= pWriter->maxLinks)
+            {
+                size_t newMax = (pWriter->maxLinks > 0) ?
+                    pWriter->maxLinks * 2 : 1024;
+                uint32_t* newLinks = (newMax < UINT32_MAX / 2) ?
+                    realloc(pWriter->pLinks, newMax * sizeof(uint32_t)) :
+                    NULL;
+                if (newLinks == NULL)
+                {
+                    // Memory error
+                    result = -1;
+                    break;
+                }
+                pWriter->pLinks = newLinks;
+                pWriter->maxLinks = newMax;
+            }
+            pWriter->pLinks[pWriter->header.nLinks++] = child;
+            pRecord->nLinks++;
+        }
+    }
+    free(children.ids);
+    return result;
+}
+
+/*
+ * Builds the (parent, name) hash table from the links. Returns 0 on success,
+ * other on memory error.
+ */
+static int gdrive_idx_writer_add_names(Gdrive_Idx_Writer* pWriter)
+{
+    pWriter->header.nameSlots = gdrive_idx_slots_for(pWriter->header.nLinks);
+    pWriter->pNameTable = calloc(pWriter->header.nameSlots,
+                                 sizeof(Gdrive_Idx_Name_Slot));
+    if (pWriter->pNameTable == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+
+    size_t mask = pWriter->header.nameSlots - 1;
+    for (uint32_t parent = 0; parent < pWriter->header.nRecords; parent++)
+    {
+        const Gdrive_Idx_Record* pParent = &(pWriter->pRecords[parent]);
+        for (uint32_t i = 0; i < pParent->nLinks; i++)
+        {
+            uint32_t child = pWriter->pLinks[pParent->firstLink + i];
+            const char* name = pWriter->pStrings +
+                    pWriter->pRecords[child].nameOffset;
+            size_t slot = gdrive_idx_name_hash(parent, name) & mask;
+            while (pWriter->pNameTable[slot].parent != 0)
+            {
+                slot = (slot + 1) & mask;
+            }
+            pWriter->pNameTable[slot].parent = parent + 1;
+            pWriter->pNameTable[slot].child = child + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Lays out the sections, and writes the snapshot to a temporary file that
+ * then replaces the file at path. Returns 0 on success, other on error.
+ */
+static int gdrive_idx_writer_output(Gdrive_Idx_Writer* pWriter,
+                                    const char* path)
+{
+    Gdrive_Idx_Header* pHeader = &(pWriter->header);
+    size_t recordsSize = pHeader->nRecords * sizeof(Gdrive_Idx_Record);
+    size_t linksSize = pHeader->nLinks * sizeof(uint32_t);
+    size_t idTableSize = pHeader->idSlots * sizeof(uint32_t);
+    size_t nameTableSize = pHeader->nameSlots * sizeof(Gdrive_Idx_Name_Slot);
+    pHeader->recordsOffset = gdrive_idx_align(sizeof(Gdrive_Idx_Header));
+    pHeader->linksOffset =
+            gdrive_idx_align(pHeader->recordsOffset + recordsSize);
+    pHeader->idTableOffset =
+            gdrive_idx_align(pHeader->linksOffset + linksSize);
+    pHeader->nameTableOffset =
+            gdrive_idx_align(pHeader->idTableOffset + idTableSize);
+    pHeader->stringsOffset =
+            gdrive_idx_align(pHeader->nameTableOffset + nameTableSize);
+
+    char* tempPath = gdrive_idx_snapshot_path(GDRIVE_IDX_SNAPSHOT_TEMP_NAME);
+    FILE* pFile = (tempPath != NULL) ? fopen(tempPath, "wb") : NULL;
+    if (pFile == NULL)
+    {
+        free(tempPath);
+        return -1;
+    }
+    int result = (
+            gdrive_idx_write_at(pFile, 0, pHeader,
+                                sizeof(Gdrive_Idx_Header)) ||
+            gdrive_idx_write_at(pFile, pHeader->recordsOffset,
+                                pWriter->pRecords, recordsSize) ||
+            gdrive_idx_write_at(pFile, pHeader->linksOffset,
+                                pWriter->pLinks, linksSize) ||
+            gdrive_idx_write_at(pFile, pHeader->idTableOffset,
+                                pWriter->pIdTable, idTableSize) ||
+            gdrive_idx_write_at(pFile, pHeader->nameTableOffset,
+                                pWriter->pNameTable, nameTableSize) ||
+            gdrive_idx_write_at(pFile, pHeader->stringsOffset,
+                                pWriter->pStrings, pHeader->stringsSize) ||
+            fflush(pFile) != 0 ||
+            fsync(fileno(pFile)) != 0
+            ) ? -1 : 0;
+    if (fclose(pFile) != 0)
+    {
+        result = -1;
+    }
+    if (result == 0 && rename(tempPath, path) != 0)
+    {
+        result = -1;
+    }
+    if (result != 0)
+    {
+        remove(tempPath);
+    }
+    free(tempPath);
+    return result;
+}
+
+/*
+ * Pads the file with zeros up to offset, then writes size bytes of data.
+ * Returns 0 on success, other on error.
+ */
+static int gdrive_idx_write_at(FILE* pFile, uint64_t offset,
+                               const void* pData, size_t size)
+{
+    static const char zeros[8] = {0};
+    long position = ftell(pFile);
+    if (position < 0 || (uint64_t) position > offset ||
+            offset - position > sizeof(zeros))
+    {
+        return -1;
+    }
+    size_t padding = offset - position;
+    if (padding > 0 && fwrite(zeros, 1, padding, pFile) != padding)
+    {
+        return -1;
+    }
+    return (size == 0 || fwrite(pData, 1, size, pFile) == size) ? 0 : -1;
+}
+
+static uint64_t gdrive_idx_align(uint64_t offset)
+{
+    return (offset + 7) & ~((uint64_t) 7);
+}
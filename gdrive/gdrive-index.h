@@ -0,0 +1,199 @@
+/*
+ * File:   gdrive-index.h
+ * Author: me
+ *
+ * An optional in-memory index of every file in the Google Drive account,
+ * holding each file's information along with its parents and children. The
+ * index is built once at startup by gdrive_idx_bootstrap(), and is then kept
+ * up to date from the list of changes (see gdrive_cache_update()) and from the
+ * responses to changes made by fuse-drive itself. While the index is complete,
+ * folder listings and looking up files by name don't need to contact Google
+ * Drive at all.
+ *
+ * If a cache directory is set (see gdrive_set_cachedir()), the index is saved
+ * there as a snapshot file, both after it is first built and at cleanup. The
+ * snapshot is used directly from a read-only mapping, with only the files
+ * that have changed since it was written kept in memory. At the next start,
+ * the snapshot is brought up to date from the list of changes instead of
+ * listing every file again.
+ *
+ * Until gdrive_idx_bootstrap() succeeds, the index is empty and every lookup
+ * function reports that it doesn't know the answer, so callers fall back to
+ * asking Google Drive.
+ *
+ * The index only reflects what Google Drive knows. Changes that are still
+ * queued (see gdrive-ns-journal.h) are not included, so callers need to apply
+ * them the same way as for listings from Google Drive.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_INDEX_H
+#define	GDRIVE_INDEX_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "gdrive-fileinfo-array.h"
+#include "gdrive-json.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+// No constructors. The index is a single struct instance that lives in static
+// memory for the lifetime of the application.
+
+/*
+ * gdrive_idx_bootstrap():  Builds the index, either from the snapshot in the
+ *                          cache directory and the changes made since it was
+ *                          saved, or by listing every file in the account 
+ *                          that isn't in the trash. Should be called after 
+ *                          gdrive_cache_init(), so that any changes made
+ *                          while the listing is in progress are picked up by
+ *                          the next cache update.
+ * Return value (int):
+ *      0 on success. On failure, the index is left empty and other than 0 is
+ *      returned.
+ */
+int gdrive_idx_bootstrap(void);
+
+/*
+ * gdrive_idx_cleanup():    Frees all memory held by the index and marks it
+ *                          incomplete.
+ */
+void gdrive_idx_cleanup(void);
+
+
+/*************************************************************************
+ * Getter and setter functions
+ *************************************************************************/
+
+/*
+ * gdrive_idx_is_complete():    Determines whether the index holds every file
+ *                              in the account.
+ * Return value (bool):
+ *      True if gdrive_idx_bootstrap() has succeeded, otherwise false.
+ */
+bool gdrive_idx_is_complete(void);
+
+/*
+ * gdrive_idx_contains():   Determines whether a file is in the index.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID to look for.
+ * Return value (bool):
+ *      True if the index is complete and holds information on the file.
+ */
+bool gdrive_idx_contains(const char* fileId);
+
+/*
+ * gdrive_idx_get_fileinfo():   Retrieves a copy of the information on one
+ *                              file.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file.
+ *      pDest (Gdrive_Fileinfo*):
+ *              Location of a struct to fill in. Any existing contents are
+ *              overwritten without being freed. On success, the caller is
+ *              responsible for calling gdrive_finfo_cleanup(). For a folder,
+ *              nChildren is the number of children Google Drive knows about.
+ * Return value (int):
+ *      0 on success, other if the index is incomplete, doesn't hold the file,
+ *      or on memory error.
+ */
+int gdrive_idx_get_fileinfo(const char* fileId, Gdrive_Fileinfo* pDest);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_idx_save():   Saves the index as a snapshot in the cache directory,
+ *                      replacing any earlier snapshot. Does nothing if the
+ *                      index is incomplete or there is no cache directory.
+ * Return value (int):
+ *      0 on success or if there was nothing to do, other on error.
+ */
+int gdrive_idx_save(void);
+
+/*
+ * gdrive_idx_print_stats():    Prints the number of files in the snapshot and
+ *                              in memory, and the memory they take up.
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_idx_print_stats(FILE* stream);
+
+/*
+ * gdrive_idx_list():   Lists the files within a folder.
+ * Parameters:
+ *      folderId (const char*):
+ *              The file ID of the folder.
+ * Return value (Gdrive_Fileinfo_Array*):
+ *      The list of files in the folder, in the same form as returned by
+ *      gdrive_folder_list() but without queued changes applied, or NULL if the
+ *      index is incomplete or on memory error. The caller is responsible for
+ *      freeing the list with gdrive_finfoarray_free().
+ */
+Gdrive_Fileinfo_Array* gdrive_idx_list(const char* folderId);
+
+/*
+ * gdrive_idx_lookup_child():   Finds the file with a given name within a
+ *                              folder.
+ * Parameters:
+ *      parentId (const char*):
+ *              The file ID of the folder.
+ *      childName (const char*):
+ *              The name of the file to find.
+ *      pChildId (char**):
+ *              If the function returns true, the location at pChildId holds
+ *              the file ID of the child, or NULL if there is no such child.
+ *              The caller is responsible for freeing the string.
+ * Return value (bool):
+ *      True if the index is complete and was able to answer, false if the
+ *      caller needs to ask Google Drive instead.
+ */
+bool gdrive_idx_lookup_child(const char* parentId, const char* childName,
+                             char** pChildId);
+
+/*
+ * gdrive_idx_update_from_json():   Brings the index up to date with a file
+ *                                  resource received from Google Drive, for
+ *                                  example in the list of changes or in the
+ *                                  response to a request that changed a file.
+ *                                  Does nothing if the index is incomplete.
+ * Parameters:
+ *      pObj (Gdrive_Json_Object*):
+ *              The file resource. If it shows the file is in the trash, the
+ *              file is removed from the index.
+ */
+void gdrive_idx_update_from_json(Gdrive_Json_Object* pObj);
+
+/*
+ * gdrive_idx_remove(): Removes a file from the index, as when the list of
+ *                      changes shows it was deleted. Does nothing if the file
+ *                      isn't in the index.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file to remove.
+ */
+void gdrive_idx_remove(const char* fileId);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_INDEX_H */
+
@@ -2,6 +2,17 @@
 
 #include "gdrive-info.h"
 #include "gdrive-cache.h"
+#include "gdrive-ns-journal.h"
+#include "gdrive-id-pool.h"
+#include "gdrive-data-journal.h"
+#include "gdrive-index.h"
+#include "gdrive-pool.h"
+#include "gdrive-intern.h"
+#include "gdrive-negcache.h"
+#include "gdrive-json-stream.h"
+#include "gdrive-ratelimit.h"
+#include "gdrive-hedge.h"
+#include "gdrive-breaker.h"
 
 #include <string.h>
 #include <sys/stat.h>
@@ -19,6 +30,8 @@
 
 #define GDRIVE_FIELDNAME_ACCESSTOKEN "access_token"
 #define GDRIVE_FIELDNAME_REFRESHTOKEN "refresh_token"
+#define GDRIVE_FIELDNAME_EXPIRESIN "expires_in"
+#define GDRIVE_FIELDNAME_SCOPE "scope"
 #define GDRIVE_FIELDNAME_CODE "code"
 #define GDRIVE_FIELDNAME_CLIENTID "client_id"
 #define GDRIVE_FIELDNAME_CLIENTSECRET "client_secret"
@@ -42,7 +55,36 @@
 #define GDRIVE_SCOPE_APPS "https://www.googleapis.com/auth/drive.apps.readonly"
 #define GDRIVE_SCOPE_MAXLENGTH 200
 
-#define GDRIVE_RETRY_LIMIT 5
+// Retry budgets, in seconds. Every wait holds up the whole filesystem, so
+// they're kept short for anything somebody is likely waiting on. Uploads get
+// longer, since giving up loses the changes, except when they're saved in the
+// cache directory and can be tried again later anyway.
+#define GDRIVE_RETRY_BUDGET_METADATA 3
+#define GDRIVE_RETRY_BUDGET_CONTENT 5
+#define GDRIVE_RETRY_BUDGET_UPLOAD 60
+#define GDRIVE_RETRY_BUDGET_UPLOAD_SAVED 5
+
+#define GDRIVE_DEADLINE_METADATA 30
+#define GDRIVE_DEADLINE_CONTENT 0
+#define GDRIVE_DEADLINE_UPLOAD 0
+#define GDRIVE_STALL_TIME 30
+// Longest time to spend connecting, including the TLS handshake
+#define GDRIVE_CONNECT_TIMEOUT 15
+
+// Seconds before the access token expires to start getting a new one in the
+// background, and to stop waiting for that and get one right away
+#define GDRIVE_AUTH_REFRESH_EARLY 300
+#define GDRIVE_AUTH_REFRESH_LATE 60
+// Seconds to wait before trying again after a background refresh fails
+#define GDRIVE_AUTH_REFRESH_RETRY 30
+
+// Most folders to combine into one files.list query, which keeps the query
+// string (about 70 bytes per folder once escaped) well within URL limits
+#define GDRIVE_LIST_MAX_PARENTS 40
+#define GDRIVE_LIST_PAGE_SIZE "1000"
+#define GDRIVE_LIST_FIELDS "items(title,id,mimeType,fileSize,createdDate,"\
+                           "modifiedDate,lastViewedByMeDate,parents(id),"\
+                           "userPermission),nextPageToken"
 
 
 #define GDRIVE_ACCESS_MODE_COUNT 4
@@ -68,6 +110,20 @@ typedef struct Gdrive_Info
     // Global, publicly accessible settings
     size_t minChunkSize;
     int maxChunks;
+    bool writeBehind;
+    char* cacheDir;
+    enum Gdrive_Sync_Policy syncPolicy;
+    time_t syncWindow;
+    enum Gdrive_Atime_Policy atimePolicy;
+    bool fullIndex;
+    size_t maxCachedFiles;
+    size_t maxCacheMemory;
+    bool memoryPressure;
+    time_t staleGrace;
+    time_t retryBudget[GDRIVE_CLASS_COUNT];
+    time_t deadline[GDRIVE_CLASS_COUNT];
+    time_t stallTime;
+    bool hedging;
     
     // Members from here on are only for use within Gdrive code/header files.
     int mode;
@@ -79,6 +135,18 @@ typedef struct Gdrive_Info
     // actual size of the strings.
     long accessTokenLength;
     long refreshTokenLength;
+    // accessTokenExpiry: When the access token stops working, or 0 if unknown
+    time_t accessTokenExpiry;
+    // pAuthRefresh: A background request for a new access token, if one is
+    // running
+    Gdrive_Xfer_Async* pAuthRefresh;
+    // authRefreshStart: When pAuthRefresh was sent
+    time_t authRefreshStart;
+    // authRefreshRetry: Don't start another background refresh before this
+    time_t authRefreshRetry;
+    // refreshingAuth: A request for a new access token is being prepared or
+    // sent, so requests shouldn't try to refresh it themselves.
+    bool refreshingAuth;
     const char* clientId;
     const char* clientSecret;
     const char* redirectUri;
@@ -86,6 +154,14 @@ typedef struct Gdrive_Info
     CURL* curlHandle;
 } Gdrive_Info;
 
+// The folders that a streamed files.list response is being sorted into
+typedef struct Gdrive_Folder_Sort
+{
+    const char* const* folderIds;
+    int nFolders;
+    Gdrive_Fileinfo_Array** pArrays;
+} Gdrive_Folder_Sort;
+
 
 
 
@@ -93,20 +169,58 @@ static int gdrive_read_auth_file(const char* filename);
 
 static void gdrive_info_cleanup(void);
 
-static int 
-gdrive_refresh_auth_token(const char* grantType, const char* tokenString);
+static int gdrive_refresh_auth_token(const char* grantType, 
+                                     const char* tokenString, 
+                                     bool* pScopesConfirmed);
+
+static Gdrive_Transfer* 
+gdrive_refresh_auth_xfer(const char* grantType, const char* tokenString);
+
+static int gdrive_read_auth_token(Gdrive_Download_Buffer* pBuf, 
+                                  time_t sentTime, bool* pScopesConfirmed);
 
 static int gdrive_prompt_for_auth(void);
 
 static int gdrive_check_scopes(void);
 
+static bool gdrive_scopes_sufficient(const char* grantedScopes);
+
 static char* gdrive_get_root_folder_id(void);
 
 static char* 
 gdrive_get_child_id_by_name(const char* parentId, const char* childName);
 
+static char* 
+gdrive_request_child_id_by_name(const char* parentId, const char* childName);
+
+static Gdrive_Fileinfo* gdrive_get_cached_fileinfo(const char* fileId);
+
+static void gdrive_adjust_child_count(const char* folderId, int change);
+
+static int gdrive_folder_list_chunk(const char* const* folderIds, int nFolders,
+                                    Gdrive_Fileinfo_Array** pArrays);
+
+static Gdrive_Fileinfo_Array* gdrive_folder_list_first(const char* folderId);
+
+static Gdrive_Json_Object* 
+gdrive_folder_list_page(const char* filter, const char* pageToken, 
+                        const char* maxResults, Gdrive_Json_Stream* pStream);
+
+static int gdrive_folder_list_sort(Gdrive_Json_Object* pFile, 
+                                   const char* const* folderIds, int nFolders,
+                                   Gdrive_Fileinfo_Array** pArrays);
+
+static int gdrive_folder_list_sort_streamed(Gdrive_Json_Object* pFile, 
+                                            void* userdata);
+
+static Gdrive_Transfer* 
+gdrive_request_patch_xfer(const char* fileId, const char* addParentId, 
+                          const char* removeParentId, const char* newName);
+
 static int gdrive_save_auth(void);
 
+static int gdrive_request_send(Gdrive_Transfer* pTransfer);
+
 void gdrive_curlhandle_setup(CURL* curlHandle);
 
 
@@ -232,6 +346,25 @@ int gdrive_init_nocurl(int access, const char* authFilename, time_t cacheTTL,
         GDRIVE_BASE_CHUNK_SIZE;
     pInfo->maxChunks = maxChunksPerFile;
     
+    // Set up the journal for unuploaded changes, and send anything left over
+    // from last time. Queued namespace changes go first, since the saved 
+    // contents may belong to files they create.
+    if (gdrive_dj_init(pInfo->cacheDir) != 0)
+    {
+        // Couldn't create or use the cache directory
+        return -1;
+    }
+    gdrive_nsj_restore();
+    gdrive_dj_recover();
+    
+    // Build the index of all files, if asked to. Without it, everything still
+    // works, just more slowly.
+    if (pInfo->fullIndex && gdrive_idx_bootstrap() != 0)
+    {
+        fputs("fuse-drive: Couldn't build the file index, continuing "
+              "without it\n", stderr);
+    }
+    
     return 0;
 }
 
@@ -243,8 +376,24 @@ void gdrive_cleanup(void)
 
 void gdrive_cleanup_nocurl(void)
 {
+    // Anything still queued needs to reach Google Drive before the cache goes
+    // away.
+    gdrive_file_sync_due(true);
+    gdrive_nsj_cleanup();
+    gdrive_idx_save();
+    gdrive_idx_cleanup();
+    gdrive_idpool_cleanup();
+    gdrive_dj_cleanup();
     gdrive_sysinfo_cleanup();
     gdrive_cache_cleanup();
+    gdrive_negcache_clear();
+    // A background token refresh that is still going is abandoned.
+    Gdrive_Info* pInfo = gdrive_get_info();
+    gdrive_dlbuf_free(gdrive_xfer_finish(pInfo->pAuthRefresh));
+    pInfo->pAuthRefresh = NULL;
+    gdrive_xfer_cleanup();
+    gdrive_hedge_cleanup();
+    gdrive_dlbuf_cleanup();
     gdrive_info_cleanup();
 }
 
@@ -263,6 +412,163 @@ int gdrive_get_maxchunks(void)
     return gdrive_get_info()->maxChunks;
 }
 
+void gdrive_set_writebehind(bool enable)
+{
+    gdrive_get_info()->writeBehind = enable;
+}
+
+bool gdrive_get_writebehind(void)
+{
+    return gdrive_get_info()->writeBehind;
+}
+
+int gdrive_set_cachedir(const char* path)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    free(pInfo->cacheDir);
+    pInfo->cacheDir = NULL;
+    if (path == NULL)
+    {
+        // Nothing else to do
+        return 0;
+    }
+    
+    pInfo->cacheDir = malloc(strlen(path) + 1);
+    if (pInfo->cacheDir == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    strcpy(pInfo->cacheDir, path);
+    return 0;
+}
+
+const char* gdrive_get_cachedir(void)
+{
+    return gdrive_get_info()->cacheDir;
+}
+
+void gdrive_set_syncpolicy(enum Gdrive_Sync_Policy policy, time_t window)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    pInfo->syncPolicy = policy;
+    pInfo->syncWindow = window;
+}
+
+enum Gdrive_Sync_Policy gdrive_get_syncpolicy(void)
+{
+    return gdrive_get_info()->syncPolicy;
+}
+
+time_t gdrive_get_syncwindow(void)
+{
+    return gdrive_get_info()->syncWindow;
+}
+
+void gdrive_set_atimepolicy(enum Gdrive_Atime_Policy policy)
+{
+    gdrive_get_info()->atimePolicy = policy;
+}
+
+enum Gdrive_Atime_Policy gdrive_get_atimepolicy(void)
+{
+    return gdrive_get_info()->atimePolicy;
+}
+
+void gdrive_set_fullindex(bool enable)
+{
+    gdrive_get_info()->fullIndex = enable;
+}
+
+bool gdrive_get_fullindex(void)
+{
+    return gdrive_get_info()->fullIndex;
+}
+
+void gdrive_set_cachelimits(size_t maxFiles, size_t maxBytes, 
+                            bool watchPressure)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    pInfo->maxCachedFiles = maxFiles;
+    pInfo->maxCacheMemory = maxBytes;
+    pInfo->memoryPressure = watchPressure;
+}
+
+size_t gdrive_get_maxcachedfiles(void)
+{
+    return gdrive_get_info()->maxCachedFiles;
+}
+
+size_t gdrive_get_maxcachememory(void)
+{
+    return gdrive_get_info()->maxCacheMemory;
+}
+
+bool gdrive_get_memorypressure(void)
+{
+    return gdrive_get_info()->memoryPressure;
+}
+
+void gdrive_set_stalegrace(time_t grace)
+{
+    gdrive_get_info()->staleGrace = grace;
+}
+
+time_t gdrive_get_stalegrace(void)
+{
+    return gdrive_get_info()->staleGrace;
+}
+
+void gdrive_set_retrybudget(enum Gdrive_Request_Class requestClass, 
+                            time_t seconds)
+{
+    gdrive_get_info()->retryBudget[requestClass] = seconds;
+}
+
+time_t gdrive_get_retrybudget(enum Gdrive_Request_Class requestClass)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    if (pInfo->retryBudget[requestClass] < 0)
+    {
+        // Never set. Only uploads start out this way, since their default
+        // depends on whether failed uploads are kept to be tried again.
+        return (pInfo->cacheDir != NULL) ? 
+            GDRIVE_RETRY_BUDGET_UPLOAD_SAVED : GDRIVE_RETRY_BUDGET_UPLOAD;
+    }
+    return pInfo->retryBudget[requestClass];
+}
+
+void gdrive_set_deadline(enum Gdrive_Request_Class requestClass, 
+                         time_t seconds)
+{
+    gdrive_get_info()->deadline[requestClass] = seconds;
+}
+
+time_t gdrive_get_deadline(enum Gdrive_Request_Class requestClass)
+{
+    return gdrive_get_info()->deadline[requestClass];
+}
+
+void gdrive_set_stalltime(time_t seconds)
+{
+    gdrive_get_info()->stallTime = seconds;
+}
+
+time_t gdrive_get_stalltime(void)
+{
+    return gdrive_get_info()->stallTime;
+}
+
+void gdrive_set_hedging(bool hedging)
+{
+    gdrive_get_info()->hedging = hedging;
+}
+
+bool gdrive_get_hedging(void)
+{
+    return gdrive_get_info()->hedging;
+}
+
 int gdrive_get_filesystem_perms(enum Gdrive_Filetype type)
 {
     // Get the permissions for regular files.
@@ -394,91 +700,184 @@ char* gdrive_filepath_to_id(const char* path)
 
 Gdrive_Fileinfo_Array* gdrive_folder_list(const char* folderId)
 {
-    // Allow for an initial quote character in addition to the terminating null
-    char* filter = malloc(strlen(folderId) + 
-                            strlen("' in parents and trashed=false") + 2);
-    if (filter == NULL)
+    Gdrive_Fileinfo_Array* pArray = NULL;
+    gdrive_folder_list_multi(&folderId, 1, &pArray);
+    return pArray;
+}
+
+int gdrive_folder_list_multi(const char* const* folderIds, int nFolders, 
+                             Gdrive_Fileinfo_Array** pArrays)
+{
+    assert(folderIds != NULL && pArrays != NULL);
+    
+    int result = 0;
+    const char* chunkIds[GDRIVE_LIST_MAX_PARENTS];
+    int chunkIndices[GDRIVE_LIST_MAX_PARENTS];
+    Gdrive_Fileinfo_Array* chunkArrays[GDRIVE_LIST_MAX_PARENTS];
+    int nChunk = 0;
+    for (int i = 0; i < nFolders; i++)
     {
-        return NULL;
+        pArrays[i] = NULL;
+        
+        // A folder that hasn't been created on Google Drive yet only contains
+        // whatever is queued to go into it, so there's nothing to ask for.
+        if (gdrive_nsj_is_pending_create(folderIds[i]))
+        {
+            pArrays[i] = gdrive_finfoarray_create(0);
+        }
+        else if (gdrive_idx_is_complete())
+        {
+            pArrays[i] = gdrive_idx_list(folderIds[i]);
+        }
+        else
+        {
+            chunkIds[nChunk] = folderIds[i];
+            chunkIndices[nChunk] = i;
+            nChunk++;
+        }
+        
+        // Send the query once it's full, or once there are no more folders.
+        if (nChunk == GDRIVE_LIST_MAX_PARENTS || 
+                (nChunk > 0 && i == nFolders - 1))
+        {
+            if (gdrive_folder_list_chunk(chunkIds, nChunk, chunkArrays) == 0)
+            {
+                for (int j = 0; j < nChunk; j++)
+                {
+                    pArrays[chunkIndices[j]] = chunkArrays[j];
+                }
+            }
+            nChunk = 0;
+        }
     }
-    strcpy(filter, "'");
-    strcat(filter, folderId);
-    strcat(filter, "' in parents and trashed=false");
-    
-    // Prepare the network request
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
     
-    if (
-            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_FILES) || 
-            gdrive_xfer_add_query(pTransfer, "q", filter) || 
-            gdrive_xfer_add_query(pTransfer, "fields", 
-                                  "items(title,id,mimeType)")
-        )
+    for (int i = 0; i < nFolders; i++)
     {
-        // Error
-        free(filter);
-        gdrive_xfer_free(pTransfer);
-        return NULL;
+        // Account for any changes that haven't been sent yet.
+        if (pArrays[i] != NULL && 
+                gdrive_nsj_apply_to_listing(folderIds[i], pArrays[i]) != 0)
+        {
+            gdrive_finfoarray_free(pArrays[i]);
+            pArrays[i] = NULL;
+        }
+        if (pArrays[i] == NULL)
+        {
+            result = -1;
+            continue;
+        }
+        
+        // Remember the count, so checking whether the folder is empty 
+        // doesn't need another request.
+        Gdrive_Fileinfo* pFolderinfo = gdrive_get_cached_fileinfo(folderIds[i]);
+        if (pFolderinfo != NULL)
+        {
+            pFolderinfo->nChildren = gdrive_finfoarray_get_count(pArrays[i]);
+        }
     }
-    free(filter);
     
-    // Send the network request
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
+    return result;
+}
+
+int gdrive_folder_is_empty(const char* folderId)
+{
+    assert(folderId != NULL);
     
+    Gdrive_Fileinfo* pFileinfo = gdrive_get_cached_fileinfo(folderId);
+    if (pFileinfo != NULL && pFileinfo->nChildren >= 0)
+    {
+        // Already counted
+        return (pFileinfo->nChildren == 0);
+    }
     
-    // TODO: Somehow unify this process with other ways to fill Gdrive_Fileinfo,
-    // reducing code duplication and taking advantage of the cache.
-    int fileCount = -1;
     Gdrive_Fileinfo_Array* pArray = NULL;
-    if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+    if (gdrive_nsj_is_pending_create(folderId) || gdrive_idx_is_complete())
     {
-        // Transfer was successful.  Convert result to a JSON object and extract
-        // the file meta-info.
-        Gdrive_Json_Object* pObj = 
-                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-        if (pObj != NULL)
+        // Listing doesn't need to contact Google Drive.
+        pArray = gdrive_folder_list(folderId);
+        if (pArray == NULL)
         {
-            fileCount = gdrive_json_array_length(pObj, "items");
-            if (fileCount > 0)
-            {
-                // Create an array of Gdrive_Fileinfo structs large enough to
-                // hold all the items.
-                pArray = gdrive_finfoarray_create(fileCount);
-                if (pArray != NULL)
-                {
-                    // Extract the file info from each member of the array.
-                    for (int index = 0; index < fileCount; index++)
-                    {
-                        Gdrive_Json_Object* pFile = gdrive_json_array_get(
-                                pObj, 
-                                "items", 
-                                index
-                                );
-                        if (pFile != NULL)
-                        {
-                            gdrive_finfoarray_add_from_json(pArray, pFile);
-                        }
-                    }
-                }
-                else
-                {
-                    // Memory error.
-                    fileCount = -1;
-                }
-            }
-            // else either failure (return -1) or 0-length array (return 0),
-            // nothing special needs to be done.
-            
-            gdrive_json_kill(pObj);
+            return -EIO;
         }
-        // else do nothing.  Already prepared to return error.
+        int nChildren = gdrive_finfoarray_get_count(pArray);
+        gdrive_finfoarray_free(pArray);
+        return (nChildren == 0);
     }
     
-    gdrive_dlbuf_free(pBuf);
+    // One child is enough to know the folder isn't empty.
+    pArray = gdrive_folder_list_first(folderId);
+    if (pArray == NULL)
+    {
+        return -EIO;
+    }
+    int nRemote = gdrive_finfoarray_get_count(pArray);
+    if (gdrive_nsj_apply_to_listing(folderId, pArray) != 0)
+    {
+        // Memory error
+        gdrive_finfoarray_free(pArray);
+        return -ENOMEM;
+    }
+    int nChildren = gdrive_finfoarray_get_count(pArray);
+    gdrive_finfoarray_free(pArray);
+    if (nChildren > 0 || nRemote == 0)
+    {
+        return (nChildren == 0);
+    }
+    
+    // The child that was found is queued to be moved or removed, but there 
+    // could be others. Only the full listing can tell.
+    pArray = gdrive_folder_list(folderId);
+    if (pArray == NULL)
+    {
+        return -EIO;
+    }
+    nChildren = gdrive_finfoarray_get_count(pArray);
+    gdrive_finfoarray_free(pArray);
+    return (nChildren == 0);
+}
 
-    return pArray;
+void gdrive_folder_prefetch(const char* folderPath, 
+                            Gdrive_Fileinfo_Array* pChildren)
+{
+    assert(folderPath != NULL && pChildren != NULL);
+    
+    size_t pathLength = strlen(folderPath);
+    // The root folder's path already ends with '/'.
+    bool isRoot = (strcmp(folderPath, "/") == 0);
+    
+    const Gdrive_Fileinfo* pChild;
+    for (pChild = gdrive_finfoarray_get_first(pChildren); 
+            pChild != NULL; 
+            pChild = gdrive_finfoarray_get_next(pChildren, pChild)
+            )
+    {
+        // Remember the path, unless an item with the same name was already
+        // found (Google Drive allows duplicate names).
+        char* childPath = 
+                malloc(pathLength + strlen(pChild->filename) + 2);
+        if (childPath != NULL)
+        {
+            strcpy(childPath, folderPath);
+            if (!isRoot)
+            {
+                strcat(childPath, "/");
+            }
+            strcat(childPath, pChild->filename);
+            char* cachedId = gdrive_cache_get_fileid(childPath);
+            if (cachedId == NULL)
+            {
+                gdrive_cache_add_fileid(childPath, pChild->id);
+            }
+            free(cachedId);
+            free(childPath);
+        }
+        
+        // Subfolders are cached without counting their children, which is 
+        // only done if something needs to know whether one is empty.
+        if (gdrive_cache_get_node(pChild->id, false, NULL) == NULL)
+        {
+            gdrive_cache_add_fileinfo(pChild);
+        }
+    }
 }
 
 int gdrive_remove_parent(const char* fileId, const char* parentId)
@@ -494,43 +893,23 @@ int gdrive_remove_parent(const char* fileId, const char* parentId)
         return -EACCES;
     }
     
-    // URL will look like 
-    // "<standard Drive Files url>/<fileId>/parents/<parentId>"
-    char* url = malloc(strlen(GDRIVE_URL_FILES) + 1 + strlen(fileId) + 
-        strlen("/parents/") + strlen(parentId) + 1);
-    if (url == NULL)
+    if (!pInfo->writeBehind)
     {
-        // Memory error
-        return -ENOMEM;
+        return gdrive_request_remove_parent(fileId, parentId);
     }
-    strcpy(url, GDRIVE_URL_FILES);
-    strcat(url, "/");
-    strcat(url, fileId);
-    strcat(url, "/parents/");
-    strcat(url, parentId);
     
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    if (pTransfer == NULL)
-    {
-        free(url);
-        return -ENOMEM;
-    }
-    if (gdrive_xfer_set_url(pTransfer, url) != 0)
+    // Queue the change, and make the cache look like it already happened.
+    int returnVal = gdrive_nsj_add_remove_parent(fileId, parentId);
+    if (returnVal == 0)
     {
-        // Error, probably memory
-        gdrive_xfer_free(pTransfer);
-        free(url);
-        return -ENOMEM;
+        Gdrive_Fileinfo* pFileinfo = gdrive_get_cached_fileinfo(fileId);
+        if (pFileinfo)
+        {
+            pFileinfo->nParents--;
+        }
+        gdrive_adjust_child_count(parentId, -1);
+        gdrive_cache_remove_fileid(fileId);
     }
-    free(url);
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_DELETE);
-    
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
-    
-    int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400) ? 
-        -EIO : 0;
-    gdrive_dlbuf_free(pBuf);
     return returnVal;
 }
 
@@ -550,50 +929,30 @@ int gdrive_delete(const char* fileId, const char* parentId)
         return -EACCES;
     }
     
-    // URL will look like 
-    // "<standard Drive Files url>/<fileId>/trash"
-    char* url = malloc(strlen(GDRIVE_URL_FILES) + 1 + strlen(fileId) + 
-        strlen("/trash") + 1);
-    if (url == NULL)
+    if (!pInfo->writeBehind)
     {
-        // Memory error
-        return -ENOMEM;
-    }
-    strcpy(url, GDRIVE_URL_FILES);
-    strcat(url, "/");
-    strcat(url, fileId);
-    strcat(url, "/trash");
-    
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    if (pTransfer == NULL)
-    {
-        free(url);
-        return -ENOMEM;
-    }
-    if (gdrive_xfer_set_url(pTransfer, url) != 0)
-    {
-        // Error, probably memory
-        gdrive_xfer_free(pTransfer);
-        free(url);
-        return -ENOMEM;
+        int returnVal = gdrive_request_trash(fileId);
+        if (returnVal == 0)
+        {
+            gdrive_cache_delete_id(fileId);
+            if (parentId != NULL && strcmp(parentId, "/") != 0)
+            {
+                // Remove the parent from the cache because the child count 
+                // will be wrong.
+                gdrive_cache_delete_id(parentId);
+            }
+        }
+        return returnVal;
     }
-    free(url);
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_POST);
-    
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
     
-    int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400) ? 
-        -EIO : 0;
-    gdrive_dlbuf_free(pBuf);
+    // Queue the change, and make the cache look like it already happened.
+    int returnVal = gdrive_nsj_add_trash(fileId);
     if (returnVal == 0)
     {
         gdrive_cache_delete_id(fileId);
-        if (parentId != NULL && strcmp(parentId, "/") != 0)
+        if (parentId != NULL)
         {
-            // Remove the parent from the cache because the child count will be
-            // wrong.
-            gdrive_cache_delete_id(parentId);
+            gdrive_adjust_child_count(parentId, -1);
         }
     }
     return returnVal;
@@ -612,66 +971,29 @@ int gdrive_add_parent(const char* fileId, const char* parentId)
         return -EACCES;
     }
     
-    // URL will look like 
-    // "<standard Drive Files url>/<fileId>/parents"
-    char* url = malloc(strlen(GDRIVE_URL_FILES) + 1 + strlen(fileId) + 1 + 
-        strlen("/parents") + 1);
-    if (url == NULL)
+    int returnVal;
+    if (pInfo->writeBehind)
     {
-        // Memory error
-        return -ENOMEM;
-    }
-    strcpy(url, GDRIVE_URL_FILES);
-    strcat(url, "/");
-    strcat(url, fileId);
-    strcat(url, "/parents");
-    
-    // Create the Parent resource for the request body
-    Gdrive_Json_Object* pObj = gdrive_json_new();
-    if (!pObj)
-    {
-        // Memory error
-        free(url);
-        return -ENOMEM;
-    }
-    gdrive_json_add_string(pObj, "id", parentId);
-    char* body = gdrive_json_to_new_string(pObj, false);
-    gdrive_json_kill(pObj);
-    if (!body)
-    {
-        // Memory error
-        free(url);
-        return -ENOMEM;
-    }
-    
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    if (pTransfer == NULL)
-    {
-        free(url);
-        free(body);
-        return -ENOMEM;
+        // The journal needs the file's name and type to show it in the new
+        // parent before the change is sent.
+        const Gdrive_Fileinfo* pFileinfo = gdrive_finfo_get_by_id(fileId);
+        if (!pFileinfo)
+        {
+            return -ENOENT;
+        }
+        returnVal = gdrive_nsj_add_new_parent(
+                fileId, parentId, pFileinfo->filename, 
+                (pFileinfo->type == GDRIVE_FILETYPE_FOLDER)
+                );
+        if (returnVal == 0)
+        {
+            gdrive_adjust_child_count(parentId, 1);
+        }
     }
-    if (gdrive_xfer_set_url(pTransfer, url) || 
-            gdrive_xfer_add_header(pTransfer, "Content-Type: application/json")
-            )
+    else
     {
-        // Error, probably memory
-        gdrive_xfer_free(pTransfer);
-        free(url);
-        free(body);
-        return -ENOMEM;
+        returnVal = gdrive_request_add_parent(fileId, parentId);
     }
-    free(url);
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_POST);
-    gdrive_xfer_set_body(pTransfer, body);
-    
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
-    free(body);
-    
-    int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400) ? 
-        -EIO : 0;
-    gdrive_dlbuf_free(pBuf);
     
     if (returnVal == 0)
     {
@@ -699,69 +1021,106 @@ int gdrive_change_basename(const char* fileId, const char* newName)
         return -EACCES;
     }
     
-    // Create the request body with the new name
-    Gdrive_Json_Object* pObj = gdrive_json_new();
-    if (!pObj)
+    if (pInfo->writeBehind)
     {
-        // Memory error
-        return -ENOMEM;
+        // Renames are queued by gdrive_move(). This one is sent right away, so
+        // anything queued for the file has to go first.
+        gdrive_nsj_commit_for(fileId);
     }
-    gdrive_json_add_string(pObj, "title", newName);
-    char* body = gdrive_json_to_new_string(pObj, false);
-    gdrive_json_kill(pObj);
-    if (!body)
+    
+    return gdrive_request_change_basename(fileId, newName);
+}
+
+int gdrive_move(const char* fileId, const char* fromParentId, 
+                const char* toParentId, const char* newName, 
+                const char* fromPath, const char* toPath)
+{
+    assert(fileId && fromParentId && toParentId && newName && 
+            fileId[0] != '\0' && newName[0] != '\0');
+    
+    // Need write access
+    Gdrive_Info* pInfo = gdrive_get_info();
+    if (!(pInfo->mode & GDRIVE_ACCESS_WRITE))
     {
-        // Error, probably memory
-        return -ENOMEM;
+        return -EACCES;
     }
     
-    // Create the url in the form of:
-    // "<GDRIVE_URL_FILES>/<fileId>"
-    char* url = malloc(strlen(GDRIVE_URL_FILES) + 1 + strlen(fileId) + 1);
-    if (!url)
+    const Gdrive_Fileinfo* pFileinfo = gdrive_finfo_get_by_id(fileId);
+    if (!pFileinfo)
+    {
+        return -ENOENT;
+    }
+    bool isFolder = (pFileinfo->type == GDRIVE_FILETYPE_FOLDER);
+    bool sameParent = (strcmp(fromParentId, toParentId) == 0);
+    char* oldName = malloc(strlen(pFileinfo->filename) + 1);
+    if (!oldName)
     {
         // Memory error
-        free(body);
         return -ENOMEM;
     }
-    strcpy(url, GDRIVE_URL_FILES);
-    strcat(url, "/");
-    strcat(url, fileId);
+    strcpy(oldName, pFileinfo->filename);
     
-    // Set up the network transfer
-    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
-    if (!pTransfer)
+    bool renamed = (strcmp(oldName, newName) != 0);
+    
+    int returnVal = 0;
+    if (pInfo->writeBehind)
     {
-        // Memory error
-        free(url);
-        free(body);
-        return -ENOMEM;
+        returnVal = gdrive_nsj_add_move(fileId, fromParentId, toParentId, 
+                                        oldName, newName, isFolder);
     }
-    if (gdrive_xfer_set_url(pTransfer, url) || 
-            gdrive_xfer_add_query(pTransfer, "updateViewedDate", "false") || 
-            gdrive_xfer_add_header(pTransfer, "Content-Type: application/json")
-            )
+    else
     {
-        // Error, probably memory
-        gdrive_xfer_free(pTransfer);
-        free(url);
-        free(body);
-        return -ENOMEM;
+        // One request changes the parents and the name together.
+        returnVal = gdrive_request_move(fileId, fromParentId, toParentId, 
+                                        renamed ? newName : NULL);
     }
-    free(url);
-    gdrive_xfer_set_body(pTransfer, body);
-    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_PATCH);
+    free(oldName);
     
-    // Send the network request
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
-    free(body);
-    
-    int returnVal = (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400) ? 
-        -EIO : 0;
-    gdrive_dlbuf_free(pBuf);
+    if (returnVal == 0)
+    {
+        // Bring the cache up to date.
+        Gdrive_Fileinfo* pCachedinfo = gdrive_get_cached_fileinfo(fileId);
+        char* cachedName = pCachedinfo ? malloc(strlen(newName) + 1) : NULL;
+        if (cachedName)
+        {
+            strcpy(cachedName, newName);
+            free(pCachedinfo->filename);
+            pCachedinfo->filename = cachedName;
+        }
+        if (!sameParent)
+        {
+            gdrive_adjust_child_count(fromParentId, -1);
+            gdrive_adjust_child_count(toParentId, 1);
+        }
+        
+        // Move the cached paths (including everything inside a folder) to 
+        // the new location, or forget them if we can't.
+        if (fromPath == NULL || toPath == NULL || 
+                gdrive_cache_move_fileid(fileId, fromPath, toPath, renamed) 
+                != 0)
+        {
+            gdrive_cache_remove_fileid(fileId);
+        }
+    }
     return returnVal;
-    
+}
+
+void gdrive_print_memstats(FILE* stream)
+{
+    fputs("Memory use:\n", stream);
+    gdrive_pool_print_all(stream);
+    gdrive_intern_print_stats(stream);
+    gdrive_idx_print_stats(stream);
+    gdrive_cache_print_stats(stream);
+    gdrive_negcache_print_stats(stream);
+    gdrive_rate_print_stats(stream);
+    gdrive_hedge_print_stats(stream);
+    gdrive_breaker_print_stats(stream);
+}
+
+int gdrive_get_status(char* dest, size_t size)
+{
+    return gdrive_breaker_describe(dest, size);
 }
 
 
@@ -776,7 +1135,23 @@ int gdrive_change_basename(const char* fileId, const char* newName)
 
 Gdrive_Info* gdrive_get_info(void)
 {
-    static Gdrive_Info info = {0};
+    static Gdrive_Info info = 
+    {
+        .retryBudget = 
+        {
+            [GDRIVE_CLASS_METADATA] = GDRIVE_RETRY_BUDGET_METADATA,
+            [GDRIVE_CLASS_CONTENT] = GDRIVE_RETRY_BUDGET_CONTENT,
+            // Worked out by gdrive_get_retrybudget()
+            [GDRIVE_CLASS_UPLOAD] = -1
+        },
+        .deadline = 
+        {
+            [GDRIVE_CLASS_METADATA] = GDRIVE_DEADLINE_METADATA,
+            [GDRIVE_CLASS_CONTENT] = GDRIVE_DEADLINE_CONTENT,
+            [GDRIVE_CLASS_UPLOAD] = GDRIVE_DEADLINE_UPLOAD
+        },
+        .stallTime = GDRIVE_STALL_TIME
+    };
     return &info;
 }
 
@@ -818,11 +1193,18 @@ int gdrive_auth(void)
     // Try to refresh existing tokens first.
     if (pInfo->refreshToken != NULL && pInfo->refreshToken[0] != '\0')
     {
+        bool scopesConfirmed = false;
         int refreshSuccess = gdrive_refresh_auth_token(
                 GDRIVE_GRANTTYPE_REFRESH,
-                pInfo->refreshToken
+                pInfo->refreshToken,
+                &scopesConfirmed
         );
         
+        if (refreshSuccess == 0 && scopesConfirmed)
+        {
+            // The response listed the scopes, and they're the ones we need.
+            return 0;
+        }
         if (refreshSuccess == 0)
         {
             // Refresh succeeded, but we don't know what scopes were previously
@@ -852,6 +1234,213 @@ int gdrive_auth(void)
     return gdrive_prompt_for_auth();
 }
 
+void gdrive_auth_keep_fresh(void)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    if (pInfo->refreshingAuth || pInfo->accessTokenExpiry == 0 || 
+            pInfo->refreshToken == NULL || pInfo->refreshToken[0] == '\0')
+    {
+        // Already refreshing (this may be the refresh request itself), or 
+        // there's nothing to go on.
+        return;
+    }
+    pInfo->refreshingAuth = true;
+    time_t now = time(NULL);
+    
+    // Collect the background refresh once it's done.
+    if (pInfo->pAuthRefresh != NULL && gdrive_xfer_poll(pInfo->pAuthRefresh))
+    {
+        Gdrive_Download_Buffer* pBuf = gdrive_xfer_finish(pInfo->pAuthRefresh);
+        pInfo->pAuthRefresh = NULL;
+        if (pBuf == NULL || 
+                gdrive_read_auth_token(pBuf, pInfo->authRefreshStart, NULL) 
+                != 0)
+        {
+            pInfo->authRefreshRetry = now + GDRIVE_AUTH_REFRESH_RETRY;
+        }
+        gdrive_dlbuf_free(pBuf);
+    }
+    
+    if (now < pInfo->authRefreshRetry)
+    {
+        // The last attempt failed not long ago.
+    }
+    else if (now >= pInfo->accessTokenExpiry - GDRIVE_AUTH_REFRESH_LATE)
+    {
+        // Too close to wait for the background refresh any longer. Refresh 
+        // right away, so that the request doesn't go out with a token that 
+        // is about to stop working. If this fails, a 401 still gets the usual
+        // handling.
+        gdrive_dlbuf_free(gdrive_xfer_finish(pInfo->pAuthRefresh));
+        pInfo->pAuthRefresh = NULL;
+        if (gdrive_refresh_auth_token(GDRIVE_GRANTTYPE_REFRESH, 
+                                      pInfo->refreshToken, NULL) != 0)
+        {
+            pInfo->authRefreshRetry = now + GDRIVE_AUTH_REFRESH_RETRY;
+        }
+    }
+    else if (pInfo->pAuthRefresh == NULL && 
+            now >= pInfo->accessTokenExpiry - GDRIVE_AUTH_REFRESH_EARLY)
+    {
+        // Start getting a new token while the old one still works. The 
+        // scopes don't change on a refresh, so there's no need to check them.
+        Gdrive_Transfer* pTransfer = 
+                gdrive_refresh_auth_xfer(GDRIVE_GRANTTYPE_REFRESH, 
+                                         pInfo->refreshToken);
+        if (pTransfer != NULL)
+        {
+            pInfo->authRefreshStart = now;
+            pInfo->pAuthRefresh = gdrive_xfer_start(pTransfer);
+            gdrive_xfer_free(pTransfer);
+        }
+        if (pInfo->pAuthRefresh == NULL)
+        {
+            pInfo->authRefreshRetry = now + GDRIVE_AUTH_REFRESH_RETRY;
+        }
+    }
+    
+    pInfo->refreshingAuth = false;
+}
+
+int gdrive_request_remove_parent(const char* fileId, const char* parentId)
+{
+    return gdrive_request_send(
+            gdrive_request_remove_parent_xfer(fileId, parentId));
+}
+
+int gdrive_request_trash(const char* fileId)
+{
+    return gdrive_request_send(gdrive_request_trash_xfer(fileId));
+}
+
+int gdrive_request_add_parent(const char* fileId, const char* parentId)
+{
+    return gdrive_request_send(
+            gdrive_request_add_parent_xfer(fileId, parentId));
+}
+
+int gdrive_request_change_basename(const char* fileId, const char* newName)
+{
+    assert(fileId && newName && fileId[0] != '\0' && newName[0] != '\0');
+    
+    return gdrive_request_move(fileId, NULL, NULL, newName);
+}
+
+int gdrive_request_move(const char* fileId, const char* fromParentId, 
+                        const char* toParentId, const char* newName)
+{
+    return gdrive_request_send(
+            gdrive_request_move_xfer(fileId, fromParentId, toParentId, 
+                                     newName));
+}
+
+Gdrive_Transfer* gdrive_request_remove_parent_xfer(const char* fileId, 
+                                                   const char* parentId)
+{
+    assert(fileId != NULL && fileId[0] != '\0' && 
+            parentId != NULL && parentId[0] != '\0'
+            );
+    
+    // Use files.patch rather than the parents collection, because it returns
+    // the file's new resource.
+    return gdrive_request_patch_xfer(fileId, NULL, parentId, NULL);
+}
+
+Gdrive_Transfer* gdrive_request_trash_xfer(const char* fileId)
+{
+    assert(fileId != NULL && fileId[0] != '\0');
+    
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
+    {
+        return NULL;
+    }
+    // URL will look like 
+    // "<standard Drive Files url>/<fileId>/trash"
+    if (gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_FILES, fileId, "/trash")
+            != 0)
+    {
+        // Error, probably memory
+        gdrive_xfer_free(pTransfer);
+        return NULL;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_POST);
+    return pTransfer;
+}
+
+Gdrive_Transfer* gdrive_request_add_parent_xfer(const char* fileId, 
+                                                const char* parentId)
+{
+    assert(fileId != NULL && fileId[0] != '\0' && 
+            parentId != NULL && parentId[0] != '\0'
+            );
+    
+    // As with removing a parent, files.patch returns the new resource.
+    return gdrive_request_patch_xfer(fileId, parentId, NULL, NULL);
+}
+
+Gdrive_Transfer* gdrive_request_move_xfer(const char* fileId, 
+                                          const char* fromParentId, 
+                                          const char* toParentId, 
+                                          const char* newName)
+{
+    assert(fileId && fileId[0] != '\0' && 
+            (fromParentId == NULL) == (toParentId == NULL));
+    
+    // Changing parents goes in the same request, as query parameters.
+    bool changeParents = (fromParentId != NULL && 
+            strcmp(fromParentId, toParentId) != 0);
+    return gdrive_request_patch_xfer(fileId, 
+                                     changeParents ? toParentId : NULL, 
+                                     changeParents ? fromParentId : NULL, 
+                                     newName);
+}
+
+int gdrive_request_result(Gdrive_Download_Buffer* pBuf)
+{
+    if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    {
+        return gdrive_request_error(pBuf);
+    }
+    
+    // The response holds the changed file's new resource, which the index 
+    // needs to see before the change shows up in the list of changes.
+    if (gdrive_idx_is_complete())
+    {
+        Gdrive_Json_Object* pObj = 
+                gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+        gdrive_idx_update_from_json(pObj);
+        gdrive_json_kill(pObj);
+    }
+    return 0;
+}
+
+int gdrive_request_error(Gdrive_Download_Buffer* pBuf)
+{
+    if (pBuf == NULL || 
+            gdrive_dlbuf_get_retrymethod(pBuf) != GDRIVE_RETRY_NORETRY)
+    {
+        // No response at all, or an error that may well go away (a server
+        // error, an exceeded rate limit, or credentials that couldn't be
+        // renewed just now)
+        return -EIO;
+    }
+    
+    switch (gdrive_dlbuf_get_httpresp(pBuf))
+    {
+        case 404:
+            return -ENOENT;
+            
+        case 403:
+            // Not a rate limit, or it would have been retried
+            return -EACCES;
+            
+        default:
+            // Google Drive refused the request itself.
+            return -EINVAL;
+    }
+}
+
 
 /*************************************************************************
  * Implementations of private functions for use within this file
@@ -943,6 +1532,9 @@ static void gdrive_info_cleanup(void)
     free(pInfo->authFilename);
     pInfo->authFilename = NULL;
     
+    free(pInfo->cacheDir);
+    pInfo->cacheDir = NULL;
+    
     free(pInfo->accessToken);
     pInfo->accessToken = NULL;
     pInfo->accessTokenLength = 0;
@@ -950,6 +1542,8 @@ static void gdrive_info_cleanup(void)
     free(pInfo->refreshToken);
     pInfo->refreshToken = NULL;
     pInfo->refreshTokenLength = 0;
+    pInfo->accessTokenExpiry = 0;
+    pInfo->authRefreshRetry = 0;
     
     pInfo->clientId = NULL;
     pInfo->clientSecret = NULL;
@@ -965,25 +1559,64 @@ static void gdrive_info_cleanup(void)
 
 
 
+/*
+ * Gets new access (and possibly refresh) tokens, either from an authorization
+ * code or from the refresh token. pScopesConfirmed can be NULL. Otherwise, it
+ * is set to true if the response says that every scope we need was granted.
+ * Returns 0 on success, 1 if the request was refused, or -1 on error.
+ */
 static int gdrive_refresh_auth_token(const char* grantType, 
-                                     const char* tokenString)
+                                     const char* tokenString, 
+                                     bool* pScopesConfirmed)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    
+    // Prepare the network request
+    Gdrive_Transfer* pTransfer = 
+            gdrive_refresh_auth_xfer(grantType, tokenString);
+    if (pTransfer == NULL)
+    {
+        // Invalid grant_type or memory error
+        return -1;
+    }
+        
+    // Do the transfer. It shouldn't start another refresh of its own.
+    time_t sentTime = time(NULL);
+    bool wasRefreshing = pInfo->refreshingAuth;
+    pInfo->refreshingAuth = true;
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    pInfo->refreshingAuth = wasRefreshing;
+    gdrive_xfer_free(pTransfer);
+    
+    if (pBuf == NULL)
+    {
+        // There was an error sending the request and getting the response.
+        return -1;
+    }
+    int returnVal = gdrive_read_auth_token(pBuf, sentTime, pScopesConfirmed);
+    gdrive_dlbuf_free(pBuf);
+    return returnVal;
+}
+
+/*
+ * Builds the request for gdrive_refresh_auth_token(). Returns NULL on error.
+ */
+static Gdrive_Transfer* 
+gdrive_refresh_auth_xfer(const char* grantType, const char* tokenString)
 {
     // Make sure we were given a valid grant_type
     if (strcmp(grantType, GDRIVE_GRANTTYPE_CODE) && 
             strcmp(grantType, GDRIVE_GRANTTYPE_REFRESH))
     {
         // Invalid grant_type
-        return -1;
+        return NULL;
     }
     
-    Gdrive_Info* pInfo = gdrive_get_info();
-    
-    // Prepare the network request
     Gdrive_Transfer* pTransfer = gdrive_xfer_create();
     if (pTransfer == NULL)
     {
         // Memory error
-        return -1;
+        return NULL;
     }
     gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_POST);
     
@@ -1005,7 +1638,7 @@ static int gdrive_refresh_auth_token(const char* grantType,
         {
             // Error
             gdrive_xfer_free(pTransfer);
-            return -1;
+            return NULL;
         }
         tokenOrCodeField = GDRIVE_FIELDNAME_CODE;
     }
@@ -1029,24 +1662,31 @@ static int gdrive_refresh_auth_token(const char* grantType,
     {
         // Error
         gdrive_xfer_free(pTransfer);
-        return -1;
+        return NULL;
     }
-        
-    // Do the transfer. 
-    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
-    gdrive_xfer_free(pTransfer);
-    
-    if (pBuf == NULL)
+    return pTransfer;
+}
+
+/*
+ * Stores the tokens from a response to the request built by 
+ * gdrive_refresh_auth_xfer(), which was sent at sentTime. pScopesConfirmed is
+ * as for gdrive_refresh_auth_token(). Returns 0 on success, 1 if the request
+ * was refused, or -1 on error.
+ */
+static int gdrive_read_auth_token(Gdrive_Download_Buffer* pBuf, 
+                                  time_t sentTime, bool* pScopesConfirmed)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
+    if (pScopesConfirmed != NULL)
     {
-        // There was an error sending the request and getting the response.
-        return -1;
+        *pScopesConfirmed = false;
     }
+    
     if (gdrive_dlbuf_get_httpresp(pBuf) >= 400)
     {
         // Failure, but probably not an error.  Most likely, the user has
         // revoked permission or the refresh token has otherwise been
         // invalidated.
-        gdrive_dlbuf_free(pBuf);
         return 1;
     }
     
@@ -1056,7 +1696,6 @@ static int gdrive_refresh_auth_token(const char* grantType,
 
     Gdrive_Json_Object* pObj = 
             gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
-    gdrive_dlbuf_free(pBuf);
     if (pObj == NULL)
     {
         // Couldn't locate JSON-formatted information in the server's 
@@ -1093,6 +1732,26 @@ static int gdrive_refresh_auth_token(const char* grantType,
                     &(pInfo->refreshTokenLength)
                     );
         }
+        
+        // Counting from when the request was sent errs on the early side.
+        bool success = false;
+        int64_t expiresIn = gdrive_json_get_int64(pObj, 
+                                                  GDRIVE_FIELDNAME_EXPIRESIN, 
+                                                  true, &success);
+        pInfo->accessTokenExpiry = (success && expiresIn > 0) ? 
+                sentTime + (time_t) expiresIn : 0;
+        
+        // The response usually lists the granted scopes, which saves asking
+        // for them separately.
+        if (pScopesConfirmed != NULL)
+        {
+            char* grantedScopes = 
+                    gdrive_json_get_new_string(pObj, GDRIVE_FIELDNAME_SCOPE, 
+                                               NULL);
+            *pScopesConfirmed = (grantedScopes != NULL && 
+                    gdrive_scopes_sufficient(grantedScopes));
+            free(grantedScopes);
+        }
     }
     gdrive_json_kill(pObj);
     
@@ -1170,7 +1829,7 @@ static int gdrive_prompt_for_auth(void)
     }
     
     // Exchange the authorization code for access and refresh tokens.
-    return gdrive_refresh_auth_token(GDRIVE_GRANTTYPE_CODE, authCode);
+    return gdrive_refresh_auth_token(GDRIVE_GRANTTYPE_CODE, authCode, NULL);
 }
 
 static int gdrive_check_scopes(void)
@@ -1220,15 +1879,26 @@ static int gdrive_check_scopes(void)
         // Couldn't interpret the response as JSON, return error.
         return -1;
     }
-    char* grantedScopes = gdrive_json_get_new_string(pObj, "scope", NULL);
+    char* grantedScopes = 
+            gdrive_json_get_new_string(pObj, GDRIVE_FIELDNAME_SCOPE, NULL);
+    gdrive_json_kill(pObj);
     if (grantedScopes == NULL)
     {
         // Key not found, or value not a string.  Return error.
-        gdrive_json_kill(pObj);
         return -1;
     }
-    gdrive_json_kill(pObj);
-    
+    bool sufficient = gdrive_scopes_sufficient(grantedScopes);
+    free(grantedScopes);
+    return sufficient ? 0 : -1;
+}
+
+/*
+ * Checks a space-separated list of granted scopes against the access mode.
+ * Returns true if every scope we need is there.
+ */
+static bool gdrive_scopes_sufficient(const char* grantedScopes)
+{
+    Gdrive_Info* pInfo = gdrive_get_info();
     
     // Go through each of the space-separated scopes in the string, comparing
     // each one to the GDRIVE_ACCESS_SCOPES array.
@@ -1252,8 +1922,10 @@ static int gdrive_check_scopes(void)
         
         // Compare the current scope to each of the entries in 
         // GDRIVE_ACCESS_SCOPES.  If there's a match, set the appropriate bit(s)
-        // in matchedScopes.
-        for (int i = 0; i < GDRIVE_ACCESS_MODE_COUNT; i++)
+        // in matchedScopes.  An empty scope (from an empty string or doubled
+        // spaces) would match everything, so skip it.
+        for (int i = 0; i < GDRIVE_ACCESS_MODE_COUNT && endIndex > startIndex; 
+                i++)
         {
             if (strncmp(GDRIVE_ACCESS_SCOPES[i], 
                         grantedScopes + startIndex, 
@@ -1266,7 +1938,6 @@ static int gdrive_check_scopes(void)
         
         startIndex = endIndex + 1;
     }
-    free(grantedScopes);
     
     // Compare the access mode we encountered to the one we expected, one piece
     // at a time.  If we don't find what we need, return failure.
@@ -1276,12 +1947,12 @@ static int gdrive_check_scopes(void)
                 !(matchedScopes & GDRIVE_ACCESS_MODES[i])
                 )
         {
-            return -1;
+            return false;
         }
     }
     
     // If we made it through to here, return success.
-    return 0;
+    return true;
 }
 
 static char* gdrive_get_root_folder_id(void)
@@ -1298,6 +1969,51 @@ static char* gdrive_get_root_folder_id(void)
 static char* 
 gdrive_get_child_id_by_name(const char* parentId, const char* childName)
 {
+    // Changes that haven't been sent yet take precedence over what Google 
+    // Drive knows.
+    char* childId = NULL;
+    if (gdrive_nsj_lookup_child(parentId, childName, &childId))
+    {
+        return childId;
+    }
+    
+    if (!gdrive_idx_lookup_child(parentId, childName, &childId))
+    {
+        childId = gdrive_request_child_id_by_name(parentId, childName);
+    }
+    if (childId != NULL && 
+            !gdrive_nsj_is_visible(childId, parentId, childName))
+    {
+        // Moved, renamed or deleted locally
+        free(childId);
+        childId = NULL;
+    }
+    return childId;
+}
+
+static char* 
+gdrive_request_child_id_by_name(const char* parentId, const char* childName)
+{
+    // A file that was found ends up in the path cache, but one that doesn't
+    // exist doesn't. Remember that answer for a moment, in the form of 
+    // "child:<parentId>/<childName>".
+    char* key = malloc(strlen("child:/") + strlen(parentId) + 
+                       strlen(childName) + 1);
+    if (key == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    strcpy(key, "child:");
+    strcat(key, parentId);
+    strcat(key, "/");
+    strcat(key, childName);
+    if (gdrive_negcache_has(key))
+    {
+        free(key);
+        return NULL;
+    }
+    
     // Construct a filter in the form of 
     // "'<parentId>' in parents and title = '<childName>'"
     char* filter = 
@@ -1307,6 +2023,7 @@ gdrive_get_child_id_by_name(const char* parentId, const char* childName)
     if (filter == NULL)
     {
         // Memory error
+        free(key);
         return NULL;
     }
     strcpy(filter, "'");
@@ -1320,6 +2037,7 @@ gdrive_get_child_id_by_name(const char* parentId, const char* childName)
     {
         // Memory error
         free(filter);
+        free(key);
         return NULL;
     }
     gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
@@ -1331,6 +2049,7 @@ gdrive_get_child_id_by_name(const char* parentId, const char* childName)
     {
         // Error
         free(filter);
+        free(key);
         gdrive_xfer_free(pTransfer);
         return NULL;
     }
@@ -1343,6 +2062,7 @@ gdrive_get_child_id_by_name(const char* parentId, const char* childName)
     {
         // Download error
         gdrive_dlbuf_free(pBuf);
+        free(key);
         return NULL;
     }
     
@@ -1357,6 +2077,7 @@ gdrive_get_child_id_by_name(const char* parentId, const char* childName)
     if (pObj == NULL)
     {
         // Couldn't convert to JSON object.
+        free(key);
         return NULL;
     }
     
@@ -1366,10 +2087,335 @@ gdrive_get_child_id_by_name(const char* parentId, const char* childName)
     {
         childId = gdrive_json_get_new_string(pArrayItem, "id", NULL);
     }
+    else
+    {
+        // There's definitely no such file.
+        gdrive_negcache_add(key);
+    }
     gdrive_json_kill(pObj);
+    free(key);
     return childId;
 }
 
+/*
+ * Returns the cached information for fileId without going to the network, or
+ * NULL if the file isn't cached.
+ */
+static Gdrive_Fileinfo* gdrive_get_cached_fileinfo(const char* fileId)
+{
+    Gdrive_Cache_Node* pNode = gdrive_cache_get_node(fileId, false, NULL);
+    return (pNode != NULL) ? gdrive_cnode_get_fileinfo(pNode) : NULL;
+}
+
+/*
+ * Adds change to the cached number of children of folderId, if the folder is 
+ * cached and its children have been counted.
+ */
+static void gdrive_adjust_child_count(const char* folderId, int change)
+{
+    Gdrive_Fileinfo* pFolderinfo = gdrive_get_cached_fileinfo(folderId);
+    if (pFolderinfo != NULL && pFolderinfo->nChildren >= 0)
+    {
+        pFolderinfo->nChildren += change;
+    }
+}
+
+static int gdrive_folder_list_chunk(const char* const* folderIds, int nFolders,
+                                    Gdrive_Fileinfo_Array** pArrays)
+{
+    assert(nFolders > 0 && nFolders <= GDRIVE_LIST_MAX_PARENTS);
+    
+    // Construct a filter in the form of "('<id1>' in parents or 
+    // '<id2>' in parents ...) and trashed=false"
+    size_t filterSize = strlen("() and trashed=false") + 1;
+    for (int i = 0; i < nFolders; i++)
+    {
+        filterSize += strlen(folderIds[i]) + strlen(" or '' in parents");
+    }
+    char* filter = malloc(filterSize);
+    if (filter == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    strcpy(filter, "(");
+    for (int i = 0; i < nFolders; i++)
+    {
+        if (i > 0)
+        {
+            strcat(filter, " or ");
+        }
+        strcat(filter, "'");
+        strcat(filter, folderIds[i]);
+        strcat(filter, "' in parents");
+    }
+    strcat(filter, ") and trashed=false");
+    
+    int result = 0;
+    for (int i = 0; i < nFolders; i++)
+    {
+        pArrays[i] = gdrive_finfoarray_create(0);
+        if (pArrays[i] == NULL)
+        {
+            // Memory error
+            result = -1;
+        }
+    }
+    
+    // Each file is sorted into its folders' lists as soon as it arrives.
+    Gdrive_Folder_Sort sort = {folderIds, nFolders, pArrays};
+    Gdrive_Json_Stream* pStream = 
+            gdrive_jstream_create("items", gdrive_folder_list_sort_streamed, 
+                                  &sort);
+    if (pStream == NULL)
+    {
+        // Memory error
+        result = -1;
+    }
+    
+    // Folders can hold more items than fit in one response, so keep asking
+    // until there are no more pages.
+    char* pageToken = NULL;
+    while (result == 0)
+    {
+        Gdrive_Json_Object* pObj = 
+                gdrive_folder_list_page(filter, pageToken, 
+                                        GDRIVE_LIST_PAGE_SIZE, pStream);
+        free(pageToken);
+        pageToken = NULL;
+        if (pObj == NULL)
+        {
+            // Download error, or couldn't store the files
+            result = -1;
+            break;
+        }
+        
+        pageToken = gdrive_json_get_new_string(pObj, "nextPageToken", NULL);
+        gdrive_json_kill(pObj);
+        if (pageToken == NULL)
+        {
+            // That was the last page.
+            break;
+        }
+    }
+    free(pageToken);
+    free(filter);
+    gdrive_jstream_free(pStream);
+    
+    if (result != 0)
+    {
+        // An incomplete listing is no better than none.
+        for (int i = 0; i < nFolders; i++)
+        {
+            gdrive_finfoarray_free(pArrays[i]);
+            pArrays[i] = NULL;
+        }
+    }
+    return result;
+}
+
+/*
+ * Asks Google Drive for just one of the files in a folder, without applying 
+ * queued changes. Returns a list with no items if the folder is empty on 
+ * Google Drive, or NULL on error.
+ */
+static Gdrive_Fileinfo_Array* gdrive_folder_list_first(const char* folderId)
+{
+    // Construct a filter in the form of "'<id>' in parents and trashed=false"
+    char* filter = malloc(strlen(folderId) + 
+                          strlen("'' in parents and trashed=false") + 1);
+    Gdrive_Fileinfo_Array* pArray = gdrive_finfoarray_create(0);
+    if (filter == NULL || pArray == NULL)
+    {
+        // Memory error
+        free(filter);
+        gdrive_finfoarray_free(pArray);
+        return NULL;
+    }
+    strcpy(filter, "'");
+    strcat(filter, folderId);
+    strcat(filter, "' in parents and trashed=false");
+    
+    Gdrive_Json_Object* pObj = 
+            gdrive_folder_list_page(filter, NULL, "1", NULL);
+    free(filter);
+    if (pObj == NULL)
+    {
+        // Download error
+        gdrive_finfoarray_free(pArray);
+        return NULL;
+    }
+    
+    Gdrive_Json_Object* pFile = gdrive_json_array_get(pObj, "items", 0);
+    if (pFile != NULL && 
+            gdrive_folder_list_sort(pFile, &folderId, 1, &pArray) != 0)
+    {
+        // Memory error
+        gdrive_finfoarray_free(pArray);
+        pArray = NULL;
+    }
+    gdrive_json_kill(pObj);
+    return pArray;
+}
+
+/*
+ * Sends one files.list request. If pStream is not NULL, the files are handed
+ * to it as they arrive and the returned object has no items. Returns NULL on
+ * error.
+ */
+static Gdrive_Json_Object* 
+gdrive_folder_list_page(const char* filter, const char* pageToken, 
+                        const char* maxResults, Gdrive_Json_Stream* pStream)
+{
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_GET);
+    if (
+            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_FILES) || 
+            gdrive_xfer_add_query(pTransfer, "q", filter) || 
+            gdrive_xfer_add_query(pTransfer, "maxResults", maxResults) || 
+            gdrive_xfer_add_query(pTransfer, "fields", GDRIVE_LIST_FIELDS) || 
+            (pageToken != NULL && 
+                gdrive_xfer_add_query(pTransfer, "pageToken", pageToken))
+        )
+    {
+        // Error
+        gdrive_xfer_free(pTransfer);
+        return NULL;
+    }
+    gdrive_xfer_set_jstream(pTransfer, pStream);
+    
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    Gdrive_Json_Object* pObj = NULL;
+    if (pBuf != NULL && gdrive_dlbuf_get_httpresp(pBuf) < 400)
+    {
+        pObj = (pStream != NULL) ? gdrive_jstream_finish(pStream) : 
+            gdrive_json_from_string(gdrive_dlbuf_get_data(pBuf));
+    }
+    else if (pStream != NULL)
+    {
+        // Throw away anything that made it into the stream.
+        gdrive_jstream_finish(pStream);
+    }
+    gdrive_dlbuf_free(pBuf);
+    return pObj;
+}
+
+static int gdrive_folder_list_sort(Gdrive_Json_Object* pFile, 
+                                   const char* const* folderIds, int nFolders,
+                                   Gdrive_Fileinfo_Array** pArrays)
+{
+    Gdrive_Fileinfo fileinfo = {0};
+    gdrive_finfo_read_json(&fileinfo, pFile);
+    
+    // A file with several parents belongs in the listing of each one that was
+    // asked for.
+    int result = 0;
+    int nParents = gdrive_json_array_length(pFile, "parents");
+    for (int index = 0; index < nParents; index++)
+    {
+        Gdrive_Json_Object* pParent = 
+                gdrive_json_array_get(pFile, "parents", index);
+        char* parentId = (pParent != NULL) ? 
+            gdrive_json_get_new_string(pParent, "id", NULL) : NULL;
+        if (parentId == NULL)
+        {
+            continue;
+        }
+        for (int i = 0; i < nFolders; i++)
+        {
+            if (strcmp(parentId, folderIds[i]) == 0 && 
+                    gdrive_finfoarray_add_copy(pArrays[i], &fileinfo) != 0)
+            {
+                // Memory error
+                result = -1;
+            }
+        }
+        free(parentId);
+    }
+    
+    gdrive_finfo_cleanup(&fileinfo);
+    return result;
+}
+
+/*
+ * gdrive_jstream_callback for gdrive_folder_list_chunk(). userdata is a 
+ * Gdrive_Folder_Sort.
+ */
+static int gdrive_folder_list_sort_streamed(Gdrive_Json_Object* pFile, 
+                                            void* userdata)
+{
+    Gdrive_Folder_Sort* pSort = (Gdrive_Folder_Sort*) userdata;
+    return gdrive_folder_list_sort(pFile, pSort->folderIds, pSort->nFolders, 
+                                   pSort->pArrays);
+}
+
+/*
+ * Builds a files.patch request that adds a parent, removes a parent and 
+ * changes the title, in any combination. Any of addParentId, removeParentId 
+ * and newName can be NULL to leave that part out. Returns NULL on failure.
+ */
+static Gdrive_Transfer* 
+gdrive_request_patch_xfer(const char* fileId, const char* addParentId, 
+                          const char* removeParentId, const char* newName)
+{
+    assert(fileId && fileId[0] != '\0');
+    
+    // Create the request body with the new name, if any
+    Gdrive_Json_Object* pObj = gdrive_json_new();
+    if (!pObj)
+    {
+        // Memory error
+        return NULL;
+    }
+    if (newName != NULL)
+    {
+        gdrive_json_add_string(pObj, "title", newName);
+    }
+    char* body = gdrive_json_to_new_string(pObj, false);
+    gdrive_json_kill(pObj);
+    if (!body)
+    {
+        // Error, probably memory
+        return NULL;
+    }
+    
+    // Set up the network transfer, with the url in the form of:
+    // "<GDRIVE_URL_FILES>/<fileId>"
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (!pTransfer)
+    {
+        // Memory error
+        free(body);
+        return NULL;
+    }
+    if (gdrive_xfer_set_file_url(pTransfer, GDRIVE_URL_FILES, fileId, NULL) || 
+            gdrive_xfer_add_query(pTransfer, "updateViewedDate", "false") || 
+            (addParentId != NULL && 
+            gdrive_xfer_add_query(pTransfer, "addParents", addParentId)) || 
+            (removeParentId != NULL && 
+            gdrive_xfer_add_query(pTransfer, "removeParents", removeParentId)
+            ) || 
+            gdrive_xfer_add_header(pTransfer, 
+                                   "Content-Type: application/json") || 
+            gdrive_xfer_copy_body(pTransfer, body)
+            )
+    {
+        // Error, probably memory
+        gdrive_xfer_free(pTransfer);
+        free(body);
+        return NULL;
+    }
+    free(body);
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_PATCH);
+    return pTransfer;
+}
+
 static int gdrive_save_auth(void)
 {
     Gdrive_Info* pInfo = gdrive_get_info();
@@ -1411,4 +2457,37 @@ void gdrive_curlhandle_setup(CURL* curlHandle)
     
     // Automatically follow redirects
     curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1);
-}
\ No newline at end of file
+    
+    // Don't let a connection that has stopped responding hold up a request
+    // forever. The overall deadline depends on the kind of request, so it's
+    // set for each transfer (see gdrive_xfer_execute()).
+    curl_easy_setopt(curlHandle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curlHandle, CURLOPT_CONNECTTIMEOUT, 
+                     (long) GDRIVE_CONNECT_TIMEOUT);
+    time_t stallTime = gdrive_get_info()->stallTime;
+    if (stallTime > 0)
+    {
+        curl_easy_setopt(curlHandle, CURLOPT_LOW_SPEED_LIMIT, 
+                         (long) GDRIVE_STALL_BYTES);
+        curl_easy_setopt(curlHandle, CURLOPT_LOW_SPEED_TIME, (long) stallTime);
+    }
+}
+
+/*
+ * Sends a request built by one of the gdrive_request_*_xfer() functions and 
+ * frees it. Returns 0 on success, or a negative error number on failure.
+ */
+static int gdrive_request_send(Gdrive_Transfer* pTransfer)
+{
+    if (pTransfer == NULL)
+    {
+        // Probably a memory error while building the request
+        return -ENOMEM;
+    }
+    
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    int returnVal = gdrive_request_result(pBuf);
+    gdrive_dlbuf_free(pBuf);
+    return returnVal;
+}
@@ -42,6 +42,7 @@ extern "C" {
 #define GDRIVE_URL_UPLOAD "https://www.googleapis.com/upload/drive/v2/files"
 #define GDRIVE_URL_ABOUT "https://www.googleapis.com/drive/v2/about"
 #define GDRIVE_URL_CHANGES "https://www.googleapis.com/drive/v2/changes"
+#define GDRIVE_URL_BATCH "https://www.googleapis.com/batch/drive/v2"
     
 
 /******************
@@ -103,6 +104,153 @@ const char* gdrive_get_access_token(void);
  *      0 for success, other value on error.
  */
 int gdrive_auth(void);
+
+/*
+ * gdrive_auth_keep_fresh():    Gets a new access token before the current one
+ *                              expires, so that requests don't fail with an
+ *                              authentication error. Starting five minutes
+ *                              before expiry, the new token is requested in
+ *                              the background. If it still hasn't arrived a
+ *                              minute before expiry, the request is made
+ *                              right away and waited for.
+ *                              Called before every request is sent, and does
+ *                              nothing most of the time.
+ */
+void gdrive_auth_keep_fresh(void);
+
+/*
+ * gdrive_request_remove_parent():  Sends the request to remove one folder from
+ *                                  a file's list of parents, without checking
+ *                                  permissions, queueing, or updating the 
+ *                                  cache. Most callers want 
+ *                                  gdrive_remove_parent() instead.
+ * Parameters:
+ *      fileId (const char*):   
+ *              The file ID of the file.
+ *      parentId (const char*): 
+ *              The file ID of the parent which should be removed.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_request_remove_parent(const char* fileId, const char* parentId);
+
+/*
+ * gdrive_request_trash():  Sends the request to move a file to the trash, 
+ *                          without checking permissions, queueing, or updating
+ *                          the cache. Most callers want gdrive_delete() 
+ *                          instead.
+ * Parameters:
+ *      fileId (const char*):   
+ *              The file ID of the file to trash.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_request_trash(const char* fileId);
+
+/*
+ * gdrive_request_add_parent(): Sends the request to add a parent to a file, 
+ *                              without checking permissions, queueing, or 
+ *                              updating the cache. Most callers want 
+ *                              gdrive_add_parent() instead.
+ * Parameters:
+ *      fileId (const char*):   
+ *              The file ID of the file.
+ *      parentId (const char*): 
+ *              The file ID of the parent folder to add.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_request_add_parent(const char* fileId, const char* parentId);
+
+/*
+ * gdrive_request_change_basename():    Sends the request to rename a file, 
+ *                                      without checking permissions, queueing,
+ *                                      or updating the cache. Most callers 
+ *                                      want gdrive_change_basename() or 
+ *                                      gdrive_move() instead.
+ * Parameters:
+ *      fileId (const char*):   
+ *              The file ID of the file to rename.
+ *      newName (const char*):  
+ *              The new basename.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_request_change_basename(const char* fileId, const char* newName);
+
+/*
+ * gdrive_request_move():   Sends a single request that moves a file from one
+ *                          parent folder to another and/or renames it, without
+ *                          checking permissions, queueing, or updating the 
+ *                          cache. Most callers want gdrive_move() instead.
+ * Parameters:
+ *      fileId (const char*):   
+ *              The file ID of the file to move.
+ *      fromParentId (const char*): 
+ *              The file ID of the parent to remove, or NULL to leave the 
+ *              parents alone. Must be NULL if and only if toParentId is NULL.
+ *      toParentId (const char*): 
+ *              The file ID of the parent to add, or NULL. If it is the same as
+ *              fromParentId, the parents are left alone.
+ *      newName (const char*):  
+ *              The new basename, or NULL to keep the current name.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_request_move(const char* fileId, const char* fromParentId, 
+                        const char* toParentId, const char* newName);
+
+/*
+ * The gdrive_request_*_xfer() functions build the same requests as the 
+ * matching gdrive_request_*() functions above, but return them unsent, so that
+ * several can be sent together with a Gdrive_Xfer_Batch. Each returns NULL on 
+ * failure (probably a memory error). Otherwise the caller is responsible for
+ * the returned transfer, either by passing it to gdrive_xfer_batch_add() or by
+ * freeing it with gdrive_xfer_free(). The response can be checked with
+ * gdrive_request_result().
+ */
+
+Gdrive_Transfer* gdrive_request_remove_parent_xfer(const char* fileId, 
+                                                   const char* parentId);
+
+Gdrive_Transfer* gdrive_request_trash_xfer(const char* fileId);
+
+Gdrive_Transfer* gdrive_request_add_parent_xfer(const char* fileId, 
+                                                const char* parentId);
+
+Gdrive_Transfer* gdrive_request_move_xfer(const char* fileId, 
+                                          const char* fromParentId, 
+                                          const char* toParentId, 
+                                          const char* newName);
+
+/*
+ * gdrive_request_result(): Interprets the response to a request built by one
+ *                          of the gdrive_request_*_xfer() functions. On 
+ *                          success, the file index (see gdrive-index.h) is
+ *                          updated from the returned resource.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The response, which may be NULL if there wasn't one.
+ * Return value (int):
+ *      0 if the request succeeded, or a negative error number on failure.
+ */
+int gdrive_request_result(Gdrive_Download_Buffer* pBuf);
+
+/*
+ * gdrive_request_error():  Picks the error number for a request that failed,
+ *                          telling apart failures that may go away if the
+ *                          request is sent again later from ones that won't.
+ * Parameters:
+ *      pBuf (Gdrive_Download_Buffer*):
+ *              The error response, or NULL if there wasn't one.
+ * Return value (int):
+ *      -EIO if there was no response, or for errors that are worth trying
+ *      again later (server errors, exceeded rate limits and authentication 
+ *      errors). Otherwise -ENOENT if the file doesn't exist, -EACCES if 
+ *      permission was denied, or -EINVAL if Google Drive refused the request
+ *      for any other reason.
+ */
+int gdrive_request_error(Gdrive_Download_Buffer* pBuf);
     
 
 
@@ -0,0 +1,219 @@
+
+
+#include "gdrive-intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+#define GDRIVE_INTERN_INITIAL_BUCKETS 1024
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+typedef struct Gdrive_Intern_Entry Gdrive_Intern_Entry;
+
+struct Gdrive_Intern_Entry
+{
+    // Next entry in the same hash bucket
+    Gdrive_Intern_Entry* pNext;
+    size_t hash;
+    unsigned long refCount;
+    // The string itself is stored in the same allocation.
+    char str[];
+};
+
+typedef struct Gdrive_Intern_Table
+{
+    size_t nEntries;
+    size_t nBuckets;
+    Gdrive_Intern_Entry** pBuckets;
+    // Totals for the report
+    unsigned long nRefs;
+    size_t stringBytes;
+    size_t savedBytes;
+} Gdrive_Intern_Table;
+
+static Gdrive_Intern_Table* gdrive_intern_get_internal(void);
+
+static size_t gdrive_intern_hash(const char* str);
+
+static int gdrive_intern_grow(Gdrive_Intern_Table* pTable);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+const char* gdrive_intern_get(const char* str)
+{
+    if (str == NULL)
+    {
+        return NULL;
+    }
+
+    Gdrive_Intern_Table* pTable = gdrive_intern_get_internal();
+    size_t hash = gdrive_intern_hash(str);
+    size_t length = strlen(str);
+    if (pTable->nBuckets > 0)
+    {
+        for (Gdrive_Intern_Entry* pEntry =
+                    pTable->pBuckets[hash % pTable->nBuckets];
+                pEntry != NULL;
+                pEntry = pEntry->pNext)
+        {
+            if (pEntry->hash == hash && strcmp(pEntry->str, str) == 0)
+            {
+                pEntry->refCount++;
+                pTable->nRefs++;
+                pTable->savedBytes += length + 1;
+                return pEntry->str;
+            }
+        }
+    }
+
+    if (pTable->nEntries >= pTable->nBuckets && gdrive_intern_grow(pTable))
+    {
+        // Memory error
+        return NULL;
+    }
+    Gdrive_Intern_Entry* pEntry =
+            malloc(sizeof(Gdrive_Intern_Entry) + length + 1);
+    if (pEntry == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    memcpy(pEntry->str, str, length + 1);
+    pEntry->hash = hash;
+    pEntry->refCount = 1;
+    size_t bucket = hash % pTable->nBuckets;
+    pEntry->pNext = pTable->pBuckets[bucket];
+    pTable->pBuckets[bucket] = pEntry;
+    pTable->nEntries++;
+    pTable->nRefs++;
+    pTable->stringBytes += length + 1;
+    return pEntry->str;
+}
+
+void gdrive_intern_release(const char* str)
+{
+    if (str == NULL)
+    {
+        return;
+    }
+
+    Gdrive_Intern_Table* pTable = gdrive_intern_get_internal();
+    Gdrive_Intern_Entry* pEntry = (Gdrive_Intern_Entry*)
+            (str - offsetof(Gdrive_Intern_Entry, str));
+    size_t length = strlen(str);
+    pTable->nRefs--;
+    if (--pEntry->refCount > 0)
+    {
+        pTable->savedBytes -= length + 1;
+        return;
+    }
+
+    Gdrive_Intern_Entry** ppEntry =
+            &(pTable->pBuckets[pEntry->hash % pTable->nBuckets]);
+    while (*ppEntry != pEntry)
+    {
+        ppEntry = &((*ppEntry)->pNext);
+    }
+    *ppEntry = pEntry->pNext;
+    pTable->nEntries--;
+    pTable->stringBytes -= length + 1;
+    free(pEntry);
+
+    if (pTable->nEntries == 0)
+    {
+        // Don't leave an empty table lying around after everything is freed.
+        free(pTable->pBuckets);
+        pTable->pBuckets = NULL;
+        pTable->nBuckets = 0;
+    }
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+void gdrive_intern_print_stats(FILE* stream)
+{
+    Gdrive_Intern_Table* pTable = gdrive_intern_get_internal();
+    size_t tableBytes = pTable->nBuckets * sizeof(Gdrive_Intern_Entry*) +
+            pTable->nEntries * sizeof(Gdrive_Intern_Entry) +
+            pTable->stringBytes;
+    fprintf(stream, "  shared strings: %lu (used %lu times), %lu KiB, "
+            "%lu KiB saved\n", (unsigned long) pTable->nEntries,
+            pTable->nRefs, (unsigned long) (tableBytes / 1024),
+            (unsigned long) (pTable->savedBytes / 1024));
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Intern_Table* gdrive_intern_get_internal(void)
+{
+    static Gdrive_Intern_Table table = {0};
+    return &table;
+}
+
+static size_t gdrive_intern_hash(const char* str)
+{
+    // djb2
+    size_t hash = 5381;
+    for (const unsigned char* p = (const unsigned char*) str; *p; p++)
+    {
+        hash = hash * 33 + *p;
+    }
+    return hash;
+}
+
+/*
+ * Doubles the number of hash buckets (or creates the first ones). Returns 0 on
+ * success, other on memory error.
+ */
+static int gdrive_intern_grow(Gdrive_Intern_Table* pTable)
+{
+    size_t newCount = (pTable->nBuckets > 0) ?
+        pTable->nBuckets * 2 : GDRIVE_INTERN_INITIAL_BUCKETS;
+    Gdrive_Intern_Entry** pNewBuckets =
+            calloc(newCount, sizeof(Gdrive_Intern_Entry*));
+    if (pNewBuckets == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    for (size_t i = 0; i < pTable->nBuckets; i++)
+    {
+        Gdrive_Intern_Entry* pEntry = pTable->pBuckets[i];
+        while (pEntry != NULL)
+        {
+            Gdrive_Intern_Entry* pNext = pEntry->pNext;
+            size_t bucket = pEntry->hash % newCount;
+            pEntry->pNext = pNewBuckets[bucket];
+            pNewBuckets[bucket] = pEntry;
+            pEntry = pNext;
+        }
+    }
+    free(pTable->pBuckets);
+    pTable->pBuckets = pNewBuckets;
+    pTable->nBuckets = newCount;
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * File:   gdrive-intern.h
+ * Author: me
+ *
+ * A table of shared, read-only copies of strings that are repeated many times,
+ * such as file IDs (which show up once for every path that leads to a file,
+ * and once for every child of a folder) and common filenames. Each distinct
+ * string is stored once, with a count of how many places use it, and is freed
+ * when the last of them lets go.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_INTERN_H
+#define	GDRIVE_INTERN_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+/*
+ * gdrive_intern_get(): Retrieves the shared copy of a string, adding it to
+ *                      the table if it isn't already there.
+ * Parameters:
+ *      str (const char*):
+ *              The string to look up. It's safe to pass a NULL pointer.
+ * Return value (const char*):
+ *      The shared copy, which must not be changed, or NULL if str is NULL or
+ *      on memory error. Each successful call must eventually be balanced by a
+ *      call to gdrive_intern_release() with the returned pointer.
+ */
+const char* gdrive_intern_get(const char* str);
+
+/*
+ * gdrive_intern_release(): Gives up one use of a shared string, freeing it if
+ *                          nothing else uses it.
+ * Parameters:
+ *      str (const char*):
+ *              A pointer returned by gdrive_intern_get() (not just an equal
+ *              string). It's safe to pass a NULL pointer.
+ */
+void gdrive_intern_release(const char* str);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_intern_print_stats(): Prints the number of shared strings, how many
+ *                              places use them, and the memory they take up
+ *                              and save.
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_intern_print_stats(FILE* stream);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_INTERN_H */
+
@@ -0,0 +1,318 @@
+
+
+#include "gdrive-json-stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+#define GDRIVE_JSTREAM_INITIAL_SIZE 256
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+typedef struct Gdrive_Jstream_Text
+{
+    char* text;
+    size_t length;
+    size_t size;
+} Gdrive_Jstream_Text;
+
+struct Gdrive_Json_Stream
+{
+    char* arrayKey;
+    size_t arrayKeyLength;
+    gdrive_jstream_callback callback;
+    void* userdata;
+    // skeleton: Everything outside of the array's elements
+    Gdrive_Jstream_Text skeleton;
+    // item: The array element currently arriving. The memory is reused for
+    // each element.
+    Gdrive_Jstream_Text item;
+    int depth;
+    bool inString;
+    bool escaped;
+    // expectKey: The next string at the top level is a key.
+    bool expectKey;
+    // inKey: The string being received is a top-level key, which starts at
+    // keyStart within the skeleton.
+    bool inKey;
+    size_t keyStart;
+    // keyMatched: The last top-level key was arrayKey.
+    bool keyMatched;
+    // inArray: Receiving the elements of the array
+    bool inArray;
+    bool failed;
+};
+
+static int gdrive_jstream_append(Gdrive_Jstream_Text* pText, char c);
+
+static void gdrive_jstream_emit(Gdrive_Json_Stream* pStream);
+
+static void gdrive_jstream_reset(Gdrive_Json_Stream* pStream);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+Gdrive_Json_Stream* gdrive_jstream_create(const char* arrayKey,
+                                          gdrive_jstream_callback callback,
+                                          void* userdata)
+{
+    Gdrive_Json_Stream* pStream = malloc(sizeof(Gdrive_Json_Stream));
+    if (pStream == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    memset(pStream, 0, sizeof(Gdrive_Json_Stream));
+    pStream->arrayKeyLength = strlen(arrayKey);
+    pStream->arrayKey = malloc(pStream->arrayKeyLength + 1);
+    if (pStream->arrayKey == NULL)
+    {
+        // Memory error
+        free(pStream);
+        return NULL;
+    }
+    memcpy(pStream->arrayKey, arrayKey, pStream->arrayKeyLength + 1);
+    pStream->callback = callback;
+    pStream->userdata = userdata;
+    return pStream;
+}
+
+void gdrive_jstream_free(Gdrive_Json_Stream* pStream)
+{
+    if (pStream == NULL)
+    {
+        // Nothing to do
+        return;
+    }
+    free(pStream->arrayKey);
+    free(pStream->skeleton.text);
+    free(pStream->item.text);
+    free(pStream);
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+int gdrive_jstream_feed(Gdrive_Json_Stream* pStream, const char* data,
+                        size_t size)
+{
+    for (size_t i = 0; i < size && !pStream->failed; i++)
+    {
+        char c = data[i];
+
+        if (pStream->inArray && pStream->depth == 2 && !pStream->inString &&
+                (c == ',' || c == ']'))
+        {
+            // The end of an element
+            gdrive_jstream_emit(pStream);
+            if (c == ',')
+            {
+                continue;
+            }
+            // else the end of the array, which goes back in the skeleton.
+            pStream->inArray = false;
+            pStream->keyMatched = false;
+        }
+
+        Gdrive_Jstream_Text* pText =
+                pStream->inArray ? &pStream->item : &pStream->skeleton;
+        if (pStream->inArray && pText->length == 0 &&
+                (c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+        {
+            // Whitespace before an element
+            continue;
+        }
+        if (gdrive_jstream_append(pText, c) != 0)
+        {
+            // Memory error
+            pStream->failed = true;
+            break;
+        }
+
+        if (pStream->inString)
+        {
+            if (pStream->escaped)
+            {
+                pStream->escaped = false;
+            }
+            else if (c == '\\')
+            {
+                pStream->escaped = true;
+            }
+            else if (c == '"')
+            {
+                pStream->inString = false;
+                if (pStream->inKey)
+                {
+                    // Leave out the closing quote.
+                    size_t keyLength =
+                            pText->length - 1 - pStream->keyStart;
+                    pStream->inKey = false;
+                    pStream->keyMatched =
+                            (keyLength == pStream->arrayKeyLength &&
+                            memcmp(pText->text + pStream->keyStart,
+                                   pStream->arrayKey, keyLength) == 0);
+                }
+            }
+            continue;
+        }
+
+        switch (c)
+        {
+            case '"':
+                pStream->inString = true;
+                if (pStream->depth == 1 && pStream->expectKey)
+                {
+                    pStream->expectKey = false;
+                    pStream->inKey = true;
+                    pStream->keyStart = pText->length;
+                }
+                break;
+
+            case '{':
+                // Fall through
+            case '[':
+                pStream->depth++;
+                if (pStream->depth == 1)
+                {
+                    pStream->expectKey = (c == '{');
+                }
+                else if (pStream->depth == 2 && c == '[' &&
+                        pStream->keyMatched)
+                {
+                    // The elements that follow go to the callback.
+                    pStream->inArray = true;
+                }
+                break;
+
+            case '}':
+                // Fall through
+            case ']':
+                if (--pStream->depth < 0)
+                {
+                    // Not valid JSON
+                    pStream->failed = true;
+                }
+                break;
+
+            case ',':
+                if (pStream->depth == 1)
+                {
+                    pStream->expectKey = true;
+                    pStream->keyMatched = false;
+                }
+                break;
+
+            default:
+                // Nothing to keep track of
+                break;
+        }
+    }
+
+    return pStream->failed ? -1 : 0;
+}
+
+Gdrive_Json_Object* gdrive_jstream_finish(Gdrive_Json_Stream* pStream)
+{
+    Gdrive_Json_Object* pObj = NULL;
+    if (!pStream->failed && pStream->depth == 0 && !pStream->inString &&
+            pStream->skeleton.length > 0 &&
+            gdrive_jstream_append(&pStream->skeleton, '\0') == 0)
+    {
+        pObj = gdrive_json_from_string(pStream->skeleton.text);
+    }
+    gdrive_jstream_reset(pStream);
+    return pObj;
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+/*
+ * Adds one character to the end of pText, making room if needed. Returns 0 on
+ * success, other on memory error.
+ */
+static int gdrive_jstream_append(Gdrive_Jstream_Text* pText, char c)
+{
+    if (pText->length + 1 > pText->size)
+    {
+        size_t newSize = (pText->size > 0) ?
+            pText->size * 2 : GDRIVE_JSTREAM_INITIAL_SIZE;
+        char* newText = realloc(pText->text, newSize);
+        if (newText == NULL)
+        {
+            // Memory error
+            return -1;
+        }
+        pText->text = newText;
+        pText->size = newSize;
+    }
+    pText->text[pText->length++] = c;
+    return 0;
+}
+
+/*
+ * Parses the element that has just been completed, if any, hands it to the
+ * callback, and frees it.
+ */
+static void gdrive_jstream_emit(Gdrive_Json_Stream* pStream)
+{
+    if (pStream->item.length == 0)
+    {
+        // An empty array
+        return;
+    }
+    if (gdrive_jstream_append(&pStream->item, '\0') != 0)
+    {
+        // Memory error
+        pStream->failed = true;
+        return;
+    }
+    pStream->item.length = 0;
+
+    Gdrive_Json_Object* pItem = gdrive_json_from_string(pStream->item.text);
+    if (pItem == NULL || pStream->callback(pItem, pStream->userdata) != 0)
+    {
+        pStream->failed = true;
+    }
+    gdrive_json_kill(pItem);
+}
+
+/*
+ * Forgets any response that has been fed in, keeping the memory for the next
+ * one.
+ */
+static void gdrive_jstream_reset(Gdrive_Json_Stream* pStream)
+{
+    pStream->skeleton.length = 0;
+    pStream->item.length = 0;
+    pStream->depth = 0;
+    pStream->inString = false;
+    pStream->escaped = false;
+    pStream->expectKey = false;
+    pStream->inKey = false;
+    pStream->keyStart = 0;
+    pStream->keyMatched = false;
+    pStream->inArray = false;
+    pStream->failed = false;
+}
@@ -0,0 +1,130 @@
+/*
+ * File:   gdrive-json-stream.h
+ * Author: me
+ *
+ * Incremental parsing of large JSON responses, such as pages of files.list
+ * and changes.list, as they are downloaded. Each element of one array at the
+ * top level of the response (normally "items") is parsed on its own as soon
+ * as it has fully arrived, handed to a callback, and freed. Everything else
+ * in the response (nextPageToken and the like) is kept and parsed at the
+ * end. Only one element is held at a time, instead of the whole response
+ * plus a JSON object for every element.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_JSON_STREAM_H
+#define	GDRIVE_JSON_STREAM_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "gdrive-json.h"
+
+#include <stddef.h>
+
+
+typedef struct Gdrive_Json_Stream Gdrive_Json_Stream;
+
+/*
+ * gdrive_jstream_callback: Signature for a callback function that receives
+ *                          array elements from a Gdrive_Json_Stream.
+ * Parameters:
+ *      pItem (Gdrive_Json_Object*):
+ *              One element of the array. It is freed after the callback
+ *              returns, so it should NOT be freed with gdrive_json_kill(). Use
+ *              gdrive_json_keep() to hold onto it.
+ *      userdata (void*):
+ *              The userdata pointer that was passed to
+ *              gdrive_jstream_create().
+ * Return value (int):
+ *      0 to keep going, other to give up on the rest of the response.
+ */
+typedef int (*gdrive_jstream_callback)(Gdrive_Json_Object* pItem,
+                                       void* userdata);
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+/*
+ * gdrive_jstream_create(): Creates a new Gdrive_Json_Stream. Once it is no
+ *                          longer needed, the caller should call
+ *                          gdrive_jstream_free().
+ * Parameters:
+ *      arrayKey (const char*):
+ *              The key, at the top level of the response, of the array whose
+ *              elements are handed to the callback. Nested keys are not
+ *              supported. This is copied.
+ *      callback (gdrive_jstream_callback):
+ *              The function to call with each element.
+ *      userdata (void*):
+ *              Passed to the callback.
+ * Return value (Gdrive_Json_Stream*):
+ *      The new stream, or NULL on memory error.
+ */
+Gdrive_Json_Stream* gdrive_jstream_create(const char* arrayKey,
+                                          gdrive_jstream_callback callback,
+                                          void* userdata);
+
+/*
+ * gdrive_jstream_free():   Frees a Gdrive_Json_Stream and any partial response
+ *                          it holds.
+ * Parameters:
+ *      pStream (Gdrive_Json_Stream*):
+ *              The stream to free. It's safe to pass a NULL pointer.
+ */
+void gdrive_jstream_free(Gdrive_Json_Stream* pStream);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_jstream_feed():   Passes the next part of the response to the
+ *                          stream, calling the callback for every array
+ *                          element that is completed by it.
+ * Parameters:
+ *      pStream (Gdrive_Json_Stream*):
+ *              The stream.
+ *      data (const char*):
+ *              The next bytes of the response, which don't need to be null
+ *              terminated or to end at any particular place.
+ *      size (size_t):
+ *              The number of bytes in data.
+ * Return value (int):
+ *      0 on success. Other if an element could not be parsed, the callback
+ *      asked to stop, or on memory error. Once this happens, the rest of the
+ *      response is ignored and gdrive_jstream_finish() returns NULL.
+ */
+int gdrive_jstream_feed(Gdrive_Json_Stream* pStream, const char* data,
+                        size_t size);
+
+/*
+ * gdrive_jstream_finish(): Parses whatever was not handed to the callback,
+ *                          once the whole response has been fed in, and gets
+ *                          the stream ready for another response.
+ * Parameters:
+ *      pStream (Gdrive_Json_Stream*):
+ *              The stream.
+ * Return value (Gdrive_Json_Object*):
+ *      The response, with the array emptied, or NULL if the response was
+ *      incomplete or invalid (in which case the elements that were already
+ *      handed to the callback may not be the whole array). The caller is
+ *      responsible for calling gdrive_json_kill() on the returned object.
+ */
+Gdrive_Json_Object* gdrive_jstream_finish(Gdrive_Json_Stream* pStream);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_JSON_STREAM_H */
+
@@ -240,6 +240,54 @@ bool gdrive_json_get_boolean(Gdrive_Json_Object* pObj, const char* key,
     return json_object_get_double(pInnerObj);
 }
 
+const char* gdrive_json_peek_string(Gdrive_Json_Object* pObj, const char* key,
+                                    int* pLength)
+{
+    Gdrive_Json_Object* pInnerObj = pObj;
+    if (key != NULL && 
+            !json_object_object_get_ex(pObj, key, &pInnerObj))
+    {
+        // Key not found
+        return NULL;
+    }
+    if (!json_object_is_type(pInnerObj, json_type_string))
+    {
+        // Not a string
+        return NULL;
+    }
+    
+    if (pLength != NULL)
+    {
+        *pLength = json_object_get_string_len(pInnerObj);
+    }
+    return json_object_get_string(pInnerObj);
+}
+
+void gdrive_json_walk(Gdrive_Json_Object* pObj, 
+                      const Gdrive_Json_Field* pFields, int nFields, 
+                      gdrive_json_field_callback callback, void* userdata)
+{
+    if (pObj == NULL || !json_object_is_type(pObj, json_type_object))
+    {
+        // Nothing to walk through
+        return;
+    }
+    
+    json_object_object_foreach(pObj, key, pValue)
+    {
+        for (int i = 0; i < nFields; i++)
+        {
+            // Checking the first character weeds out most keys cheaply.
+            if (key[0] == pFields[i].key[0] && 
+                    strcmp(key, pFields[i].key) == 0)
+            {
+                callback(pFields[i].id, pValue, userdata);
+                break;
+            }
+        }
+    }
+}
+
 Gdrive_Json_Object* gdrive_json_from_string(const char* inStr)
 {
     return json_tokener_parse(inStr);
@@ -26,6 +26,32 @@ extern "C" {
     
 typedef json_object Gdrive_Json_Object;
 
+/*
+ * One entry in the list of keys that gdrive_json_walk() looks for. The id is
+ * passed to the callback to say which key was found, so the list can be a 
+ * static table that is set up once.
+ */
+typedef struct Gdrive_Json_Field
+{
+    const char* key;
+    int id;
+} Gdrive_Json_Field;
+
+/*
+ * gdrive_json_field_callback:  Signature for a callback function to be used
+ *                              with gdrive_json_walk().
+ * Parameters:
+ *      id (int):
+ *              The id from the Gdrive_Json_Field entry whose key was found.
+ *      pValue (Gdrive_Json_Object*):
+ *              The key's value. It should NOT be freed with 
+ *              gdrive_json_kill().
+ *      userdata (void*):
+ *              The userdata pointer that was passed to gdrive_json_walk().
+ */
+typedef void (*gdrive_json_field_callback)(int id, Gdrive_Json_Object* pValue,
+                                           void* userdata);
+
 /*
  * gdrive_json_get_nested_object(): Retrieves a contained JSON object from 
  *                                  within the outer object.
@@ -255,6 +281,54 @@ double gdrive_json_get_double(Gdrive_Json_Object* pObj, const char* key,
 bool gdrive_json_get_boolean(Gdrive_Json_Object* pObj, const char* key, 
                              bool* pSuccess);
 
+/*
+ * gdrive_json_peek_string():   Retrieves the value of a JSON string without
+ *                              copying it. Does not convert from non-string 
+ *                              types to string.
+ * Parameters:
+ *      pObj (Gdrive_Json_Object*):
+ *              The JSON object directly containing the string, or if key is 
+ *              NULL, the actual JSON string object.
+ *      key (const char*):
+ *              If NULL, then pObj should be the actual JSON string object.
+ *              Otherwise, the key whose value should be retrieved. Unlike most
+ *              other functions here, this must be a single key, not nested.
+ *      pLength (int*):
+ *              Can be NULL. If non-NULL and the string is found, holds the 
+ *              length of the string after this function returns, NOT 
+ *              including the terminating null.
+ * Return value (const char*):
+ *      On success, the null-terminated string. On failure, NULL. The string 
+ *      belongs to the JSON object, and should not be used after the root 
+ *      object is freed.
+ */
+const char* gdrive_json_peek_string(Gdrive_Json_Object* pObj, const char* key,
+                                    int* pLength);
+
+/*
+ * gdrive_json_walk():  Goes through the keys of a JSON object once, calling a
+ *                      function for each key that is in a given list. This is
+ *                      quicker than looking each key up separately when 
+ *                      several are needed from the same object.
+ * Parameters:
+ *      pObj (Gdrive_Json_Object*):
+ *              The JSON object to go through. If it isn't an object (for 
+ *              example, if it's an array), nothing is done.
+ *      pFields (const Gdrive_Json_Field*):
+ *              The keys to look for. Only keys of pObj itself are matched, not
+ *              nested keys.
+ *      nFields (int):
+ *              The number of entries in pFields.
+ *      callback (gdrive_json_field_callback):
+ *              Called once for each key of pObj that is in pFields, in the 
+ *              order that they appear in pObj.
+ *      userdata (void*):
+ *              Passed to callback.
+ */
+void gdrive_json_walk(Gdrive_Json_Object* pObj, 
+                      const Gdrive_Json_Field* pFields, int nFields, 
+                      gdrive_json_field_callback callback, void* userdata);
+
 /*
  * gdrive_json_from_string():   Creates a JSON object from a string 
  *                              representation.
@@ -0,0 +1,151 @@
+
+
+#include "gdrive-negcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+typedef struct Gdrive_Negcache_Entry Gdrive_Negcache_Entry;
+
+struct Gdrive_Negcache_Entry
+{
+    // Next entry, added earlier than this one
+    Gdrive_Negcache_Entry* pNext;
+    time_t added;
+    char* key;
+};
+
+typedef struct Gdrive_Negcache
+{
+    // pHead: Most recent entry first
+    Gdrive_Negcache_Entry* pHead;
+    // Totals for the report
+    unsigned long nAdded;
+    unsigned long nHits;
+} Gdrive_Negcache;
+
+static Gdrive_Negcache* gdrive_negcache_get_internal(void);
+
+static void gdrive_negcache_expire(Gdrive_Negcache* pCache, time_t now);
+
+static void gdrive_negcache_free_all(Gdrive_Negcache_Entry* pEntry);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+void gdrive_negcache_clear(void)
+{
+    Gdrive_Negcache* pCache = gdrive_negcache_get_internal();
+    gdrive_negcache_free_all(pCache->pHead);
+    pCache->pHead = NULL;
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+bool gdrive_negcache_has(const char* key)
+{
+    Gdrive_Negcache* pCache = gdrive_negcache_get_internal();
+    gdrive_negcache_expire(pCache, time(NULL));
+
+    for (const Gdrive_Negcache_Entry* pEntry = pCache->pHead;
+            pEntry != NULL;
+            pEntry = pEntry->pNext)
+    {
+        if (strcmp(pEntry->key, key) == 0)
+        {
+            pCache->nHits++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void gdrive_negcache_add(const char* key)
+{
+    Gdrive_Negcache_Entry* pEntry = malloc(sizeof(Gdrive_Negcache_Entry));
+    if (pEntry == NULL)
+    {
+        // Memory error. Nothing is lost except the chance to skip a request.
+        return;
+    }
+    pEntry->pNext = NULL;
+    pEntry->key = malloc(strlen(key) + 1);
+    if (pEntry->key == NULL)
+    {
+        // Memory error
+        free(pEntry);
+        return;
+    }
+    strcpy(pEntry->key, key);
+
+    // Newer entries go in front, so that the oldest can be cut off the end.
+    Gdrive_Negcache* pCache = gdrive_negcache_get_internal();
+    pEntry->added = time(NULL);
+    pEntry->pNext = pCache->pHead;
+    pCache->pHead = pEntry;
+    pCache->nAdded++;
+}
+
+void gdrive_negcache_print_stats(FILE* stream)
+{
+    Gdrive_Negcache* pCache = gdrive_negcache_get_internal();
+    fprintf(stream, "  missing-file lookups: %lu sent to Google Drive, %lu "
+            "more answered from them\n", pCache->nAdded, pCache->nHits);
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Negcache* gdrive_negcache_get_internal(void)
+{
+    static Gdrive_Negcache cache = {0};
+    return &cache;
+}
+
+/*
+ * Frees every entry added GDRIVE_NEGCACHE_WINDOW or more seconds ago. They're
+ * all at the end of the list.
+ */
+static void gdrive_negcache_expire(Gdrive_Negcache* pCache, time_t now)
+{
+    Gdrive_Negcache_Entry** ppEntry = &(pCache->pHead);
+    while (*ppEntry != NULL &&
+            now - (*ppEntry)->added < GDRIVE_NEGCACHE_WINDOW)
+    {
+        ppEntry = &((*ppEntry)->pNext);
+    }
+    gdrive_negcache_free_all(*ppEntry);
+    *ppEntry = NULL;
+}
+
+/*
+ * Frees pEntry and every entry after it in the list.
+ */
+static void gdrive_negcache_free_all(Gdrive_Negcache_Entry* pEntry)
+{
+    while (pEntry != NULL)
+    {
+        Gdrive_Negcache_Entry* pNext = pEntry->pNext;
+        free(pEntry->key);
+        free(pEntry);
+        pEntry = pNext;
+    }
+}
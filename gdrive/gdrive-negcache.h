@@ -0,0 +1,97 @@
+/*
+ * File:   gdrive-negcache.h
+ * Author: me
+ *
+ * A short-lived cache of lookups that found nothing. Files that are found go
+ * into the regular caches, but a missing file used to be asked about again
+ * every time. When many processes look for the same missing file at about the
+ * same time (such as every job of a parallel build probing for the same
+ * header), only the first lookup goes to Google Drive. Each lookup is
+ * identified by a key built from what it asks for, such as the parent folder
+ * and name of a file.
+ *
+ * This is not single-flight coalescing. FUSE is mounted single-threaded, so
+ * lookups never actually overlap and there is never a request in progress to
+ * wait on. Lookups that arrive "together" are really handled one after
+ * another, so the answer is kept for a moment instead: until
+ * GDRIVE_NEGCACHE_WINDOW seconds after it arrived, or until anything changes
+ * (see gdrive_negcache_clear()), whichever comes first. A file created by
+ * another client can therefore go unseen for at most that long.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_NEGCACHE_H
+#define	GDRIVE_NEGCACHE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+
+
+#define GDRIVE_NEGCACHE_WINDOW 1
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+/*
+ * gdrive_negcache_clear(): Forgets every lookup. Must be called whenever
+ *                          files are created, moved, renamed or removed,
+ *                          locally or on Google Drive, so that no lookup gets
+ *                          an answer from before the change.
+ */
+void gdrive_negcache_clear(void);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_negcache_has():   Determines whether an identical lookup found
+ *                          nothing less than GDRIVE_NEGCACHE_WINDOW seconds
+ *                          ago.
+ * Parameters:
+ *      key (const char*):
+ *              Identifies the lookup.
+ * Return value (bool):
+ *      True if the lookup is known to find nothing, false if the caller needs
+ *      to do the lookup itself (and then pass the key to gdrive_negcache_add()
+ *      if nothing was found).
+ */
+bool gdrive_negcache_has(const char* key);
+
+/*
+ * gdrive_negcache_add():   Records that a lookup found nothing. Lookups that
+ *                          fail for any other reason (such as a network
+ *                          error) should not be recorded.
+ * Parameters:
+ *      key (const char*):
+ *              Identifies the lookup. A copy is kept.
+ */
+void gdrive_negcache_add(const char* key);
+
+/*
+ * gdrive_negcache_print_stats():   Prints how many lookups were answered
+ *                                  without asking Google Drive.
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_negcache_print_stats(FILE* stream);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_NEGCACHE_H */
+
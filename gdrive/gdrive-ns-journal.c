@@ -0,0 +1,1239 @@
+
+
+#include "gdrive-ns-journal.h"
+
+#include "gdrive-info.h"
+#include "gdrive-cache.h"
+#include "gdrive-id-pool.h"
+#include "gdrive-data-journal.h"
+#include "gdrive-retry.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+// Queued changes are committed once the oldest has waited this many seconds,
+// or once this many have built up, whichever comes first.
+#define GDRIVE_NSJ_COMMIT_DELAY 5
+#define GDRIVE_NSJ_MAX_PENDING 64
+// At cleanup without a cache directory, how many more times to try changes 
+// that failed for reasons that may go away, and how long (in milliseconds) to
+// wait before each try
+#define GDRIVE_NSJ_CLEANUP_TRIES 3
+#define GDRIVE_NSJ_CLEANUP_WAIT 10000
+// Names of the file in the cache directory that holds changes left over at
+// unmount, and of the temporary file used while writing it
+#define GDRIVE_NSJ_SAVE_NAME "namespace"
+#define GDRIVE_NSJ_SAVE_TEMP_NAME "namespace.tmp"
+// Where a saved file that couldn't be read back is moved, so that the next
+// save doesn't replace it
+#define GDRIVE_NSJ_SAVE_BAD_NAME "namespace.bad"
+// How each type of change is written in the saved file, in the same order as
+// enum Gdrive_Nsj_Optype
+#define GDRIVE_NSJ_TYPE_CHARS "CTRAM"
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+enum Gdrive_Nsj_Optype
+{
+    GDRIVE_NSJ_CREATE,
+    GDRIVE_NSJ_TRASH,
+    GDRIVE_NSJ_REMOVE_PARENT,
+    GDRIVE_NSJ_ADD_PARENT,
+    GDRIVE_NSJ_MOVE
+};
+
+typedef struct Gdrive_Nsj_Op
+{
+    enum Gdrive_Nsj_Optype type;
+    // fileId: The file being changed
+    char* fileId;
+    // parentId: The parent folder for CREATE, REMOVE_PARENT and ADD_PARENT,
+    // or the folder being moved out of for MOVE. NULL for TRASH.
+    char* parentId;
+    // newParentId: The folder being moved into for MOVE, otherwise NULL.
+    char* newParentId;
+    // title: The file's basename after this change. NULL for TRASH and
+    // REMOVE_PARENT.
+    char* title;
+    // oldTitle: The file's basename before the change for MOVE, otherwise
+    // NULL.
+    char* oldTitle;
+    bool isFolder;
+    time_t queuedTime;
+    struct Gdrive_Nsj_Op* pPrev;
+    struct Gdrive_Nsj_Op* pNext;
+} Gdrive_Nsj_Op;
+
+typedef struct Gdrive_Ns_Journal
+{
+    // Oldest change at the head, newest at the tail.
+    Gdrive_Nsj_Op* pHead;
+    Gdrive_Nsj_Op* pTail;
+    int nOps;
+    // committing: Guards against committing recursively, for example if an
+    // error while committing leads to a cache lookup.
+    bool committing;
+} Gdrive_Ns_Journal;
+
+static Gdrive_Ns_Journal* gdrive_nsj_get_internal(void);
+
+static int gdrive_nsj_append(enum Gdrive_Nsj_Optype type, const char* fileId,
+                             const char* parentId, const char* newParentId,
+                             const char* title, const char* oldTitle,
+                             bool isFolder);
+
+static void gdrive_nsj_unlink(Gdrive_Nsj_Op* pOp);
+
+static void gdrive_nsj_requeue(Gdrive_Nsj_Op* pOp);
+
+static bool gdrive_nsj_is_retryable(int result);
+
+static void gdrive_nsj_op_free(Gdrive_Nsj_Op* pOp);
+
+static bool gdrive_nsj_id_equal(const char* idOne, const char* idTwo);
+
+static bool gdrive_nsj_op_references(const Gdrive_Nsj_Op* pOp,
+                                     const char* fileId);
+
+static bool gdrive_nsj_op_targets(const Gdrive_Nsj_Op* pOp,
+                                  const char* parentId);
+
+static bool gdrive_nsj_replay(const char* fileId, const char* parentId,
+                              bool visible, const char** pName);
+
+static int gdrive_nsj_commit_through(Gdrive_Nsj_Op* pLast);
+
+static int gdrive_nsj_execute(const Gdrive_Nsj_Op* pOp);
+
+static bool gdrive_nsj_can_batch(const Gdrive_Nsj_Op* pOp,
+                                 Gdrive_Nsj_Op* const* pGroup, int nGroup);
+
+static void gdrive_nsj_execute_group(Gdrive_Nsj_Op* const* pGroup,
+                                     int nGroup, int* results);
+
+static Gdrive_Transfer* gdrive_nsj_make_xfer(const Gdrive_Nsj_Op* pOp);
+
+static void gdrive_nsj_drop_dependents(const char* fileId,
+                                       const Gdrive_Nsj_Op* pLast,
+                                       bool* pDone);
+
+static void gdrive_nsj_invalidate(const Gdrive_Nsj_Op* pOp);
+
+static char* gdrive_nsj_save_path(const char* name);
+
+static int gdrive_nsj_save(void);
+
+static int gdrive_nsj_load_line(char* line);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+void gdrive_nsj_cleanup(void)
+{
+    // Changes that couldn't be sent because of a network or server problem
+    // are still queued.
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    gdrive_nsj_commit_all();
+
+    // With a cache directory, keep them there for the next mount. With 
+    // nothing left, this removes whatever an earlier run saved.
+    int nLeft = pJournal->nOps;
+    bool saved = false;
+    if (gdrive_dj_enabled())
+    {
+        saved = (gdrive_nsj_save() == 0);
+        if (!saved)
+        {
+            fprintf(stderr, "Could not save queued changes in %s\n", 
+                    gdrive_get_cachedir());
+        }
+        else if (nLeft > 0)
+        {
+            fprintf(stderr, "%d queued changes could not be sent to Google "
+                    "Drive yet. They were saved in %s and will be sent the "
+                    "next time it is used.\n", nLeft, gdrive_get_cachedir());
+        }
+    }
+
+    // Otherwise, give Google Drive a few chances to come back before giving 
+    // up on them.
+    for (int i = 0; 
+            !saved && i < GDRIVE_NSJ_CLEANUP_TRIES && pJournal->pHead != NULL; 
+            i++)
+    {
+        gdrive_retry_sleep(GDRIVE_NSJ_CLEANUP_WAIT);
+        gdrive_nsj_commit_all();
+    }
+
+    // If they weren't saved, there's nowhere to keep anything left over once
+    // we exit, so at least say what is being lost.
+    while (pJournal->pHead != NULL)
+    {
+        Gdrive_Nsj_Op* pOp = pJournal->pHead;
+        if (!saved)
+        {
+            fprintf(stderr, "Could not send queued change to %s to Google "
+                    "Drive, giving up on it\n", pOp->fileId);
+        }
+        gdrive_nsj_unlink(pOp);
+        gdrive_nsj_op_free(pOp);
+    }
+}
+
+void gdrive_nsj_restore(void)
+{
+    if (!gdrive_dj_enabled())
+    {
+        // Nothing could have been saved
+        return;
+    }
+    char* path = gdrive_nsj_save_path(GDRIVE_NSJ_SAVE_NAME);
+    FILE* inFile = (path != NULL) ? fopen(path, "r") : NULL;
+    if (inFile == NULL)
+    {
+        // Nothing saved (or a memory error)
+        free(path);
+        return;
+    }
+
+    int error = 0;
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    while (error == 0 && (length = getline(&line, &lineSize, inFile)) > 0)
+    {
+        if (line[length - 1] == '\n')
+        {
+            line[length - 1] = '\0';
+        }
+        error = gdrive_nsj_load_line(line);
+    }
+    free(line);
+    fclose(inFile);
+    if (error != 0)
+    {
+        // Don't send a partial list of changes, since a later change may 
+        // depend on one that's missing. Move the file out of the way so that
+        // it isn't replaced, and leave it for the user.
+        char* badPath = gdrive_nsj_save_path(GDRIVE_NSJ_SAVE_BAD_NAME);
+        if (badPath != NULL && rename(path, badPath) == 0)
+        {
+            fprintf(stderr, "Could not read queued changes from %s (%s). "
+                    "They were not sent, and the file was moved to %s\n", 
+                    path, strerror(-error), badPath);
+        }
+        else
+        {
+            fprintf(stderr, "Could not read queued changes from %s (%s). "
+                    "They were not sent\n", path, strerror(-error));
+        }
+        free(badPath);
+        free(path);
+        while (gdrive_nsj_get_internal()->pHead != NULL)
+        {
+            Gdrive_Nsj_Op* pOp = gdrive_nsj_get_internal()->pHead;
+            gdrive_nsj_unlink(pOp);
+            gdrive_nsj_op_free(pOp);
+        }
+        return;
+    }
+    free(path);
+
+    // Send what we can now. Until the saved copy is updated to match, a crash
+    // would only mean sending some of the changes twice.
+    gdrive_nsj_commit_all();
+    gdrive_nsj_save();
+}
+
+
+/******************
+ * Getter and setter functions
+ ******************/
+
+bool gdrive_nsj_is_pending_create(const char* fileId)
+{
+    return gdrive_nsj_get_pending_create(fileId, NULL, NULL);
+}
+
+bool gdrive_nsj_get_pending_create(const char* fileId,
+                                   const char** pParentId,
+                                   const char** pTitle)
+{
+    for (const Gdrive_Nsj_Op* pOp = gdrive_nsj_get_internal()->pHead;
+            pOp != NULL;
+            pOp = pOp->pNext)
+    {
+        if (pOp->type == GDRIVE_NSJ_CREATE &&
+                gdrive_nsj_id_equal(pOp->fileId, fileId))
+        {
+            if (pParentId != NULL)
+            {
+                *pParentId = pOp->parentId;
+            }
+            if (pTitle != NULL)
+            {
+                *pTitle = pOp->title;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+int gdrive_nsj_add_create(const char* fileId, const char* parentId,
+                          const char* title, bool isFolder)
+{
+    int returnVal = gdrive_nsj_append(GDRIVE_NSJ_CREATE, fileId, parentId,
+                                      NULL, title, NULL, isFolder);
+    gdrive_nsj_commit_due();
+    return returnVal;
+}
+
+int gdrive_nsj_add_trash(const char* fileId)
+{
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+
+    // If the file hasn't been created on Google Drive yet, and no other queued
+    // change refers to it (such as the creation of a child inside it), there's
+    // no need to create it and then trash it. Just forget about it.
+    bool canDiscard = false;
+    for (const Gdrive_Nsj_Op* pOp = pJournal->pHead;
+            pOp != NULL;
+            pOp = pOp->pNext)
+    {
+        if (pOp->type == GDRIVE_NSJ_CREATE &&
+                gdrive_nsj_id_equal(pOp->fileId, fileId))
+        {
+            canDiscard = true;
+        }
+        else if (gdrive_nsj_id_equal(pOp->parentId, fileId) ||
+                gdrive_nsj_id_equal(pOp->newParentId, fileId))
+        {
+            canDiscard = false;
+            break;
+        }
+    }
+
+    if (canDiscard)
+    {
+        Gdrive_Nsj_Op* pOp = pJournal->pHead;
+        while (pOp != NULL)
+        {
+            Gdrive_Nsj_Op* pNext = pOp->pNext;
+            if (gdrive_nsj_id_equal(pOp->fileId, fileId))
+            {
+                gdrive_nsj_unlink(pOp);
+                gdrive_nsj_op_free(pOp);
+            }
+            pOp = pNext;
+        }
+        return 0;
+    }
+
+    int returnVal = gdrive_nsj_append(GDRIVE_NSJ_TRASH, fileId, NULL, NULL,
+                                      NULL, NULL, false);
+    gdrive_nsj_commit_due();
+    return returnVal;
+}
+
+int gdrive_nsj_add_remove_parent(const char* fileId, const char* parentId)
+{
+    int returnVal = gdrive_nsj_append(GDRIVE_NSJ_REMOVE_PARENT, fileId,
+                                      parentId, NULL, NULL, NULL, false);
+    gdrive_nsj_commit_due();
+    return returnVal;
+}
+
+int gdrive_nsj_add_new_parent(const char* fileId, const char* parentId,
+                              const char* title, bool isFolder)
+{
+    int returnVal = gdrive_nsj_append(GDRIVE_NSJ_ADD_PARENT, fileId,
+                                      parentId, NULL, title, NULL, isFolder);
+    gdrive_nsj_commit_due();
+    return returnVal;
+}
+
+int gdrive_nsj_add_move(const char* fileId, const char* fromParentId,
+                        const char* toParentId, const char* oldTitle,
+                        const char* newTitle, bool isFolder)
+{
+    int returnVal = gdrive_nsj_append(GDRIVE_NSJ_MOVE, fileId, fromParentId,
+                                      toParentId, newTitle, oldTitle,
+                                      isFolder);
+    gdrive_nsj_commit_due();
+    return returnVal;
+}
+
+bool gdrive_nsj_lookup_child(const char* parentId, const char* childName,
+                             char** pChildId)
+{
+    *pChildId = NULL;
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+
+    // Work from the newest change backward, so that the most recent file to
+    // take a name wins.
+    for (const Gdrive_Nsj_Op* pOp = pJournal->pTail;
+            pOp != NULL;
+            pOp = pOp->pPrev)
+    {
+        if (!gdrive_nsj_op_targets(pOp, parentId))
+        {
+            continue;
+        }
+        const char* name = NULL;
+        if (gdrive_nsj_replay(pOp->fileId, parentId, false, &name) &&
+                strcmp(name, childName) == 0)
+        {
+            *pChildId = malloc(strlen(pOp->fileId) + 1);
+            if (*pChildId != NULL)
+            {
+                strcpy(*pChildId, pOp->fileId);
+            }
+            return true;
+        }
+    }
+
+    // A folder that only exists locally can't have anything else in it.
+    return gdrive_nsj_is_pending_create(parentId);
+}
+
+bool gdrive_nsj_is_visible(const char* fileId, const char* parentId,
+                           const char* childName)
+{
+    const char* name = childName;
+    return gdrive_nsj_replay(fileId, parentId, true, &name) &&
+            strcmp(name, childName) == 0;
+}
+
+int gdrive_nsj_apply_to_listing(const char* folderId,
+                                Gdrive_Fileinfo_Array* pArray)
+{
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    if (pJournal->pHead == NULL)
+    {
+        // Nothing queued, nothing to change.
+        return 0;
+    }
+
+    // First drop or rename anything Google Drive reported that has since been
+    // moved away or renamed.
+    const Gdrive_Fileinfo* pItem = gdrive_finfoarray_get_first(pArray);
+    while (pItem != NULL)
+    {
+        const char* name = pItem->filename;
+        if (!gdrive_nsj_replay(pItem->id, folderId, true, &name))
+        {
+            pItem = gdrive_finfoarray_remove(pArray, pItem);
+            continue;
+        }
+        if (strcmp(name, pItem->filename) != 0 &&
+                gdrive_finfoarray_rename(pArray, pItem, name) != 0)
+        {
+            // Memory error
+            return -ENOMEM;
+        }
+        pItem = gdrive_finfoarray_get_next(pArray, pItem);
+    }
+
+    // Then add anything that queued changes placed in this folder.
+    for (const Gdrive_Nsj_Op* pOp = pJournal->pHead;
+            pOp != NULL;
+            pOp = pOp->pNext)
+    {
+        if (!gdrive_nsj_op_targets(pOp, folderId))
+        {
+            continue;
+        }
+        const char* name = NULL;
+        if (!gdrive_nsj_replay(pOp->fileId, folderId, false, &name))
+        {
+            continue;
+        }
+
+        // Skip it if it's already listed.
+        bool found = false;
+        for (pItem = gdrive_finfoarray_get_first(pArray);
+                pItem != NULL && !found;
+                pItem = gdrive_finfoarray_get_next(pArray, pItem))
+        {
+            found = gdrive_nsj_id_equal(pItem->id, pOp->fileId);
+        }
+        if (found)
+        {
+            continue;
+        }
+
+        // Use the cached information if there is any. Otherwise, fill in what
+        // we know. Either way, use the name from the journal.
+        Gdrive_Fileinfo fileinfo = {0};
+        Gdrive_Cache_Node* pNode =
+                gdrive_cache_get_node(pOp->fileId, false, NULL);
+        if (pNode != NULL)
+        {
+            fileinfo = *gdrive_cnode_get_fileinfo(pNode);
+        }
+        else
+        {
+            fileinfo.type = pOp->isFolder ?
+                GDRIVE_FILETYPE_FOLDER : GDRIVE_FILETYPE_FILE;
+            fileinfo.basePermission = pOp->isFolder ?
+                (S_IROTH | S_IWOTH | S_IXOTH) : (S_IROTH | S_IWOTH);
+            fileinfo.nParents = 1;
+            fileinfo.nChildren = pOp->isFolder ?
+                GDRIVE_FINFO_CHILDREN_UNKNOWN : 0;
+        }
+        // Casting away const is safe, gdrive_finfoarray_add_copy() makes
+        // its own copies of the strings.
+        fileinfo.id = pOp->fileId;
+        fileinfo.filename = (char*) name;
+        if (gdrive_finfoarray_add_copy(pArray, &fileinfo) != 0)
+        {
+            // Memory error
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+int gdrive_nsj_commit_for(const char* fileId)
+{
+    // Find the last queued change that involves fileId. Everything up to that
+    // point needs to be sent, in order.
+    Gdrive_Nsj_Op* pLast = NULL;
+    for (Gdrive_Nsj_Op* pOp = gdrive_nsj_get_internal()->pHead;
+            pOp != NULL;
+            pOp = pOp->pNext)
+    {
+        if (gdrive_nsj_op_references(pOp, fileId))
+        {
+            pLast = pOp;
+        }
+    }
+
+    if (pLast == NULL)
+    {
+        // Nothing queued for this file
+        return 0;
+    }
+    gdrive_nsj_commit_through(pLast);
+
+    // Failures of unrelated changes have already been reported, and don't 
+    // stop the caller from using fileId. A change involving fileId that is 
+    // still queued (most importantly its creation) does.
+    for (const Gdrive_Nsj_Op* pOp = gdrive_nsj_get_internal()->pHead;
+            pOp != NULL;
+            pOp = pOp->pNext)
+    {
+        if (gdrive_nsj_op_references(pOp, fileId))
+        {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+int gdrive_nsj_commit_due(void)
+{
+    if (gdrive_get_writebehind())
+    {
+        // Failure here isn't a problem. Creating files will fall back to
+        // waiting on the network if there are no IDs available.
+        gdrive_idpool_fill();
+    }
+
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    if (pJournal->pHead == NULL ||
+            (pJournal->nOps < GDRIVE_NSJ_MAX_PENDING &&
+            pJournal->pHead->queuedTime + GDRIVE_NSJ_COMMIT_DELAY > time(NULL))
+        )
+    {
+        // Nothing is due yet
+        return 0;
+    }
+
+    return gdrive_nsj_commit_through(pJournal->pTail);
+}
+
+int gdrive_nsj_commit_all(void)
+{
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    return (pJournal->pTail != NULL) ?
+        gdrive_nsj_commit_through(pJournal->pTail) : 0;
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Ns_Journal* gdrive_nsj_get_internal(void)
+{
+    static Gdrive_Ns_Journal journal = {0};
+    return &journal;
+}
+
+static int gdrive_nsj_append(enum Gdrive_Nsj_Optype type, const char* fileId,
+                             const char* parentId, const char* newParentId,
+                             const char* title, const char* oldTitle,
+                             bool isFolder)
+{
+    Gdrive_Nsj_Op* pOp = malloc(sizeof(Gdrive_Nsj_Op));
+    if (pOp == NULL)
+    {
+        // Memory error
+        return -ENOMEM;
+    }
+    memset(pOp, 0, sizeof(Gdrive_Nsj_Op));
+    pOp->type = type;
+    pOp->isFolder = isFolder;
+    pOp->queuedTime = time(NULL);
+
+    // Copy whichever strings were given
+    const char* sources[] = {fileId, parentId, newParentId, title, oldTitle};
+    char** dests[] = {&pOp->fileId, &pOp->parentId, &pOp->newParentId,
+                      &pOp->title, &pOp->oldTitle};
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++)
+    {
+        if (sources[i] == NULL)
+        {
+            continue;
+        }
+        *dests[i] = malloc(strlen(sources[i]) + 1);
+        if (*dests[i] == NULL)
+        {
+            // Memory error
+            gdrive_nsj_op_free(pOp);
+            return -ENOMEM;
+        }
+        strcpy(*dests[i], sources[i]);
+    }
+
+    // Add to the tail
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    pOp->pPrev = pJournal->pTail;
+    if (pJournal->pTail != NULL)
+    {
+        pJournal->pTail->pNext = pOp;
+    }
+    else
+    {
+        pJournal->pHead = pOp;
+    }
+    pJournal->pTail = pOp;
+    pJournal->nOps++;
+
+    return 0;
+}
+
+static void gdrive_nsj_unlink(Gdrive_Nsj_Op* pOp)
+{
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    if (pOp->pPrev != NULL)
+    {
+        pOp->pPrev->pNext = pOp->pNext;
+    }
+    else
+    {
+        pJournal->pHead = pOp->pNext;
+    }
+    if (pOp->pNext != NULL)
+    {
+        pOp->pNext->pPrev = pOp->pPrev;
+    }
+    else
+    {
+        pJournal->pTail = pOp->pPrev;
+    }
+    pOp->pPrev = NULL;
+    pOp->pNext = NULL;
+    pJournal->nOps--;
+}
+
+/*
+ * Puts a change that was taken off the queue back at the front, and restarts
+ * its wait so that it isn't tried again right away.
+ */
+static void gdrive_nsj_requeue(Gdrive_Nsj_Op* pOp)
+{
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    pOp->pPrev = NULL;
+    pOp->pNext = pJournal->pHead;
+    if (pJournal->pHead != NULL)
+    {
+        pJournal->pHead->pPrev = pOp;
+    }
+    else
+    {
+        pJournal->pTail = pOp;
+    }
+    pJournal->pHead = pOp;
+    pJournal->nOps++;
+    pOp->queuedTime = time(NULL);
+}
+
+/*
+ * Returns true if a change that failed with result (a negative error number
+ * from gdrive_request_error() or similar) may succeed if it's sent again 
+ * later. Changes refused by Google Drive, such as for a file that doesn't 
+ * exist or that we aren't allowed to change, never will.
+ */
+static bool gdrive_nsj_is_retryable(int result)
+{
+    return result == -EIO || result == -ENOMEM;
+}
+
+static void gdrive_nsj_op_free(Gdrive_Nsj_Op* pOp)
+{
+    if (pOp == NULL)
+    {
+        // Nothing to do
+        return;
+    }
+    free(pOp->fileId);
+    free(pOp->parentId);
+    free(pOp->newParentId);
+    free(pOp->title);
+    free(pOp->oldTitle);
+    free(pOp);
+}
+
+static bool gdrive_nsj_id_equal(const char* idOne, const char* idTwo)
+{
+    return idOne != NULL && idTwo != NULL && strcmp(idOne, idTwo) == 0;
+}
+
+static bool gdrive_nsj_op_references(const Gdrive_Nsj_Op* pOp,
+                                     const char* fileId)
+{
+    return gdrive_nsj_id_equal(pOp->fileId, fileId) ||
+            gdrive_nsj_id_equal(pOp->parentId, fileId) ||
+            gdrive_nsj_id_equal(pOp->newParentId, fileId);
+}
+
+/*
+ * Returns true if pOp could place its file inside parentId.
+ */
+static bool gdrive_nsj_op_targets(const Gdrive_Nsj_Op* pOp,
+                                  const char* parentId)
+{
+    switch (pOp->type)
+    {
+        case GDRIVE_NSJ_CREATE:
+        case GDRIVE_NSJ_ADD_PARENT:
+            return gdrive_nsj_id_equal(pOp->parentId, parentId);
+        case GDRIVE_NSJ_MOVE:
+            return gdrive_nsj_id_equal(pOp->newParentId, parentId);
+        default:
+            return false;
+    }
+}
+
+/*
+ * Starting from whether fileId is in parentId (visible) and under what name
+ * (*pName), applies each queued change involving fileId from oldest to newest.
+ * Returns whether fileId ends up in parentId, and stores the final name in
+ * *pName. The stored name points into either the original *pName or the
+ * journal, and should not be freed.
+ */
+static bool gdrive_nsj_replay(const char* fileId, const char* parentId,
+                              bool visible, const char** pName)
+{
+    for (const Gdrive_Nsj_Op* pOp = gdrive_nsj_get_internal()->pHead;
+            pOp != NULL;
+            pOp = pOp->pNext)
+    {
+        if (!gdrive_nsj_id_equal(pOp->fileId, fileId))
+        {
+            continue;
+        }
+        switch (pOp->type)
+        {
+            case GDRIVE_NSJ_CREATE:
+            case GDRIVE_NSJ_ADD_PARENT:
+                if (gdrive_nsj_id_equal(pOp->parentId, parentId))
+                {
+                    visible = true;
+                }
+                *pName = pOp->title;
+                break;
+
+            case GDRIVE_NSJ_TRASH:
+                visible = false;
+                break;
+
+            case GDRIVE_NSJ_REMOVE_PARENT:
+                if (gdrive_nsj_id_equal(pOp->parentId, parentId))
+                {
+                    visible = false;
+                }
+                break;
+
+            case GDRIVE_NSJ_MOVE:
+                if (gdrive_nsj_id_equal(pOp->parentId, parentId))
+                {
+                    visible = false;
+                }
+                if (gdrive_nsj_id_equal(pOp->newParentId, parentId))
+                {
+                    visible = true;
+                }
+                // Titles belong to the file, not to the link, so this renames
+                // the file in all of its parents.
+                *pName = pOp->title;
+                break;
+        }
+    }
+
+    return visible && *pName != NULL;
+}
+
+static int gdrive_nsj_commit_through(Gdrive_Nsj_Op* pLast)
+{
+    Gdrive_Ns_Journal* pJournal = gdrive_nsj_get_internal();
+    if (pJournal->committing)
+    {
+        // Already in the middle of committing further up the stack.
+        return 0;
+    }
+    pJournal->committing = true;
+
+    int returnVal = 0;
+    bool done = false;
+    while (pJournal->pHead != NULL && !done)
+    {
+        // Take as many changes from the front of the queue as can be sent
+        // together. Creating a file is always sent on its own, since later
+        // changes usually depend on it.
+        Gdrive_Nsj_Op* pGroup[GDRIVE_XFER_BATCH_MAX];
+        int results[GDRIVE_XFER_BATCH_MAX];
+        int nGroup = 0;
+        while (pJournal->pHead != NULL && !done &&
+                nGroup < GDRIVE_XFER_BATCH_MAX &&
+                (nGroup == 0 ||
+                gdrive_nsj_can_batch(pJournal->pHead, pGroup, nGroup))
+            )
+        {
+            Gdrive_Nsj_Op* pOp = pJournal->pHead;
+            done = (pOp == pLast);
+            gdrive_nsj_unlink(pOp);
+            pGroup[nGroup++] = pOp;
+            if (pOp->type == GDRIVE_NSJ_CREATE)
+            {
+                break;
+            }
+        }
+
+        gdrive_nsj_execute_group(pGroup, nGroup, results);
+
+        // Changes that failed for reasons that may go away (such as network
+        // errors, server errors, or Google Drive being down) go back to the
+        // front of the queue, in their original order. Nothing queued after
+        // them can be sent first, so stop and try again later.
+        for (int i = nGroup - 1; i >= 0; i--)
+        {
+            if (gdrive_nsj_is_retryable(results[i]))
+            {
+                gdrive_nsj_requeue(pGroup[i]);
+                returnVal = results[i];
+                done = true;
+            }
+        }
+
+        for (int i = 0; i < nGroup; i++)
+        {
+            Gdrive_Nsj_Op* pOp = pGroup[i];
+            int result = results[i];
+            if (gdrive_nsj_is_retryable(result))
+            {
+                // Still queued
+                continue;
+            }
+            if (result != 0)
+            {
+                // Nobody is waiting on this change any more, so the best we
+                // can do is report it and make sure the cache doesn't keep
+                // showing something that didn't happen.
+                fprintf(stderr, "Could not commit queued change to %s: %s\n",
+                        pOp->fileId, strerror(-result));
+                returnVal = result;
+                if (pOp->type == GDRIVE_NSJ_CREATE)
+                {
+                    // Anything else that involves the file can't succeed
+                    // either.
+                    gdrive_nsj_drop_dependents(pOp->fileId, pLast, &done);
+                }
+                gdrive_nsj_invalidate(pOp);
+            }
+            gdrive_nsj_op_free(pOp);
+        }
+    }
+
+    pJournal->committing = false;
+    return returnVal;
+}
+
+static int gdrive_nsj_execute(const Gdrive_Nsj_Op* pOp)
+{
+    switch (pOp->type)
+    {
+        case GDRIVE_NSJ_CREATE:
+            return gdrive_file_create_remote(pOp->fileId, pOp->parentId,
+                                             pOp->title, pOp->isFolder);
+
+        case GDRIVE_NSJ_TRASH:
+            return gdrive_request_trash(pOp->fileId);
+
+        case GDRIVE_NSJ_REMOVE_PARENT:
+            return gdrive_request_remove_parent(pOp->fileId, pOp->parentId);
+
+        case GDRIVE_NSJ_ADD_PARENT:
+            return gdrive_request_add_parent(pOp->fileId, pOp->parentId);
+
+        case GDRIVE_NSJ_MOVE:
+        {
+            bool renamed = (strcmp(pOp->oldTitle, pOp->title) != 0);
+            return gdrive_request_move(pOp->fileId, pOp->parentId,
+                                       pOp->newParentId,
+                                       renamed ? pOp->title : NULL);
+        }
+
+        default:
+            return -EINVAL;
+    }
+}
+
+/*
+ * Returns true if pOp can be sent in the same batch as the nGroup changes in
+ * pGroup, meaning that it doesn't matter which order they reach Google Drive
+ * in. Sharing a parent folder is fine, but no change can involve a file that
+ * another one changes.
+ */
+static bool gdrive_nsj_can_batch(const Gdrive_Nsj_Op* pOp,
+                                 Gdrive_Nsj_Op* const* pGroup, int nGroup)
+{
+    if (pOp->type == GDRIVE_NSJ_CREATE)
+    {
+        return false;
+    }
+    for (int i = 0; i < nGroup; i++)
+    {
+        if (gdrive_nsj_op_references(pGroup[i], pOp->fileId) ||
+                gdrive_nsj_op_references(pOp, pGroup[i]->fileId))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Sends the nGroup changes in pGroup, which must be independent of each other
+ * (see gdrive_nsj_can_batch()), in a single batch request if there is more
+ * than one. Stores 0 or a negative error number for each change in the
+ * matching element of results.
+ */
+static void gdrive_nsj_execute_group(Gdrive_Nsj_Op* const* pGroup,
+                                     int nGroup, int* results)
+{
+    Gdrive_Xfer_Batch* pBatch = (nGroup > 1) ?
+        gdrive_xfer_batch_create() : NULL;
+    if (pBatch == NULL)
+    {
+        // Only one change, or out of memory. Send them one at a time.
+        for (int i = 0; i < nGroup; i++)
+        {
+            results[i] = gdrive_nsj_execute(pGroup[i]);
+        }
+        return;
+    }
+
+    int indices[GDRIVE_XFER_BATCH_MAX];
+    for (int i = 0; i < nGroup; i++)
+    {
+        indices[i] = gdrive_xfer_batch_add(pBatch,
+                                           gdrive_nsj_make_xfer(pGroup[i]));
+    }
+    gdrive_xfer_batch_execute(pBatch);
+    for (int i = 0; i < nGroup; i++)
+    {
+        results[i] = (indices[i] < 0) ? -ENOMEM :
+            gdrive_request_result(
+                gdrive_xfer_batch_get_response(pBatch, indices[i]));
+    }
+    gdrive_xfer_batch_free(pBatch);
+}
+
+/*
+ * Builds, but doesn't send, the request for a change other than a creation.
+ * Returns NULL on failure.
+ */
+static Gdrive_Transfer* gdrive_nsj_make_xfer(const Gdrive_Nsj_Op* pOp)
+{
+    switch (pOp->type)
+    {
+        case GDRIVE_NSJ_TRASH:
+            return gdrive_request_trash_xfer(pOp->fileId);
+
+        case GDRIVE_NSJ_REMOVE_PARENT:
+            return gdrive_request_remove_parent_xfer(pOp->fileId,
+                                                     pOp->parentId);
+
+        case GDRIVE_NSJ_ADD_PARENT:
+            return gdrive_request_add_parent_xfer(pOp->fileId, pOp->parentId);
+
+        case GDRIVE_NSJ_MOVE:
+        {
+            bool renamed = (strcmp(pOp->oldTitle, pOp->title) != 0);
+            return gdrive_request_move_xfer(pOp->fileId, pOp->parentId,
+                                            pOp->newParentId,
+                                            renamed ? pOp->title : NULL);
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * Discards every queued change that involves fileId, including (recursively)
+ * anything that involves a file whose creation is discarded. Sets *pDone if
+ * pLast is among the discarded changes.
+ */
+static void gdrive_nsj_drop_dependents(const char* fileId,
+                                       const Gdrive_Nsj_Op* pLast,
+                                       bool* pDone)
+{
+    Gdrive_Nsj_Op* pOp = gdrive_nsj_get_internal()->pHead;
+    while (pOp != NULL)
+    {
+        if (!gdrive_nsj_op_references(pOp, fileId))
+        {
+            pOp = pOp->pNext;
+            continue;
+        }
+
+        gdrive_nsj_unlink(pOp);
+        if (pOp == pLast)
+        {
+            *pDone = true;
+        }
+        if (pOp->type == GDRIVE_NSJ_CREATE &&
+                !gdrive_nsj_id_equal(pOp->fileId, fileId))
+        {
+            gdrive_nsj_drop_dependents(pOp->fileId, pLast, pDone);
+        }
+        gdrive_nsj_invalidate(pOp);
+        gdrive_nsj_op_free(pOp);
+
+        // The recursive call may have removed anything, so start over.
+        pOp = gdrive_nsj_get_internal()->pHead;
+    }
+}
+
+/*
+ * Removes everything a failed or discarded change touched from the cache, so
+ * that it will be fetched fresh from Google Drive the next time it's needed.
+ */
+static void gdrive_nsj_invalidate(const Gdrive_Nsj_Op* pOp)
+{
+    gdrive_cache_delete_id(pOp->fileId);
+    if (pOp->parentId != NULL)
+    {
+        gdrive_cache_delete_id(pOp->parentId);
+    }
+    if (pOp->newParentId != NULL)
+    {
+        gdrive_cache_delete_id(pOp->newParentId);
+    }
+}
+
+/*
+ * Returns the path of a file within the cache directory, or NULL if there is
+ * no cache directory or on memory error. The caller is responsible for 
+ * freeing the path.
+ */
+static char* gdrive_nsj_save_path(const char* name)
+{
+    const char* cacheDir = gdrive_get_cachedir();
+    if (cacheDir == NULL)
+    {
+        return NULL;
+    }
+    char* path = malloc(strlen(cacheDir) + 1 + strlen(name) + 1);
+    if (path == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    strcpy(path, cacheDir);
+    strcat(path, "/");
+    strcat(path, name);
+    return path;
+}
+
+/*
+ * Writes every queued change to the cache directory, replacing whatever was
+ * saved before, so that gdrive_nsj_restore() can queue them again. If nothing
+ * is queued, removes the saved copy instead. Returns 0 on success, or a 
+ * negative error number if the changes couldn't all be saved, in which case
+ * the earlier copy (if any) is left alone.
+ *
+ * Each change is one line:
+ *      <type> <isFolder> <fileId> <parentId> <newParentId> <title>[/<oldTitle>]
+ * where <type> is one of the letters in GDRIVE_NSJ_TYPE_CHARS, a missing ID is
+ * written as "-", and the titles are written only for the types that have
+ * them. The titles come from pathnames, so they can't contain a '/'.
+ */
+static int gdrive_nsj_save(void)
+{
+    char* path = gdrive_nsj_save_path(GDRIVE_NSJ_SAVE_NAME);
+    char* tempPath = gdrive_nsj_save_path(GDRIVE_NSJ_SAVE_TEMP_NAME);
+    if (path == NULL || tempPath == NULL)
+    {
+        free(path);
+        free(tempPath);
+        return -ENOMEM;
+    }
+
+    int returnVal = 0;
+    const Gdrive_Nsj_Op* pOp = gdrive_nsj_get_internal()->pHead;
+    if (pOp == NULL)
+    {
+        if (unlink(path) != 0 && errno != ENOENT)
+        {
+            returnVal = -errno;
+        }
+        free(path);
+        free(tempPath);
+        return returnVal;
+    }
+
+    FILE* outFile = fopen(tempPath, "w");
+    if (outFile == NULL)
+    {
+        returnVal = -errno;
+        free(path);
+        free(tempPath);
+        return returnVal;
+    }
+    for (; pOp != NULL && returnVal == 0; pOp = pOp->pNext)
+    {
+        const char* title = (pOp->title != NULL) ? pOp->title : "";
+        const char* oldTitle = (pOp->oldTitle != NULL) ? pOp->oldTitle : "";
+        if (strchr(title, '\n') != NULL || strchr(oldTitle, '\n') != NULL ||
+                strchr(title, '/') != NULL)
+        {
+            // Can't be represented in a single line
+            returnVal = -EINVAL;
+            break;
+        }
+        if (fprintf(outFile, "%c %d %s %s %s %s%s%s\n", 
+                    GDRIVE_NSJ_TYPE_CHARS[pOp->type], pOp->isFolder ? 1 : 0,
+                    pOp->fileId, 
+                    (pOp->parentId != NULL) ? pOp->parentId : "-", 
+                    (pOp->newParentId != NULL) ? pOp->newParentId : "-", 
+                    title, (pOp->oldTitle != NULL) ? "/" : "", oldTitle) < 0)
+        {
+            returnVal = -EIO;
+        }
+    }
+    if (returnVal == 0 && (fflush(outFile) != 0 || fsync(fileno(outFile)) != 0))
+    {
+        returnVal = -errno;
+    }
+    if (fclose(outFile) != 0 && returnVal == 0)
+    {
+        returnVal = -EIO;
+    }
+    if (returnVal == 0 && rename(tempPath, path) != 0)
+    {
+        returnVal = -errno;
+    }
+    if (returnVal != 0)
+    {
+        remove(tempPath);
+    }
+    free(path);
+    free(tempPath);
+    return returnVal;
+}
+
+/*
+ * Queues the change described by one line written by gdrive_nsj_save(). The
+ * line is changed in the process. Returns 0 on success, or a negative error
+ * number on failure.
+ */
+static int gdrive_nsj_load_line(char* line)
+{
+    // Split off the five fields before the titles
+    char* fields[5];
+    char* pos = line;
+    for (int i = 0; i < 5; i++)
+    {
+        fields[i] = pos;
+        pos = strchr(pos, ' ');
+        if (pos == NULL)
+        {
+            // Corrupt record
+            return -EINVAL;
+        }
+        *pos = '\0';
+        pos++;
+    }
+
+    const char* typePos = strchr(GDRIVE_NSJ_TYPE_CHARS, fields[0][0]);
+    if (fields[0][0] == '\0' || fields[0][1] != '\0' || typePos == NULL)
+    {
+        // Unknown change
+        return -EINVAL;
+    }
+    enum Gdrive_Nsj_Optype type = typePos - GDRIVE_NSJ_TYPE_CHARS;
+    const char* parentId = (strcmp(fields[3], "-") != 0) ? fields[3] : NULL;
+    const char* newParentId = (strcmp(fields[4], "-") != 0) ? fields[4] : NULL;
+    char* title = pos;
+    char* oldTitle = NULL;
+    if (type == GDRIVE_NSJ_MOVE)
+    {
+        oldTitle = strchr(title, '/');
+        if (oldTitle == NULL)
+        {
+            // Corrupt record
+            return -EINVAL;
+        }
+        *oldTitle = '\0';
+        oldTitle++;
+    }
+    else if (type == GDRIVE_NSJ_TRASH || type == GDRIVE_NSJ_REMOVE_PARENT)
+    {
+        title = NULL;
+    }
+
+    return gdrive_nsj_append(type, fields[2], parentId, newParentId, title,
+                             oldTitle, fields[1][0] == '1');
+}
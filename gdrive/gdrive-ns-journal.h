@@ -0,0 +1,296 @@
+/*
+ * File:   gdrive-ns-journal.h
+ * Author: me
+ *
+ * An ordered journal of namespace changes (creating, trashing, linking,
+ * unlinking and moving files) that have been applied to the local cache but
+ * not yet sent to Google Drive. This is only used when write-behind is
+ * enabled with gdrive_set_writebehind().
+ *
+ * Changes are sent in the order they were made. Whenever something needs the
+ * server to know about a particular file (uploading its contents, changing its
+ * metadata, or fetching its information), every queued change up to and
+ * including the last one involving that file is committed first. The rest are
+ * committed once they have waited long enough (checked whenever the cache is
+ * refreshed and whenever a new change is queued), and everything is committed
+ * by gdrive_cleanup().
+ *
+ * A change that fails because of a network or server problem (or because
+ * Google Drive is down) stays at the front of the queue and is tried again
+ * later, and nothing after it is sent in the meantime. Only changes that
+ * Google Drive refuses, such as for a file that no longer exists, are dropped.
+ * Whatever is still queued at unmount is saved in the cache directory, if
+ * there is one (see gdrive_set_cachedir()), and queued again by 
+ * gdrive_nsj_restore() the next time.
+ *
+ * Until a change is committed, folder listings and pathname lookups are
+ * adjusted so that they already reflect it.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_NS_JOURNAL_H
+#define	GDRIVE_NS_JOURNAL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "gdrive-fileinfo-array.h"
+
+#include <stdbool.h>
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+// No constructors. The journal is a single struct instance that lives in
+// static memory for the lifetime of the application.
+
+/*
+ * gdrive_nsj_cleanup():    Commits all queued changes, then frees any memory
+ *                          associated with the journal. Changes that can't be
+ *                          sent yet are saved in the cache directory if there
+ *                          is one. Otherwise, sending them is tried a few more
+ *                          times over about half a minute, and any that still
+ *                          fail are reported on stderr and lost.
+ */
+void gdrive_nsj_cleanup(void);
+
+/*
+ * gdrive_nsj_restore():    Queues the changes that gdrive_nsj_cleanup() saved
+ *                          at the end of an earlier run, and tries to send 
+ *                          them. Should be called once, after authentication,
+ *                          after the cache and gdrive_dj_init() are set up, 
+ *                          and before gdrive_dj_recover().
+ */
+void gdrive_nsj_restore(void);
+
+
+/*************************************************************************
+ * Getter and setter functions
+ *************************************************************************/
+
+/*
+ * gdrive_nsj_is_pending_create():  Determines whether a file or folder has been
+ *                                  created locally but not yet on Google Drive.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID to look for.
+ * Return value (bool):
+ *      True if the creation of fileId is still queued, otherwise false.
+ */
+bool gdrive_nsj_is_pending_create(const char* fileId);
+
+/*
+ * gdrive_nsj_get_pending_create(): Like gdrive_nsj_is_pending_create(), but
+ *                                  also retrieves where the item will be
+ *                                  created.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID to look for.
+ *      pParentId (const char**):
+ *              If non-NULL and the creation is queued, the location pointed to
+ *              is set to the file ID of the parent folder. The string belongs
+ *              to the journal and is only valid until the journal changes.
+ *      pTitle (const char**):
+ *              If non-NULL and the creation is queued, the location pointed to
+ *              is set to the item's basename, with the same lifetime as
+ *              *pParentId.
+ * Return value (bool):
+ *      True if the creation of fileId is still queued, otherwise false.
+ */
+bool gdrive_nsj_get_pending_create(const char* fileId,
+                                   const char** pParentId,
+                                   const char** pTitle);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_nsj_add_create(): Queues the creation of a new file or folder.
+ * Parameters:
+ *      fileId (const char*):
+ *              A previously unused file ID, as obtained from
+ *              gdrive_idpool_get().
+ *      parentId (const char*):
+ *              The file ID of the folder that will contain the new item.
+ *      title (const char*):
+ *              The basename of the new item.
+ *      isFolder (bool):
+ *              True to create a folder, false to create a regular file.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_nsj_add_create(const char* fileId, const char* parentId,
+                          const char* title, bool isFolder);
+
+/*
+ * gdrive_nsj_add_trash():  Queues moving a file or folder to the trash. If the
+ *                          item was created by a change that is still queued
+ *                          and nothing else queued depends on it, the queued
+ *                          changes are simply discarded instead.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID to trash.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_nsj_add_trash(const char* fileId);
+
+/*
+ * gdrive_nsj_add_remove_parent():  Queues removing one parent folder from a
+ *                                  file's list of parents.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file to change.
+ *      parentId (const char*):
+ *              The file ID of the parent folder to remove.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_nsj_add_remove_parent(const char* fileId, const char* parentId);
+
+/*
+ * gdrive_nsj_add_new_parent(): Queues adding a parent folder to a file's list
+ *                              of parents.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file to change.
+ *      parentId (const char*):
+ *              The file ID of the parent folder to add.
+ *      title (const char*):
+ *              The file's current basename.
+ *      isFolder (bool):
+ *              True if the file is a folder.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_nsj_add_new_parent(const char* fileId, const char* parentId,
+                              const char* title, bool isFolder);
+
+/*
+ * gdrive_nsj_add_move():   Queues moving a file to a different folder, giving
+ *                          it a new basename, or both.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID of the file to move.
+ *      fromParentId (const char*):
+ *              The file ID of the folder the file is being moved out of.
+ *      toParentId (const char*):
+ *              The file ID of the folder the file is being moved into. May be
+ *              the same as fromParentId.
+ *      oldTitle (const char*):
+ *              The file's current basename.
+ *      newTitle (const char*):
+ *              The file's new basename. May be the same as oldTitle.
+ *      isFolder (bool):
+ *              True if the file is a folder.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_nsj_add_move(const char* fileId, const char* fromParentId,
+                        const char* toParentId, const char* oldTitle,
+                        const char* newTitle, bool isFolder);
+
+/*
+ * gdrive_nsj_lookup_child():   Looks for a queued change that places a file
+ *                              with a given name in a given folder.
+ * Parameters:
+ *      parentId (const char*):
+ *              The file ID of the folder.
+ *      childName (const char*):
+ *              The basename to look for.
+ *      pChildId (char**):
+ *              If this function returns true, the location pointed to by
+ *              pChildId is set to a newly allocated copy of the matching file
+ *              ID, or to NULL if no such file exists. The caller is
+ *              responsible for freeing the string.
+ * Return value (bool):
+ *      True if the journal alone can answer the lookup (either a queued change
+ *      put a matching file in the folder, or the folder itself has not been
+ *      created on Google Drive yet). False if Google Drive needs to be asked,
+ *      in which case the answer should be checked with
+ *      gdrive_nsj_is_visible().
+ */
+bool gdrive_nsj_lookup_child(const char* parentId, const char* childName,
+                             char** pChildId);
+
+/*
+ * gdrive_nsj_is_visible(): Determines whether a file that Google Drive reports
+ *                          under a given folder and name is still there once
+ *                          queued changes are taken into account.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID reported by Google Drive.
+ *      parentId (const char*):
+ *              The file ID of the folder.
+ *      childName (const char*):
+ *              The basename reported by Google Drive.
+ * Return value (bool):
+ *      True if the file is still in the folder with the same name, otherwise
+ *      false.
+ */
+bool gdrive_nsj_is_visible(const char* fileId, const char* parentId,
+                           const char* childName);
+
+/*
+ * gdrive_nsj_apply_to_listing():   Adjusts a folder listing obtained from
+ *                                  Google Drive so that it reflects queued
+ *                                  changes, dropping, renaming and adding items
+ *                                  as needed.
+ * Parameters:
+ *      folderId (const char*):
+ *              The file ID of the listed folder.
+ *      pArray (Gdrive_Fileinfo_Array*):
+ *              The listing to adjust.
+ * Return value (int):
+ *      0 on success, or a negative error number on failure.
+ */
+int gdrive_nsj_apply_to_listing(const char* folderId,
+                                Gdrive_Fileinfo_Array* pArray);
+
+/*
+ * gdrive_nsj_commit_for(): Sends every queued change up to and including the
+ *                          last one that involves a given file, so that the
+ *                          file can be used in requests to Google Drive.
+ * Parameters:
+ *      fileId (const char*):
+ *              The file ID that is about to be used.
+ * Return value (int):
+ *      0 if nothing involving fileId is still queued afterward, even if some
+ *      other change failed. -EIO if a change involving fileId couldn't be 
+ *      sent yet and is still queued, in which case Google Drive may not know
+ *      about the file at all.
+ */
+int gdrive_nsj_commit_for(const char* fileId);
+
+/*
+ * gdrive_nsj_commit_due(): Sends all queued changes if the oldest has waited
+ *                          long enough or too many have built up, and tops up
+ *                          the pool of reserved file IDs.
+ * Return value (int):
+ *      0 on success, or a negative error number if any change failed.
+ */
+int gdrive_nsj_commit_due(void);
+
+/*
+ * gdrive_nsj_commit_all(): Sends all queued changes.
+ * Return value (int):
+ *      0 on success, or a negative error number if any change failed.
+ */
+int gdrive_nsj_commit_all(void);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_NS_JOURNAL_H */
+
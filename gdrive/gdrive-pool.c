@@ -0,0 +1,194 @@
+
+
+#include "gdrive-pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+// Slabs are allocated in one piece of about this size.
+#define GDRIVE_POOL_SLAB_SIZE (256 * 1024)
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+// Slabs start with this header, padded so the objects after it are aligned
+// for any type.
+typedef union Gdrive_Pool_Slab_Header
+{
+    void* pNext;
+    long double alignLongDouble;
+    long long alignLongLong;
+    void (*alignFunction)(void);
+} Gdrive_Pool_Slab_Header;
+
+static Gdrive_Pool** gdrive_pool_get_list(void);
+
+static size_t gdrive_pool_stride(const Gdrive_Pool* pPool);
+
+static size_t gdrive_pool_per_slab(const Gdrive_Pool* pPool);
+
+static int gdrive_pool_add_slab(Gdrive_Pool* pPool);
+
+static void gdrive_pool_free_slabs(Gdrive_Pool* pPool);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+void* gdrive_pool_alloc(Gdrive_Pool* pPool)
+{
+    if (!pPool->registered)
+    {
+        Gdrive_Pool** ppList = gdrive_pool_get_list();
+        pPool->pNextPool = *ppList;
+        *ppList = pPool;
+        pPool->registered = true;
+    }
+
+    void* pObject = pPool->pFreeList;
+    if (pObject != NULL)
+    {
+        memcpy(&(pPool->pFreeList), pObject, sizeof(void*));
+    }
+    else
+    {
+        if (pPool->nFresh == 0 && gdrive_pool_add_slab(pPool) != 0)
+        {
+            // Memory error
+            return NULL;
+        }
+        pObject = pPool->pNextFresh;
+        pPool->pNextFresh += gdrive_pool_stride(pPool);
+        pPool->nFresh--;
+    }
+
+    memset(pObject, 0, pPool->objectSize);
+    pPool->nLive++;
+    if (pPool->nLive > pPool->nPeak)
+    {
+        pPool->nPeak = pPool->nLive;
+    }
+    return pObject;
+}
+
+void gdrive_pool_free(Gdrive_Pool* pPool, void* pObject)
+{
+    if (pObject == NULL)
+    {
+        return;
+    }
+
+    memcpy(pObject, &(pPool->pFreeList), sizeof(void*));
+    pPool->pFreeList = pObject;
+    pPool->nLive--;
+    if (pPool->nLive == 0)
+    {
+        // Nothing left, so the free list only points into slabs that can go.
+        gdrive_pool_free_slabs(pPool);
+    }
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+void gdrive_pool_print_all(FILE* stream)
+{
+    for (Gdrive_Pool* pPool = *gdrive_pool_get_list();
+            pPool != NULL;
+            pPool = pPool->pNextPool)
+    {
+        size_t slabBytes = pPool->nSlabs * GDRIVE_POOL_SLAB_SIZE;
+        fprintf(stream, "  %s: %lu in use (peak %lu), %lu bytes each, "
+                "%lu KiB in %lu slabs\n", pPool->name,
+                (unsigned long) pPool->nLive, (unsigned long) pPool->nPeak,
+                (unsigned long) gdrive_pool_stride(pPool),
+                (unsigned long) (slabBytes / 1024),
+                (unsigned long) pPool->nSlabs);
+    }
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Pool** gdrive_pool_get_list(void)
+{
+    static Gdrive_Pool* pList = NULL;
+    return &pList;
+}
+
+/*
+ * The distance between objects in a slab: the object size, rounded up so
+ * that every object is aligned like the slab header (and has room for the
+ * free list pointer).
+ */
+static size_t gdrive_pool_stride(const Gdrive_Pool* pPool)
+{
+    size_t align = sizeof(Gdrive_Pool_Slab_Header);
+    size_t size = (pPool->objectSize > sizeof(void*)) ?
+        pPool->objectSize : sizeof(void*);
+    return (size + align - 1) / align * align;
+}
+
+static size_t gdrive_pool_per_slab(const Gdrive_Pool* pPool)
+{
+    size_t perSlab = (GDRIVE_POOL_SLAB_SIZE - sizeof(Gdrive_Pool_Slab_Header))
+            / gdrive_pool_stride(pPool);
+    return (perSlab > 0) ? perSlab : 1;
+}
+
+static int gdrive_pool_add_slab(Gdrive_Pool* pPool)
+{
+    size_t perSlab = gdrive_pool_per_slab(pPool);
+    size_t slabSize = sizeof(Gdrive_Pool_Slab_Header) +
+            perSlab * gdrive_pool_stride(pPool);
+    if (slabSize < GDRIVE_POOL_SLAB_SIZE)
+    {
+        // Keep every slab the same size, so the report can count them.
+        slabSize = GDRIVE_POOL_SLAB_SIZE;
+    }
+    Gdrive_Pool_Slab_Header* pSlab = malloc(slabSize);
+    if (pSlab == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    pSlab->pNext = pPool->pSlabs;
+    pPool->pSlabs = pSlab;
+    pPool->nSlabs++;
+    pPool->pNextFresh = (char*) (pSlab + 1);
+    pPool->nFresh = perSlab;
+    return 0;
+}
+
+static void gdrive_pool_free_slabs(Gdrive_Pool* pPool)
+{
+    Gdrive_Pool_Slab_Header* pSlab = pPool->pSlabs;
+    while (pSlab != NULL)
+    {
+        Gdrive_Pool_Slab_Header* pNext = pSlab->pNext;
+        free(pSlab);
+        pSlab = pNext;
+    }
+    pPool->pSlabs = NULL;
+    pPool->nSlabs = 0;
+    pPool->pFreeList = NULL;
+    pPool->pNextFresh = NULL;
+    pPool->nFresh = 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * File:   gdrive-pool.h
+ * Author: me
+ *
+ * Pools of fixed-size objects, for structs that there can be millions of (such
+ * as cache nodes). Objects are carved out of large slabs instead of being
+ * allocated one at a time, which saves malloc()'s per-allocation overhead and
+ * keeps objects of the same kind close together in memory. Freed objects are
+ * reused before a new slab is allocated, and all of a pool's slabs are given
+ * back once the pool has no objects left.
+ *
+ * Every pool that has been used is listed in the memory report printed by
+ * gdrive_pool_print_all().
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_POOL_H
+#define	GDRIVE_POOL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+/*
+ * A pool is normally a static variable, set up with GDRIVE_POOL_INIT. Only the
+ * gdrive_pool_ functions should change its members.
+ */
+typedef struct Gdrive_Pool
+{
+    // name: What the objects are, for the memory report
+    const char* name;
+    size_t objectSize;
+    // pFreeList: Freed objects, linked through their first bytes
+    void* pFreeList;
+    // pSlabs: The slabs, linked through their first bytes
+    void* pSlabs;
+    size_t nSlabs;
+    // pNextFresh, nFresh: The part of the newest slab that has never been used
+    char* pNextFresh;
+    size_t nFresh;
+    size_t nLive;
+    size_t nPeak;
+    // Other pools that have been used, for the memory report
+    struct Gdrive_Pool* pNextPool;
+    bool registered;
+} Gdrive_Pool;
+
+/*
+ * GDRIVE_POOL_INIT:    Initializer for a pool of objects of the given type,
+ *                      for example:
+ *                      static Gdrive_Pool pool =
+ *                              GDRIVE_POOL_INIT("cache nodes", Gdrive_Node);
+ */
+#define GDRIVE_POOL_INIT(name, type) \
+        {(name), sizeof(type), NULL, NULL, 0, NULL, 0, 0, 0, NULL, false}
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+/*
+ * gdrive_pool_alloc(): Gets an object from a pool.
+ * Parameters:
+ *      pPool (Gdrive_Pool*):
+ *              The pool.
+ * Return value (void*):
+ *      A zero-filled object, or NULL on memory error. The object must be
+ *      returned with gdrive_pool_free(), never with free().
+ */
+void* gdrive_pool_alloc(Gdrive_Pool* pPool);
+
+/*
+ * gdrive_pool_free():  Returns an object to its pool. If the pool has no
+ *                      objects left, its slabs are freed.
+ * Parameters:
+ *      pPool (Gdrive_Pool*):
+ *              The pool that the object came from.
+ *      pObject (void*):
+ *              The object to return. It's safe to pass a NULL pointer.
+ */
+void gdrive_pool_free(Gdrive_Pool* pPool, void* pObject);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_pool_print_all(): Prints one line for each pool that has been used,
+ *                          with its current and peak number of objects and
+ *                          the memory its slabs take up.
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_pool_print_all(FILE* stream);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_POOL_H */
+
@@ -1,10 +1,10 @@
 
 
 #include "gdrive-query.h"
-#include "gdrive-info.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 
 
 
@@ -15,12 +15,18 @@
 
 typedef struct Gdrive_Query
 {
-    char* field;
-    char* value;
     struct Gdrive_Query* pNext;
+    // length: The length of pair, not counting the null terminator
+    size_t length;
+    // pair: The URL-escaped field and value, joined with '='
+    char pair[];
 } Gdrive_Query;
 
-Gdrive_Query* gdrive_query_create(void);
+static bool gdrive_query_is_unreserved(unsigned char c);
+
+static size_t gdrive_query_escaped_length(const char* str);
+
+static char* gdrive_query_escape(char* dest, const char* str);
 
 
 /*************************************************************************
@@ -33,31 +39,12 @@ Gdrive_Query* gdrive_query_create(void);
 
 void gdrive_query_free(Gdrive_Query* pQuery)
 {
-    if (pQuery == NULL)
-    {
-        // Nothing to do
-        return;
-    }
-    
-    // Work from the end back to the beginning with recursion.
-    if (pQuery->pNext != NULL)
-    {
-        gdrive_query_free(pQuery->pNext);
-    }
-    
-    // Free up the strings.  They were created with curl_easy_escape(), so we 
-    // need to use curl_free().
-    if (pQuery->field != NULL)
-    {
-        curl_free(pQuery->field);
-    }
-    if (pQuery->value != NULL)
+    while (pQuery != NULL)
     {
-        curl_free(pQuery->value);
+        Gdrive_Query* pNext = pQuery->pNext;
+        free(pQuery);
+        pQuery = pNext;
     }
-    
-    // Free the struct itself.
-    free(pQuery);
 }
 
 
@@ -83,157 +70,162 @@ Gdrive_Query* gdrive_query_add(Gdrive_Query* pQuery,
     // require a different mechanism to report errors, can't just return NULL
     // (and have the caller lose the pointer to the original Gdrive_Query list).
     
-    // If there is no existing Gdrive_Query, create an empty one.
-    if (pQuery == NULL)
-    {
-        pQuery = gdrive_query_create();
-        if (pQuery == NULL)
-        {
-            // Memory error
-            return NULL;
-        }
-    }
-    
-    // Add a new empty Gdrive_Query to the end of the list (unless the first
-    // one is already empty, as it will be if we just created it).
-    Gdrive_Query* pLast = pQuery;
-    if (pLast->field != NULL || pLast->value != NULL)
+    // The escaped field and value go in the same allocation as the struct.
+    size_t length = gdrive_query_escaped_length(field) + 1 + 
+            gdrive_query_escaped_length(value);
+    Gdrive_Query* pNew = malloc(sizeof(Gdrive_Query) + length + 1);
+    if (pNew == NULL)
     {
-        while (pLast->pNext != NULL)
-        {
-            pLast = pLast->pNext;
-        }
-        pLast->pNext = gdrive_query_create();
-        if (pLast->pNext == NULL)
-        {
-            // Memory error
-            gdrive_query_free(pQuery);
-            return NULL;
-        }
-        pLast = pLast->pNext;
+        // Memory error
+        gdrive_query_free(pQuery);
+        return NULL;
     }
+    pNew->pNext = NULL;
+    pNew->length = length;
+    char* end = gdrive_query_escape(pNew->pair, field);
+    *end++ = '=';
+    end = gdrive_query_escape(end, value);
+    *end = '\0';
     
-    // Populate the newly-created Gdrive_Query with URL-escaped strings
-    CURL* curlHandle = gdrive_get_curlhandle();
-    if (curlHandle == NULL)
+    if (pQuery == NULL)
     {
-        // Error
-        gdrive_query_free(pQuery);
-        return NULL;
+        // This is the first field and value.
+        return pNew;
     }
-    pLast->field = curl_easy_escape(curlHandle, field, 0);
-    pLast->value = curl_easy_escape(curlHandle, value, 0);
-    curl_easy_cleanup(curlHandle);
     
-    if (pLast->field == NULL || pLast->value == NULL)
+    // Add to the end of the list.
+    Gdrive_Query* pLast = pQuery;
+    while (pLast->pNext != NULL)
     {
-        // Error
-        gdrive_query_free(pQuery);
-        return NULL;
+        pLast = pLast->pNext;
     }
+    pLast->pNext = pNew;
     return pQuery;
 }
 
-
-
 char* gdrive_query_assemble(const Gdrive_Query* pQuery, const char* url)
 {
-    // If there is a url, allow for its length plus the '?' character (or the
-    // url length plus terminating null if there is no query string).
-    int totalLength = (url == NULL) ? 0 : (strlen(url) + 1);
-    
-    // If there is a query string (or POST data, which is handled the same way),
-    // each field adds its length plus 1 for the '=' character. Each value adds
-    // its length plus 1, for either the '&' character (all but the last item)
-    // or the terminating null (on the last item).
-    const Gdrive_Query* pCurrentQuery = pQuery;
-    while (pCurrentQuery != NULL)
+    char* result = NULL;
+    size_t size = 0;
+    if (gdrive_query_assemble_into(pQuery, url, &result, &size) != 0)
     {
-        if (pCurrentQuery->field != NULL && pCurrentQuery->value != NULL)
-        {
-            totalLength += strlen(pCurrentQuery->field) + 1;
-            totalLength += strlen(pCurrentQuery->value) + 1;
-        }
-        else
-        {
-            // The query is empty.  Add 1 to the length for the null terminator
-            totalLength++;
-        }
-        pCurrentQuery = pCurrentQuery->pNext;
+        free(result);
+        return NULL;
     }
-    
-    if (totalLength < 1)
+    return result;
+}
+
+int gdrive_query_assemble_into(const Gdrive_Query* pQuery, const char* url, 
+                               char** pBuffer, size_t* pSize)
+{
+    if (pQuery == NULL && url == NULL)
     {
         // Invalid arguments
-        return NULL;
+        return -1;
     }
     
-    // Allocate a string long enough to hold everything.
-    char* result = malloc(totalLength);
-    if (result == NULL)
-    {
-        // Memory error
-        return NULL;
+    // If there is a url, allow for its length plus the '?' character. Each 
+    // field/value pair adds its length plus 1, for either the '&' character 
+    // (all but the last item) or the terminating null (on the last item). 
+    // That leaves room for one extra character, so there's room for the 
+    // terminating null when there is no query string.
+    size_t urlLength = (url == NULL) ? 0 : strlen(url);
+    size_t totalLength = urlLength + 1;
+    for (const Gdrive_Query* pCurrentQuery = pQuery; 
+            pCurrentQuery != NULL; 
+            pCurrentQuery = pCurrentQuery->pNext)
+    {
+        totalLength += pCurrentQuery->length + 1;
     }
     
-    // Copy the url into the result string.  If there is no url, start with an
-    // empty string.
-    if (url != NULL)
+    if (totalLength > *pSize)
     {
-        strcpy(result, url);
-        if (pQuery == NULL)
-        {
-            // We had a URL string but no query string, so we're done.
-            return result;
-        }
-        else
+        char* newBuffer = realloc(*pBuffer, totalLength);
+        if (newBuffer == NULL)
         {
-            // We have both a URL and a query, so they need to be separated
-            // with a '?'.
-            strcat(result, "?");
+            // Memory error
+            return -1;
         }
-    }
-    else
-    {
-        result[0] = '\0';
-    }
-    
-    if (pQuery == NULL)
-    {
-        // There was no query string, so we're done.
-        return result;
+        *pBuffer = newBuffer;
+        *pSize = totalLength;
     }
     
-    // Copy each of the query field/value pairs into the result.
-    pCurrentQuery = pQuery;
-    while (pCurrentQuery != NULL)
+    // Copy the url, then the query string separated from it by a '?'.
+    char* end = *pBuffer;
+    if (url != NULL)
     {
-        if (pCurrentQuery->field != NULL && pCurrentQuery->value != NULL)
+        memcpy(end, url, urlLength);
+        end += urlLength;
+        if (pQuery != NULL)
         {
-            strcat(result, pCurrentQuery->field);
-            strcat(result, "=");
-            strcat(result, pCurrentQuery->value);
+            *end++ = '?';
         }
+    }
+    for (const Gdrive_Query* pCurrentQuery = pQuery; 
+            pCurrentQuery != NULL; 
+            pCurrentQuery = pCurrentQuery->pNext)
+    {
+        memcpy(end, pCurrentQuery->pair, pCurrentQuery->length);
+        end += pCurrentQuery->length;
         if (pCurrentQuery->pNext != NULL)
         {
-            strcat(result, "&");
+            *end++ = '&';
         }
-        pCurrentQuery = pCurrentQuery->pNext;
     }
+    *end = '\0';
     
-    return result;
+    return 0;
 }
 
+
 /*************************************************************************
  * Implementations of private functions for use within this file
  *************************************************************************/
 
-Gdrive_Query* gdrive_query_create(void)
+/*
+ * Characters that don't need escaping in a URL (the "unreserved" characters 
+ * from RFC 3986), the same as for curl_easy_escape()
+ */
+static bool gdrive_query_is_unreserved(unsigned char c)
 {
-    Gdrive_Query* result = malloc(sizeof(Gdrive_Query));
-    if (result != NULL)
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || 
+            (c >= '0' && c <= '9') || 
+            c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+/*
+ * Returns the length of str once it has been percent-encoded.
+ */
+static size_t gdrive_query_escaped_length(const char* str)
+{
+    size_t length = 0;
+    for (const unsigned char* p = (const unsigned char*) str; *p; p++)
     {
-        memset(result, 0, sizeof(Gdrive_Query));
+        length += gdrive_query_is_unreserved(*p) ? 1 : 3;
     }
-    return result;
+    return length;
+}
+
+/*
+ * Copies str into dest, percent-encoding it. dest must have room for 
+ * gdrive_query_escaped_length(str) characters. Returns a pointer to just past
+ * the last character written. Does not null terminate.
+ */
+static char* gdrive_query_escape(char* dest, const char* str)
+{
+    static const char hexDigits[] = "0123456789ABCDEF";
+    for (const unsigned char* p = (const unsigned char*) str; *p; p++)
+    {
+        if (gdrive_query_is_unreserved(*p))
+        {
+            *dest++ = *p;
+        }
+        else
+        {
+            *dest++ = '%';
+            *dest++ = hexDigits[*p >> 4];
+            *dest++ = hexDigits[*p & 0x0F];
+        }
+    }
+    return dest;
 }
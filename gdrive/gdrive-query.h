@@ -19,6 +19,8 @@ extern "C" {
 #endif
     
     
+#include <stddef.h>
+    
 typedef struct Gdrive_Query Gdrive_Query;
 
 
@@ -93,15 +95,37 @@ Gdrive_Query* gdrive_query_add(Gdrive_Query* pQuery, const char* field,
  *      If ONLY pQuery is NULL, returns an exact copy of url.
  *      If ONLY url is NULL, returns the assembled query/post string. This is
  *      usable as HTTP POST data.
- *      NOTE 1: A NULL string or query is not the same as an empty string ("")
- *      or an empty query (a Gdrive_pQuery* that has been created but has not
- *      had any field/value pairs added). A NULL argument suppresses the 
- *      separating '?' character, whereas an empty argument does not.
+ *      NOTE 1: A NULL url is not the same as an empty string (""). A NULL url
+ *      suppresses the separating '?' character, whereas an empty one does not.
  *      NOTE 2: The caller is responsible for freeing the memory pointed to by
  *      the return value.
  */
 char* gdrive_query_assemble(const Gdrive_Query* pQuery, const char* url);
 
+/*
+ * gdrive_query_assemble_into():    Like gdrive_query_assemble(), but puts the
+ *                                  result into a buffer that the caller keeps
+ *                                  and reuses, instead of allocating a new
+ *                                  string each time.
+ * Parameters:
+ *      pQuery (const Gdrive_Query*):
+ *              As for gdrive_query_assemble().
+ *      url (const char*):
+ *              As for gdrive_query_assemble().
+ *      pBuffer (char**):
+ *              Points to the buffer, which is made larger with realloc() if
+ *              needed. *pBuffer can be NULL to start with. The caller is 
+ *              responsible for freeing it, even on failure.
+ *      pSize (size_t*):
+ *              Points to the size of *pBuffer, which is updated if the buffer 
+ *              grows. Must point to 0 if *pBuffer is NULL.
+ * Return value (int):
+ *      0 on success, other on failure (if both pQuery and url are NULL, or on
+ *      memory error).
+ */
+int gdrive_query_assemble_into(const Gdrive_Query* pQuery, const char* url, 
+                               char** pBuffer, size_t* pSize);
+
 
 #ifdef	__cplusplus
 }
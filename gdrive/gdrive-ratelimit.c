@@ -0,0 +1,210 @@
+
+
+#include "gdrive-ratelimit.h"
+
+#include <time.h>
+
+
+/*************************************************************************
+ * Constants needed only internally within this file
+ *************************************************************************/
+
+// Slow down at most once per this many seconds, so that one burst of rate
+// limit errors (from requests that were already on their way) only counts 
+// once.
+#define GDRIVE_RATE_DECREASE_GAP 1.0
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+enum Gdrive_Rate_Bucket_Type
+{
+    GDRIVE_BUCKET_METADATA,
+    GDRIVE_BUCKET_MEDIA,
+    GDRIVE_BUCKET_COUNT
+};
+
+typedef struct Gdrive_Rate_Bucket
+{
+    const char* name;
+    double maxRate;
+    // rate: Requests per second. Also the most tokens the bucket holds (but
+    // at least 1), so up to a second's worth of requests can go out back to
+    // back.
+    double rate;
+    double tokens;
+    // lastRefill: When tokens was last brought up to date, in seconds on the
+    // monotonic clock
+    double lastRefill;
+    double lastDecrease;
+    // Totals for the report
+    unsigned long nRequests;
+    unsigned long nWaits;
+    double secondsWaited;
+    unsigned long nRateLimited;
+} Gdrive_Rate_Bucket;
+
+static Gdrive_Rate_Bucket* 
+gdrive_rate_get_bucket(enum Gdrive_Request_Class requestClass);
+
+static double gdrive_rate_now(void);
+
+static void gdrive_rate_refill(Gdrive_Rate_Bucket* pBucket, double now);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Other accessible functions
+ ******************/
+
+void gdrive_rate_acquire(enum Gdrive_Request_Class requestClass, int cost)
+{
+    Gdrive_Rate_Bucket* pBucket = gdrive_rate_get_bucket(requestClass);
+    gdrive_rate_refill(pBucket, gdrive_rate_now());
+    pBucket->nRequests++;
+    
+    // The bucket can go into debt for a batch that costs more than it holds,
+    // which makes the requests after it wait their turn.
+    if (pBucket->tokens < 1.0)
+    {
+        double waitSeconds = (1.0 - pBucket->tokens) / pBucket->rate;
+        struct timespec waitTime;
+        waitTime.tv_sec = (time_t) waitSeconds;
+        waitTime.tv_nsec = (long) ((waitSeconds - waitTime.tv_sec) * 1e9);
+        nanosleep(&waitTime, NULL);
+        pBucket->nWaits++;
+        pBucket->secondsWaited += waitSeconds;
+        gdrive_rate_refill(pBucket, gdrive_rate_now());
+    }
+    pBucket->tokens -= cost;
+}
+
+bool gdrive_rate_try_acquire(enum Gdrive_Request_Class requestClass)
+{
+    Gdrive_Rate_Bucket* pBucket = gdrive_rate_get_bucket(requestClass);
+    gdrive_rate_refill(pBucket, gdrive_rate_now());
+    if (pBucket->tokens < 1.0)
+    {
+        // Would have to wait
+        return false;
+    }
+    pBucket->nRequests++;
+    pBucket->tokens -= 1.0;
+    return true;
+}
+
+void gdrive_rate_report(enum Gdrive_Request_Class requestClass, 
+                        bool rateLimited)
+{
+    Gdrive_Rate_Bucket* pBucket = gdrive_rate_get_bucket(requestClass);
+    if (!rateLimited)
+    {
+        // Additive increase, about one request per second for each second's 
+        // worth of clean responses
+        pBucket->rate += 1.0 / pBucket->rate;
+        if (pBucket->rate > pBucket->maxRate)
+        {
+            pBucket->rate = pBucket->maxRate;
+        }
+        return;
+    }
+    
+    pBucket->nRateLimited++;
+    double now = gdrive_rate_now();
+    if (now - pBucket->lastDecrease < GDRIVE_RATE_DECREASE_GAP)
+    {
+        // Already slowed down for this burst
+        return;
+    }
+    
+    // Multiplicative decrease, and no more bursts until the bucket refills.
+    pBucket->lastDecrease = now;
+    pBucket->rate /= 2;
+    if (pBucket->rate < GDRIVE_RATE_MIN)
+    {
+        pBucket->rate = GDRIVE_RATE_MIN;
+    }
+    gdrive_rate_refill(pBucket, now);
+    if (pBucket->tokens > 0)
+    {
+        pBucket->tokens = 0;
+    }
+}
+
+void gdrive_rate_print_stats(FILE* stream)
+{
+    for (int i = 0; i < GDRIVE_CLASS_COUNT; i++)
+    {
+        Gdrive_Rate_Bucket* pBucket = gdrive_rate_get_bucket(i);
+        if (i == GDRIVE_CLASS_UPLOAD)
+        {
+            // Shares the content bucket
+            continue;
+        }
+        fprintf(stream, "  %s requests: %lu, now paced at %.1f/s, waited "
+                "%lu times (%.1f s), rate limited %lu times\n", pBucket->name, 
+                pBucket->nRequests, pBucket->rate, pBucket->nWaits, 
+                pBucket->secondsWaited, pBucket->nRateLimited);
+    }
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static Gdrive_Rate_Bucket* 
+gdrive_rate_get_bucket(enum Gdrive_Request_Class requestClass)
+{
+    static Gdrive_Rate_Bucket buckets[GDRIVE_BUCKET_COUNT] = 
+    {
+        [GDRIVE_BUCKET_METADATA] = 
+        {
+            .name = "metadata",
+            .maxRate = GDRIVE_RATE_MAX_METADATA,
+            .rate = GDRIVE_RATE_INITIAL,
+            .tokens = GDRIVE_RATE_INITIAL,
+            .lastRefill = -1
+        },
+        [GDRIVE_BUCKET_MEDIA] = 
+        {
+            .name = "content",
+            .maxRate = GDRIVE_RATE_MAX_MEDIA,
+            .rate = GDRIVE_RATE_INITIAL,
+            .tokens = GDRIVE_RATE_INITIAL,
+            .lastRefill = -1
+        }
+    };
+    return &buckets[(requestClass == GDRIVE_CLASS_METADATA) ? 
+        GDRIVE_BUCKET_METADATA : GDRIVE_BUCKET_MEDIA];
+}
+
+static double gdrive_rate_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Adds the tokens earned since the last refill, up to the bucket's size.
+ */
+static void gdrive_rate_refill(Gdrive_Rate_Bucket* pBucket, double now)
+{
+    if (pBucket->lastRefill >= 0)
+    {
+        pBucket->tokens += (now - pBucket->lastRefill) * pBucket->rate;
+    }
+    double size = (pBucket->rate > 1.0) ? pBucket->rate : 1.0;
+    if (pBucket->tokens > size)
+    {
+        pBucket->tokens = size;
+    }
+    pBucket->lastRefill = now;
+}
@@ -0,0 +1,101 @@
+/*
+ * File:   gdrive-ratelimit.h
+ * Author: me
+ *
+ * Client-side rate limiting, to stay just under Google Drive's request quotas
+ * instead of going over them and backing off. Requests are paced by a token
+ * bucket, with one bucket for metadata requests and another for file contents
+ * (downloads and uploads), which have separate quotas. Each bucket adjusts 
+ * its rate as it goes (AIMD): the rate is halved when Google Drive says a
+ * rate limit was exceeded (a 403 with a rate limit reason, or a 429), and 
+ * creeps back up by about one request per second for every second's worth of
+ * responses that come back without one.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_RATELIMIT_H
+#define	GDRIVE_RATELIMIT_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "gdrive.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+
+// Requests per second to start at, and the limits of the adjustments
+#define GDRIVE_RATE_INITIAL 20.0
+#define GDRIVE_RATE_MIN 0.5
+#define GDRIVE_RATE_MAX_METADATA 200.0
+#define GDRIVE_RATE_MAX_MEDIA 100.0
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_rate_acquire():   Waits, if needed, until a request can be sent
+ *                          without going over the current rate. Should be 
+ *                          called right before each request is sent, 
+ *                          including retries.
+ * Parameters:
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request, which decides the bucket. Content and 
+ *              upload requests share one.
+ *      cost (int):
+ *              How many requests this counts as against the quota, which is
+ *              more than 1 for a batch request.
+ */
+void gdrive_rate_acquire(enum Gdrive_Request_Class requestClass, int cost);
+
+/*
+ * gdrive_rate_try_acquire():   Like gdrive_rate_acquire(), but for requests
+ *                              that are only worth sending right away, such 
+ *                              as a second copy of a slow request (see 
+ *                              gdrive-hedge.h).
+ * Parameters:
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request, which decides the bucket.
+ * Return value (bool):
+ *      True if the request can be sent now (and has been counted), false if
+ *      it would have to wait.
+ */
+bool gdrive_rate_try_acquire(enum Gdrive_Request_Class requestClass);
+
+/*
+ * gdrive_rate_report():    Adjusts the rate after a response arrives.
+ * Parameters:
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request, as given to gdrive_rate_acquire().
+ *      rateLimited (bool):
+ *              True if Google Drive said a rate limit was exceeded, false for
+ *              any other response.
+ */
+void gdrive_rate_report(enum Gdrive_Request_Class requestClass, 
+                        bool rateLimited);
+
+/*
+ * gdrive_rate_print_stats():   Prints the current rate of each bucket, how 
+ *                              often requests had to wait, and how often 
+ *                              rate limits were hit.
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_rate_print_stats(FILE* stream);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_RATELIMIT_H */
+
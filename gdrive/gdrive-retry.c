@@ -0,0 +1,134 @@
+
+
+#include "gdrive-retry.h"
+
+#include <stdlib.h>
+
+
+/*************************************************************************
+ * Private struct and declarations of private functions for use within
+ * this file
+ *************************************************************************/
+
+static long gdrive_retry_budget_left(const Gdrive_Retry* pRetry);
+
+
+/*************************************************************************
+ * Implementations of public functions for internal or external use
+ *************************************************************************/
+
+/******************
+ * Constructors, factory methods, destructors and similar
+ ******************/
+
+void gdrive_retry_init(Gdrive_Retry* pRetry, 
+                       enum Gdrive_Request_Class requestClass)
+{
+    pRetry->requestClass = requestClass;
+    pRetry->attempts = 1;
+    pRetry->waitedMs = 0;
+    pRetry->lastWaitMs = GDRIVE_RETRY_BASE_MS;
+}
+
+
+/******************
+ * Other accessible functions
+ ******************/
+
+long gdrive_retry_next_wait(Gdrive_Retry* pRetry, long retryAfterMs)
+{
+    if (pRetry->attempts >= GDRIVE_RETRY_LIMIT)
+    {
+        // Out of attempts
+        return -1;
+    }
+    
+    long budgetLeft = gdrive_retry_budget_left(pRetry);
+    long waitMs;
+    if (retryAfterMs >= 0)
+    {
+        // The server knows best. If it wants longer than the budget allows, 
+        // retrying sooner would only fail again.
+        if (retryAfterMs > budgetLeft)
+        {
+            return -1;
+        }
+        waitMs = retryAfterMs;
+    }
+    else
+    {
+        // Decorrelated jitter: anywhere from the base to three times the last
+        // wait, capped.
+        long upper = 3 * pRetry->lastWaitMs;
+        upper = (upper < GDRIVE_RETRY_CAP_MS) ? upper : GDRIVE_RETRY_CAP_MS;
+        waitMs = GDRIVE_RETRY_BASE_MS + 
+                rand() % (upper - GDRIVE_RETRY_BASE_MS + 1);
+        if (waitMs > budgetLeft)
+        {
+            // Use whatever is left, as long as that's still a real wait.
+            if (budgetLeft < GDRIVE_RETRY_BASE_MS)
+            {
+                return -1;
+            }
+            waitMs = budgetLeft;
+        }
+        pRetry->lastWaitMs = waitMs;
+    }
+    
+    pRetry->attempts++;
+    pRetry->waitedMs += waitMs;
+    return waitMs;
+}
+
+bool gdrive_retry_again_now(Gdrive_Retry* pRetry)
+{
+    if (pRetry->attempts >= GDRIVE_RETRY_LIMIT)
+    {
+        // Out of attempts
+        return false;
+    }
+    pRetry->attempts++;
+    return true;
+}
+
+void gdrive_retry_sleep(long waitMs)
+{
+    struct timespec waitTime;
+    waitTime.tv_sec = waitMs / 1000;
+    waitTime.tv_nsec = (waitMs % 1000) * 1000000L;
+    nanosleep(&waitTime, NULL);
+}
+
+void gdrive_retry_set_due(struct timespec* pDue, long waitMs)
+{
+    clock_gettime(CLOCK_MONOTONIC, pDue);
+    pDue->tv_sec += waitMs / 1000;
+    pDue->tv_nsec += (waitMs % 1000) * 1000000L;
+    if (pDue->tv_nsec >= 1000000000L)
+    {
+        pDue->tv_sec++;
+        pDue->tv_nsec -= 1000000000L;
+    }
+}
+
+bool gdrive_retry_is_due(const struct timespec* pDue)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec > pDue->tv_sec) || 
+            (now.tv_sec == pDue->tv_sec && now.tv_nsec >= pDue->tv_nsec);
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+/*
+ * Returns how many milliseconds of waiting the request's budget still allows.
+ */
+static long gdrive_retry_budget_left(const Gdrive_Retry* pRetry)
+{
+    long budgetMs = (long) gdrive_get_retrybudget(pRetry->requestClass) * 1000;
+    return (budgetMs > pRetry->waitedMs) ? budgetMs - pRetry->waitedMs : 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * File:   gdrive-retry.h
+ * Author: me
+ *
+ * Decides when, and whether, a failed request gets another try. Waits grow 
+ * with "decorrelated jitter": each one is picked at random between 
+ * GDRIVE_RETRY_BASE_MS and three times the one before, up to 
+ * GDRIVE_RETRY_CAP_MS, so that many clients backing off at once spread out 
+ * instead of retrying in step. A Retry-After header from the server is used 
+ * as-is instead. All the waits for one request come out of the retry budget 
+ * for its class (see gdrive_set_retrybudget()), and a request gives up once
+ * the next wait doesn't fit in what is left, or after GDRIVE_RETRY_LIMIT 
+ * attempts.
+ *
+ * Requests sent with gdrive_xfer_execute() still wait in place, since the
+ * caller needs the answer before it can go on. Background requests started 
+ * with gdrive_xfer_start() are set aside until their retry time instead, and
+ * everything else carries on in the meantime.
+ *
+ * This header is used internally by Gdrive code and should not be included
+ * outside of Gdrive code.
+ *
+ * Created on October 18, 2026
+ */
+
+#ifndef GDRIVE_RETRY_H
+#define	GDRIVE_RETRY_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "gdrive.h"
+
+#include <stdbool.h>
+#include <time.h>
+
+
+#define GDRIVE_RETRY_LIMIT 5
+#define GDRIVE_RETRY_BASE_MS 1000
+#define GDRIVE_RETRY_CAP_MS 32000
+
+typedef struct Gdrive_Retry
+{
+    enum Gdrive_Request_Class requestClass;
+    // attempts: How many times the request has been sent
+    int attempts;
+    // waitedMs: Total of the waits so far, counted against the budget
+    long waitedMs;
+    // lastWaitMs: The last wait, which the next one grows from
+    long lastWaitMs;
+} Gdrive_Retry;
+
+
+/*************************************************************************
+ * Constructors, factory methods, destructors and similar
+ *************************************************************************/
+
+/*
+ * gdrive_retry_init(): Gets a Gdrive_Retry ready for a new request, which is
+ *                      about to be sent for the first time.
+ * Parameters:
+ *      pRetry (Gdrive_Retry*):
+ *              The struct to fill in, normally kept on the stack or alongside
+ *              the request.
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request, which decides its retry budget.
+ */
+void gdrive_retry_init(Gdrive_Retry* pRetry, 
+                       enum Gdrive_Request_Class requestClass);
+
+
+/*************************************************************************
+ * Other accessible functions
+ *************************************************************************/
+
+/*
+ * gdrive_retry_next_wait():    Works out how long to wait before sending a 
+ *                              failed request again, and counts the wait 
+ *                              against the request's budget.
+ * Parameters:
+ *      pRetry (Gdrive_Retry*):
+ *              The request's retry state.
+ *      retryAfterMs (long):
+ *              How long the server asked to wait (from a Retry-After header), 
+ *              or a negative number if it didn't say.
+ * Return value (long):
+ *      The number of milliseconds to wait, or -1 if the request should give
+ *      up instead.
+ */
+long gdrive_retry_next_wait(Gdrive_Retry* pRetry, long retryAfterMs);
+
+/*
+ * gdrive_retry_again_now():    Counts an attempt that is retried right away
+ *                              without waiting, such as after refreshing an
+ *                              expired access token.
+ * Parameters:
+ *      pRetry (Gdrive_Retry*):
+ *              The request's retry state.
+ * Return value (bool):
+ *      True if the request can be sent again, false if it has used all of its
+ *      attempts.
+ */
+bool gdrive_retry_again_now(Gdrive_Retry* pRetry);
+
+/*
+ * gdrive_retry_sleep():    Waits, blocking the calling thread.
+ * Parameters:
+ *      waitMs (long):
+ *              How long to wait, in milliseconds.
+ */
+void gdrive_retry_sleep(long waitMs);
+
+/*
+ * gdrive_retry_set_due():  Works out when a request that was set aside should
+ *                          be sent again.
+ * Parameters:
+ *      pDue (struct timespec*):
+ *              Set to the time (on the monotonic clock) that is waitMs from
+ *              now.
+ *      waitMs (long):
+ *              How long to wait, in milliseconds.
+ */
+void gdrive_retry_set_due(struct timespec* pDue, long waitMs);
+
+/*
+ * gdrive_retry_is_due():   Checks whether a time set with 
+ *                          gdrive_retry_set_due() has arrived.
+ * Parameters:
+ *      pDue (const struct timespec*):
+ *              The time set by gdrive_retry_set_due().
+ * Return value (bool):
+ *      True if the time has come, otherwise false.
+ */
+bool gdrive_retry_is_due(const struct timespec* pDue);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GDRIVE_RETRY_H */
+
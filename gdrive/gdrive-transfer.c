@@ -4,11 +4,22 @@
 #include "gdrive-transfer.h"
 #include "gdrive-query.h"
 #include "gdrive-info.h"
+#include "gdrive-negcache.h"
+#include "gdrive-retry.h"
+#include "gdrive-ratelimit.h"
+#include "gdrive-breaker.h"
 
 #include <string.h>
+#include <strings.h>
+#include <stdio.h>
 
 
-#define GDRIVE_RETRY_LIMIT 5
+
+// Separates the parts of a batch request body. Google Drive picks its own
+// boundary for the response.
+#define GDRIVE_BATCH_BOUNDARY "fuse_drive_7d41c2e98a05b36f_batch"
+
+#define GDRIVE_XFER_AUTH_PREFIX "Authorization: Bearer "
 
 
 /*************************************************************************
@@ -25,13 +36,60 @@ typedef struct Gdrive_Transfer
     Gdrive_Query* pQuery;
     Gdrive_Query* pPostData;
     const char* body;
+    char* ownedBody;
     struct curl_slist* pHeaders;
     FILE* destFile;
+    Gdrive_Json_Stream* pStream;
     gdrive_xfer_upload_callback uploadCallback;
     void* userdata;
     off_t uploadOffset;
+    // cost: How many requests this counts as against the quota
+    int cost;
 } Gdrive_Transfer;
 
+typedef struct Gdrive_Xfer_Batch
+{
+    int nItems;
+    int maxItems;
+    // Parallel arrays, one entry per transfer added.
+    Gdrive_Transfer** pTransfers;
+    Gdrive_Download_Buffer** pResponses;
+} Gdrive_Xfer_Batch;
+
+typedef struct Gdrive_Xfer_Async
+{
+    CURLM* multiHandle;
+    CURL* curlHandle;
+    Gdrive_Download_Buffer* pBuf;
+    // pHeaders: Taken from the transfer, since curl uses them until the 
+    // transfer is done
+    struct curl_slist* pHeaders;
+    Gdrive_Retry retry;
+    // parked: Waiting until due to be sent again, after an error that is 
+    // worth retrying
+    bool parked;
+    struct timespec due;
+    // done: True once the transfer has finished, successfully or not
+    bool done;
+} Gdrive_Xfer_Async;
+
+// Memory that is reused from one request to the next instead of being 
+// allocated for each one. FUSE calls are handled one at a time, so one set is
+// enough.
+typedef struct Gdrive_Xfer_Buffers
+{
+    char* url;
+    size_t urlSize;
+    char* postData;
+    size_t postDataSize;
+    // authHeader: "Authorization: Bearer <token>", rebuilt only when the 
+    // access token changes
+    char* authHeader;
+    size_t authHeaderSize;
+} Gdrive_Xfer_Buffers;
+
+static Gdrive_Xfer_Buffers* gdrive_xfer_get_buffers(void);
+
 
 /*
  * Returns 0 on success, other on failure.
@@ -46,6 +104,37 @@ static size_t gdrive_xfer_upload_callback_internal(char* buffer, size_t size,
 static struct curl_slist* 
 gdrive_get_authbearer_header(struct curl_slist* pHeaders);
 
+static int gdrive_xfer_update_authheader(Gdrive_Transfer* pTransfer);
+
+static CURL* gdrive_xfer_prepare(Gdrive_Transfer* pTransfer);
+
+static enum Gdrive_Request_Class 
+gdrive_xfer_get_class(const Gdrive_Transfer* pTransfer);
+
+static void gdrive_xfer_async_free(Gdrive_Xfer_Async* pAsync);
+
+static int gdrive_xfer_batch_send(Gdrive_Xfer_Batch* pBatch, int first, 
+                                  int count);
+
+static int gdrive_xfer_batch_add_part(char** pBody, size_t* pLength, 
+                                      const Gdrive_Transfer* pTransfer, 
+                                      int index);
+
+static void gdrive_xfer_batch_read_response(Gdrive_Xfer_Batch* pBatch, 
+                                            int first, int count, 
+                                            Gdrive_Download_Buffer* pBuf);
+
+static bool gdrive_xfer_batch_should_resend(Gdrive_Download_Buffer* pBuf);
+
+static int gdrive_xfer_append(char** pDest, size_t* pLength, 
+                              const char* src, size_t srcLength);
+
+static const char* gdrive_xfer_find(const char* start, const char* end, 
+                                    const char* needle);
+
+static const char* gdrive_xfer_skip_headers(const char* start, 
+                                            const char* end);
+
 
 /*************************************************************************
  * Implementations of public functions for internal or external use
@@ -62,6 +151,7 @@ Gdrive_Transfer* gdrive_xfer_create()
     {
         memset(returnVal, 0, sizeof(Gdrive_Transfer));
         returnVal->retryOnAuthError = true;
+        returnVal->cost = 1;
         returnVal->pHeaders = gdrive_get_authbearer_header(NULL);
     }
     
@@ -84,6 +174,8 @@ void gdrive_xfer_free(Gdrive_Transfer* pTransfer)
     pTransfer->pQuery = NULL;
     gdrive_query_free(pTransfer->pPostData);
     pTransfer->pPostData = NULL;
+    free(pTransfer->ownedBody);
+    pTransfer->ownedBody = NULL;
     if (pTransfer->pHeaders != NULL)
     {
         curl_slist_free_all(pTransfer->pHeaders);
@@ -94,6 +186,43 @@ void gdrive_xfer_free(Gdrive_Transfer* pTransfer)
     free(pTransfer);
 }
 
+Gdrive_Xfer_Batch* gdrive_xfer_batch_create(void)
+{
+    Gdrive_Xfer_Batch* pBatch = malloc(sizeof(Gdrive_Xfer_Batch));
+    if (pBatch != NULL)
+    {
+        memset(pBatch, 0, sizeof(Gdrive_Xfer_Batch));
+    }
+    return pBatch;
+}
+
+void gdrive_xfer_cleanup(void)
+{
+    Gdrive_Xfer_Buffers* pBuffers = gdrive_xfer_get_buffers();
+    free(pBuffers->url);
+    free(pBuffers->postData);
+    free(pBuffers->authHeader);
+    memset(pBuffers, 0, sizeof(Gdrive_Xfer_Buffers));
+}
+
+void gdrive_xfer_batch_free(Gdrive_Xfer_Batch* pBatch)
+{
+    if (pBatch == NULL)
+    {
+        // Nothing to do
+        return;
+    }
+    
+    for (int i = 0; i < pBatch->nItems; i++)
+    {
+        gdrive_xfer_free(pBatch->pTransfers[i]);
+        gdrive_dlbuf_free(pBatch->pResponses[i]);
+    }
+    free(pBatch->pTransfers);
+    free(pBatch->pResponses);
+    free(pBatch);
+}
+
 
 /******************
  * Getter and setter functions
@@ -112,14 +241,41 @@ void gdrive_xfer_set_retryonautherror(Gdrive_Transfer* pTransfer, bool retry)
 
 int gdrive_xfer_set_url(Gdrive_Transfer* pTransfer, const char* url)
 {
-    size_t size = strlen(url) + 1;
-    pTransfer->url = malloc(size);
-    if (pTransfer->url == NULL)
+    return gdrive_xfer_set_file_url(pTransfer, url, NULL, NULL);
+}
+
+int gdrive_xfer_set_file_url(Gdrive_Transfer* pTransfer, const char* baseUrl, 
+                             const char* fileId, const char* suffix)
+{
+    // Work out the length first, so the URL can be built in one allocation.
+    size_t baseLength = strlen(baseUrl);
+    size_t idLength = (fileId != NULL) ? strlen(fileId) : 0;
+    size_t suffixLength = (suffix != NULL) ? strlen(suffix) : 0;
+    char* url = malloc(baseLength + 1 + idLength + suffixLength + 1);
+    if (url == NULL)
     {
         // Memory error
         return -1;
     }
-    memcpy(pTransfer->url, url, size);
+    
+    char* end = url;
+    memcpy(end, baseUrl, baseLength);
+    end += baseLength;
+    if (fileId != NULL)
+    {
+        *end++ = '/';
+        memcpy(end, fileId, idLength);
+        end += idLength;
+    }
+    if (suffix != NULL)
+    {
+        memcpy(end, suffix, suffixLength);
+        end += suffixLength;
+    }
+    *end = '\0';
+    
+    free(pTransfer->url);
+    pTransfer->url = url;
     return 0;
 }
 
@@ -128,11 +284,33 @@ void gdrive_xfer_set_destfile(Gdrive_Transfer* pTransfer, FILE* destFile)
     pTransfer->destFile = destFile;
 }
 
+void gdrive_xfer_set_jstream(Gdrive_Transfer* pTransfer, 
+                             Gdrive_Json_Stream* pStream)
+{
+    pTransfer->pStream = pStream;
+}
+
 void gdrive_xfer_set_body(Gdrive_Transfer* pTransfer, const char* body)
 {
     pTransfer->body = body;
 }
 
+int gdrive_xfer_copy_body(Gdrive_Transfer* pTransfer, const char* body)
+{
+    size_t size = strlen(body) + 1;
+    char* bodyCopy = malloc(size);
+    if (bodyCopy == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    memcpy(bodyCopy, body, size);
+    free(pTransfer->ownedBody);
+    pTransfer->ownedBody = bodyCopy;
+    pTransfer->body = bodyCopy;
+    return 0;
+}
+
 void gdrive_xfer_set_uploadcallback(Gdrive_Transfer* pTransfer, 
                                     gdrive_xfer_upload_callback callback, 
                                     void* userdata)
@@ -167,6 +345,359 @@ int gdrive_xfer_add_header(Gdrive_Transfer* pTransfer, const char* header)
 }
 
 Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
+{
+    CURL* curlHandle = gdrive_xfer_prepare(pTransfer);
+    if (curlHandle == NULL)
+    {
+        // Invalid transfer or memory error
+        return NULL;
+    }
+    
+    Gdrive_Download_Buffer* pBuf;
+    pBuf = gdrive_dlbuf_create((pTransfer->destFile == NULL) ? 512 : 0, 
+                               pTransfer->destFile
+            );
+    if (pBuf == NULL)
+    {
+        // Memory error.
+        curl_easy_cleanup(curlHandle);
+        return NULL;
+    }
+    gdrive_dlbuf_set_jstream(pBuf, pTransfer->pStream);
+    
+    // Requests that only read can safely be sent twice if the first one is
+    // slow to answer.
+    enum Gdrive_Request_Class requestClass = gdrive_xfer_get_class(pTransfer);
+    gdrive_dlbuf_set_hedge(pBuf, gdrive_get_hedging() && 
+            pTransfer->requestType == GDRIVE_REQUEST_GET && 
+            requestClass != GDRIVE_CLASS_UPLOAD);
+    
+    gdrive_dlbuf_download_with_retry(pBuf, curlHandle, 
+                                     pTransfer->retryOnAuthError, 
+                                     requestClass, pTransfer->cost
+            );
+    curl_easy_cleanup(curlHandle);
+    
+    if (!gdrive_dlbuf_get_success(pBuf))
+    {
+        // Download failure
+        gdrive_dlbuf_free(pBuf);
+        return NULL;
+    }
+    
+    // The HTTP Response may be success (e.g., 200) or failure (400 or higher),
+    // but the actual request succeeded as far as libcurl is concerned.  Return
+    // the buffer.
+    return pBuf;
+}
+
+int gdrive_xfer_batch_add(Gdrive_Xfer_Batch* pBatch, 
+                          Gdrive_Transfer* pTransfer)
+{
+    if (pTransfer == NULL)
+    {
+        // Probably a memory error while building the transfer
+        return -1;
+    }
+    if (pTransfer->url == NULL || pTransfer->destFile != NULL || 
+            pTransfer->pStream != NULL || pTransfer->uploadCallback != NULL)
+    {
+        // Can't be sent as part of a batch
+        gdrive_xfer_free(pTransfer);
+        return -1;
+    }
+    
+    // Make room if needed
+    if (pBatch->nItems == pBatch->maxItems)
+    {
+        int newMax = (pBatch->maxItems > 0) ? 2 * pBatch->maxItems : 16;
+        Gdrive_Transfer** pNewTransfers = 
+                realloc(pBatch->pTransfers, newMax * sizeof(Gdrive_Transfer*));
+        if (pNewTransfers == NULL)
+        {
+            // Memory error
+            gdrive_xfer_free(pTransfer);
+            return -1;
+        }
+        pBatch->pTransfers = pNewTransfers;
+        Gdrive_Download_Buffer** pNewResponses = 
+                realloc(pBatch->pResponses, 
+                        newMax * sizeof(Gdrive_Download_Buffer*));
+        if (pNewResponses == NULL)
+        {
+            // Memory error
+            gdrive_xfer_free(pTransfer);
+            return -1;
+        }
+        pBatch->pResponses = pNewResponses;
+        pBatch->maxItems = newMax;
+    }
+    
+    pBatch->pTransfers[pBatch->nItems] = pTransfer;
+    pBatch->pResponses[pBatch->nItems] = NULL;
+    return pBatch->nItems++;
+}
+
+int gdrive_xfer_batch_execute(Gdrive_Xfer_Batch* pBatch)
+{
+    int nRequests = 0;
+    
+    // A batch of one gains nothing over sending the transfer by itself.
+    if (pBatch->nItems > 1)
+    {
+        for (int first = 0; first < pBatch->nItems; 
+                first += GDRIVE_XFER_BATCH_MAX)
+        {
+            int count = pBatch->nItems - first;
+            count = (count < GDRIVE_XFER_BATCH_MAX) ? 
+                count : GDRIVE_XFER_BATCH_MAX;
+            if (gdrive_xfer_batch_send(pBatch, first, count) == 0)
+            {
+                nRequests++;
+            }
+        }
+    }
+    
+    // Anything that didn't get a usable answer gets sent separately, with the
+    // normal retry handling.
+    for (int i = 0; i < pBatch->nItems; i++)
+    {
+        if (gdrive_xfer_batch_should_resend(pBatch->pResponses[i]))
+        {
+            gdrive_dlbuf_free(pBatch->pResponses[i]);
+            pBatch->pResponses[i] = gdrive_xfer_execute(pBatch->pTransfers[i]);
+        }
+    }
+    
+    return nRequests;
+}
+
+Gdrive_Download_Buffer* 
+gdrive_xfer_batch_get_response(Gdrive_Xfer_Batch* pBatch, int index)
+{
+    if (index < 0 || index >= pBatch->nItems)
+    {
+        // Invalid index
+        return NULL;
+    }
+    return pBatch->pResponses[index];
+}
+
+int gdrive_xfer_renew_auth(CURL* curlHandle)
+{
+    char* pPrivate = NULL;
+    curl_easy_getinfo(curlHandle, CURLINFO_PRIVATE, &pPrivate);
+    if (pPrivate == NULL)
+    {
+        // Not prepared from a transfer, so there's nothing to update.
+        return 0;
+    }
+    
+    Gdrive_Transfer* pTransfer = (Gdrive_Transfer*) pPrivate;
+    if (gdrive_xfer_update_authheader(pTransfer) != 0)
+    {
+        // Memory error
+        return -1;
+    }
+    curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, pTransfer->pHeaders);
+    return 0;
+}
+
+Gdrive_Xfer_Async* gdrive_xfer_start(Gdrive_Transfer* pTransfer)
+{
+    if (pTransfer->destFile != NULL || pTransfer->pStream != NULL || 
+            pTransfer->uploadCallback != NULL)
+    {
+        // Only small requests with in-memory responses are supported.
+        return NULL;
+    }
+    
+    Gdrive_Xfer_Async* pAsync = malloc(sizeof(Gdrive_Xfer_Async));
+    if (pAsync == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    memset(pAsync, 0, sizeof(Gdrive_Xfer_Async));
+    gdrive_retry_init(&pAsync->retry, gdrive_xfer_get_class(pTransfer));
+    pAsync->curlHandle = gdrive_xfer_prepare(pTransfer);
+    pAsync->pHeaders = pTransfer->pHeaders;
+    pTransfer->pHeaders = NULL;
+    if (pAsync->curlHandle != NULL)
+    {
+        // The transfer may be gone long before this finishes.
+        curl_easy_setopt(pAsync->curlHandle, CURLOPT_PRIVATE, NULL);
+    }
+    pAsync->pBuf = gdrive_dlbuf_create(512, NULL);
+    pAsync->multiHandle = curl_multi_init();
+    if (pAsync->curlHandle == NULL || pAsync->pBuf == NULL || 
+            pAsync->multiHandle == NULL)
+    {
+        // Memory or other error
+        gdrive_xfer_async_free(pAsync);
+        return NULL;
+    }
+    
+    if (!gdrive_breaker_allow())
+    {
+        // Google Drive has been failing, so don't wait on it.
+        gdrive_xfer_async_free(pAsync);
+        return NULL;
+    }
+    gdrive_rate_acquire(pAsync->retry.requestClass, 1);
+    gdrive_dlbuf_attach(pAsync->pBuf, pAsync->curlHandle);
+    if (curl_multi_add_handle(pAsync->multiHandle, pAsync->curlHandle) != 
+            CURLM_OK)
+    {
+        gdrive_xfer_async_free(pAsync);
+        return NULL;
+    }
+    
+    // Get the request going.
+    gdrive_xfer_poll(pAsync);
+    return pAsync;
+}
+
+bool gdrive_xfer_poll(Gdrive_Xfer_Async* pAsync)
+{
+    if (pAsync->done)
+    {
+        return true;
+    }
+    
+    if (pAsync->parked)
+    {
+        if (!gdrive_retry_is_due(&pAsync->due))
+        {
+            // Not time to try again yet
+            return false;
+        }
+        
+        // Send it again, unless Google Drive has been failing since.
+        if (!gdrive_breaker_allow())
+        {
+            gdrive_dlbuf_set_result(pAsync->pBuf, pAsync->curlHandle, 
+                                    CURLE_COULDNT_CONNECT);
+            pAsync->done = true;
+            return true;
+        }
+        gdrive_rate_acquire(pAsync->retry.requestClass, 1);
+        gdrive_dlbuf_attach(pAsync->pBuf, pAsync->curlHandle);
+        if (curl_multi_add_handle(pAsync->multiHandle, pAsync->curlHandle) 
+                != CURLM_OK)
+        {
+            gdrive_dlbuf_set_result(pAsync->pBuf, pAsync->curlHandle, 
+                                    CURLE_FAILED_INIT);
+            pAsync->done = true;
+            return true;
+        }
+        pAsync->parked = false;
+    }
+    
+    // Do whatever can be done without waiting.
+    int running = 0;
+    CURLMcode multiResult = curl_multi_perform(pAsync->multiHandle, &running);
+    if (multiResult == CURLM_OK && running > 0)
+    {
+        // Still going
+        return false;
+    }
+    
+    // Finished (or failed). Find out how it went.
+    CURLcode result = CURLE_RECV_ERROR;
+    CURLMsg* pMsg;
+    int nMsgs;
+    while ((pMsg = curl_multi_info_read(pAsync->multiHandle, &nMsgs)) != NULL)
+    {
+        if (pMsg->msg == CURLMSG_DONE)
+        {
+            result = pMsg->data.result;
+        }
+    }
+    gdrive_dlbuf_set_result(pAsync->pBuf, pAsync->curlHandle, result);
+    gdrive_breaker_report(gdrive_dlbuf_is_unavailable(pAsync->pBuf));
+    if (result == CURLE_OK)
+    {
+        gdrive_rate_report(pAsync->retry.requestClass, 
+                           gdrive_dlbuf_is_ratelimited(pAsync->pBuf));
+    }
+    
+    // Set the transfer aside if it's worth retrying and the budget allows.
+    if (gdrive_dlbuf_get_retrymethod(pAsync->pBuf) == GDRIVE_RETRY_RETRY)
+    {
+        long retryAfterMs = gdrive_dlbuf_get_retryafter(pAsync->pBuf);
+        long waitMs = gdrive_retry_next_wait(&pAsync->retry, retryAfterMs);
+        if (waitMs >= 0 && !gdrive_breaker_is_open() && 
+                curl_multi_remove_handle(pAsync->multiHandle, 
+                                         pAsync->curlHandle) == CURLM_OK)
+        {
+            gdrive_retry_set_due(&pAsync->due, waitMs);
+            pAsync->parked = true;
+            return false;
+        }
+    }
+    
+    pAsync->done = true;
+    return true;
+}
+
+Gdrive_Download_Buffer* gdrive_xfer_finish(Gdrive_Xfer_Async* pAsync)
+{
+    if (pAsync == NULL)
+    {
+        return NULL;
+    }
+    
+    Gdrive_Download_Buffer* pBuf = NULL;
+    if (pAsync->done && gdrive_dlbuf_get_success(pAsync->pBuf))
+    {
+        // Hand the buffer over to the caller.
+        pBuf = pAsync->pBuf;
+        pAsync->pBuf = NULL;
+    }
+    gdrive_xfer_async_free(pAsync);
+    return pBuf;
+}
+
+
+/*************************************************************************
+ * Implementations of private functions for use within this file
+ *************************************************************************/
+
+static int gdrive_xfer_add_query_or_post(Gdrive_Query** ppQuery, 
+                                         const char* field, const char* value)
+{
+    *ppQuery = gdrive_query_add(*ppQuery, field, value);
+    return (*ppQuery == NULL);
+}
+
+static size_t gdrive_xfer_upload_callback_internal(char* buffer, size_t size, 
+                                                   size_t nitems, 
+                                                   void* instream)
+{
+    // Get the transfer struct.
+    Gdrive_Transfer* pTransfer = (Gdrive_Transfer*) instream;
+    size_t bytesTransferred = 
+            pTransfer->uploadCallback(buffer, pTransfer->uploadOffset, 
+                                      size * nitems, pTransfer->userdata
+            );
+    if (bytesTransferred == (size_t)(-1))
+    {
+        // Upload error
+        return CURL_READFUNC_ABORT;
+    }
+    // else succeeded
+    
+    pTransfer->uploadOffset += bytesTransferred;
+    return bytesTransferred;
+}
+
+/*
+ * Creates a curl handle set up for the transfer (everything except where the
+ * response goes). Returns NULL on error. The caller is responsible for passing
+ * the handle to curl_easy_cleanup().
+ */
+static CURL* gdrive_xfer_prepare(Gdrive_Transfer* pTransfer)
 {
     if (pTransfer->url == NULL)
     {
@@ -174,7 +705,27 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
         return NULL;
     }
     
+    // Get a new access token first if the current one is about to expire, and
+    // make sure this request uses the newest one.
+    gdrive_auth_keep_fresh();
+    if (gdrive_xfer_update_authheader(pTransfer) != 0)
+    {
+        // Memory error
+        return NULL;
+    }
+    
     CURL* curlHandle = gdrive_get_curlhandle();
+    if (curlHandle == NULL)
+    {
+        // Memory error
+        return NULL;
+    }
+    
+    if (pTransfer->requestType != GDRIVE_REQUEST_GET)
+    {
+        // Anything that changes Google Drive can make earlier lookups wrong.
+        gdrive_negcache_clear();
+    }
     
     bool needsBody = false;
     
@@ -213,18 +764,16 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
     }
     
     // Append any query parameters to the URL, and add the full URL to the
-    // curl handle.
-    char* fullUrl = NULL;
-    fullUrl = gdrive_query_assemble(pTransfer->pQuery, pTransfer->url);
-    if (fullUrl == NULL)
+    // curl handle (which makes its own copy).
+    Gdrive_Xfer_Buffers* pBuffers = gdrive_xfer_get_buffers();
+    if (gdrive_query_assemble_into(pTransfer->pQuery, pTransfer->url, 
+                                   &pBuffers->url, &pBuffers->urlSize) != 0)
     {
         // Memory error or invalid URL
         curl_easy_cleanup(curlHandle);
         return NULL;
     }
-    curl_easy_setopt(curlHandle, CURLOPT_URL, fullUrl);
-    free(fullUrl);
-    fullUrl = NULL;
+    curl_easy_setopt(curlHandle, CURLOPT_URL, pBuffers->url);
     
     // Set simple POST fields, if applicable
     if (needsBody && pTransfer->body == NULL && pTransfer->pPostData == NULL && 
@@ -243,16 +792,17 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
     }
     else if (pTransfer->pPostData != NULL)
     {
-        char* postData = gdrive_query_assemble(pTransfer->pPostData, NULL);
-        if (postData == NULL)
+        if (gdrive_query_assemble_into(pTransfer->pPostData, NULL, 
+                                       &pBuffers->postData, 
+                                       &pBuffers->postDataSize) != 0)
         {
             // Memory error or invalid query
             curl_easy_cleanup(curlHandle);
             return NULL;
         }
         curl_easy_setopt(curlHandle, CURLOPT_POSTFIELDSIZE, -1L);
-        curl_easy_setopt(curlHandle, CURLOPT_COPYPOSTFIELDS, postData);
-        free(postData);
+        curl_easy_setopt(curlHandle, CURLOPT_COPYPOSTFIELDS, 
+                         pBuffers->postData);
     }
     
     // Set upload data callback, if applicable
@@ -268,101 +818,490 @@ Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer)
     
 
     
-    // Set headers
+    // Set headers, and remember where they came from in case they need to be
+    // changed before the request is sent again (see gdrive_xfer_renew_auth()).
     curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, pTransfer->pHeaders);
+    curl_easy_setopt(curlHandle, CURLOPT_PRIVATE, pTransfer);
     
+    // Give up on an attempt that takes longer than its class allows.
+    time_t deadline = gdrive_get_deadline(gdrive_xfer_get_class(pTransfer));
+    if (deadline > 0)
+    {
+        curl_easy_setopt(curlHandle, CURLOPT_TIMEOUT, (long) deadline);
+    }
     
-    Gdrive_Download_Buffer* pBuf;
-    pBuf = gdrive_dlbuf_create((pTransfer->destFile == NULL) ? 512 : 0, 
-                               pTransfer->destFile
-            );
-    if (pBuf == NULL)
+    return curlHandle;
+}
+
+/*
+ * Works out which retry budget the transfer uses.
+ */
+static enum Gdrive_Request_Class 
+gdrive_xfer_get_class(const Gdrive_Transfer* pTransfer)
+{
+    if (pTransfer->uploadCallback != NULL)
     {
-        // Memory error.
-        curl_easy_cleanup(curlHandle);
-        return NULL;
+        return GDRIVE_CLASS_UPLOAD;
+    }
+    if (pTransfer->destFile != NULL)
+    {
+        return GDRIVE_CLASS_CONTENT;
     }
+    return GDRIVE_CLASS_METADATA;
+}
+
+static Gdrive_Xfer_Buffers* gdrive_xfer_get_buffers(void)
+{
+    static Gdrive_Xfer_Buffers buffers = {0};
+    return &buffers;
+}
+
+/*
+ * pHeaders can be NULL, or an existing set of headers can be given.
+ */
+static struct curl_slist* 
+gdrive_get_authbearer_header(struct curl_slist* pHeaders)
+{
+    const char* token = gdrive_get_access_token();
     
-    gdrive_dlbuf_download_with_retry(pBuf, curlHandle, 
-                                     pTransfer->retryOnAuthError, 
-                                     0, GDRIVE_RETRY_LIMIT
-            );
-    curl_easy_cleanup(curlHandle);
+    // If we don't have any access token yet, do nothing
+    if (!token)
+    {
+        return pHeaders;
+    }
     
-    if (!gdrive_dlbuf_get_success(pBuf))
+    // The header only needs to be put together again when the token has 
+    // changed.
+    Gdrive_Xfer_Buffers* pBuffers = gdrive_xfer_get_buffers();
+    const size_t prefixLength = strlen(GDRIVE_XFER_AUTH_PREFIX);
+    if (pBuffers->authHeader == NULL || 
+            strcmp(pBuffers->authHeader + prefixLength, token) != 0)
     {
-        // Download failure
-        gdrive_dlbuf_free(pBuf);
-        return NULL;
+        size_t size = prefixLength + strlen(token) + 1;
+        if (size > pBuffers->authHeaderSize)
+        {
+            char* newHeader = realloc(pBuffers->authHeader, size);
+            if (newHeader == NULL)
+            {
+                // Memory error
+                return NULL;
+            }
+            pBuffers->authHeader = newHeader;
+            pBuffers->authHeaderSize = size;
+        }
+        memcpy(pBuffers->authHeader, GDRIVE_XFER_AUTH_PREFIX, prefixLength);
+        strcpy(pBuffers->authHeader + prefixLength, token);
     }
     
-    // The HTTP Response may be success (e.g., 200) or failure (400 or higher),
-    // but the actual request succeeded as far as libcurl is concerned.  Return
-    // the buffer.
-    return pBuf;
+    // Copy the string into a curl_slist for use in headers.
+    return curl_slist_append(pHeaders, pBuffers->authHeader);
 }
 
+/*
+ * Replaces the transfer's Authorization header if the access token has changed
+ * since the transfer was created. Returns 0 on success, other on failure.
+ */
+static int gdrive_xfer_update_authheader(Gdrive_Transfer* pTransfer)
+{
+    const char* token = gdrive_get_access_token();
+    if (token == NULL)
+    {
+        // Nothing to update to
+        return 0;
+    }
+    
+    const size_t prefixLength = strlen(GDRIVE_XFER_AUTH_PREFIX);
+    const struct curl_slist* pFirst = pTransfer->pHeaders;
+    if (pFirst != NULL && 
+            strncmp(pFirst->data, GDRIVE_XFER_AUTH_PREFIX, prefixLength) == 0 &&
+            strcmp(pFirst->data + prefixLength, token) == 0)
+    {
+        // Already up to date, which is almost always the case
+        return 0;
+    }
+    
+    // Build a new list with the current token, keeping the other headers.
+    struct curl_slist* pHeaders = gdrive_get_authbearer_header(NULL);
+    if (pHeaders == NULL)
+    {
+        // Memory error
+        return -1;
+    }
+    for (const struct curl_slist* pHeader = pTransfer->pHeaders; 
+            pHeader != NULL; 
+            pHeader = pHeader->next)
+    {
+        if (strncmp(pHeader->data, GDRIVE_XFER_AUTH_PREFIX, prefixLength) == 0)
+        {
+            continue;
+        }
+        struct curl_slist* pNewHeaders = 
+                curl_slist_append(pHeaders, pHeader->data);
+        if (pNewHeaders == NULL)
+        {
+            // Memory error
+            curl_slist_free_all(pHeaders);
+            return -1;
+        }
+        pHeaders = pNewHeaders;
+    }
+    curl_slist_free_all(pTransfer->pHeaders);
+    pTransfer->pHeaders = pHeaders;
+    return 0;
+}
 
-/*************************************************************************
- * Implementations of private functions for use within this file
- *************************************************************************/
-
-static int gdrive_xfer_add_query_or_post(Gdrive_Query** ppQuery, 
-                                         const char* field, const char* value)
+/*
+ * Sends count transfers, starting at index first, as a single batch request,
+ * and stores whatever responses come back. Returns 0 if the batch request
+ * itself succeeded, other on failure.
+ */
+static int gdrive_xfer_batch_send(Gdrive_Xfer_Batch* pBatch, int first, 
+                                  int count)
 {
-    *ppQuery = gdrive_query_add(*ppQuery, field, value);
-    return (*ppQuery == NULL);
+    // Assemble the multipart/mixed body
+    char* body = NULL;
+    size_t length = 0;
+    for (int i = first; i < first + count; i++)
+    {
+        if (gdrive_xfer_batch_add_part(&body, &length, 
+                                       pBatch->pTransfers[i], i) != 0)
+        {
+            // Memory error
+            free(body);
+            return -1;
+        }
+    }
+    const char* closing = "--" GDRIVE_BATCH_BOUNDARY "--\r\n";
+    if (gdrive_xfer_append(&body, &length, closing, strlen(closing)) != 0)
+    {
+        // Memory error
+        free(body);
+        return -1;
+    }
+    
+    Gdrive_Transfer* pTransfer = gdrive_xfer_create();
+    if (pTransfer == NULL || 
+            gdrive_xfer_set_url(pTransfer, GDRIVE_URL_BATCH) || 
+            gdrive_xfer_add_header(pTransfer, "Content-Type: multipart/mixed; "
+                                   "boundary=" GDRIVE_BATCH_BOUNDARY)
+            )
+    {
+        // Memory error
+        gdrive_xfer_free(pTransfer);
+        free(body);
+        return -1;
+    }
+    gdrive_xfer_set_requesttype(pTransfer, GDRIVE_REQUEST_POST);
+    gdrive_xfer_set_body(pTransfer, body);
+    // Each part counts against the quota on its own.
+    pTransfer->cost = count;
+    
+    Gdrive_Download_Buffer* pBuf = gdrive_xfer_execute(pTransfer);
+    gdrive_xfer_free(pTransfer);
+    free(body);
+    
+    if (pBuf == NULL || gdrive_dlbuf_get_httpresp(pBuf) >= 400)
+    {
+        // The whole batch failed.
+        gdrive_dlbuf_free(pBuf);
+        return -1;
+    }
+    gdrive_xfer_batch_read_response(pBatch, first, count, pBuf);
+    gdrive_dlbuf_free(pBuf);
+    
+    // Parts can hit rate limits even when the batch as a whole succeeds.
+    bool rateLimited = false;
+    for (int i = first; i < first + count && !rateLimited; i++)
+    {
+        rateLimited = (pBatch->pResponses[i] != NULL && 
+                gdrive_dlbuf_is_ratelimited(pBatch->pResponses[i]));
+    }
+    if (rateLimited)
+    {
+        gdrive_rate_report(GDRIVE_CLASS_METADATA, true);
+    }
+    return 0;
 }
 
-static size_t gdrive_xfer_upload_callback_internal(char* buffer, size_t size, 
-                                                   size_t nitems, 
-                                                   void* instream)
+/*
+ * Appends one transfer, as an application/http part, to a batch request body.
+ * Returns 0 on success, other on failure.
+ */
+static int gdrive_xfer_batch_add_part(char** pBody, size_t* pLength, 
+                                      const Gdrive_Transfer* pTransfer, 
+                                      int index)
 {
-    // Get the transfer struct.
-    Gdrive_Transfer* pTransfer = (Gdrive_Transfer*) instream;
-    size_t bytesTransferred = 
-            pTransfer->uploadCallback(buffer, pTransfer->uploadOffset, 
-                                      size * nitems, pTransfer->userdata
-            );
-    if (bytesTransferred == (size_t)(-1))
+    const char* method;
+    switch (pTransfer->requestType)
     {
-        // Upload error
-        return CURL_READFUNC_ABORT;
+        case GDRIVE_REQUEST_GET:
+            method = "GET";
+            break;
+        case GDRIVE_REQUEST_POST:
+            method = "POST";
+            break;
+        case GDRIVE_REQUEST_PUT:
+            method = "PUT";
+            break;
+        case GDRIVE_REQUEST_PATCH:
+            method = "PATCH";
+            break;
+        case GDRIVE_REQUEST_DELETE:
+            method = "DELETE";
+            break;
+        default:
+            // Unsupported request type
+            return -1;
     }
-    // else succeeded
     
-    pTransfer->uploadOffset += bytesTransferred;
-    return bytesTransferred;
+    char* fullUrl = gdrive_query_assemble(pTransfer->pQuery, pTransfer->url);
+    char* postData = (pTransfer->body == NULL && pTransfer->pPostData != NULL) ?
+        gdrive_query_assemble(pTransfer->pPostData, NULL) : NULL;
+    if (fullUrl == NULL || 
+            (pTransfer->body == NULL && pTransfer->pPostData != NULL && 
+            postData == NULL))
+    {
+        // Memory error or invalid URL
+        free(fullUrl);
+        free(postData);
+        return -1;
+    }
+    const char* partBody = (pTransfer->body != NULL) ? 
+        pTransfer->body : postData;
+    
+    // Part headers and the request line. The Content-ID is echoed back in the
+    // response, which is how responses are matched up with transfers.
+    char partStart[256];
+    snprintf(partStart, sizeof(partStart), 
+             "--" GDRIVE_BATCH_BOUNDARY "\r\n"
+             "Content-Type: application/http\r\n"
+             "Content-ID: <item%d>\r\n"
+             "\r\n"
+             "%s ", index, method);
+    int error = gdrive_xfer_append(pBody, pLength, partStart, 
+                                   strlen(partStart)) || 
+            gdrive_xfer_append(pBody, pLength, fullUrl, strlen(fullUrl)) || 
+            gdrive_xfer_append(pBody, pLength, "\r\n", 2);
+    free(fullUrl);
+    
+    // The inner request's own headers. Authorization comes from the outer 
+    // request.
+    for (const struct curl_slist* pHeader = pTransfer->pHeaders; 
+            pHeader != NULL && !error; 
+            pHeader = pHeader->next)
+    {
+        if (strncasecmp(pHeader->data, "Authorization:", 
+                        strlen("Authorization:")) == 0)
+        {
+            continue;
+        }
+        error = gdrive_xfer_append(pBody, pLength, pHeader->data, 
+                                   strlen(pHeader->data)) || 
+                gdrive_xfer_append(pBody, pLength, "\r\n", 2);
+    }
+    
+    // Blank line, then the body if there is one
+    error = error || gdrive_xfer_append(pBody, pLength, "\r\n", 2);
+    if (partBody != NULL && !error)
+    {
+        error = gdrive_xfer_append(pBody, pLength, partBody, 
+                                   strlen(partBody)) || 
+                gdrive_xfer_append(pBody, pLength, "\r\n", 2);
+    }
+    free(postData);
+    return error;
 }
 
 /*
- * pHeaders can be NULL, or an existing set of headers can be given.
+ * Splits a multipart/mixed batch response into its parts, and stores each
+ * part's status and body as the response for the matching transfer.
  */
-static struct curl_slist* 
-gdrive_get_authbearer_header(struct curl_slist* pHeaders)
+static void gdrive_xfer_batch_read_response(Gdrive_Xfer_Batch* pBatch, 
+                                            int first, int count, 
+                                            Gdrive_Download_Buffer* pBuf)
 {
-    const char* token = gdrive_get_access_token();
+    const char* data = gdrive_dlbuf_get_data(pBuf);
+    const char* contentType = 
+            gdrive_dlbuf_get_header(pBuf, GDRIVE_HEADER_CONTENT_TYPE);
+    if (data == NULL || contentType == NULL)
+    {
+        // Nothing to read
+        return;
+    }
+    const char* dataEnd = data + strlen(data);
     
-    // If we don't have any access token yet, do nothing
-    if (!token)
+    // Find the boundary in the Content-Type header.
+    const char* boundary = strstr(contentType, "boundary=");
+    if (boundary == NULL)
     {
-        return pHeaders;
+        // Not a multipart response
+        return;
+    }
+    boundary += strlen("boundary=");
+    if (*boundary == '"')
+    {
+        boundary++;
     }
+    size_t boundaryLength = strcspn(boundary, "\"; \r\n");
+    if (boundaryLength == 0 || boundaryLength > 200)
+    {
+        // Not a usable boundary
+        return;
+    }
+    char delimiter[256] = "--";
+    strncat(delimiter, boundary, boundaryLength);
     
-    // First form a string with the required text and the access token.
-    char* header = malloc(strlen("Authorization: Bearer ") + 
-                          strlen(token) + 1
-    );
-    if (!header)
+    const char* part = gdrive_xfer_find(data, dataEnd, delimiter);
+    while (part != NULL)
+    {
+        part += strlen(delimiter);
+        if (strncmp(part, "--", 2) == 0)
+        {
+            // Closing delimiter
+            break;
+        }
+        const char* partEnd = gdrive_xfer_find(part, dataEnd, delimiter);
+        const char* next = partEnd;
+        if (partEnd == NULL)
+        {
+            partEnd = dataEnd;
+        }
+        
+        // Match the part to a transfer using its Content-ID, which looks like
+        // "<response-item12>".
+        const char* inner = gdrive_xfer_skip_headers(part, partEnd);
+        const char* contentId = gdrive_xfer_find(part, inner, "response-item");
+        int index = (contentId != NULL) ? 
+            atoi(contentId + strlen("response-item")) : -1;
+        
+        // The inner response starts with a status line like 
+        // "HTTP/1.1 200 OK", then its headers, then the body.
+        const char* status = (inner < partEnd) ? 
+            memchr(inner, ' ', partEnd - inner) : NULL;
+        const char* innerBody = gdrive_xfer_skip_headers(inner, partEnd);
+        if (index >= first && index < first + count && status != NULL && 
+                pBatch->pResponses[index] == NULL)
+        {
+            // The line break before the next delimiter belongs to the 
+            // delimiter, not the body.
+            const char* bodyEnd = partEnd;
+            if (bodyEnd > innerBody && bodyEnd[-1] == '\n')
+            {
+                bodyEnd--;
+            }
+            if (bodyEnd > innerBody && bodyEnd[-1] == '\r')
+            {
+                bodyEnd--;
+            }
+            pBatch->pResponses[index] = 
+                    gdrive_dlbuf_create_filled(strtol(status, NULL, 10), 
+                                               innerBody, 
+                                               bodyEnd - innerBody);
+        }
+        
+        part = next;
+    }
+}
+
+/*
+ * Returns true if a transfer in a batch should be sent again by itself,
+ * because it got no response, or because it got an error that 
+ * gdrive_xfer_execute() knows how to retry.
+ */
+static bool gdrive_xfer_batch_should_resend(Gdrive_Download_Buffer* pBuf)
+{
+    if (pBuf == NULL)
+    {
+        return true;
+    }
+    long httpResp = gdrive_dlbuf_get_httpresp(pBuf);
+    return (httpResp == 401 || httpResp == 403 || httpResp == 429 || 
+            httpResp >= 500);
+}
+
+/*
+ * Appends srcLength bytes from src to the null-terminated, heap-allocated
+ * string at *pDest (which may be NULL), whose length is *pLength. Returns 0 on
+ * success, other on failure.
+ */
+static int gdrive_xfer_append(char** pDest, size_t* pLength, 
+                              const char* src, size_t srcLength)
+{
+    char* newDest = realloc(*pDest, *pLength + srcLength + 1);
+    if (newDest == NULL)
     {
         // Memory error
-        return NULL;
+        return -1;
     }
-    strcpy(header, "Authorization: Bearer ");
-    strcat(header, token);
-    
-    // Copy the string into a curl_slist for use in headers.
-    struct curl_slist* returnVal = curl_slist_append(pHeaders, header);
-    free(header);
-    return returnVal;
+    memcpy(newDest + *pLength, src, srcLength);
+    *pLength += srcLength;
+    newDest[*pLength] = '\0';
+    *pDest = newDest;
+    return 0;
+}
+
+/*
+ * Like strstr(), but only searches between start and end.
+ */
+static const char* gdrive_xfer_find(const char* start, const char* end, 
+                                    const char* needle)
+{
+    size_t needleLength = strlen(needle);
+    for (const char* p = start; p + needleLength <= end; p++)
+    {
+        if (memcmp(p, needle, needleLength) == 0)
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Given the start of a block of header lines, returns the position just past
+ * the blank line that ends it, or end if there is no blank line.
+ */
+static const char* gdrive_xfer_skip_headers(const char* start, 
+                                            const char* end)
+{
+    const char* line = start;
+    while (line < end)
+    {
+        const char* lineEnd = memchr(line, '\n', end - line);
+        if (lineEnd == NULL)
+        {
+            return end;
+        }
+        // Blank lines are either "\n" or "\r\n". A leading line break just
+        // after a delimiter is the end of the delimiter line, not a blank 
+        // line.
+        bool blank = (lineEnd == line || 
+                (lineEnd == line + 1 && *line == '\r'));
+        if (blank && line != start)
+        {
+            return lineEnd + 1;
+        }
+        line = lineEnd + 1;
+    }
+    return end;
+}
+
+static void gdrive_xfer_async_free(Gdrive_Xfer_Async* pAsync)
+{
+    if (pAsync->multiHandle != NULL && pAsync->curlHandle != NULL)
+    {
+        // Safe even if the handle was never added
+        curl_multi_remove_handle(pAsync->multiHandle, pAsync->curlHandle);
+    }
+    if (pAsync->curlHandle != NULL)
+    {
+        curl_easy_cleanup(pAsync->curlHandle);
+    }
+    if (pAsync->multiHandle != NULL)
+    {
+        curl_multi_cleanup(pAsync->multiHandle);
+    }
+    gdrive_dlbuf_free(pAsync->pBuf);
+    curl_slist_free_all(pAsync->pHeaders);
+    free(pAsync);
 }
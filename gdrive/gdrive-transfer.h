@@ -21,8 +21,24 @@ extern "C" {
     
 #include <sys/types.h>
     
+// The most transfers Google Drive accepts in a single batch request
+#define GDRIVE_XFER_BATCH_MAX 100
+
 typedef struct Gdrive_Transfer Gdrive_Transfer;
 
+/*
+ * A group of independent transfers that are sent to Google Drive together in
+ * one HTTP request, using the batch endpoint. Each transfer still gets its own
+ * response.
+ */
+typedef struct Gdrive_Xfer_Batch Gdrive_Xfer_Batch;
+
+/*
+ * A transfer that runs in the background while other work goes on. It only
+ * makes progress when gdrive_xfer_poll() is called.
+ */
+typedef struct Gdrive_Xfer_Async Gdrive_Xfer_Async;
+
 /*
  * gdrive_xfer_upload_callback: Signature for a callback function to be used
  *                              with gdrive_xfer_set_uploadcallback().
@@ -84,6 +100,31 @@ Gdrive_Transfer* gdrive_xfer_create();
  */
 void gdrive_xfer_free(Gdrive_Transfer* pTransfer);
 
+/*
+ * gdrive_xfer_cleanup():   Frees the memory that is kept and reused from one
+ *                          transfer to the next. Should be called once no more
+ *                          transfers will be made.
+ */
+void gdrive_xfer_cleanup(void);
+
+/*
+ * gdrive_xfer_batch_create():  Creates a new, empty batch of transfers.
+ * Return value (Gdrive_Xfer_Batch*):
+ *      On success, a pointer to a batch that transfers can be added to with
+ *      gdrive_xfer_batch_add(). On failure, NULL. When no longer needed, the
+ *      returned pointer should be passed to gdrive_xfer_batch_free().
+ */
+Gdrive_Xfer_Batch* gdrive_xfer_batch_create(void);
+
+/*
+ * gdrive_xfer_batch_free():    Frees a batch, along with every transfer that
+ *                              was added to it and every response it received.
+ * Parameters:
+ *      pBatch (Gdrive_Xfer_Batch*):
+ *              The batch to free. It is safe to pass a NULL pointer.
+ */
+void gdrive_xfer_batch_free(Gdrive_Xfer_Batch* pBatch);
+
 
 /*************************************************************************
  * Getter and setter functions
@@ -140,6 +181,28 @@ void gdrive_xfer_set_retryonautherror(Gdrive_Transfer* pTransfer, bool retry);
  */
 int gdrive_xfer_set_url(Gdrive_Transfer* pTransfer, const char* url);
 
+/*
+ * gdrive_xfer_set_file_url():  Sets the URL for a request about one file, in
+ *                              the form "<baseUrl>/<fileId><suffix>", such as
+ *                              GDRIVE_URL_FILES "/abc123/copy", without the 
+ *                              caller needing to put it together first.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):   
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create().
+ *      baseUrl (const char*):
+ *              The endpoint, such as GDRIVE_URL_FILES or GDRIVE_URL_UPLOAD.
+ *      fileId (const char*):
+ *              The file ID, or NULL to leave out both the ID and the '/' 
+ *              before it.
+ *      suffix (const char*):
+ *              Anything that follows the file ID, starting with '/', or NULL.
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_xfer_set_file_url(Gdrive_Transfer* pTransfer, const char* baseUrl, 
+                             const char* fileId, const char* suffix);
+
 /*
  * gdrive_xfer_set_destfile():  Sets the download destination to an open file
  *                              stream. This is optional and only needs done
@@ -154,6 +217,26 @@ int gdrive_xfer_set_url(Gdrive_Transfer* pTransfer, const char* url);
  */
 void gdrive_xfer_set_destfile(Gdrive_Transfer* pTransfer, FILE* destFile);
 
+/*
+ * gdrive_xfer_set_jstream():   Parses a successful JSON response as it is 
+ *                              downloaded, with a Gdrive_Json_Stream, instead
+ *                              of keeping it in memory. This is optional, and
+ *                              is meant for long lists such as pages of 
+ *                              files.list. After gdrive_xfer_execute(), the
+ *                              caller gets the rest of the response with
+ *                              gdrive_jstream_finish() if the HTTP response
+ *                              was successful. Error responses are returned
+ *                              in memory as usual.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):   
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create().
+ *      pStream (Gdrive_Json_Stream*):   
+ *              The stream to feed. It is NOT freed with the transfer.
+ */
+void gdrive_xfer_set_jstream(Gdrive_Transfer* pTransfer, 
+                             Gdrive_Json_Stream* pStream);
+
 /*
  * gdrive_xfer_set_body():  Set the body of the HTTP request explicitly. Only
  *                          one of gdrive_xfer_set_body(),
@@ -171,6 +254,23 @@ void gdrive_xfer_set_destfile(Gdrive_Transfer* pTransfer, FILE* destFile);
  */
 void gdrive_xfer_set_body(Gdrive_Transfer* pTransfer, const char* body);
 
+/*
+ * gdrive_xfer_copy_body(): The same as gdrive_xfer_set_body(), except that
+ *                          the transfer keeps its own copy of the body. This 
+ *                          is useful for transfers that outlive the function
+ *                          that builds them, such as ones added to a batch.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):   
+ *              Pointer to a Gdrive_Transfer struct created by an earlier call 
+ *              to gdrive_xfer_create().
+ *      body (const char*): 
+ *              A null-terminated string containing the text to use as the 
+ *              request body.
+ * Return value (int):
+ *      0 on success, non-zero on failure.
+ */
+int gdrive_xfer_copy_body(Gdrive_Transfer* pTransfer, const char* body);
+
 /*
  * gdrive_xfer_set_uploadcallback():    Set a callback function to supply the
  *                                      request body for a transfer. Only one of
@@ -273,10 +373,13 @@ int gdrive_xfer_add_header(Gdrive_Transfer* pTransfer, const char* header);
 /*
  * gdrive_xfer_execute():   Perform the upload or download operation described
  *                          by a Gdrive_Transfer struct. If the transfer results
- *                          in an HTTP status code of 5XX (server error) or in
- *                          a Rate Limit Exceeded error, it will be retried 
- *                          using an exponential backoff strategy, up to a 
- *                          maximum of GDRIVE_RETRY_LIMIT attempts. Unless
+ *                          in an HTTP status code of 5XX (server error), 429, 
+ *                          or a Rate Limit Exceeded error, it will be retried 
+ *                          as described in gdrive-retry.h, within the retry
+ *                          budget for its class (uploads for transfers with 
+ *                          an upload callback, content for transfers with a 
+ *                          destination file, and metadata for everything 
+ *                          else). Unless
  *                          gdrive_xfer_set_retryonautherror() has been called
  *                          with a value of false, authentication errors are
  *                          also retried after refreshing authentication 
@@ -288,6 +391,128 @@ int gdrive_xfer_add_header(Gdrive_Transfer* pTransfer, const char* header);
  */
 Gdrive_Download_Buffer* gdrive_xfer_execute(Gdrive_Transfer* pTransfer);
 
+/*
+ * gdrive_xfer_batch_add(): Adds a transfer to a batch. Only small metadata
+ *                          requests belong in a batch. Transfers that use
+ *                          gdrive_xfer_set_destfile(), 
+ *                          gdrive_xfer_set_jstream() or 
+ *                          gdrive_xfer_set_uploadcallback() can't be added.
+ *                          Transfers in the same batch may be carried out in
+ *                          any order, so they must not depend on each other.
+ * Parameters:
+ *      pBatch (Gdrive_Xfer_Batch*):
+ *              The batch to add to.
+ *      pTransfer (Gdrive_Transfer*):
+ *              The transfer to add. The batch takes ownership of the transfer,
+ *              even on failure, and frees it in gdrive_xfer_batch_free(). Any
+ *              body set with gdrive_xfer_set_body() must remain valid until 
+ *              then. If NULL, the call fails.
+ * Return value (int):
+ *      The transfer's index within the batch, used to retrieve its response
+ *      with gdrive_xfer_batch_get_response(), or -1 on failure.
+ */
+int gdrive_xfer_batch_add(Gdrive_Xfer_Batch* pBatch, 
+                          Gdrive_Transfer* pTransfer);
+
+/*
+ * gdrive_xfer_batch_execute(): Sends every transfer in a batch. Transfers are
+ *                              grouped into as few batch requests as Google
+ *                              Drive allows (up to GDRIVE_XFER_BATCH_MAX per 
+ *                              request). Any transfer whose response is 
+ *                              missing, or is an error that 
+ *                              gdrive_xfer_execute() would retry, is then sent
+ *                              on its own with gdrive_xfer_execute().
+ * Parameters:
+ *      pBatch (Gdrive_Xfer_Batch*):
+ *              The batch to send. It should only be executed once.
+ * Return value (int):
+ *      The number of batch requests sent. Individual transfers can fail even
+ *      when the batch requests succeed, so check each response.
+ */
+int gdrive_xfer_batch_execute(Gdrive_Xfer_Batch* pBatch);
+
+/*
+ * gdrive_xfer_batch_get_response():    Retrieves the response to one transfer
+ *                                      in a batch that has been executed.
+ * Parameters:
+ *      pBatch (Gdrive_Xfer_Batch*):
+ *              The executed batch.
+ *      index (int):
+ *              The index returned by gdrive_xfer_batch_add().
+ * Return value (Gdrive_Download_Buffer*):
+ *      The response, or NULL if there was no response (for example, on a 
+ *      network error). Only the HTTP status and the data are filled in. The
+ *      returned pointer belongs to the batch and should NOT be passed to 
+ *      gdrive_dlbuf_free().
+ */
+Gdrive_Download_Buffer* 
+gdrive_xfer_batch_get_response(Gdrive_Xfer_Batch* pBatch, int index);
+
+/*
+ * gdrive_xfer_renew_auth():    Puts the current access token into a request
+ *                              that is about to be sent again after an
+ *                              authentication error. Without this, it would
+ *                              be sent with the same expired token.
+ * Parameters:
+ *      curlHandle (CURL*):
+ *              The curl handle being used for the request. Handles that
+ *              weren't set up for a Gdrive_Transfer (or that belong to one
+ *              started with gdrive_xfer_start()) are left alone.
+ * Return value (int):
+ *      0 on success, other on failure.
+ */
+int gdrive_xfer_renew_auth(CURL* curlHandle);
+
+/*
+ * gdrive_xfer_start(): Starts a transfer without waiting for it to finish. 
+ *                      Only small requests are supported: transfers that use
+ *                      gdrive_xfer_set_destfile(), gdrive_xfer_set_jstream() 
+ *                      or gdrive_xfer_set_uploadcallback() can't be started 
+ *                      this way. Server errors and exceeded rate limits are
+ *                      retried as for gdrive_xfer_execute(), but without 
+ *                      blocking: the transfer is set aside until it is time
+ *                      to try again, and gdrive_xfer_poll() sends it again 
+ *                      once that time has come. Authentication is not 
+ *                      refreshed.
+ * Parameters:
+ *      pTransfer (Gdrive_Transfer*):
+ *              The transfer to start. Everything needed is copied or taken
+ *              over (including any headers), so the caller can free it right
+ *              away.
+ * Return value (Gdrive_Xfer_Async*):
+ *      The running transfer, or NULL on error. The caller is responsible for
+ *      passing the returned pointer to gdrive_xfer_finish().
+ */
+Gdrive_Xfer_Async* gdrive_xfer_start(Gdrive_Transfer* pTransfer);
+
+/*
+ * gdrive_xfer_poll():  Moves a background transfer along as far as it can go
+ *                      without waiting, and checks whether it's done.
+ * Parameters:
+ *      pAsync (Gdrive_Xfer_Async*):
+ *              The transfer returned by gdrive_xfer_start().
+ * Return value (bool):
+ *      True if the transfer has finished (successfully or not), false if it's
+ *      still going.
+ */
+bool gdrive_xfer_poll(Gdrive_Xfer_Async* pAsync);
+
+/*
+ * gdrive_xfer_finish():    Collects the response to a background transfer
+ *                          and frees it. A transfer that hasn't finished is 
+ *                          abandoned.
+ * Parameters:
+ *      pAsync (Gdrive_Xfer_Async*):
+ *              The transfer returned by gdrive_xfer_start(). It's safe to pass
+ *              a NULL pointer. The pointer should not be used after this 
+ *              function returns.
+ * Return value (Gdrive_Download_Buffer*):
+ *      The response, or NULL if the transfer failed or hadn't finished. The 
+ *      response may still be an HTTP error. The caller is responsible for 
+ *      passing the returned pointer to gdrive_dlbuf_free().
+ */
+Gdrive_Download_Buffer* gdrive_xfer_finish(Gdrive_Xfer_Async* pAsync);
+
 
 #ifdef	__cplusplus
 }
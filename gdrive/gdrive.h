@@ -39,6 +39,9 @@ extern "C" {
 #define GDRIVE_ACCESS_ALL 0x0F
     
 #define GDRIVE_BASE_CHUNK_SIZE 262144L
+// Requests slower than this many bytes per second count as stalled (see 
+// gdrive_set_stalltime())
+#define GDRIVE_STALL_BYTES 1024L
 
     
 enum Gdrive_Interaction
@@ -48,6 +51,41 @@ enum Gdrive_Interaction
     GDRIVE_INTERACTION_ALWAYS
 };
 
+enum Gdrive_Sync_Policy
+{
+    // Upload on every close of a handle opened for writing, and on every fsync
+    // unless there is a cache directory to keep the changes in
+    GDRIVE_SYNC_STRICT,
+    // Upload at most once per sync window for each file, and on last close
+    GDRIVE_SYNC_COALESCE,
+    // Only upload when the last handle opened for writing is closed
+    GDRIVE_SYNC_CLOSE
+};
+
+// Kinds of requests, which can be given different retry budgets and 
+// deadlines
+enum Gdrive_Request_Class
+{
+    // File information, listings, and changes to them
+    GDRIVE_CLASS_METADATA,
+    // Downloading file contents
+    GDRIVE_CLASS_CONTENT,
+    // Uploading file contents
+    GDRIVE_CLASS_UPLOAD,
+    // GDRIVE_CLASS_COUNT: The number of classes, not a class itself
+    GDRIVE_CLASS_COUNT
+};
+
+enum Gdrive_Atime_Policy
+{
+    // Never update the access time when a file is read
+    GDRIVE_ATIME_NOATIME,
+    // Update it if it is older than the modification time, or a day old
+    GDRIVE_ATIME_RELATIME,
+    // Update it every time a file is read
+    GDRIVE_ATIME_STRICT
+};
+
 enum Gdrive_Filetype
 {
     // May add a Google Docs file type or others
@@ -57,6 +95,8 @@ enum Gdrive_Filetype
 
 typedef struct Gdrive_Info Gdrive_Info;
 
+#include <stdio.h>
+
 
 #include "gdrive-fileinfo.h"
 #include "gdrive-fileinfo-array.h"
@@ -191,6 +231,326 @@ int gdrive_get_maxchunks(void);
  */
 int gdrive_get_filesystem_perms(enum Gdrive_Filetype type);
 
+/*
+ * gdrive_set_writebehind():    Enables or disables write-behind for namespace
+ *                              changes. When enabled, creating, deleting, 
+ *                              linking, unlinking and moving files take effect
+ *                              locally right away and are sent to Google Drive
+ *                              later, in the order they were made. Should be 
+ *                              called before gdrive_init().
+ * Parameters:
+ *      enable (bool):
+ *              True to enable write-behind, false to send every change 
+ *              immediately (the default).
+ */
+void gdrive_set_writebehind(bool enable);
+
+/*
+ * gdrive_get_writebehind():    Determines whether write-behind is enabled for
+ *                              namespace changes.
+ * Return value (bool):
+ *      True if write-behind is enabled, otherwise false.
+ */
+bool gdrive_get_writebehind(void);
+
+/*
+ * gdrive_set_cachedir():   Sets a directory for keeping file changes that have
+ *                          not been uploaded yet, so that they survive the
+ *                          program exiting or crashing. Any changes left there
+ *                          by an earlier run are uploaded during gdrive_init().
+ *                          Must be called before gdrive_init() to have any
+ *                          effect.
+ * Parameters:
+ *      path (const char*):
+ *              The directory to use. It will be created if it does not exist.
+ *              If NULL (the default), unuploaded changes are only kept in 
+ *              temporary files.
+ * Return value (int):
+ *      0 on success, other on failure (probably a memory error).
+ */
+int gdrive_set_cachedir(const char* path);
+
+/*
+ * gdrive_get_cachedir():   Retrieves the directory set with 
+ *                          gdrive_set_cachedir().
+ * Return value (const char*):
+ *      The directory, or NULL if none was set. The returned string should not
+ *      be changed or freed.
+ */
+const char* gdrive_get_cachedir(void);
+
+/*
+ * gdrive_set_syncpolicy(): Sets when file contents are uploaded in response to
+ *                          gdrive_file_persist() (fsync) and to closing files.
+ *                          Uploads that are put off are sent later, the next
+ *                          time the cache is updated, and always when the last
+ *                          writer closes the file. With any policy except 
+ *                          GDRIVE_SYNC_STRICT, changed timestamps are also 
+ *                          held back for the sync window (or until the next
+ *                          upload of the file's contents) instead of being 
+ *                          sent when the file is closed. Should be called 
+ *                          before gdrive_init().
+ * Parameters:
+ *      policy (enum Gdrive_Sync_Policy):
+ *              GDRIVE_SYNC_STRICT (the default), GDRIVE_SYNC_COALESCE, or 
+ *              GDRIVE_SYNC_CLOSE.
+ *      window (time_t):
+ *              For GDRIVE_SYNC_COALESCE, the minimum number of seconds between
+ *              uploads of the same file. For all policies, how long changed 
+ *              timestamps wait before being sent on their own.
+ */
+void gdrive_set_syncpolicy(enum Gdrive_Sync_Policy policy, time_t window);
+
+/*
+ * gdrive_get_syncpolicy(): Retrieves the policy set with 
+ *                          gdrive_set_syncpolicy().
+ * Return value (enum Gdrive_Sync_Policy):
+ *      The current sync policy.
+ */
+enum Gdrive_Sync_Policy gdrive_get_syncpolicy(void);
+
+/*
+ * gdrive_get_syncwindow(): Retrieves the window set with 
+ *                          gdrive_set_syncpolicy().
+ * Return value (time_t):
+ *      The minimum number of seconds between uploads of the same file with
+ *      GDRIVE_SYNC_COALESCE.
+ */
+time_t gdrive_get_syncwindow(void);
+
+/*
+ * gdrive_set_atimepolicy():    Sets whether opening a file for reading updates
+ *                              its access time. Access time updates are always
+ *                              sent to Google Drive lazily, as described for
+ *                              gdrive_set_syncpolicy(). Explicitly setting the
+ *                              access time with gdrive_file_set_atime() is not
+ *                              affected. Should be called before gdrive_init().
+ * Parameters:
+ *      policy (enum Gdrive_Atime_Policy):
+ *              GDRIVE_ATIME_NOATIME (the default), GDRIVE_ATIME_RELATIME, or
+ *              GDRIVE_ATIME_STRICT.
+ */
+void gdrive_set_atimepolicy(enum Gdrive_Atime_Policy policy);
+
+/*
+ * gdrive_get_atimepolicy():    Retrieves the policy set with 
+ *                              gdrive_set_atimepolicy().
+ * Return value (enum Gdrive_Atime_Policy):
+ *      The current atime policy.
+ */
+enum Gdrive_Atime_Policy gdrive_get_atimepolicy(void);
+
+/*
+ * gdrive_set_fullindex():  Enables or disables building an index of every 
+ *                          file in the account during gdrive_init(). With the
+ *                          index, looking up paths and listing folders don't
+ *                          need to contact Google Drive, which makes walking
+ *                          large trees much faster, at the cost of a slower 
+ *                          start and memory for every file. The index is kept
+ *                          up to date from the list of changes. Should be 
+ *                          called before gdrive_init().
+ * Parameters:
+ *      enable (bool):
+ *              True to build the index, false (the default) to look files up
+ *              as they're needed.
+ */
+void gdrive_set_fullindex(bool enable);
+
+/*
+ * gdrive_get_fullindex():  Determines whether building the full index was
+ *                          requested with gdrive_set_fullindex().
+ * Return value (bool):
+ *      True if the index was requested, otherwise false.
+ */
+bool gdrive_get_fullindex(void);
+
+/*
+ * gdrive_set_cachelimits():    Limits the size of the caches of file 
+ *                              information and of paths. When a cache grows
+ *                              past a limit, the entries that have gone 
+ *                              longest without being used are dropped (and
+ *                              looked up again if they're needed later) until
+ *                              it is back under. Entries for open files and
+ *                              files with changes that haven't been sent yet 
+ *                              are kept no matter what. The limits are checked
+ *                              whenever the caches are brought up to date
+ *                              with the list of changes. Should be called 
+ *                              before gdrive_init().
+ * Parameters:
+ *      maxFiles (size_t):
+ *              The most entries each cache should hold, or 0 for no limit (the
+ *              default).
+ *      maxBytes (size_t):
+ *              About how much memory the two caches together should use, or 0
+ *              for no limit (the default). The memory used by each entry is 
+ *              estimated, so this is approximate.
+ *      watchPressure (bool):
+ *              If true, also watch the memory pressure (PSI) reported for the
+ *              process's cgroup (or the whole system, if the cgroup's isn't 
+ *              available), and shrink both caches by half whenever it's high.
+ */
+void gdrive_set_cachelimits(size_t maxFiles, size_t maxBytes, 
+                            bool watchPressure);
+
+/*
+ * gdrive_get_maxcachedfiles(): Retrieves the entry limit set with 
+ *                              gdrive_set_cachelimits().
+ * Return value (size_t):
+ *      The most entries for each cache, or 0 for no limit.
+ */
+size_t gdrive_get_maxcachedfiles(void);
+
+/*
+ * gdrive_get_maxcachememory(): Retrieves the memory limit set with 
+ *                              gdrive_set_cachelimits().
+ * Return value (size_t):
+ *      The approximate most bytes for the caches, or 0 for no limit.
+ */
+size_t gdrive_get_maxcachememory(void);
+
+/*
+ * gdrive_get_memorypressure(): Determines whether watching memory pressure 
+ *                              was requested with gdrive_set_cachelimits().
+ * Return value (bool):
+ *      True if the caches shrink under memory pressure, otherwise false.
+ */
+bool gdrive_get_memorypressure(void);
+
+/*
+ * gdrive_set_stalegrace(): Lets cached file information and paths be used for
+ *                          a while after they expire (after the cache TTL 
+ *                          given to gdrive_init() has passed), while the 
+ *                          list of changes is fetched in the background. Once
+ *                          it arrives, the changes are applied the next time
+ *                          an expired entry is looked up. Only entries that 
+ *                          expired more than grace seconds ago wait for 
+ *                          Google Drive. Should be called before 
+ *                          gdrive_init().
+ * Parameters:
+ *      grace (time_t):
+ *              How long (in seconds) past expiry an entry can still be used,
+ *              or 0 (the default) to always wait for fresh information.
+ */
+void gdrive_set_stalegrace(time_t grace);
+
+/*
+ * gdrive_get_stalegrace(): Retrieves the grace period set with 
+ *                          gdrive_set_stalegrace().
+ * Return value (time_t):
+ *      The grace period in seconds, or 0 if expired entries aren't used.
+ */
+time_t gdrive_get_stalegrace(void);
+
+/*
+ * gdrive_set_retrybudget():    Sets the longest time that requests of one 
+ *                              class can spend waiting between retries after
+ *                              errors that are worth retrying (server errors 
+ *                              and exceeded rate limits). A request that would
+ *                              need to wait longer than what is left of its 
+ *                              budget fails instead. Requests other than 
+ *                              background updates wait in place, so this is
+ *                              also about the longest that one request can 
+ *                              hold up its caller, not counting the time the
+ *                              attempts themselves take (see 
+ *                              gdrive_set_deadline()).
+ * Parameters:
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request.
+ *      seconds (time_t):
+ *              The budget in seconds, or 0 to never wait and retry. The 
+ *              defaults are 3 seconds for metadata, 5 for content and 60
+ *              for uploads, or 5 for uploads if a cache directory is set
+ *              (see gdrive_set_cachedir()), since changes that fail to 
+ *              upload are kept there and tried again later.
+ */
+void gdrive_set_retrybudget(enum Gdrive_Request_Class requestClass, 
+                            time_t seconds);
+
+/*
+ * gdrive_get_retrybudget():    Retrieves the budget set with 
+ *                              gdrive_set_retrybudget().
+ * Parameters:
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request.
+ * Return value (time_t):
+ *      The retry budget in seconds.
+ */
+time_t gdrive_get_retrybudget(enum Gdrive_Request_Class requestClass);
+
+/*
+ * gdrive_set_deadline():   Sets the longest time that one attempt at a 
+ *                          request of one class can take, from connecting to
+ *                          receiving the last byte. A request that takes 
+ *                          longer is abandoned and fails. Should be called 
+ *                          before gdrive_init().
+ * Parameters:
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request.
+ *      seconds (time_t):
+ *              The deadline in seconds, or 0 for none. The default is 30 
+ *              seconds for metadata, and none for content and uploads (which
+ *              can be large, and are covered by gdrive_set_stalltime()).
+ */
+void gdrive_set_deadline(enum Gdrive_Request_Class requestClass, 
+                         time_t seconds);
+
+/*
+ * gdrive_get_deadline():   Retrieves the deadline set with 
+ *                          gdrive_set_deadline().
+ * Parameters:
+ *      requestClass (enum Gdrive_Request_Class):
+ *              The kind of request.
+ * Return value (time_t):
+ *      The deadline in seconds, or 0 for none.
+ */
+time_t gdrive_get_deadline(enum Gdrive_Request_Class requestClass);
+
+/*
+ * gdrive_set_stalltime():  Sets how long a request can go on transferring 
+ *                          less than GDRIVE_STALL_BYTES bytes per second 
+ *                          before it is abandoned and fails, whatever its
+ *                          class. Should be called before gdrive_init().
+ * Parameters:
+ *      seconds (time_t):
+ *              The time in seconds, or 0 to never abandon slow requests. The
+ *              default is 30 seconds.
+ */
+void gdrive_set_stalltime(time_t seconds);
+
+/*
+ * gdrive_get_stalltime():  Retrieves the time set with 
+ *                          gdrive_set_stalltime().
+ * Return value (time_t):
+ *      The time in seconds, or 0 if slow requests are never abandoned.
+ */
+time_t gdrive_get_stalltime(void);
+
+/*
+ * gdrive_set_hedging():    Sets whether requests that only read (file 
+ *                          information, listings and downloads) are sent a 
+ *                          second time when no response has started to 
+ *                          arrive after an unusually long wait (longer than
+ *                          95% of recent requests of the same class). 
+ *                          Whichever copy answers first is used, and the 
+ *                          other is abandoned. This cuts down on the rare 
+ *                          requests that get stuck, at the cost of a few 
+ *                          extra requests. Uploads and other changes are 
+ *                          never sent twice.
+ * Parameters:
+ *      hedging (bool):
+ *              True to send slow requests twice, false (the default) to 
+ *              never do so.
+ */
+void gdrive_set_hedging(bool hedging);
+
+/*
+ * gdrive_get_hedging():    Retrieves the setting set with 
+ *                          gdrive_set_hedging().
+ * Return value (bool):
+ *      True if slow requests are sent twice, otherwise false.
+ */
+bool gdrive_get_hedging(void);
+
 
 /******************
  * Other fully public functions
@@ -208,6 +568,62 @@ int gdrive_get_filesystem_perms(enum Gdrive_Filetype type);
  */
 Gdrive_Fileinfo_Array*  gdrive_folder_list(const char* folderId);
 
+/*
+ * gdrive_folder_list_multi():  Retrieves the lists of files within several
+ *                              folders at once. Folders are listed together
+ *                              in a single query (or a few, for many folders),
+ *                              and the results are divided up by parent.
+ * Parameters:
+ *      folderIds (const char* const*):
+ *              An array of Google Drive file IDs of the folders to list.
+ *      nFolders (int):
+ *              The number of IDs in folderIds.
+ *      pArrays (Gdrive_Fileinfo_Array**):
+ *              An array of at least nFolders pointers. On return, pArrays[i]
+ *              holds the list of files within folderIds[i], as would be 
+ *              returned by gdrive_folder_list(), or NULL if that folder could
+ *              not be listed. The caller is responsible for freeing each 
+ *              non-NULL list with gdrive_finfoarray_free().
+ * Return value (int):
+ *      0 if every folder was listed, other if any failed.
+ */
+int gdrive_folder_list_multi(const char* const* folderIds, int nFolders, 
+                             Gdrive_Fileinfo_Array** pArrays);
+
+/*
+ * gdrive_folder_is_empty():    Determines whether a folder has no files in 
+ *                              it, including changes that haven't been sent
+ *                              yet. Uses the count from an earlier listing if
+ *                              there is one, otherwise asks Google Drive for
+ *                              a single file in the folder.
+ * Parameters:
+ *      folderId (const char*):
+ *              The Google Drive file ID of the folder.
+ * Return value (int):
+ *      1 if the folder is empty, 0 if it isn't, or a negative error number on
+ *      failure.
+ */
+int gdrive_folder_is_empty(const char* folderId);
+
+/*
+ * gdrive_folder_prefetch():    Caches what is already known about the 
+ *                              contents of a folder that has just been listed,
+ *                              so that looking at each item afterward (as ls -l
+ *                              or find do) doesn't need its own requests. The
+ *                              file ID of each item is cached under its path,
+ *                              information about each file and subfolder that
+ *                              isn't already cached is cached directly from 
+ *                              the listing. Subfolders' children aren't 
+ *                              counted.
+ * Parameters:
+ *      folderPath (const char*):
+ *              The path of the folder that was listed.
+ *      pChildren (Gdrive_Fileinfo_Array*):
+ *              The listing, as returned by gdrive_folder_list().
+ */
+void gdrive_folder_prefetch(const char* folderPath, 
+                            Gdrive_Fileinfo_Array* pChildren);
+
 /*
  * gdrive_filepath_to_id(): Find the Google Drive file ID corresponding to a
  *                          given filepath.
@@ -275,6 +691,66 @@ int gdrive_add_parent(const char* fileId, const char* parentId);
  */
 int gdrive_change_basename(const char* fileId, const char* newName);
 
+/*
+ * gdrive_move():   Move a file from one parent folder to another, rename it, or
+ *                  both.
+ * Parameters:
+ *      fileId (const char*):   
+ *              The file ID of the file to move.
+ *      fromParentId (const char*): 
+ *              The file ID of the parent folder the file is moved out of. Any
+ *              other parents are left alone.
+ *      toParentId (const char*): 
+ *              The file ID of the folder the file is moved into. May be the
+ *              same as fromParentId to only rename the file.
+ *      newName (const char*):  
+ *              The file's new basename. May be the same as the current name to
+ *              only move the file. NOTE: Renaming a file with multiple parents
+ *              also renames it in its other parents.
+ *      fromPath (const char*):
+ *              The file's full path before the move, or NULL if not known.
+ *      toPath (const char*):
+ *              The file's full path after the move, or NULL if not known. If
+ *              both paths are given, cached path lookups for the file (and
+ *              for everything inside it, if it is a folder) are moved to the
+ *              new path instead of being discarded.
+ * Return value (int):
+ *      0 on success. On error, returns a negative value whose absolute value
+ *      is defined in <errors.h>
+ */
+int gdrive_move(const char* fileId, const char* fromParentId, 
+                const char* toParentId, const char* newName, 
+                const char* fromPath, const char* toPath);
+
+/*
+ * gdrive_print_memstats(): Prints how much memory is used for cached file 
+ *                          information: the objects in each pool, the 
+ *                          shared copies of file IDs and names, and the file
+ *                          index (if there is one).
+ * Parameters:
+ *      stream (FILE*):
+ *              Where to print the report.
+ */
+void gdrive_print_memstats(FILE* stream);
+
+/*
+ * gdrive_get_status():     Describes the health of the connection to Google
+ *                          Drive, for people to read: whether requests are 
+ *                          being sent, or are failing right away because 
+ *                          Google Drive has been failing (and if so, when it
+ *                          will next be tried). Doesn't contact Google Drive.
+ * Parameters:
+ *      dest (char*):
+ *              Where to write the description, which is null terminated and
+ *              cut short if needed. Can be NULL if size is 0.
+ *      size (size_t):
+ *              The size of dest in bytes.
+ * Return value (int):
+ *      The length of the whole description, not counting the null 
+ *      terminator, as for snprintf().
+ */
+int gdrive_get_status(char* dest, size_t size);
+
 
 #ifdef	__cplusplus
 }
@@ -38,16 +38,28 @@ OBJECTFILES= \
 	${OBJECTDIR}/code-template.o \
 	${OBJECTDIR}/fuse-drive-options.o \
 	${OBJECTDIR}/fuse-drive.o \
+	${OBJECTDIR}/gdrive/gdrive-breaker.o \
 	${OBJECTDIR}/gdrive/gdrive-cache-node.o \
 	${OBJECTDIR}/gdrive/gdrive-cache.o \
+	${OBJECTDIR}/gdrive/gdrive-data-journal.o \
 	${OBJECTDIR}/gdrive/gdrive-download-buffer.o \
 	${OBJECTDIR}/gdrive/gdrive-file-contents.o \
 	${OBJECTDIR}/gdrive/gdrive-fileid-cache-node.o \
 	${OBJECTDIR}/gdrive/gdrive-fileinfo-array.o \
 	${OBJECTDIR}/gdrive/gdrive-fileinfo.o \
+	${OBJECTDIR}/gdrive/gdrive-hedge.o \
+	${OBJECTDIR}/gdrive/gdrive-id-pool.o \
+	${OBJECTDIR}/gdrive/gdrive-index.o \
 	${OBJECTDIR}/gdrive/gdrive-info.o \
+	${OBJECTDIR}/gdrive/gdrive-intern.o \
+	${OBJECTDIR}/gdrive/gdrive-json-stream.o \
 	${OBJECTDIR}/gdrive/gdrive-json.o \
+	${OBJECTDIR}/gdrive/gdrive-negcache.o \
+	${OBJECTDIR}/gdrive/gdrive-ns-journal.o \
+	${OBJECTDIR}/gdrive/gdrive-pool.o \
 	${OBJECTDIR}/gdrive/gdrive-query.o \
+	${OBJECTDIR}/gdrive/gdrive-ratelimit.o \
+	${OBJECTDIR}/gdrive/gdrive-retry.o \
 	${OBJECTDIR}/gdrive/gdrive-sysinfo.o \
 	${OBJECTDIR}/gdrive/gdrive-transfer.o \
 	${OBJECTDIR}/gdrive/gdrive-util.o
@@ -92,6 +104,11 @@ ${OBJECTDIR}/fuse-drive.o: fuse-drive.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/fuse-drive.o fuse-drive.c
 
+${OBJECTDIR}/gdrive/gdrive-breaker.o: gdrive/gdrive-breaker.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-breaker.o gdrive/gdrive-breaker.c
+
 ${OBJECTDIR}/gdrive/gdrive-cache-node.o: gdrive/gdrive-cache-node.c 
 	${MKDIR} -p ${OBJECTDIR}/gdrive
 	${RM} "$@.d"
@@ -102,6 +119,11 @@ ${OBJECTDIR}/gdrive/gdrive-cache.o: gdrive/gdrive-cache.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-cache.o gdrive/gdrive-cache.c
 
+${OBJECTDIR}/gdrive/gdrive-data-journal.o: gdrive/gdrive-data-journal.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-data-journal.o gdrive/gdrive-data-journal.c
+
 ${OBJECTDIR}/gdrive/gdrive-download-buffer.o: gdrive/gdrive-download-buffer.c 
 	${MKDIR} -p ${OBJECTDIR}/gdrive
 	${RM} "$@.d"
@@ -127,21 +149,71 @@ ${OBJECTDIR}/gdrive/gdrive-fileinfo.o: gdrive/gdrive-fileinfo.c
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-fileinfo.o gdrive/gdrive-fileinfo.c
 
+${OBJECTDIR}/gdrive/gdrive-hedge.o: gdrive/gdrive-hedge.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-hedge.o gdrive/gdrive-hedge.c
+
+${OBJECTDIR}/gdrive/gdrive-id-pool.o: gdrive/gdrive-id-pool.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-id-pool.o gdrive/gdrive-id-pool.c
+
+${OBJECTDIR}/gdrive/gdrive-index.o: gdrive/gdrive-index.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-index.o gdrive/gdrive-index.c
+
 ${OBJECTDIR}/gdrive/gdrive-info.o: gdrive/gdrive-info.c 
 	${MKDIR} -p ${OBJECTDIR}/gdrive
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-info.o gdrive/gdrive-info.c
 
+${OBJECTDIR}/gdrive/gdrive-intern.o: gdrive/gdrive-intern.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-intern.o gdrive/gdrive-intern.c
+
 ${OBJECTDIR}/gdrive/gdrive-json.o: gdrive/gdrive-json.c 
 	${MKDIR} -p ${OBJECTDIR}/gdrive
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-json.o gdrive/gdrive-json.c
 
+${OBJECTDIR}/gdrive/gdrive-json-stream.o: gdrive/gdrive-json-stream.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-json-stream.o gdrive/gdrive-json-stream.c
+
+${OBJECTDIR}/gdrive/gdrive-negcache.o: gdrive/gdrive-negcache.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-negcache.o gdrive/gdrive-negcache.c
+
+${OBJECTDIR}/gdrive/gdrive-ns-journal.o: gdrive/gdrive-ns-journal.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-ns-journal.o gdrive/gdrive-ns-journal.c
+
+${OBJECTDIR}/gdrive/gdrive-pool.o: gdrive/gdrive-pool.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-pool.o gdrive/gdrive-pool.c
+
 ${OBJECTDIR}/gdrive/gdrive-query.o: gdrive/gdrive-query.c 
 	${MKDIR} -p ${OBJECTDIR}/gdrive
 	${RM} "$@.d"
 	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-query.o gdrive/gdrive-query.c
 
+${OBJECTDIR}/gdrive/gdrive-ratelimit.o: gdrive/gdrive-ratelimit.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-ratelimit.o gdrive/gdrive-ratelimit.c
+
+${OBJECTDIR}/gdrive/gdrive-retry.o: gdrive/gdrive-retry.c 
+	${MKDIR} -p ${OBJECTDIR}/gdrive
+	${RM} "$@.d"
+	$(COMPILE.c) -g -Wall -DFUSE_USE_VERSION=26 -D_XOPEN_SOURCE=700 `pkg-config --cflags fuse` `pkg-config --cflags libcurl` `pkg-config --cflags json-c` -std=c99  -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/gdrive/gdrive-retry.o gdrive/gdrive-retry.c
+
 ${OBJECTDIR}/gdrive/gdrive-sysinfo.o: gdrive/gdrive-sysinfo.c 
 	${MKDIR} -p ${OBJECTDIR}/gdrive
 	${RM} "$@.d"